@@ -12,6 +12,7 @@ import { gltfToThree } from "@/client/game/util/gltf_helpers";
 import {
   biomesMeshToBufferGeometry,
   groupGeometryToBufferGeometry,
+  tiledGroupGeometryToBufferGeometry,
   wireframeGeometryToBufferGeometry,
 } from "@/client/game/util/meshes";
 import { makeColorMap } from "@/client/game/util/textures";
@@ -319,6 +320,32 @@ interface SubMeshOptions {
   colorOverride?: [number, number, number];
   opacity?: number;
   translucent?: boolean;
+  // The sub-mesh comes from toTiledGroupMesh, and must be rendered opaque.
+  tiled?: boolean;
+}
+
+// Makes the material sample the atlas tile of each vertex at the fractional
+// part of its uv, so that merged faces repeat their texture across.
+function tileAtlasMap(material: THREE.MeshBasicMaterial) {
+  material.onBeforeCompile = (shader) => {
+    shader.vertexShader = shader.vertexShader
+      .replace(
+        "#include <common>",
+        "#include <common>\nattribute vec4 tile;\nvarying vec4 vTile;"
+      )
+      .replace("#include <uv_vertex>", "#include <uv_vertex>\nvTile = tile;");
+    shader.fragmentShader = shader.fragmentShader
+      .replace("#include <common>", "#include <common>\nvarying vec4 vTile;")
+      .replace(
+        "#include <map_fragment>",
+        [
+          "#ifdef USE_MAP",
+          "diffuseColor *= texture2D(map, vTile.xy + fract(vMapUv) * vTile.zw);",
+          "#endif",
+        ].join("\n")
+      );
+  };
+  return material;
 }
 
 export function buildSubMesh(data: GroupSubMesh, options: SubMeshOptions) {
@@ -327,9 +354,12 @@ export function buildSubMesh(data: GroupSubMesh, options: SubMeshOptions) {
   // be aware of our shaders
   // Using a transparent MeshBasicMaterial also adds some in-object sorting,
   // but these meshes won't respect fog
-  const bufferGeo = groupGeometryToBufferGeometry(data);
+  const bufferGeo = options.tiled
+    ? tiledGroupGeometryToBufferGeometry(data)
+    : groupGeometryToBufferGeometry(data);
 
   if (options.opacity && options.opacity !== 1.0) {
+    ok(!options.tiled, "Tiled group meshes must be opaque");
     // Temp: use in-house translucent material here, if an opacity was specified
     // this will allow things to be affected by fog
     // NOTE: these will not export to GLTF correctly
@@ -358,9 +388,10 @@ export function buildSubMesh(data: GroupSubMesh, options: SubMeshOptions) {
     if (options.colorOverride) {
       materialOptions.color = new THREE.Color(...options.colorOverride);
     }
+    const material = new THREE.MeshBasicMaterial(materialOptions);
     return new THREE.Mesh(
       bufferGeo,
-      new THREE.MeshBasicMaterial(materialOptions)
+      options.tiled ? tileAtlasMap(material) : material
     );
   }
 }
@@ -387,17 +418,24 @@ export async function groupMesh(
     transparent?: boolean;
     colorOverride?: [number, number, number];
     blueprintId?: BiomesId;
+    // Merge the coplanar block faces, which renders the same with fewer
+    // vertices but does not survive exporting to GLTF.
+    tiled?: boolean;
   } = {}
 ) {
   if (!groupData) {
     return;
   }
   const groupIndex = await deps.get("/groups/index");
-  const groupMesh = voxeloo.toGroupMesh(groupData.tensor, groupIndex);
+  const tiled = (opts.tiled ?? false) && !opts.transparent;
+  const groupMesh = tiled
+    ? voxeloo.toTiledGroupMesh(groupData.tensor, groupIndex)
+    : voxeloo.toGroupMesh(groupData.tensor, groupIndex);
 
   const blockMesh = buildSubMesh(groupMesh.blocks, {
     colorOverride: opts.colorOverride,
     opacity: opts.transparent ? 0.6 : 1.0,
+    tiled,
   });
   const glassMesh = buildSubMesh(groupMesh.glass, {
     colorOverride: opts.colorOverride,
@@ -458,7 +496,9 @@ async function genGroupMesh(
   deps: ClientResourceDeps,
   groupId: BiomesId
 ): Promise<GroupMesh | undefined> {
-  return groupMesh(context, deps, deps.get("/groups/data", groupId));
+  return groupMesh(context, deps, deps.get("/groups/data", groupId), {
+    tiled: true,
+  });
 }
 
 async function genGroupSrcMesh(
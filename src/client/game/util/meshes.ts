@@ -217,6 +217,24 @@ export function groupGeometryToBufferGeometry(mesh: GroupSubMesh) {
   );
 }
 
+export function tiledGroupGeometryToBufferGeometry(mesh: GroupSubMesh) {
+  const geometry = new THREE.BufferGeometry();
+
+  // Populate the vertex array and define the vertex attributes.
+  const vbo = new THREE.InterleavedBuffer(mesh.vertices(), mesh.stride());
+  addAttributes(geometry, vbo, [
+    { name: "position", size: 3 },
+    { name: "normal", size: 3 },
+    { name: "uv", size: 2 },
+    { name: "tile", size: 4 },
+  ]);
+
+  // Populate the index array.
+  geometry.setIndex(new THREE.BufferAttribute(mesh.indices(), 1));
+
+  return geometry;
+}
+
 export function wireframeGeometryToBufferGeometry(mesh: WireframeMesh) {
   const geometry = new THREE.BufferGeometry();
 
@@ -11,6 +11,8 @@ import {
   shardEncode,
   voxelShard,
 } from "@/shared/game/shard";
+import { unionAABB } from "@/shared/math/linear";
+import type { ReadonlyAABB } from "@/shared/math/types";
 import type { VoxelooModule } from "@/shared/wasm/types";
 import type { GaiaTerrainMapV2 } from "@/shared/wasm/types/gaia";
 import { compact } from "lodash";
@@ -32,6 +34,10 @@ function shardDependencies(id: ShardId) {
 }
 
 export class SkyOcclusionSimulation extends Simulation {
+  // The union of the boxes of the shards whose voxels changed since each
+  // column was last updated, or null if the whole column must be recomputed.
+  private readonly pendingChanges = new Map<ShardId, ReadonlyAABB | null>();
+
   constructor(
     private readonly voxeloo: VoxelooModule,
     private readonly replica: GaiaReplica,
@@ -40,6 +46,20 @@ export class SkyOcclusionSimulation extends Simulation {
     super("sky_occlusion");
   }
 
+  private addPendingChange(shard: ShardId, change: ReadonlyAABB | null) {
+    const [x, _, z] = shardDecode(shard);
+    const column = shardEncode(x, 0, z);
+    const pending = this.pendingChanges.get(column);
+    if (pending === null || change === null) {
+      this.pendingChanges.set(column, null);
+    } else {
+      this.pendingChanges.set(
+        column,
+        pending ? unionAABB(pending, change) : change
+      );
+    }
+  }
+
   reduce(shards: Set<ShardId>) {
     for (const shard of shards) {
       const [x, _, y] = shardDecode(shard);
@@ -67,12 +87,29 @@ export class SkyOcclusionSimulation extends Simulation {
       return [];
     }
 
+    // Terrain edits only affect the occlusion within reach of the edited
+    // shard, but new seeds can change anything in the column.
+    const box: ReadonlyAABB | null = change.entity.shard_seed
+      ? null
+      : [entity.box.v0, entity.box.v1];
     const shardId = voxelShard(...entity.box.v0);
-    return shardDependencies(shardId);
+    const dependencies = shardDependencies(shardId);
+    for (const dependency of dependencies) {
+      this.addPendingChange(dependency, box);
+    }
+    return dependencies;
   }
 
   async update(shard: TerrainShard) {
     const column = columnAlign(...shard.box.v0);
+    const key = voxelShard(column[0], 0, column[1]);
+    const change = this.pendingChanges.get(key);
+    this.pendingChanges.delete(key);
+
+    if (change) {
+      return this.updateSpan(column, change);
+    }
+
     const terrainMap = this.voxeloo.updateOcclusion(this.map, column);
     try {
       return {
@@ -84,4 +121,27 @@ export class SkyOcclusionSimulation extends Simulation {
       terrainMap.delete();
     }
   }
+
+  private updateSpan(column: Vec2i, change: ReadonlyAABB) {
+    const shards = this.voxeloo.updateOcclusionSpan(this.map, column, {
+      v0: change[0],
+      v1: change[1],
+    });
+    try {
+      const changes = [];
+      for (let i = 0; i < shards.size(); ++i) {
+        const terrainMap = shards.get(i);
+        try {
+          changes.push(
+            changeFromSkyOcclusion(this.voxeloo, this.replica, terrainMap)
+          );
+        } finally {
+          terrainMap.delete();
+        }
+      }
+      return { changes: compact(changes) };
+    } finally {
+      shards.delete();
+    }
+  }
 }
@@ -1,13 +1,15 @@
 import { Simulation } from "@/server/gaia_v2/simulations/api";
 import type { GaiaReplica, TerrainShard } from "@/server/gaia_v2/table";
 import { changeFromWater } from "@/server/gaia_v2/terrain/emitter";
-import type { Iff } from "@/shared/api/transaction";
+import type { ChangeToApply, Iff } from "@/shared/api/transaction";
+import { using } from "@/shared/deletable";
 import type { Change } from "@/shared/ecs/change";
 import { Entity } from "@/shared/ecs/gen/entities";
+import { TerrainShardSelector } from "@/shared/ecs/gen/selectors";
 import type { ShardId } from "@/shared/game/shard";
 import { shardNeighbours, voxelShard } from "@/shared/game/shard";
 import type { VoxelooModule } from "@/shared/wasm/types";
-import type { GaiaTerrainMapV2 } from "@/shared/wasm/types/gaia";
+import type { GaiaTerrainMapV2, WorldMap } from "@/shared/wasm/types/gaia";
 
 export class WaterSimulation extends Simulation {
   constructor(
@@ -45,18 +47,50 @@ export class WaterSimulation extends Simulation {
   }
 
   async update(shard: TerrainShard, version: number) {
-    const map = this.voxeloo.updateWater(this.map, shard.box.v0);
-    try {
-      return {
-        changes: [
-          {
-            ...changeFromWater(this.voxeloo, this.replica, map),
-            iffs: [[shard.id, version]] as Iff[], // Players can update water
-          },
-        ],
-      };
-    } finally {
-      map.delete();
+    // The kernel stores the changed shards in the map as it steps, so a single
+    // call advances the water around the shard and across its neighbours.
+    return using(new this.voxeloo.GaiaWaterSimulation(), (kernel) => {
+      kernel.activate(shard.box.v0);
+      const count = kernel.step(this.map, CONFIG.gaiaV2WaterStepsPerUpdate);
+      const changes: ChangeToApply[] = [];
+      for (let i = 0; i < count; ++i) {
+        const map = kernel.changed(i);
+        try {
+          const change = this.changeWithIff(shard, version, map);
+          if (change) {
+            changes.push(change);
+          }
+        } finally {
+          map.delete();
+        }
+      }
+      return { changes };
+    });
+  }
+
+  private changeWithIff(
+    shard: TerrainShard,
+    version: number,
+    map: WorldMap<"U8">
+  ): ChangeToApply | undefined {
+    const change = changeFromWater(this.voxeloo, this.replica, map);
+    if (!change) {
+      return;
+    }
+    const entity = this.replica.table.get(
+      TerrainShardSelector.query.key(voxelShard(...map.aabb.v0))
+    );
+    if (!entity) {
+      return;
     }
+    // Players can update water, so only apply over the versions we read.
+    const entityVersion =
+      entity.id === shard.id
+        ? version
+        : this.replica.table.getWithVersion(entity.id)[0];
+    return {
+      ...change,
+      iffs: [[entity.id, entityVersion]] as Iff[],
+    };
   }
 }
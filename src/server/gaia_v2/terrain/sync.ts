@@ -1,11 +1,17 @@
 import type { GaiaServerContext } from "@/server/gaia_v2/context";
 import type { GaiaReplica } from "@/server/gaia_v2/table";
+import { BackgroundTaskController } from "@/shared/abort";
 import { using, usingAsync } from "@/shared/deletable";
 import {
   ChangeBuffer,
   type Change,
   type ReadonlyChanges,
 } from "@/shared/ecs/change";
+import type {
+  AsDelta,
+  ReadonlyEntity,
+  ReadonlyEntityWith,
+} from "@/shared/ecs/gen/entities";
 import { Entity } from "@/shared/ecs/gen/entities";
 import { TerrainShardSelector } from "@/shared/ecs/gen/selectors";
 import type { ListenerKey } from "@/shared/events";
@@ -13,16 +19,39 @@ import { ReadonlyTerrain } from "@/shared/game/terrain/terrain";
 import type { BiomesId } from "@/shared/ids";
 import { log } from "@/shared/logging";
 import type { RegistryLoader } from "@/shared/registry";
-import { asyncYieldForEach } from "@/shared/util/async";
+import { asyncYieldForEach, sleep } from "@/shared/util/async";
 import type { VoxelooModule } from "@/shared/wasm/types";
 import type {
   GaiaTerrainMapBuilderV2,
   GaiaTerrainMapV2,
 } from "@/shared/wasm/types/gaia";
 import { ok } from "assert";
+import { readFile, writeFile } from "fs/promises";
+import path from "path";
+
+// Checkpoints only hold the terrain map, so the tick of the latest change that
+// had been applied to the map is kept next to them. On restore, the shards that
+// changed after it are synced again from the replica.
+function checkpointTickPath(dir: string) {
+  return path.join(dir, "tick.json");
+}
+
+async function readCheckpointTick(dir: string): Promise<number | undefined> {
+  try {
+    const { tick } = JSON.parse(
+      await readFile(checkpointTickPath(dir), "utf8")
+    );
+    return typeof tick === "number" ? tick : undefined;
+  } catch {
+    return undefined;
+  }
+}
 
 export class TerrainSync {
+  private readonly controller = new BackgroundTaskController();
   private changeSubscription?: ListenerKey;
+  // The tick of the latest change applied to the map.
+  private appliedTick = 0;
 
   constructor(
     private readonly voxeloo: VoxelooModule,
@@ -40,23 +69,33 @@ export class TerrainSync {
       return;
     }
 
+    this.syncShard(shard, change.entity);
+    this.appliedTick = Math.max(this.appliedTick, change.tick);
+  }
+
+  // Copies the layers of the shard that are present in the given entity, or
+  // delta of it, over to the map.
+  private syncShard(
+    shard: ReadonlyEntityWith<"box" | "shard_seed">,
+    layers: AsDelta<ReadonlyEntity>
+  ) {
     using(new ReadonlyTerrain(this.voxeloo, shard), (terrain) => {
-      if (change.entity.shard_diff && terrain.unsafeDiff) {
+      if (layers.shard_diff && terrain.unsafeDiff) {
         this.map.updateDiff(shard.box.v0, terrain.unsafeDiff);
       }
-      if (change.entity.shard_water && terrain.unsafeWater) {
+      if (layers.shard_water && terrain.unsafeWater) {
         this.map.updateWater(shard.box.v0, terrain.unsafeWater.cpp);
       }
-      if (change.entity.shard_irradiance && terrain.unsafeIrradiance) {
+      if (layers.shard_irradiance && terrain.unsafeIrradiance) {
         this.map.updateIrradiance(shard.box.v0, terrain.unsafeIrradiance.cpp);
       }
-      if (change.entity.shard_sky_occlusion && terrain.unsafeSkyOcclusion) {
+      if (layers.shard_sky_occlusion && terrain.unsafeSkyOcclusion) {
         this.map.updateOcclusion(shard.box.v0, terrain.unsafeSkyOcclusion.cpp);
       }
-      if (change.entity.shard_dye && terrain.unsafeDye) {
+      if (layers.shard_dye && terrain.unsafeDye) {
         this.map.updateDye(shard.box.v0, terrain.unsafeDye.cpp);
       }
-      if (change.entity.shard_growth && terrain.unsafeGrowth) {
+      if (layers.shard_growth && terrain.unsafeGrowth) {
         this.map.updateGrowth(shard.box.v0, terrain.unsafeGrowth.cpp);
       }
     });
@@ -66,6 +105,7 @@ export class TerrainSync {
     for (const change of changes) {
       this.handleChange(change);
     }
+    this.map.tickRecording();
   }
 
   private async buildTerrainMap(builder: GaiaTerrainMapBuilderV2) {
@@ -74,10 +114,11 @@ export class TerrainSync {
     ];
     let seedsPopulated = 0;
     for await (const shardId of asyncYieldForEach(shardIds, 100)) {
-      const entity = this.replica.table.get(shardId);
+      const [version, entity] = this.replica.table.getWithVersion(shardId);
       if (!entity?.box) {
         continue;
       }
+      this.appliedTick = Math.max(this.appliedTick, version);
       try {
         using(new ReadonlyTerrain(this.voxeloo, entity), (terrain) => {
           ok(entity.box);
@@ -131,6 +172,70 @@ export class TerrainSync {
     );
   }
 
+  // Restores the map from the latest checkpoint in the directory, then syncs
+  // the shards that changed after it was taken from the replica. Returns false
+  // if there is no checkpoint to restore, or if the world has grown past it.
+  private async restoreTerrainMap(dir: string) {
+    const tick = await readCheckpointTick(dir);
+    if (
+      tick === undefined ||
+      !this.voxeloo.GaiaTerrainCheckpointer.restore(dir, this.map)
+    ) {
+      log.info(`No terrain checkpoint to restore from ${dir}`);
+      return false;
+    }
+
+    const shardIds: BiomesId[] = [
+      ...this.replica.table.scanIds(TerrainShardSelector.query.all()),
+    ];
+    let synced = 0;
+    this.appliedTick = tick;
+    for await (const shardId of asyncYieldForEach(shardIds, 100)) {
+      const [version, entity] = this.replica.table.getWithVersion(shardId);
+      if (!Entity.has(entity, "shard_seed", "box")) {
+        continue;
+      }
+      if (!this.map.contains(entity.box.v0)) {
+        log.warn(`Terrain checkpoint does not cover shard ${entity.box.v0}`);
+        return false;
+      }
+      if (version > tick) {
+        this.syncShard(entity, entity);
+        synced += 1;
+      }
+      this.appliedTick = Math.max(this.appliedTick, version);
+    }
+
+    log.info(
+      `Restored terrain checkpoint at tick ${tick} and synced ${synced} of ${shardIds.length} shards. Bytes: ${this.map.storageSize()}`
+    );
+    return true;
+  }
+
+  // Periodically checkpoints the map to the directory, a full checkpoint
+  // every fullInterval of them and incremental ones in between.
+  private startCheckpoints(dir: string) {
+    const checkpointer = new this.voxeloo.GaiaTerrainCheckpointer(
+      dir,
+      CONFIG.gaiaV2TerrainCheckpointFullInterval
+    );
+    this.controller.runInBackground("checkpoint", async (signal) => {
+      try {
+        while (
+          await sleep(CONFIG.gaiaV2TerrainCheckpointIntervalMs, signal)
+        ) {
+          const tick = this.appliedTick;
+          checkpointer.checkpoint(this.map);
+          await writeFile(checkpointTickPath(dir), JSON.stringify({ tick }));
+        }
+      } catch (error) {
+        log.error("Failed to checkpoint the terrain map", { error });
+      } finally {
+        checkpointer.delete();
+      }
+    });
+  }
+
   async start() {
     log.info(`Gaia loading initial terrain data...`);
 
@@ -147,10 +252,15 @@ export class TerrainSync {
       }
     });
 
-    // Initialize the map.
-    await usingAsync(new this.voxeloo.GaiaTerrainMapBuilderV2(), (builder) =>
-      this.buildTerrainMap(builder)
-    );
+    // Initialize the map, from the latest checkpoint if there is one.
+    const checkpointDir = CONFIG.gaiaV2TerrainCheckpointDir;
+    if (!checkpointDir || !(await this.restoreTerrainMap(checkpointDir))) {
+      this.appliedTick = 0;
+      await usingAsync(
+        new this.voxeloo.GaiaTerrainMapBuilderV2(),
+        (builder) => this.buildTerrainMap(builder)
+      );
+    }
 
     // Catchup on any changes that occurred during our initialization.
     while (!buffer.empty) {
@@ -159,11 +269,24 @@ export class TerrainSync {
       }
     }
 
+    if (CONFIG.gaiaV2TerrainRecordingDir) {
+      log.info(
+        `Recording terrain edits to ${CONFIG.gaiaV2TerrainRecordingDir}`
+      );
+      this.map.startRecording(CONFIG.gaiaV2TerrainRecordingDir);
+    }
+
+    if (checkpointDir) {
+      log.info(`Checkpointing the terrain map to ${checkpointDir}`);
+      this.startCheckpoints(checkpointDir);
+    }
+
     // We're good, directly process from now on.
     bootstrapped = true;
   }
 
   async stop() {
+    await this.controller.abortAndWait();
     if (this.changeSubscription) {
       this.replica.off("tick", this.changeSubscription);
       this.changeSubscription = undefined;
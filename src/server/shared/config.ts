@@ -424,8 +424,19 @@ const DEFAULT_CONFIG = deepFreeze({
   gaiaV2DryRun: false,
   // How quickly to step muck values in a single update
   gaiaV2MuckSimStepSize: 7,
+  // How many water steps to run around a shard in a single update
+  gaiaV2WaterStepsPerUpdate: 1,
   // How many missing shards to tolerate
   gaiaV2MissingShardsThreshold: 0,
+  // Where to record the terrain edits for offline replay (see gaia_bench),
+  // empty to disable recording.
+  gaiaV2TerrainRecordingDir: "",
+  // Where to checkpoint the terrain map and restore it from on start, empty to
+  // always build it from the replica.
+  gaiaV2TerrainCheckpointDir: "",
+  gaiaV2TerrainCheckpointIntervalMs: minutesToMs(5),
+  // How many checkpoints are taken per full one, the rest are incremental.
+  gaiaV2TerrainCheckpointFullInterval: 12,
   // Gaia shutdown delay
   // When shutting down we release shards, then we push our hipri queue so others can
   // handle it, this is they delay before we do that push (giving time for the balancer
@@ -2,7 +2,11 @@ import type { ReadonlyVec2i, ReadonlyVec3i } from "@/shared/ecs/gen/types";
 import type { ReadonlyVec3 } from "@/shared/math/types";
 import type { DynamicBuffer } from "@/shared/wasm/buffers";
 import type { DataType } from "@/shared/wasm/tensors";
-import type { SparseBlock, VolumeBlock } from "@/shared/wasm/types/biomes";
+import type {
+  CPPVector,
+  SparseBlock,
+  VolumeBlock,
+} from "@/shared/wasm/types/biomes";
 import type { Vec3i } from "@/shared/wasm/types/common";
 import type {
   DyeTensor,
@@ -43,7 +47,7 @@ export interface GaiaTerrainMapBuilder {
 
 export interface GaiaTerrainMapV2 {
   aabb(): AABB;
-  contains(): boolean;
+  contains(pos: ReadonlyVec3): boolean;
   storageSize(): number;
   updateDiff(pos: ReadonlyVec3, diff: SparseBlock<"U32">): void;
   updateWater(pos: ReadonlyVec3, water: WaterTensor): void;
@@ -51,6 +55,8 @@ export interface GaiaTerrainMapV2 {
   updateDye(pos: ReadonlyVec3, dye: DyeTensor): void;
   updateGrowth(pos: ReadonlyVec3, growth: GrowthTensor): void;
   updateOcclusion(pos: ReadonlyVec3, occlusion: OcclusionTensor): void;
+  startRecording(dir: string): void;
+  tickRecording(): number;
   delete(): void;
 }
 
@@ -70,6 +76,19 @@ export interface GaiaTerrainMapBuilderV2 {
   delete(): void;
 }
 
+export interface GaiaTerrainCheckpointer {
+  checkpoint(map: GaiaTerrainMapV2): void;
+  delete(): void;
+}
+
+export interface GaiaWaterSimulation {
+  activate(pos: ReadonlyVec3i): void;
+  activeCount(): number;
+  step(map: GaiaTerrainMapV2, steps: number): number;
+  changed(index: number): WorldMap<"U8">;
+  delete(): void;
+}
+
 export interface GaiaTerrainStreamReader {
   isOpen(): boolean;
   isEmpty(): boolean;
@@ -168,6 +187,15 @@ interface GaiaTerrainMapBuilderV2Ctor {
   new (): GaiaTerrainMapBuilderV2;
 }
 
+interface GaiaTerrainCheckpointerCtor {
+  new (dir: string, fullInterval: number): GaiaTerrainCheckpointer;
+  restore(dir: string, map: GaiaTerrainMapV2): boolean;
+}
+
+interface GaiaWaterSimulationCtor {
+  new (): GaiaWaterSimulation;
+}
+
 interface GaiaTerrainStreamCtor {
   new (): GaiaTerrainStream;
 }
@@ -242,6 +270,8 @@ export interface GaiaModule {
   GaiaTerrainMapBuilder: GaiaTerrainMapBuilderCtor;
   GaiaTerrainMapV2: GaiaTerrainMapV2Ctor;
   GaiaTerrainMapBuilderV2: GaiaTerrainMapBuilderV2Ctor;
+  GaiaTerrainCheckpointer: GaiaTerrainCheckpointerCtor;
+  GaiaWaterSimulation: GaiaWaterSimulationCtor;
   GaiaTerrainStream: GaiaTerrainStreamCtor;
   GaiaTerrainWriter: GaiaTerrainWriterCtor;
   GaiaSkyOcclusionMap: GaiaSkyOcclusionMapCtor;
@@ -278,6 +308,12 @@ export interface GaiaModule {
 
   updateOcclusion(map: GaiaTerrainMapV2, column: ReadonlyVec2i): WorldMap<"U8">;
 
+  updateOcclusionSpan(
+    map: GaiaTerrainMapV2,
+    column: ReadonlyVec2i,
+    change: AABB
+  ): CPPVector<WorldMap<"U8">>;
+
   updateWater(map: GaiaTerrainMapV2, worldPos: ReadonlyVec3i): WorldMap<"U8">;
 
   makeWorldMap<T extends DataType>(
@@ -1,7 +1,11 @@
 import type { ShardId } from "@/shared/game/shard";
 import type { BiomesId } from "@/shared/ids";
 import type { ReadonlyVec3, Vec3 } from "@/shared/math/types";
-import type { SparseBlock, VolumeBlock } from "@/shared/wasm/types/biomes";
+import type {
+  CPPVector,
+  SparseBlock,
+  VolumeBlock,
+} from "@/shared/wasm/types/biomes";
 import type { DynamicBuffer } from "@/shared/wasm/types/buffer";
 import type { Vec3i } from "@/shared/wasm/types/common";
 import type { Occluder } from "@/shared/wasm/types/culling";
@@ -60,6 +64,17 @@ export interface BlockGeometryBuffer {
   vertices: Float32Array;
 }
 
+// 12-byte vertices of 16-bit fixed point positions (1/1024 voxel units, with a
+// 16 voxel bias), the face direction and the uv in 1/uvScale units.
+export interface PackedGeometryBuffer {
+  origin: Vec3i;
+  empty: boolean;
+  stride: number;
+  uvScale: number;
+  indices: Uint16Array | Uint32Array;
+  vertices: Uint16Array;
+}
+
 // Flora types
 
 export interface FloraIndexCtor {
@@ -218,6 +233,31 @@ export interface GroupMesh {
   glass: GroupSubMesh;
 }
 
+// The rows of a group atlas cache blitted to since the last delta.
+export interface GroupAtlasDelta {
+  row(): number;
+  textureShape(): [number, number];
+  textureData(): Uint8Array;
+  // The [rows, cols] of the whole atlas. When resized, the delta holds all of
+  // the rows in use and the atlas texture must be reallocated.
+  shape(): [number, number];
+  resized(): boolean;
+  delete(): void;
+}
+
+export interface GroupAtlasCacheCtor {
+  new (index: GroupIndex, height: number): GroupAtlasCache;
+}
+
+// The uvs of cached group meshes are normalized against an atlas of 2048
+// rows, so the atlas must be sampled with its v scaled by 2048 / rows.
+export interface GroupAtlasCache {
+  textureShape(): [number, number];
+  textureData(): Uint8Array;
+  takeDelta(): GroupAtlasDelta;
+  delete(): void;
+}
+
 // Water types
 export interface WaterGeometryBuffer {
   origin: Vec3i;
@@ -230,6 +270,10 @@ export interface WaterGeometryBuffer {
 // Collision structures
 type AABB = [Vec3, Vec3];
 
+export interface AABBVectorCtor {
+  new (): CPPVector<AABB>;
+}
+
 export interface BoxListCtor {
   new (): BoxList;
 }
@@ -247,9 +291,57 @@ export interface BoxDict {
   scan(fn: (aabb: AABB) => void): void;
   intersect(aabb: AABB, fn: (hit: AABB) => boolean | void): void;
   intersects(aabb: AABB): boolean;
+  // 1 for each of the boxes that intersects the dict, else 0.
+  intersectsAll(aabbs: CPPVector<AABB>): CPPVector<number>;
+  delete(): void;
+}
+
+export interface Contact {
+  // The time of impact, or the whole duration if nothing is hit.
+  time: number;
+  // The normal of the face that is hit, or zero if nothing is hit.
+  normal: Vec3;
+}
+
+export interface Vec3VectorCtor {
+  new (): CPPVector<Vec3>;
+}
+
+export interface BoxDictSetCtor {
+  new (): BoxDictSet;
+}
+
+export interface BoxDictSet {
+  add(dict: BoxDict): void;
+  sweep(aabb: AABB, velocity: Vec3, dt: number): Contact;
+  sweepAll(
+    aabbs: CPPVector<AABB>,
+    velocities: CPPVector<Vec3>,
+    dt: number
+  ): CPPVector<Contact>;
   delete(): void;
 }
 
+// Raycasting types
+export interface Ray {
+  origin: Vec3;
+  dir: Vec3;
+  max_distance: number;
+}
+
+export interface RayHit {
+  // The kind of entry that was hit, or EMPTY if the ray hit nothing.
+  kind: { value: GroupEntryKind };
+  voxel: Vec3i;
+  pos: Vec3;
+  normal: Vec3;
+  distance: number;
+}
+
+export interface RayVectorCtor {
+  new (): CPPVector<Ray>;
+}
+
 export interface WireframeMesh {
   empty(): boolean;
   stride(): number;
@@ -310,6 +402,12 @@ export interface GaloisModule {
     index: ShapeIndex,
     origin: Vec3i
   ): BlockGeometryBuffer;
+  toPackedBlockGeometry(
+    tensor: IsomorphismTensor,
+    occlusions: OcclusionTensor,
+    index: ShapeIndex,
+    origin: Vec3i
+  ): PackedGeometryBuffer;
   toBlockSamples(
     index: BlockIndex,
     dye: number,
@@ -335,6 +433,14 @@ export interface GaloisModule {
     raySrc: Vec3,
     rayDir: Vec3
   ): number | undefined;
+  Vector_Ray: RayVectorCtor;
+  castRays(
+    index: ShapeIndex,
+    rays: CPPVector<Ray>,
+    isomorphismLoader: (shard: ShardId) => IsomorphismTensor | undefined,
+    floraLoader: (shard: ShardId) => FloraTensor | undefined,
+    glassLoader: (shard: ShardId) => GlassTensor | undefined
+  ): CPPVector<RayHit>;
 
   // Flora routines
   FloraIndex: FloraIndexCtor;
@@ -388,7 +494,17 @@ export interface GaloisModule {
   GroupIndex: GroupIndexCtor;
   GroupTensor: GroupTensorCtor;
   GroupTensorBuilder: GroupTensorBuilderCtor;
+  GroupAtlasCache: GroupAtlasCacheCtor;
   toGroupMesh(tensor: GroupTensor, index: GroupIndex): GroupMesh;
+  // Like toGroupMesh, but with coplanar block faces of the same texture merged.
+  // Each block vertex is a position, normal, uv in tile units and the atlas
+  // tile (offset and extent) that the uv repeats.
+  toTiledGroupMesh(tensor: GroupTensor, index: GroupIndex): GroupMesh;
+  toCachedGroupMesh(
+    tensor: GroupTensor,
+    index: GroupIndex,
+    cache: GroupAtlasCache
+  ): GroupMesh;
   toGroupBoxList(index: GroupIndex, tensor: GroupTensor, origin: Vec3): BoxList;
 
   // Water routines
@@ -411,4 +527,7 @@ export interface GaloisModule {
 
   // Collision routines
   BoxList: BoxListCtor;
+  Vector_AABB: AABBVectorCtor;
+  Vector_Vec3d: Vec3VectorCtor;
+  BoxDictSet: BoxDictSetCtor;
 }
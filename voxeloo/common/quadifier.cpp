@@ -1,5 +1,9 @@
 #include "voxeloo/common/quadifier.hpp"
 
+#include <algorithm>
+#include <bit>
+#include <tuple>
+
 namespace voxeloo::quadifier {
 
 std::vector<Quad> merge(std::vector<Vec2i> cells) {
@@ -60,4 +64,60 @@ std::vector<Quad> merge(std::vector<Vec2i> cells) {
 
   return out;
 }
+
+std::vector<Quad> merge_rows(CellMask rows) {
+  std::vector<Quad> out;
+  for (int y = 0; y < kMaskDim; y += 1) {
+    while (rows[y]) {
+      auto x = std::countr_zero(rows[y]);
+      auto w = std::countr_one(rows[y] >> x);
+      auto run = (w == kMaskDim ? ~0u : (1u << w) - 1) << x;
+
+      auto h = 1;
+      while (y + h < kMaskDim && (rows[y + h] & run) == run) {
+        rows[y + h] &= ~run;
+        h += 1;
+      }
+      rows[y] &= ~run;
+      out.push_back(Quad{{x, y}, {x + w, y + h}});
+    }
+  }
+  return out;
+}
+
+namespace {
+
+// Joins the quads that span the same range of the other axis and touch along
+// the given axis.
+void merge_along(std::vector<Quad>& quads, size_t axis) {
+  auto other = 1 - axis;
+  std::sort(quads.begin(), quads.end(), [&](const auto& a, const auto& b) {
+    return std::tie(a.v0[other], a.v1[other], a.v0[axis]) <
+           std::tie(b.v0[other], b.v1[other], b.v0[axis]);
+  });
+
+  size_t n = 0;
+  for (const auto& quad : quads) {
+    if (n > 0) {
+      auto& prev = quads[n - 1];
+      if (prev.v0[other] == quad.v0[other] &&
+          prev.v1[other] == quad.v1[other] &&
+          prev.v1[axis] == quad.v0[axis]) {
+        prev.v1[axis] = quad.v1[axis];
+        continue;
+      }
+    }
+    quads[n++] = quad;
+  }
+  quads.resize(n);
+}
+
+}  // namespace
+
+std::vector<Quad> merge_seams(std::vector<Quad> quads) {
+  merge_along(quads, 0);
+  merge_along(quads, 1);
+  return quads;
+}
+
 }  // namespace voxeloo::quadifier
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
 #include <functional>
 #include <unordered_map>
 #include <vector>
@@ -20,6 +22,20 @@ inline bool operator==(const Quad& a, const Quad& b) {
 
 std::vector<Quad> merge(std::vector<Vec2i> cells);
 
+static constexpr int kMaskDim = 32;
+
+// A 32x32 grid of cells with one word per row: bit x of rows[y] is (x, y).
+using CellMask = std::array<uint32_t, kMaskDim>;
+
+// Greedily merges the set cells of the mask: each quad takes the lowest run
+// of the first row left and extends it down over the rows that contain it.
+std::vector<Quad> merge_rows(CellMask rows);
+
+// Merges quads that meet edge to edge, e.g. across the seams between masks:
+// first along x between quads covering the same rows, then along y between
+// quads covering the same columns.
+std::vector<Quad> merge_seams(std::vector<Quad> quads);
+
 template <typename Key>
 using QuadifierOutput = std::vector<std::tuple<Key, Quad>>;
 
@@ -49,4 +65,73 @@ class Quadifier {
   std::unordered_map<Key, std::vector<Vec2i>, Hash, KeyEqual> map_;
 };
 
+// A greedy quadifier over cell bitmasks. Cells are bucketed by a dense slice
+// index supplied by the caller (e.g. direction and plane) and, within a slice,
+// by key, compared for equality rather than hashed since a slice rarely holds
+// more than a few keys. Cells may be anywhere in the non-negative quadrant;
+// each 32x32 tile of a slice is merged on its own and the quads of a key are
+// then merged across the tile seams.
+template <typename Key, typename KeyEqual = std::equal_to<Key>>
+class MaskQuadifier {
+  struct Mask {
+    Key key;
+    Vec2i tile;
+    CellMask rows;
+  };
+
+ public:
+  explicit MaskQuadifier(size_t slice_count) : slices_(slice_count) {}
+
+  void add(size_t slice, const Key& key, const Vec2i& pos) {
+    CHECK_ARGUMENT(slice < slices_.size());
+    CHECK_ARGUMENT(pos.x >= 0 && pos.y >= 0);
+    Vec2i tile{pos.x / kMaskDim, pos.y / kMaskDim};
+
+    // Cells tend to be added in runs sharing a mask, so search from the back.
+    auto& masks = slices_[slice];
+    auto it = masks.rbegin();
+    while (it != masks.rend() && !(it->tile == tile && eq_(it->key, key))) {
+      ++it;
+    }
+    auto& mask =
+        it != masks.rend() ? *it : masks.emplace_back(Mask{key, tile, {}});
+    mask.rows[pos.y % kMaskDim] |= 1u << (pos.x % kMaskDim);
+  }
+
+  auto build() {
+    QuadifierOutput<Key> ret;
+    std::vector<Quad> quads;
+    for (auto& masks : slices_) {
+      // Gather the tiles of each key, in order of first appearance.
+      for (size_t i = 0; i < masks.size(); i += 1) {
+        if (masks[i].rows == CellMask{}) {
+          continue;
+        }
+        quads.clear();
+        for (size_t j = i; j < masks.size(); j += 1) {
+          auto& mask = masks[j];
+          if (j > i && !eq_(mask.key, masks[i].key)) {
+            continue;
+          }
+          auto origin = kMaskDim * mask.tile;
+          for (auto quad : merge_rows(mask.rows)) {
+            quads.push_back(Quad{quad.v0 + origin, quad.v1 + origin});
+          }
+          mask.rows = {};
+        }
+        for (auto quad : merge_seams(std::move(quads))) {
+          ret.emplace_back(masks[i].key, quad);
+        }
+        quads.clear();
+      }
+      masks.clear();
+    }
+    return ret;
+  }
+
+ private:
+  std::vector<std::vector<Mask>> slices_;
+  KeyEqual eq_;
+};
+
 }  // namespace voxeloo::quadifier
@@ -76,4 +76,76 @@ TEST_CASE("Test merge disconnected", "[all]") {
   REQUIRE(quads[2] == Quad{{0, 3}, {4, 4}});
 }
 
+TEST_CASE("Test merge_rows", "[all]") {
+  // A 3x2 block, a full-width row and a U open at the bottom.
+  CellMask rows{};
+  rows[0] = 0b111;
+  rows[1] = 0b111;
+  rows[4] = ~0u;
+  rows[6] = 0b1111;
+  rows[7] = 0b1001;
+  rows[8] = 0b1001;
+  auto quads = merge_rows(rows);
+  REQUIRE(quads.size() == 5);
+  REQUIRE(quads[0] == Quad{{0, 0}, {3, 2}});
+  REQUIRE(quads[1] == Quad{{0, 4}, {32, 5}});
+  REQUIRE(quads[2] == Quad{{0, 6}, {4, 7}});
+  REQUIRE(quads[3] == Quad{{0, 7}, {1, 9}});
+  REQUIRE(quads[4] == Quad{{3, 7}, {4, 9}});
+}
+
+TEST_CASE("Test the mask quadifier", "[all]") {
+  MaskQuadifier<int> quadifier(2);
+  for (auto x = 30; x < 34; x += 1) {
+    for (auto y = 0; y < 2; y += 1) {
+      quadifier.add(0, 7, {x, y});
+    }
+  }
+  quadifier.add(0, 8, {0, 0});
+  quadifier.add(1, 7, {0, 0});
+
+  auto quads = quadifier.build();
+  REQUIRE(quads.size() == 3);
+  REQUIRE(quads[0] == std::make_tuple(7, Quad{{30, 0}, {34, 2}}));
+  REQUIRE(quads[1] == std::make_tuple(8, Quad{{0, 0}, {1, 1}}));
+  REQUIRE(quads[2] == std::make_tuple(7, Quad{{0, 0}, {1, 1}}));
+  REQUIRE(quadifier.build().empty());
+}
+
+TEST_CASE("Test the mask quadifier on a large uniform surface", "[all]") {
+  // A full micro-voxel plane of a shard spans 8x8 tiles.
+  MaskQuadifier<int> quadifier(1);
+  for (auto y = 0; y < 256; y += 1) {
+    for (auto x = 0; x < 256; x += 1) {
+      quadifier.add(0, 3, {x, y});
+    }
+  }
+  auto quads = quadifier.build();
+  REQUIRE(quads.size() == 1);
+  REQUIRE(quads[0] == std::make_tuple(3, Quad{{0, 0}, {256, 256}}));
+
+  // A hole only splits the tiles around it.
+  for (auto y = 0; y < 256; y += 1) {
+    for (auto x = 0; x < 256; x += 1) {
+      if (x != 100 || y != 40) {
+        quadifier.add(0, 3, {x, y});
+      }
+    }
+  }
+  quads = quadifier.build();
+  REQUIRE(quads.size() == 8);
+}
+
+TEST_CASE("Test merge_seams", "[all]") {
+  auto quads = merge_seams({
+      {{0, 0}, {32, 32}},
+      {{32, 0}, {64, 32}},
+      {{0, 32}, {64, 64}},
+      {{64, 0}, {70, 16}},
+  });
+  REQUIRE(quads.size() == 2);
+  REQUIRE(quads[0] == Quad{{0, 0}, {64, 64}});
+  REQUIRE(quads[1] == Quad{{64, 0}, {70, 16}});
+}
+
 }  // namespace voxeloo::quadifier
\ No newline at end of file
@@ -189,7 +189,11 @@ inline void parallel_do(uint32_t b, Fn&& fn) {
     }));
   }
 
-  // Wait for all tasks to finish before returning.
+  // Wait for all tasks to finish before returning, including when one of them
+  // throws, as they all refer to the function.
+  for (auto& future : futures) {
+    future.wait();
+  }
   for (auto& future : futures) {
     future.get();
   }
@@ -0,0 +1,490 @@
+#include "voxeloo/gaia/checkpoint.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "voxeloo/common/errors.hpp"
+#include "voxeloo/tensors/arrays.hpp"
+#include "voxeloo/tensors/succinct.hpp"
+#include "voxeloo/tensors/tensors.hpp"
+
+namespace voxeloo::gaia {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+constexpr uint32_t kMagic = 0x504b4347;  // "GCKP"
+constexpr uint32_t kVersion = 1;
+constexpr uint32_t kLayerCount = 8;
+constexpr size_t kWriteBufferSize = 1 << 20;
+
+// The levels of a dict holding a single key, the smallest a chunk can have.
+constexpr uint32_t kMinLevelCount = 10;
+
+enum class Kind : uint32_t {
+  kFull = 0,
+  kIncremental = 1,
+};
+
+struct Header {
+  uint32_t magic;
+  uint32_t version;
+  Kind kind;
+  uint32_t layer_count;
+  int32_t v0[3];
+  int32_t v1[3];
+};
+
+struct LayerHeader {
+  uint32_t value_size;
+  uint32_t record_count;
+};
+
+struct RecordHeader {
+  uint32_t index;
+  uint32_t max;
+  uint32_t level_count;
+  uint32_t value_count;
+};
+
+// Calls fn with the corresponding layer of each map, in file order.
+template <typename Fn, typename... Maps>
+void visit_layers(Fn&& fn, Maps&... maps) {
+  fn(maps.seeds...);
+  fn(maps.diffs...);
+  fn(maps.terrains...);
+  fn(maps.waters...);
+  fn(maps.irradiances...);
+  fn(maps.dyes...);
+  fn(maps.growths...);
+  fn(maps.occlusions...);
+}
+
+// Buffered sequential writer. The file is written next to its final path and
+// renamed into place once synced, so a crash never leaves a torn checkpoint.
+class FileWriter {
+ public:
+  explicit FileWriter(std::string path)
+      : path_(std::move(path)),
+        temp_path_(path_ + ".tmp"),
+        file_(std::fopen(temp_path_.c_str(), "wb")),
+        buffer_(new char[kWriteBufferSize]) {
+    CHECK_STATE(file_ != nullptr);
+    std::setvbuf(file_, buffer_.get(), _IOFBF, kWriteBufferSize);
+  }
+
+  FileWriter(const FileWriter&) = delete;
+  FileWriter& operator=(const FileWriter&) = delete;
+
+  ~FileWriter() {
+    if (file_ != nullptr) {
+      std::fclose(file_);
+      std::remove(temp_path_.c_str());
+    }
+  }
+
+  void write(const void* data, size_t size) {
+    if (size > 0) {
+      CHECK_STATE(std::fwrite(data, 1, size, file_) == size);
+    }
+  }
+
+  template <typename T>
+  void write(const T& val) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    write(&val, sizeof(T));
+  }
+
+  void commit() {
+    CHECK_STATE(std::fflush(file_) == 0);
+    CHECK_STATE(::fsync(::fileno(file_)) == 0);
+    CHECK_STATE(std::fclose(file_) == 0);
+    file_ = nullptr;
+    fs::rename(temp_path_, path_);
+  }
+
+ private:
+  std::string path_;
+  std::string temp_path_;
+  std::FILE* file_;
+  std::unique_ptr<char[]> buffer_;
+};
+
+// Read-only memory mapping of a whole file.
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& path) : data_(nullptr), size_(0) {
+    auto fd = ::open(path.c_str(), O_RDONLY);
+    CHECK_STATE(fd >= 0);
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && st.st_size > 0) {
+      size_ = static_cast<size_t>(st.st_size);
+      auto addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (addr != MAP_FAILED) {
+        data_ = static_cast<const char*>(addr);
+        ::madvise(addr, size_, MADV_SEQUENTIAL);
+      }
+    }
+    ::close(fd);
+    CHECK_STATE(data_ != nullptr);
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() {
+    ::munmap(const_cast<char*>(data_), size_);
+  }
+
+  auto data() const {
+    return data_;
+  }
+
+  auto size() const {
+    return size_;
+  }
+
+ private:
+  const char* data_;
+  size_t size_;
+};
+
+class Cursor {
+ public:
+  explicit Cursor(const MappedFile& file)
+      : pos_(file.data()), end_(file.data() + file.size()) {}
+
+  void read(void* data, size_t size) {
+    CHECK_STATE(size <= static_cast<size_t>(end_ - pos_));
+    if (size > 0) {
+      std::memcpy(data, pos_, size);
+      pos_ += size;
+    }
+  }
+
+  template <typename T>
+  T read() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    T ret;
+    read(&ret, sizeof(T));
+    return ret;
+  }
+
+  auto remaining() const {
+    return static_cast<size_t>(end_ - pos_);
+  }
+
+  bool done() const {
+    return pos_ == end_;
+  }
+
+ private:
+  const char* pos_;
+  const char* end_;
+};
+
+void write_header(FileWriter& out, Kind kind, const voxels::Box& aabb) {
+  out.write(Header{
+      kMagic,
+      kVersion,
+      kind,
+      kLayerCount,
+      {aabb.v0.x, aabb.v0.y, aabb.v0.z},
+      {aabb.v1.x, aabb.v1.y, aabb.v1.z},
+  });
+}
+
+voxels::Box header_box(const Header& header) {
+  const auto& [x0, y0, z0] = header.v0;
+  const auto& [x1, y1, z1] = header.v1;
+  return voxels::Box{{x0, y0, z0}, {x1, y1, z1}};
+}
+
+Header read_header(Cursor& in) {
+  auto header = in.read<Header>();
+  CHECK_STATE(header.magic == kMagic);
+  CHECK_STATE(header.version == kVersion);
+  CHECK_STATE(header.layer_count == kLayerCount);
+  return header;
+}
+
+template <typename T>
+void write_layer(
+    FileWriter& out,
+    const WorldMap<T>& layer,
+    const std::vector<uint32_t>& indices) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  out.write(LayerHeader{
+      static_cast<uint32_t>(sizeof(T)),
+      static_cast<uint32_t>(indices.size()),
+  });
+  for (auto index : indices) {
+    const auto& array = layer.tensor.chunks[index]->array;
+    const auto& levels = array.dict.levels();
+    out.write(RecordHeader{
+        index,
+        array.dict.max(),
+        static_cast<uint32_t>(levels.size()),
+        static_cast<uint32_t>(array.data.size()),
+    });
+    out.write(levels.data(), sizeof(uint32_t) * levels.size());
+    out.write(array.data.data(), sizeof(T) * array.data.size());
+  }
+}
+
+template <typename T>
+void read_layer(Cursor& in, WorldMap<T>& layer) {
+  auto header = in.read<LayerHeader>();
+  CHECK_STATE(header.value_size == sizeof(T));
+  auto& chunks = layer.tensor.chunks;
+  for (uint32_t i = 0; i < header.record_count; i += 1) {
+    auto record = in.read<RecordHeader>();
+    CHECK_STATE(record.index < chunks.size());
+
+    // Check the sizes against each other and the file before allocating, so
+    // that a corrupt record fails here rather than as a huge allocation.
+    CHECK_STATE(record.max == tensors::kChunkSize - 1);
+    CHECK_STATE(record.level_count >= kMinLevelCount);
+    CHECK_STATE(record.level_count % 2 == 0);
+    CHECK_STATE(record.value_count > 0);
+    CHECK_STATE(record.value_count <= tensors::kChunkSize);
+    auto levels_size = sizeof(uint32_t) * uint64_t{record.level_count};
+    auto data_size = sizeof(T) * uint64_t{record.value_count};
+    CHECK_STATE(levels_size + data_size <= in.remaining());
+
+    tensors::Buffer<uint32_t> levels(record.level_count);
+    in.read(levels.data(), levels_size);
+    tensors::Buffer<T> data(record.value_count);
+    in.read(data.data(), data_size);
+
+    tensors::RankDict dict(
+        static_cast<tensors::DictKey>(record.max), std::move(levels));
+    CHECK_STATE(dict.count() == record.value_count);
+    chunks[record.index] = std::make_shared<tensors::Chunk<T>>(
+        tensors::Array<T>{std::move(dict), std::move(data)});
+  }
+}
+
+template <typename T>
+auto all_indices(const WorldMap<T>& layer) {
+  std::vector<uint32_t> ret(layer.tensor.chunks.size());
+  for (uint32_t i = 0; i < ret.size(); i += 1) {
+    ret[i] = i;
+  }
+  return ret;
+}
+
+template <typename T>
+void reset_layer(WorldMap<T>& layer, const voxels::Box& aabb) {
+  auto shape = to<unsigned int>(voxels::box_size(aabb));
+  auto count = tensors::shape_len(tensors::chunk_div(shape));
+  layer = WorldMap<T>{
+      aabb,
+      tensors::Tensor<T>(shape, tensors::Buffer<tensors::ChunkPtr<T>>(count)),
+  };
+}
+
+auto checkpoint_path(const std::string& dir, uint64_t sequence, Kind kind) {
+  char name[32];
+  std::snprintf(
+      name,
+      sizeof(name),
+      "%016llu.%s",
+      static_cast<unsigned long long>(sequence),
+      kind == Kind::kFull ? "full" : "incr");
+  return (fs::path(dir) / name).string();
+}
+
+struct CheckpointFile {
+  uint64_t sequence;
+  Kind kind;
+  fs::path path;
+};
+
+// Lists the checkpoints in the directory ordered by sequence number.
+auto list_checkpoints(const std::string& dir) {
+  std::vector<CheckpointFile> ret;
+  if (!fs::is_directory(dir)) {
+    return ret;
+  }
+  for (const auto& entry : fs::directory_iterator(dir)) {
+    auto ext = entry.path().extension();
+    if (ext != ".full" && ext != ".incr") {
+      continue;
+    }
+    auto stem = entry.path().stem().string();
+    if (stem.empty() ||
+        !std::all_of(stem.begin(), stem.end(), [](char c) {
+          return c >= '0' && c <= '9';
+        })) {
+      continue;
+    }
+    ret.push_back(CheckpointFile{
+        std::stoull(stem),
+        ext == ".full" ? Kind::kFull : Kind::kIncremental,
+        entry.path(),
+    });
+  }
+  std::sort(ret.begin(), ret.end(), [](const auto& a, const auto& b) {
+    return a.sequence < b.sequence;
+  });
+  return ret;
+}
+
+}  // namespace
+
+void write_checkpoint(const std::string& path, const TerrainMapV2& map) {
+  FileWriter out(path);
+  write_header(out, Kind::kFull, map.aabb());
+  visit_layers(
+      [&](const auto& layer) {
+        write_layer(out, layer, all_indices(layer));
+      },
+      map);
+  out.commit();
+}
+
+size_t write_checkpoint(
+    const std::string& path,
+    const TerrainMapV2& map,
+    const TerrainMapV2& base) {
+  CHECK_ARGUMENT(map.aabb() == base.aabb());
+
+  size_t ret = 0;
+  FileWriter out(path);
+  write_header(out, Kind::kIncremental, map.aabb());
+  visit_layers(
+      [&](const auto& layer, const auto& base_layer) {
+        const auto& chunks = layer.tensor.chunks;
+        const auto& base_chunks = base_layer.tensor.chunks;
+        CHECK_ARGUMENT(chunks.size() == base_chunks.size());
+
+        std::vector<uint32_t> indices;
+        for (uint32_t i = 0; i < chunks.size(); i += 1) {
+          if (chunks[i] != base_chunks[i]) {
+            indices.push_back(i);
+          }
+        }
+        write_layer(out, layer, indices);
+        ret += indices.size();
+      },
+      map,
+      base);
+  out.commit();
+  return ret;
+}
+
+TerrainMapV2 read_checkpoint(const std::string& path) {
+  MappedFile file(path);
+  Cursor in(file);
+  auto header = read_header(in);
+  CHECK_STATE(header.kind == Kind::kFull);
+
+  auto aabb = header_box(header);
+  TerrainMapV2 ret;
+  visit_layers(
+      [&](auto& layer) {
+        reset_layer(layer, aabb);
+        read_layer(in, layer);
+        for (const auto& chunk : layer.tensor.chunks) {
+          CHECK_STATE(chunk != nullptr);
+        }
+      },
+      ret);
+  CHECK_STATE(in.done());
+  return ret;
+}
+
+void apply_checkpoint(TerrainMapV2& map, const std::string& path) {
+  MappedFile file(path);
+  Cursor in(file);
+  auto header = read_header(in);
+  CHECK_ARGUMENT(map.aabb() == header_box(header));
+
+  visit_layers(
+      [&](auto& layer) {
+        read_layer(in, layer);
+      },
+      map);
+  CHECK_STATE(in.done());
+}
+
+TerrainCheckpointer::TerrainCheckpointer(
+    std::string dir, uint32_t full_interval)
+    : dir_(std::move(dir)),
+      full_interval_(full_interval),
+      incremental_count_(0),
+      sequence_(0) {
+  CHECK_ARGUMENT(full_interval > 0);
+  fs::create_directories(dir_);
+
+  // Continue numbering after any existing checkpoints so that they are only
+  // superseded once this checkpointer writes its first full checkpoint.
+  auto existing = list_checkpoints(dir_);
+  if (!existing.empty()) {
+    sequence_ = existing.back().sequence + 1;
+  }
+}
+
+void TerrainCheckpointer::checkpoint(const TerrainMapV2& map) {
+  auto full = !base_ || base_->aabb() != map.aabb() ||
+              incremental_count_ + 1 >= full_interval_;
+  auto sequence = sequence_++;
+  if (full) {
+    write_checkpoint(checkpoint_path(dir_, sequence, Kind::kFull), map);
+    incremental_count_ = 0;
+    for (const auto& file : list_checkpoints(dir_)) {
+      if (file.sequence < sequence) {
+        fs::remove(file.path);
+      }
+    }
+  } else {
+    write_checkpoint(
+        checkpoint_path(dir_, sequence, Kind::kIncremental), map, *base_);
+    incremental_count_ += 1;
+  }
+  base_ = map;
+}
+
+bool TerrainCheckpointer::restore(const std::string& dir, TerrainMapV2& map) {
+  auto paths = history(dir);
+  if (paths.empty()) {
+    return false;
+  }
+
+  map = read_checkpoint(paths.front());
+  for (auto it = paths.begin() + 1; it != paths.end(); ++it) {
+    apply_checkpoint(map, *it);
+  }
+  return true;
+}
+
+std::vector<std::string> TerrainCheckpointer::history(const std::string& dir) {
+  auto files = list_checkpoints(dir);
+  auto it = std::find_if(files.rbegin(), files.rend(), [](const auto& file) {
+    return file.kind == Kind::kFull;
+  });
+
+  std::vector<std::string> ret;
+  if (it != files.rend()) {
+    for (auto jt = std::prev(it.base()); jt != files.end(); ++jt) {
+      ret.push_back(jt->path.string());
+    }
+  }
+  return ret;
+}
+
+}  // namespace voxeloo::gaia
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "voxeloo/gaia/terrain.hpp"
+
+namespace voxeloo::gaia {
+
+// Checkpoints are a native, host-endian dump of every layer of a TerrainMapV2.
+// Each chunk is written as its raw RLE dictionary and run values, so restoring
+// is a bulk copy out of a memory-mapped file with no re-encoding or merging.
+// They are meant for fast restarts from local disk, not as a portable format.
+
+// Writes every chunk of the map to the given path.
+void write_checkpoint(const std::string& path, const TerrainMapV2& map);
+
+// Writes only the chunks of the map that differ from the ones in base, which
+// must be an earlier version of the same map. Returns the number of chunks
+// written. Changes are detected by chunk identity, so this relies on updates
+// replacing chunk pointers rather than mutating chunks in place.
+size_t write_checkpoint(
+    const std::string& path, const TerrainMapV2& map, const TerrainMapV2& base);
+
+// Reads a checkpoint written by the full form of write_checkpoint.
+TerrainMapV2 read_checkpoint(const std::string& path);
+
+// Replaces the chunks of the map with the ones stored in the given checkpoint.
+// The checkpoint must have been taken from a map with the same AABB.
+void apply_checkpoint(TerrainMapV2& map, const std::string& path);
+
+// Maintains a directory of periodic checkpoints. Every call to checkpoint()
+// writes a new file: a full checkpoint every full_interval calls, otherwise an
+// incremental checkpoint of the chunks changed since the previous call. Writing
+// a full checkpoint removes the files it supersedes.
+class TerrainCheckpointer {
+ public:
+  TerrainCheckpointer(std::string dir, uint32_t full_interval);
+
+  void checkpoint(const TerrainMapV2& map);
+
+  // Restores the latest full checkpoint in the directory followed by all of
+  // the incremental checkpoints taken after it. Returns false if the directory
+  // holds no full checkpoint.
+  static bool restore(const std::string& dir, TerrainMapV2& map);
+
+  // Returns the paths of the checkpoints that restore() would apply, in order,
+  // or nothing if the directory holds no full checkpoint.
+  static std::vector<std::string> history(const std::string& dir);
+
+ private:
+  std::string dir_;
+  uint32_t full_interval_;
+  uint32_t incremental_count_;
+  uint64_t sequence_;
+  std::optional<TerrainMapV2> base_;
+};
+
+}  // namespace voxeloo::gaia
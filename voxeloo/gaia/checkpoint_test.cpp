@@ -0,0 +1,171 @@
+#include "voxeloo/gaia/checkpoint.hpp"
+
+#include <catch2/catch.hpp>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+
+#include "voxeloo/common/geometry.hpp"
+
+using namespace voxeloo;  // NOLINT
+using galois::terrain::TerrainId;
+
+namespace {
+
+auto make_map() {
+  gaia::TerrainMapBuilderV2 builder;
+  for (int x = 0; x < 96; x += 32) {
+    tensors::SparseTensorBuilder<TerrainId> seed(tensors::kChunkShape);
+    for (auto y = 0u; y < 8u; y += 1) {
+      seed.set({static_cast<unsigned int>(x / 8), y, 3}, 5);
+    }
+    builder.assign_seed_block({x, 0, 0}, std::move(seed).build());
+    builder.assign_water_block(
+        {x, 0, 0}, tensors::make_tensor<uint8_t>(tensors::kChunkShape, 2));
+    builder.assign_irradiance_block(
+        {x, 0, 0},
+        tensors::make_tensor<uint32_t>(tensors::kChunkShape, 0xabcdef01));
+    builder.assign_occlusion_block(
+        {x, 0, 0}, tensors::make_tensor<uint8_t>(tensors::kChunkShape, 15));
+  }
+  return std::move(builder).build();
+}
+
+auto make_diff(TerrainId val) {
+  tensors::SparseTensorBuilder<std::optional<TerrainId>> builder(
+      tensors::kChunkShape);
+  builder.set({1, 2, 3}, val);
+  return std::move(builder).build();
+}
+
+void require_same_layer(const auto& a, const auto& b) {
+  REQUIRE(a.aabb == b.aabb);
+  REQUIRE(a.tensor.shape == b.tensor.shape);
+  REQUIRE(tensors::hash(a.tensor) == tensors::hash(b.tensor));
+}
+
+void require_same_map(
+    const gaia::TerrainMapV2& a, const gaia::TerrainMapV2& b) {
+  require_same_layer(a.seeds, b.seeds);
+  require_same_layer(a.diffs, b.diffs);
+  require_same_layer(a.terrains, b.terrains);
+  require_same_layer(a.waters, b.waters);
+  require_same_layer(a.irradiances, b.irradiances);
+  require_same_layer(a.dyes, b.dyes);
+  require_same_layer(a.growths, b.growths);
+  require_same_layer(a.occlusions, b.occlusions);
+}
+
+struct TempDir {
+  std::filesystem::path path;
+
+  explicit TempDir(const char* name)
+      : path(std::filesystem::temp_directory_path() / name) {
+    std::filesystem::remove_all(path);
+    std::filesystem::create_directories(path);
+  }
+
+  ~TempDir() {
+    std::filesystem::remove_all(path);
+  }
+
+  auto file(const char* name) const {
+    return (path / name).string();
+  }
+};
+
+// Overwrites the 32-bit word at the given byte offset of the file.
+void patch_word(const std::string& path, size_t offset, uint32_t val) {
+  std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+  file.seekp(static_cast<std::streamoff>(offset));
+  file.write(reinterpret_cast<const char*>(&val), sizeof(val));
+}
+
+}  // namespace
+
+TEST_CASE("Test full and incremental checkpoints", "[all]") {
+  TempDir dir("gaia_checkpoint_test");
+  auto map = make_map();
+
+  gaia::write_checkpoint(dir.file("full"), map);
+  auto restored = gaia::read_checkpoint(dir.file("full"));
+  require_same_map(map, restored);
+  REQUIRE(restored.get_terrain({32 + 4, 5, 3}) == 5);
+
+  auto base = map;
+  map.update_diff({32, 0, 0}, make_diff(9));
+  map.update_water(
+      {64, 0, 0}, tensors::make_tensor<uint8_t>(tensors::kChunkShape, 7));
+
+  // The diff also changes the merged terrain chunk.
+  REQUIRE(gaia::write_checkpoint(dir.file("incr"), map, base) == 3);
+  gaia::apply_checkpoint(restored, dir.file("incr"));
+  require_same_map(map, restored);
+  REQUIRE(restored.get_terrain({33, 2, 3}) == 9);
+  REQUIRE(restored.waters.get({64, 0, 0}) == 7);
+
+  // Incremental checkpoints cannot be read on their own.
+  REQUIRE_THROWS(gaia::read_checkpoint(dir.file("incr")));
+}
+
+TEST_CASE("Test periodic checkpoints", "[all]") {
+  TempDir dir("gaia_checkpointer_test");
+  auto map = make_map();
+
+  gaia::TerrainMapV2 restored;
+  REQUIRE(!gaia::TerrainCheckpointer::restore(dir.path.string(), restored));
+
+  gaia::TerrainCheckpointer checkpointer(dir.path.string(), 3);
+  for (TerrainId i = 1; i <= 4; i += 1) {
+    map.update_diff({static_cast<int>(32 * (i % 3)), 0, 0}, make_diff(i));
+    checkpointer.checkpoint(map);
+  }
+
+  // The fourth checkpoint is full and supersedes the first three.
+  auto count = std::distance(
+      std::filesystem::directory_iterator(dir.path),
+      std::filesystem::directory_iterator());
+  REQUIRE(count == 1);
+
+  map.update_diff({0, 0, 0}, make_diff(12));
+  checkpointer.checkpoint(map);
+  map.update_dye(
+      {32, 0, 0}, tensors::make_tensor<uint8_t>(tensors::kChunkShape, 3));
+  checkpointer.checkpoint(map);
+
+  REQUIRE(gaia::TerrainCheckpointer::restore(dir.path.string(), restored));
+  require_same_map(map, restored);
+  REQUIRE(restored.get_terrain({1, 2, 3}) == 12);
+  REQUIRE(restored.dyes.get({32, 0, 0}) == 3);
+}
+
+TEST_CASE("Test reading corrupt checkpoints", "[all]") {
+  TempDir dir("gaia_corrupt_checkpoint_test");
+  auto map = make_map();
+
+  // The first record header follows the file header (40 bytes) and the layer
+  // header (8 bytes), as index, max, level count and value count.
+  static constexpr size_t kLevelCount = 40 + 8 + 8;
+  static constexpr size_t kValueCount = kLevelCount + 4;
+
+  gaia::write_checkpoint(dir.file("full"), map);
+  patch_word(dir.file("full"), kLevelCount, 0x40000000);
+  REQUIRE_THROWS(gaia::read_checkpoint(dir.file("full")));
+
+  gaia::write_checkpoint(dir.file("full"), map);
+  patch_word(dir.file("full"), kValueCount, 0xffffffff);
+  REQUIRE_THROWS(gaia::read_checkpoint(dir.file("full")));
+
+  // Sizes that fit in the file but disagree with the dict.
+  gaia::write_checkpoint(dir.file("full"), map);
+  patch_word(dir.file("full"), kValueCount, 1);
+  REQUIRE_THROWS(gaia::read_checkpoint(dir.file("full")));
+
+  gaia::write_checkpoint(dir.file("full"), map);
+  std::filesystem::resize_file(
+      dir.file("full"), std::filesystem::file_size(dir.file("full")) - 1);
+  REQUIRE_THROWS(gaia::read_checkpoint(dir.file("full")));
+
+  gaia::write_checkpoint(dir.file("full"), map);
+  require_same_map(map, gaia::read_checkpoint(dir.file("full")));
+}
@@ -0,0 +1,385 @@
+// Replays a recording of terrain edits (see replay.hpp) against the gaia
+// simulations and reports the latency percentiles and throughput of each:
+//
+//   gaia_bench [recording_dir]
+//
+// Without a recording, a synthetic workload of digging and building on rolling
+// hills next to a pool of water is recorded to a temporary directory first.
+//
+// Throughput is reported in voxels per second. For the light simulation and
+// the sky occlusion columns, these are the edited voxels; for water and
+// irradiance, the voxels of the shards they step. Irradiance is timed both on
+// the layered map and on a record-per-shard copy of it (see records.hpp).
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "voxeloo/common/geometry.hpp"
+#include "voxeloo/gaia/light.hpp"
+#include "voxeloo/gaia/records.hpp"
+#include "voxeloo/gaia/replay.hpp"
+#include "voxeloo/gaia/terrain.hpp"
+#include "voxeloo/gaia/water.hpp"
+
+namespace voxeloo::gaia {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+static const auto k = static_cast<int>(tensors::kChunkDim);
+static const auto kShardVoxels = static_cast<size_t>(tensors::kChunkSize);
+
+// The latencies and volume of work of one stage of the replay.
+class Stage {
+ public:
+  explicit Stage(std::string name) : name_(std::move(name)), voxels_(0) {}
+
+  template <typename Fn>
+  auto time(size_t voxels, Fn&& fn) {
+    auto start = Clock::now();
+    auto ret = fn();
+    latencies_.push_back(
+        std::chrono::duration<double, std::milli>(Clock::now() - start)
+            .count());
+    voxels_ += voxels;
+    return ret;
+  }
+
+  void report() {
+    if (latencies_.empty()) {
+      std::printf("%-12s %8d\n", name_.c_str(), 0);
+      return;
+    }
+    std::sort(latencies_.begin(), latencies_.end());
+    auto percentile = [&](double p) {
+      auto i = static_cast<size_t>(p * (latencies_.size() - 1) + 0.5);
+      return latencies_[i];
+    };
+    double total = 0.0;
+    for (auto latency : latencies_) {
+      total += latency;
+    }
+    std::printf(
+        "%-12s %8zu %10.3f %10.3f %10.3f %10.3f %12.3f\n",
+        name_.c_str(),
+        latencies_.size(),
+        percentile(0.5),
+        percentile(0.9),
+        percentile(0.99),
+        latencies_.back(),
+        total > 0.0 ? 1e-3 * voxels_ / total : 0.0);
+  }
+
+  static void report_header() {
+    std::printf(
+        "%-12s %8s %10s %10s %10s %10s %12s\n",
+        "stage",
+        "samples",
+        "p50 (ms)",
+        "p90 (ms)",
+        "p99 (ms)",
+        "max (ms)",
+        "Mvoxels/s");
+  }
+
+ private:
+  std::string name_;
+  size_t voxels_;
+  std::vector<double> latencies_;
+};
+
+// Synthetic workload.
+
+const auto kSyntheticShards = Vec3i{8, 4, 8};
+const auto kSyntheticFrames = 200;
+
+auto hill_height(int x, int z) {
+  return 40 + (x / 8 + z / 8) % 5 * 3 + (x * 7 + z * 13) % 3;
+}
+
+auto in_pool(Vec3i pos) {
+  return pos.x >= 120 && pos.x < 136 && pos.z >= 120 && pos.z < 136 &&
+         pos.y >= hill_height(pos.x, pos.z) &&
+         pos.y < hill_height(pos.x, pos.z) + 2;
+}
+
+auto make_synthetic_map() {
+  TerrainMapBuilderV2 builder;
+  for (int sz = 0; sz < kSyntheticShards.z; sz += 1) {
+    for (int sy = 0; sy < kSyntheticShards.y; sy += 1) {
+      for (int sx = 0; sx < kSyntheticShards.x; sx += 1) {
+        auto origin = k * vec3(sx, sy, sz);
+        tensors::SparseTensorBuilder<TerrainId> seed(tensors::kChunkShape);
+        tensors::SparseTensorBuilder<uint8_t> water(tensors::kChunkShape);
+        for (auto z = 0; z < k; z += 1) {
+          for (auto y = 0; y < k; y += 1) {
+            for (auto x = 0; x < k; x += 1) {
+              auto pos = origin + vec3(x, y, z);
+              auto local = to<unsigned int>(vec3(x, y, z));
+              if (pos.y < hill_height(pos.x, pos.z)) {
+                seed.set(local, 1);
+              } else if (in_pool(pos)) {
+                water.set(local, 15);
+              }
+            }
+          }
+        }
+        builder.assign_seed_block(origin, std::move(seed).build());
+        builder.assign_water_block(origin, std::move(water).build());
+      }
+    }
+  }
+  return std::move(builder).build();
+}
+
+// Records frames of a few spheres dug out of or built onto the hills.
+void record_synthetic(const std::string& dir) {
+  auto map = make_synthetic_map();
+  TerrainRecorder recorder(dir, map);
+
+  std::mt19937 rng(1234);
+  auto extent = k * kSyntheticShards;
+  std::uniform_int_distribution<int> xs(0, extent.x - 1);
+  std::uniform_int_distribution<int> zs(0, extent.z - 1);
+  std::uniform_int_distribution<int> edits(1, 3);
+  std::uniform_int_distribution<int> radii(1, 4);
+  std::bernoulli_distribution digs(0.6);
+  for (auto frame = 0; frame < kSyntheticFrames; frame += 1) {
+    for (auto i = edits(rng); i > 0; i -= 1) {
+      auto x = xs(rng);
+      auto z = zs(rng);
+      auto center = vec3(x, hill_height(x, z), z);
+      auto origin = k * floor_div(center, k);
+      auto radius = radii(rng);
+      auto id = digs(rng) ? std::optional<TerrainId>(0) : TerrainId(1);
+      recorder.update_diff(
+          map,
+          origin,
+          tensors::map_dense(
+              tensors::make_tensor(*map.diffs.chunk(origin)),
+              [&](Vec3u p, auto val) {
+                auto d = origin + to<int>(p) - center;
+                return d.x * d.x + d.y * d.y + d.z * d.z <= radius * radius
+                           ? id
+                           : val;
+              }));
+    }
+    recorder.tick();
+  }
+}
+
+// Replay.
+
+// Converts a TerrainMapV2 to a terrain map. Chunks are copied, since terrain
+// maps are edited in place.
+auto to_terrain_map(const TerrainMapV2& map) {
+  TerrainMapBuilder builder;
+  auto [v0, v1] = map.aabb();
+  for (auto z = v0.z; z < v1.z; z += k) {
+    for (auto y = v0.y; y < v1.y; y += k) {
+      for (auto x = v0.x; x < v1.x; x += k) {
+        auto pos = vec3(x, y, z);
+        builder.assign_seed_block(
+            pos, tensors::make_tensor(*map.seeds.chunk(pos)));
+        builder.assign_diff_block(
+            pos, tensors::make_tensor(*map.diffs.chunk(pos)));
+        builder.assign_dye_block(
+            pos, tensors::make_tensor(*map.dyes.chunk(pos)));
+      }
+    }
+  }
+  return std::move(builder).build();
+}
+
+void replay(const std::string& dir) {
+  TerrainReplay replay(dir);
+  auto map = replay.initial();
+  auto [v0, v1] = map.aabb();
+  std::printf(
+      "replaying %zu frames over %d x %d x %d voxels\n",
+      replay.frame_count(),
+      v1.x - v0.x,
+      v1.y - v0.y,
+      v1.z - v0.z);
+
+  Stage light_init("light.init");
+  Stage light("light");
+  Stage occlusion_init("occl.init");
+  Stage occlusion("occlusion");
+  Stage water("water");
+  Stage irradiance("irradiance");
+  Stage irradiance_records("irr.records");
+
+  // The light simulation runs on its own copy of the terrain, edited through
+  // a terrain writer as in production.
+  auto logger = make_dep<Logger>([](const std::string&) {});
+  auto terrain = make_dep<Lazy<TerrainMap>>();
+  terrain->set(to_terrain_map(map));
+  auto terrain_stream = make_dep<TerrainStream>();
+  TerrainWriter writer(logger, terrain, terrain_stream);
+
+  auto sky_occlusion_map = make_dep<Lazy<SkyOcclusionMap>>();
+  auto irradiance_map = make_dep<Lazy<IrradianceMap>>();
+  LightSimulation simulation(
+      logger,
+      terrain,
+      sky_occlusion_map,
+      make_dep<SkyOcclusionWriter>(
+          logger, sky_occlusion_map, make_dep<SkyOcclusionStream>()),
+      irradiance_map,
+      make_dep<IrradianceWriter>(
+          logger, irradiance_map, make_dep<IrradianceStream>()),
+      terrain_stream);
+  auto map_voxels = static_cast<size_t>(v1.x - v0.x) * (v1.y - v0.y) *
+                    static_cast<size_t>(v1.z - v0.z);
+  light_init.time(map_voxels, [&] {
+    simulation.init();
+    return 0;
+  });
+
+  SkyOcclusionCache cache;
+  for (auto z = v0.z; z < v1.z; z += k) {
+    for (auto x = v0.x; x < v1.x; x += k) {
+      auto column_voxels = static_cast<size_t>(v1.y - v0.y) * k * k;
+      auto column = occlusion_init.time(column_voxels, [&] {
+        return update_occlusion(map, {x, z}, cache);
+      });
+      for (auto y = v0.y; y < v1.y; y += k) {
+        map.occlusions.chunk({x, y, z}) = column.chunk({x, y, z});
+      }
+    }
+  }
+
+  // Kept in sync with the edits, for the irradiance stage.
+  TerrainRecordMap records(map);
+
+  // A light source in the middle of the receptive field of every shard.
+  auto sources = [] {
+    tensors::SparseTensorBuilder<uint32_t> builder({64u, 64u, 64u});
+    builder.set({32u, 32u, 32u}, 0xffc0800f);
+    return std::move(builder).build();
+  }();
+
+  std::vector<Vec3i> active;
+  for (auto z = v0.z; z < v1.z; z += k) {
+    for (auto y = v0.y; y < v1.y; y += k) {
+      for (auto x = v0.x; x < v1.x; x += k) {
+        if (tensors::any(map.waters.chunk({x, y, z})->array, [](auto w) {
+              return w > 0;
+            })) {
+          active.push_back({x, y, z});
+        }
+      }
+    }
+  }
+
+  for (size_t frame = 0; frame < replay.frame_count(); frame += 1) {
+    auto changes = replay.apply(frame, map);
+    std::vector<Vec3i> edited;
+    for (const auto& change : changes) {
+      edited.push_back(change.pos);
+    }
+
+    // Light: replay the edits through the terrain writer.
+    for (auto pos : edited) {
+      writer.update_diff(pos, tensors::make_tensor(*map.diffs.chunk(pos)));
+      writer.update_dye(pos, tensors::make_tensor(*map.dyes.chunk(pos)));
+    }
+    size_t edited_voxels = 0;
+    for (const auto& change : changes) {
+      edited_voxels += change_size(change);
+    }
+    light.time(edited_voxels, [&] {
+      simulation.tick();
+      return 0;
+    });
+
+    // Sky occlusion: the columns within reach of each change.
+    for (const auto& change : changes) {
+      auto box = change_box(change);
+      for (auto dz = -k; dz <= k; dz += k) {
+        for (auto dx = -k; dx <= k; dx += k) {
+          auto column = Vec2i{change.pos.x + dx, change.pos.z + dz};
+          if (!map.contains({column.x, v0.y, column.y})) {
+            continue;
+          }
+          auto shards = occlusion.time(change_size(change), [&] {
+            return update_occlusion(map, column, box, cache);
+          });
+          for (const auto& shard : shards) {
+            map.occlusions.chunk(shard.pos) = shard.chunk;
+          }
+        }
+      }
+    }
+
+    // Water: one step of the active shards and the edited ones.
+    active.insert(active.end(), edited.begin(), edited.end());
+    auto update = water.time(kShardVoxels * active.size(), [&] {
+      return update_water(map, active, 1);
+    });
+    for (const auto& shard : update.shards) {
+      map.waters.chunk(shard.pos) = shard.chunk;
+    }
+    active = std::move(update.active);
+
+    // Irradiance: the edited shards.
+    for (auto pos : edited) {
+      auto out = irradiance.time(kShardVoxels, [&] {
+        return update_irradiance(map, pos, sources);
+      });
+      map.irradiances.chunk(pos) = out.chunk(pos);
+    }
+
+    // Irradiance again, gathering the layers from the records.
+    for (auto pos : edited) {
+      records.update_diff(pos, tensors::make_tensor(*map.diffs.chunk(pos)));
+      records.update_dye(pos, tensors::make_tensor(*map.dyes.chunk(pos)));
+    }
+    for (auto pos : edited) {
+      auto out = irradiance_records.time(kShardVoxels, [&] {
+        return update_irradiance(records, pos, sources);
+      });
+      records.update_irradiance(pos, out.tensor);
+    }
+  }
+
+  Stage::report_header();
+  light_init.report();
+  light.report();
+  occlusion_init.report();
+  occlusion.report();
+  water.report();
+  irradiance.report();
+  irradiance_records.report();
+}
+
+}  // namespace
+
+}  // namespace voxeloo::gaia
+
+int main(int argc, char** argv) {
+  namespace fs = std::filesystem;
+  if (argc > 2) {
+    std::fprintf(stderr, "usage: %s [recording_dir]\n", argv[0]);
+    return 1;
+  }
+  if (argc == 2) {
+    voxeloo::gaia::replay(argv[1]);
+    return 0;
+  }
+
+  auto dir = fs::temp_directory_path() / "gaia_bench";
+  fs::remove_all(dir);
+  voxeloo::gaia::record_synthetic(dir.string());
+  voxeloo::gaia::replay(dir.string());
+  fs::remove_all(dir);
+  return 0;
+}
@@ -1,35 +1,151 @@
 #include "voxeloo/gaia/light.hpp"
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <bitset>
+#include <chrono>
+#include <cmath>
 #include <memory>
+#include <vector>
 
 #include "prometheus/counter.h"
+#include "prometheus/gauge.h"
+#include "prometheus/histogram.h"
 #include "voxeloo/common/format.hpp"
 #include "voxeloo/common/geometry.hpp"
 #include "voxeloo/common/hashing.hpp"
 #include "voxeloo/common/metrics.hpp"
+#include "voxeloo/gaia/properties.hpp"
 #include "voxeloo/gaia/timer.hpp"
-#include "voxeloo/galois/terrain.hpp"
 #include "voxeloo/tensors/buffers.hpp"
 
 namespace voxeloo::gaia {
 
 namespace {
 
+auto& light_init_ms =
+    prometheus::BuildHistogram()
+        .Name("gaia_light_cpp_init_ms")
+        .Help("Duration of the light simulation initialization.")
+        .Register(metrics::registry())
+        .Add({}, latency_buckets());
+
+auto& light_tick_ms =
+    prometheus::BuildHistogram()
+        .Name("gaia_light_cpp_tick_ms")
+        .Help("Duration per light simulation tick.")
+        .Register(metrics::registry())
+        .Add({}, latency_buckets());
+
+auto& sky_occlusion_update_duration_ms =
+    prometheus::BuildHistogram()
+        .Name("gaia_light_cpp_sky_occlusion_update_duration_ms")
+        .Help("Duration per sky-occlusion map column update.")
+        .Register(metrics::registry())
+        .Add({}, latency_buckets());
+
+auto& irradiance_update_duration_ms =
+    prometheus::BuildHistogram()
+        .Name("gaia_light_cpp_irradiance_update_duration_ms")
+        .Help("Duration per irradiance map update (queue completion).")
+        .Register(metrics::registry())
+        .Add({}, latency_buckets());
+
+auto& sky_occlusion_columns_per_tick =
+    prometheus::BuildHistogram()
+        .Name("gaia_light_cpp_sky_occlusion_columns_per_tick")
+        .Help("Number of sky-occlusion columns updated per tick.")
+        .Register(metrics::registry())
+        .Add({}, count_buckets());
+
+// The gauges replaced by the histograms above, still set with the last value
+// until the dashboards reading them move over.
+
 auto& sky_occlusion_update_ms =
     prometheus::BuildGauge()
         .Name("gaia_light_cpp_sky_occlusion_update_ms")
-        .Help("Duration per sky-occlusion map column update.")
+        .Help(
+            "Deprecated, see gaia_light_cpp_sky_occlusion_update_duration_ms.")
         .Register(metrics::registry())
         .Add({});
 
 auto& irradiance_update_ms =
     prometheus::BuildGauge()
         .Name("gaia_light_cpp_irradiance_update_ms")
-        .Help("Duration per irradiance map update (queue completion).")
+        .Help("Deprecated, see gaia_light_cpp_irradiance_update_duration_ms.")
+        .Register(metrics::registry())
+        .Add({});
+
+auto& sky_occlusion_pending_columns =
+    prometheus::BuildGauge()
+        .Name("gaia_light_cpp_sky_occlusion_pending_columns")
+        .Help("Number of sky-occlusion columns waiting to be updated.")
+        .Register(metrics::registry())
+        .Add({});
+
+auto& terrain_changes =
+    prometheus::BuildHistogram()
+        .Name("gaia_light_cpp_terrain_changes")
+        .Help("Number of terrain change events drained per tick.")
+        .Register(metrics::registry())
+        .Add({}, count_buckets());
+
+auto& light_queue_voxels =
+    prometheus::BuildCounter()
+        .Name("gaia_light_cpp_queue_voxels_total")
+        .Help("Number of voxels visited by the light propagation queues.")
+        .Register(metrics::registry());
+
+auto& sky_occlusion_queue_voxels = light_queue_voxels.Add({{"map", "sky"}});
+auto& irradiance_queue_voxels = light_queue_voxels.Add({{"map", "rgb"}});
+
+auto& light_chunks =
+    prometheus::BuildCounter()
+        .Name("gaia_light_cpp_chunks_total")
+        .Help("Number of light chunks signalled, by map and by whether they "
+              "were emitted or skipped for an unchanged checksum.")
+        .Register(metrics::registry());
+
+auto& sky_occlusion_emitted_chunks =
+    light_chunks.Add({{"map", "sky"}, {"result", "emitted"}});
+auto& sky_occlusion_skipped_chunks =
+    light_chunks.Add({{"map", "sky"}, {"result", "skipped"}});
+auto& irradiance_emitted_chunks =
+    light_chunks.Add({{"map", "rgb"}, {"result", "emitted"}});
+auto& irradiance_skipped_chunks =
+    light_chunks.Add({{"map", "rgb"}, {"result", "skipped"}});
+
+auto& occlusion_update_ms =
+    prometheus::BuildHistogram()
+        .Name("gaia_light_cpp_occlusion_update_ms")
+        .Help("Duration per sky-occlusion update of a terrain map column.")
+        .Register(metrics::registry())
+        .Add({}, latency_buckets());
+
+auto& occlusion_chunks =
+    prometheus::BuildCounter()
+        .Name("gaia_light_cpp_occlusion_chunks_total")
+        .Help("Number of sky-occlusion chunks emitted by column updates.")
         .Register(metrics::registry())
         .Add({});
 
+auto& irradiance_shard_ms =
+    prometheus::BuildHistogram()
+        .Name("gaia_light_cpp_irradiance_shard_ms")
+        .Help("Duration per irradiance update of a terrain map shard.")
+        .Register(metrics::registry())
+        .Add({}, latency_buckets());
+
+// Time spent on scheduled sky-occlusion columns per tick.
+static constexpr std::chrono::duration<double, std::milli> kColumnBudget(4.0);
+
+// Columns near an edit are scheduled with a priority that grows with the size
+// of the edit, and gain one unit of priority per tick while waiting. Every
+// column is also refreshed in turn in the background, one every this many
+// ticks, once no edited columns are pending.
+static constexpr uint64_t kRefreshInterval = 2;
+
 static constexpr uint8_t kMaxIntensity = 15;
 static constexpr uint8_t kMaxOcclusion = 15;
 static constexpr uint8_t kOcclusionStep = 1;
@@ -37,26 +153,108 @@ static constexpr uint8_t kOcclusionStep = 1;
 using TerrainArray = tensors::Array<TerrainId>;
 
 auto is_occlusive(TerrainId id) {
-  return id != 0 && galois::terrain::is_block_id(id);
+  return (terrain_flags(id) & OCCLUSIVE) != 0;
+}
+
+// Occlusion bitmasks of a chunk: one word per row of voxels along x, indexed
+// by layer (y) and then row (z).
+static_assert(tensors::kChunkDim == 32);
+using LayerMask = std::array<uint32_t, tensors::kChunkDim>;
+using ChunkMask = std::array<LayerMask, tensors::kChunkDim>;
+
+static constexpr uint32_t kFullRow = ~0u;
+
+// Returns the topmost layer containing a voxel matching the predicate, or -1 if
+// there is none.
+template <typename T, typename Pred>
+int top_layer(const tensors::Array<T>& array, Pred&& pred) {
+  int ret = -1;
+  tensors::scan(array, [&](auto run, auto val) {
+    if (pred(val)) {
+      ret = std::max(ret, static_cast<int>((run.pos + run.len - 1) >> 10));
+    }
+  });
+  return ret;
 }
 
-template <typename T>
-auto reverse(const tensors::Array<T>& array) {
-  auto n = array.data.size();
+// Sets the bits of the voxels matching the predicate directly from the runs.
+template <typename T, typename Pred>
+void fill_mask(const tensors::Array<T>& array, Pred&& pred, ChunkMask& mask) {
+  mask = {};
+  tensors::scan(array, [&](auto run, auto val) {
+    if (!pred(val)) {
+      return;
+    }
+    uint32_t pos = run.pos;
+    uint32_t end = run.pos + run.len;
+    while (pos < end) {
+      auto x = pos & 31;
+      auto n = std::min(32 - x, end - pos);
+      auto bits = n == 32 ? kFullRow : ((1u << n) - 1) << x;
+      mask[pos >> 10][(pos >> 5) & 31] |= bits;
+      pos += n;
+    }
+  });
+}
+
+// Ors the layers [from, to] of the mask into acc.
+void accumulate(const ChunkMask& mask, int from, int to, LayerMask& acc) {
+  for (auto y = from; y <= to; y += 1) {
+    for (auto z = 0u; z < tensors::kChunkDim; z += 1) {
+      acc[z] |= mask[y][z];
+    }
+  }
+}
+
+bool all_occluded(const LayerMask& acc) {
+  return std::all_of(acc.begin(), acc.end(), [](uint32_t row) {
+    return row == kFullRow;
+  });
+}
 
-  // Build up the pairs of positions and their values.
-  tensors::MultiBufferBuilder<tensors::ArrayPos, T> builder(n);
-  scan(array, [&](auto run, auto val) {
-    builder.add(run.len, val);
+bool none_occluded(const LayerMask& acc) {
+  return std::all_of(acc.begin(), acc.end(), [](uint32_t row) {
+    return row == 0;
   });
-  auto [lens, vals] = std::move(builder).build();
+}
 
-  // Create a new array from the reversed pairs.
-  tensors::ArrayBuilder<T> out(n);
-  for (auto i = 0; i < n; i += 1) {
-    out.add(lens[n - i - 1], vals[n - i - 1]);
+void add_row(tensors::ArrayBuilder<uint8_t>& builder, uint32_t row) {
+  if (row == 0 || row == kFullRow) {
+    builder.add(32, row ? kMaxOcclusion : 0);
+    return;
+  }
+  for (uint32_t x = 0; x < 32;) {
+    auto bits = row >> x;
+    auto set = bits & 1;
+    auto len = std::min<uint32_t>(
+        std::countr_zero(set ? ~bits : bits), 32 - x);
+    builder.add(len, set ? kMaxOcclusion : 0);
+    x += len;
   }
-  return std::move(out).build();
+}
+
+// Sweeps down through the layers of a chunk (at or below the top layer holding
+// anything occlusive), accumulating the occluded voxels in acc, and returns the
+// resulting sky-occlusion chunk.
+tensors::Chunk<uint8_t> sweep_occlusion(
+    const ChunkMask& mask, int top, LayerMask& acc) {
+  ChunkMask out;
+  for (int y = tensors::kChunkDim - 1; y >= 0; y -= 1) {
+    if (y <= top) {
+      for (auto z = 0u; z < tensors::kChunkDim; z += 1) {
+        acc[z] |= mask[y][z];
+      }
+    }
+    out[y] = acc;
+  }
+
+  tensors::ArrayBuilder<uint8_t> builder;
+  for (const auto& layer : out) {
+    for (auto row : layer) {
+      add_row(builder, row);
+    }
+  }
+  return tensors::Chunk<uint8_t>(std::move(builder).build());
 }
 
 auto to_occlusion_shard(const TerrainMap& terrain, Vec3i pos) {
@@ -90,24 +288,21 @@ void initialize_sky_occlusion_column(
   auto sy = v1.y - step;
 
   // Emit all of the empty non-occlusive shards.
-  for (; is_empty(terrain, {sx, sy, sz}); sy -= step) {
+  for (; sy >= v0.y && is_empty(terrain, {sx, sy, sz}); sy -= step) {
     writer.update({sx, sy, sz}, tensors::make_chunk<uint8_t>(0));
   }
 
-  static const auto layer_size = tensors::kChunkDim * tensors::kChunkDim;
-
   // Emit shards until every voxel column is occluded.
-  std::bitset<layer_size> prev;
-  for (; !prev.all() && sy >= v0.y; sy -= step) {
-    auto src = reverse(to_occlusion_shard(terrain, {sx, sy, sz}));
-    auto dst = tensors::map_dense(src, [&](auto pos, auto id) {
-      auto i = pos % layer_size;
-      if (is_occlusive(id)) {
-        prev[i] = true;
-      }
-      return static_cast<uint8_t>(prev[i] ? kMaxOcclusion : 0);
-    });
-    writer.update({sx, sy, sz}, tensors::Chunk(reverse(dst)));
+  LayerMask acc{};
+  ChunkMask mask;
+  for (; !all_occluded(acc) && sy >= v0.y; sy -= step) {
+    auto src = to_occlusion_shard(terrain, {sx, sy, sz});
+    auto is_set = [](bool occlusive) {
+      return occlusive;
+    };
+    fill_mask(src, is_set, mask);
+    auto chunk = sweep_occlusion(mask, top_layer(src, is_set), acc);
+    writer.update({sx, sy, sz}, std::move(chunk));
   }
 
   // Emit the final shards that are fully occluded.
@@ -129,7 +324,7 @@ void schedule_sky_occlusion_column(
   auto sy = v1.y - step;
 
   // Skip over all fully non-occlusive shards.
-  for (; is_empty(terrain, {sx, sy, sz}); sy -= step) {
+  for (; sy >= v0.y && is_empty(terrain, {sx, sy, sz}); sy -= step) {
   }
 
   auto get_default = [&](Vec3i pos) {
@@ -168,139 +363,22 @@ void schedule_sky_occlusion_column(
 }
 
 auto emissiveness_old(TerrainId id, uint8_t dye) {
-  // TODO(matthew): Make this use terrain quirks after they has been
-  // migrated to bikkie
-  switch (id) {
-    // led
-    case 64:
-      switch (dye) {
-        // none
-        case 0:
-          return Vec4<uint8_t>{15, 15, 15, 0};
-
-        // blue
-        case 1:
-          return Vec4<uint8_t>{3, 3, 15, 0};
-
-        // red
-        case 2:
-          return Vec4<uint8_t>{15, 3, 3, 0};
-
-        // green
-        case 3:
-          return Vec4<uint8_t>{3, 15, 3, 0};
-
-        // orange
-        case 4:
-          return Vec4<uint8_t>{15, 8, 2, 0};
-
-        // white
-        case 5:
-          return Vec4<uint8_t>{15, 15, 15, 0};
-
-        // purple
-        case 6:
-          return Vec4<uint8_t>{9, 5, 15, 0};
-
-        // pink
-        case 7:
-          return Vec4<uint8_t>{15, 6, 15, 0};
-
-        // yellow
-        case 8:
-          return Vec4<uint8_t>{15, 15, 0, 0};
-
-        // black
-        case 9:
-          return Vec4<uint8_t>{10, 1, 15, 0};
-
-        // tan
-        case 10:
-          return Vec4<uint8_t>{15, 15, 15, 0};
-
-        // brown
-        case 11:
-          return Vec4<uint8_t>{15, 15, 15, 0};
-
-        // silver
-        case 12:
-          return Vec4<uint8_t>{15, 15, 15, 0};
-
-        // cyan
-        case 13:
-          return Vec4<uint8_t>{15, 15, 15, 0};
-
-        // magenta
-        case 14:
-          return Vec4<uint8_t>{15, 15, 15, 0};
-
-        // brightgreen
-        case 15:
-          return Vec4<uint8_t>{15, 15, 15, 0};
-
-        // brightred
-        case 16:
-          return Vec4<uint8_t>{15, 15, 15, 0};
-
-        // brightpurple
-        case 17:
-          return Vec4<uint8_t>{15, 15, 15, 0};
-
-        // brightpink
-        case 18:
-          return Vec4<uint8_t>{15, 15, 15, 0};
-
-        // brightyellow
-        case 19:
-          return Vec4<uint8_t>{15, 15, 15, 0};
-
-        // brightblue
-        case 20:
-          return Vec4<uint8_t>{15, 15, 15, 0};
-
-        // brightorange
-        case 21:
-          return Vec4<uint8_t>{15, 15, 15, 0};
-
-        // lightblue
-        case 22:
-          return Vec4<uint8_t>{15, 15, 15, 0};
-      };
-
-    // emberstone
-    case 65:
-      return Vec4<uint8_t>{15, 6, 5, 0};
-
-    // sunstone
-    case 66:
-      return Vec4<uint8_t>{15, 12, 3, 0};
-
-    // moonstone
-    case 67:
-      return Vec4<uint8_t>{14, 14, 15, 0};
-
-    // flare
-    case 16777231:
-      return Vec4<uint8_t>{kMaxIntensity, kMaxIntensity, kMaxIntensity, 0};
-
-    default:
-      return Vec4<uint8_t>{};
-  };
+  return TerrainProperties::get().emission(id, dye).levels;
 }
 
 auto is_emissive(TerrainId id) {
-  return emissiveness_old(id, 0) != Vec4<uint8_t>{0, 0, 0, 0};
+  return (terrain_flags(id) & RGB_EMISSIVE) != 0;
 }
 
-auto sky_radius(Vec3i change) {
+auto sky_radius(const voxels::Box& change) {
   static const auto max_light_radius = Vec3<int>{
       kMaxOcclusion,
       kMaxOcclusion,
       kMaxOcclusion,
   };
   return voxels::Box{
-      {change - max_light_radius},
-      {change + max_light_radius + 1},
+      {change.v0 - max_light_radius},
+      {change.v1 + max_light_radius},
   };
 }
 
@@ -328,8 +406,10 @@ void process_sky_occlusion_queue(
     return sky_occlusion.contains(pos) ? sparse_writer.get(pos) : kMaxOcclusion;
   };
 
+  size_t visited = 0;
   while (!queue.empty()) {
     auto pos = queue.pop();
+    visited += 1;
     if (!sky_occlusion.contains(pos)) {
       continue;
     }
@@ -366,6 +446,7 @@ void process_sky_occlusion_queue(
     push_if(z_pos > new_val + kOcclusionStep, pos + vec3(0, 0, 1));
   }
 
+  sky_occlusion_queue_voxels.Increment(static_cast<double>(visited));
   for (auto pos : sparse_writer.flush()) {
     signaler.signal(pos);
   }
@@ -464,6 +545,7 @@ void process_irradiance_rgb_queue(
     Queue<Vec3i>& queue) {
   // TODO(matthew): Evaluate if these colour calculations are correct (enough)
   ShardWriter<Vec4<uint8_t>> sparse_writer(irradiance);
+  size_t visited = 0;
   for (int color = 0; color < 3; ++color) {
     auto color_queue = queue;
 
@@ -479,6 +561,7 @@ void process_irradiance_rgb_queue(
 
     while (!color_queue.empty()) {
       auto pos = color_queue.pop();
+      visited += 1;
       if (!irradiance.contains(pos)) {
         continue;
       }
@@ -542,6 +625,7 @@ void process_irradiance_rgb_queue(
     }
   }
 
+  irradiance_queue_voxels.Increment(static_cast<double>(visited));
   for (auto pos : sparse_writer.flush()) {
     signaler.signal(pos);
   }
@@ -555,6 +639,9 @@ void SkyOcclusionWriter::update(Vec3i pos, tensors::Chunk<uint8_t> chunk) {
 void SkyOcclusionWriter::signal(Vec3i pos) {
   if (checksums_.update(pos, *map_->get().chunk(pos))) {
     stream_->write(pos);
+    sky_occlusion_emitted_chunks.Increment();
+  } else {
+    sky_occlusion_skipped_chunks.Increment();
   }
 }
 
@@ -566,10 +653,14 @@ void IrradianceWriter::update(Vec3i pos, tensors::Chunk<Vec4<uint8_t>> chunk) {
 void IrradianceWriter::signal(Vec3i pos) {
   if (checksums_.update(pos, *map_->get().chunk(pos))) {
     stream_->write(pos);
+    irradiance_emitted_chunks.Increment();
+  } else {
+    irradiance_skipped_chunks.Increment();
   }
 }
 
 void LightSimulation::init() {
+  ScopedTimer timer(light_init_ms);
   const auto& terrain = terrain_->get();
   const auto [v0, v1] = terrain.aabb();
   const auto shape = to<unsigned int>(v1 - v0);
@@ -611,53 +702,67 @@ void LightSimulation::init() {
 }
 
 void LightSimulation::tick() {
-  auto changes = subscription_.read();
+  ScopedTimer tick_timer(light_tick_ms);
+  subscription_.read(changes_);
+  terrain_changes.Observe(static_cast<double>(changes_.size()));
+  auto changes = coalesce_changes(changes_);
 
   const auto& terrain = terrain_->get();
 
   // Update all columns within the receptive-field of any changed terrain voxel.
   {
-    Timer timer([&](double duration) {
-      sky_occlusion_update_ms.Set(duration);
-    });
-
-    // Accumulate the distinct set of columns impacted by the changes.
-    Set2 columns;
-    for (auto pos : changes) {
-      auto aabb = voxels::intersect_box(terrain.aabb(), sky_radius(pos));
+    ScopedTimer timer(
+        sky_occlusion_update_duration_ms, sky_occlusion_update_ms);
+
+    // Prioritize the columns within the receptive-field of the changes.
+    for (const auto& change : changes) {
+      auto priority = std::log2(1.0 + change_size(change));
+      auto aabb = voxels::intersect_box(
+          terrain.aabb(), sky_radius(change_box(change)));
       auto from = to_shard_pos(aabb.v0);
       for (auto z = from.z; z < aabb.v1.z; z += tensors::kChunkDim) {
         for (auto x = from.x; x < aabb.v1.x; x += tensors::kChunkDim) {
-          columns.insert({x, z});
+          column_scheduler_.push({x, z}, priority);
         }
       }
     }
 
-    // Also schedule the next column in the scan.
-    if (one_in(2)) {
-      columns.insert(
-          terrain.aabb().v0.xz() +
-          to<int>(tensors::kChunkDim * column_scanner_.get().next()));
-    }
-
-    // Compute the new sky-occlusion tensor for the sheduled columns.
+    // Compute the new sky-occlusion tensor for as many edited columns as the
+    // budget allows, most important first.
     auto& so_map = sky_occlusion_map_->get();
     auto& so_writer = *sky_occlusion_writer_;
     Queue<Vec3i> queue;
-    for (auto column : columns) {
+    auto update_column = [&](Vec2i column) {
       initialize_sky_occlusion_column(column, terrain, so_writer);
       schedule_sky_occlusion_column(column, terrain, so_map, so_writer, queue);
+    };
+    auto columns = column_scheduler_.run(kColumnBudget, update_column);
+
+    // Also refresh the next column in the scan, unless edits are backed up.
+    if (column_scheduler_.empty() &&
+        column_scheduler_.tick() % kRefreshInterval == 0) {
+      update_column(
+          terrain.aabb().v0.xz() +
+          to<int>(tensors::kChunkDim * column_scanner_.get().next()));
+      columns += 1;
     }
+    sky_occlusion_columns_per_tick.Observe(static_cast<double>(columns));
+    sky_occlusion_pending_columns.Set(
+        static_cast<double>(column_scheduler_.size()));
+
     process_sky_occlusion_queue(terrain, so_map, so_writer, queue);
   }
 
   // Update the irradiance map for all shards within some distance of a change.
   {
-    Timer timer([&](double duration) {
-      irradiance_update_ms.Set(duration);
-    });
+    ScopedTimer timer(irradiance_update_duration_ms, irradiance_update_ms);
 
-    auto queue = make_queue<Vec3i>(changes);
+    Queue<Vec3i> queue;
+    for (const auto& change : changes) {
+      scan_changes(change, [&](auto pos) {
+        queue.push(pos);
+      });
+    }
     auto& im = irradiance_map_->get();
     process_irradiance_rgb_queue(terrain, im, *irradiance_writer_, queue);
   }
@@ -670,153 +775,12 @@ inline float scaledGrowthIntensity(float maxIntensity, uint8_t growth) {
 }
 
 Colour emissiveness(TerrainId id, uint8_t dye, uint8_t growth) {
-  // TODO(matthew): Make this use terrain quirks after they has been
-  // migrated to bikkie
-  switch (id) {
-    // led
-    case 64:
-      switch (dye) {
-        // none
-        case 0:
-          return Colour{{255, 255, 255}, kMaxIntensity};
-
-        // blue
-        case 1:
-          return Colour{{44, 116, 255}, kMaxIntensity};
-
-        // red
-        case 2:
-          return Colour{{255, 80, 80}, kMaxIntensity};
-
-        // green
-        case 3:
-          return Colour{{80, 255, 80}, kMaxIntensity};
-
-        // orange
-        case 4:
-          return Colour{{255, 128, 32}, kMaxIntensity};
-
-        // white
-        case 5:
-          return Colour{{255, 255, 255}, kMaxIntensity};
-
-        // purple
-        case 6:
-          return Colour{{128, 80, 255}, kMaxIntensity};
-
-        // pink
-        case 7:
-          return Colour{{255, 96, 207}, kMaxIntensity};
-
-        // yellow
-        case 8:
-          return Colour{{255, 232, 23}, kMaxIntensity};
-
-        // black
-        case 9:
-          return Colour{{160, 16, 255}, kMaxIntensity};
-
-        // tan
-        case 10:
-          return Colour{{255, 209, 143}, kMaxIntensity};
-
-        // brown
-        case 11:
-          return Colour{{121, 55, 14}, kMaxIntensity};
-
-        // silver
-        case 12:
-          return Colour{{127, 136, 151}, kMaxIntensity};
-
-        // cyan
-        case 13:
-          return Colour{{21, 255, 245}, kMaxIntensity};
-
-        // magenta
-        case 14:
-          return Colour{{252, 15, 255}, kMaxIntensity};
-
-        // brightgreen
-        case 15:
-          return Colour{{189, 255, 177}, kMaxIntensity};
-
-        // brightred
-        case 16:
-          return Colour{{255, 157, 157}, kMaxIntensity};
-
-        // brightpurple
-        case 17:
-          return Colour{{223, 187, 255}, kMaxIntensity};
-
-        // brightpink
-        case 18:
-          return Colour{{255, 220, 236}, kMaxIntensity};
-
-        // brightyellow
-        case 19:
-          return Colour{{255, 254, 217}, kMaxIntensity};
-
-        // brightblue
-        case 20:
-          return Colour{{150, 183, 255}, kMaxIntensity};
-
-        // brightorange
-        case 21:
-          return Colour{{255, 197, 142}, kMaxIntensity};
-
-        // lightblue
-        case 22:
-          return Colour{{176, 228, 255}, kMaxIntensity};
-      };
-
-    // emberstone
-    case 65:
-      return Colour{{255, 96, 80}, kMaxIntensity};
-
-    // sunstone
-    case 66:
-      return Colour{{255, 192, 48}, kMaxIntensity};
-
-    // moonstone
-    case 67:
-      return Colour{{240, 240, 255}, kMaxIntensity};
-
-    // flare
-    case 16777231:
-      return Colour{{255, 255, 255}, kMaxIntensity};
-
-    // ultraviolet
-    case 16777261:
-      return Colour{
-          {153, 50, 204}, scaledGrowthIntensity(kMaxIntensity, growth)};
-
-    // Fire Flower
-    case 16777263:
-      return Colour{{255, 0, 40}, scaledGrowthIntensity(kMaxIntensity, growth)};
-
-    // Marigold
-    case 16777264:
-      return Colour{
-          {255, 165, 0}, scaledGrowthIntensity(kMaxIntensity, growth)};
-
-    // Morning Glory
-    case 16777265:
-      return Colour{
-          {130, 200, 255}, scaledGrowthIntensity(kMaxIntensity, growth)};
-
-    // Peony
-    case 16777266:
-      return Colour{
-          {255, 90, 170}, scaledGrowthIntensity(kMaxIntensity, growth)};
-
-    // Sun Flower
-    case 16777267:
-      return Colour{
-          {255, 255, 0}, scaledGrowthIntensity(kMaxIntensity, growth)};
-
-    default:
-      return Colour{{255, 255, 255}, 0};
-  };
+  const auto& emission = TerrainProperties::get().emission(id, dye);
+  auto intensity = static_cast<float>(emission.intensity);
+  if (emission.scales_with_growth) {
+    intensity = scaledGrowthIntensity(intensity, growth);
+  }
+  return Colour{emission.rgb.to<float>(), intensity};
 }
 
 inline Colour get_colour(const std::array<Colour, 6>& colours) {
@@ -952,6 +916,7 @@ WorldMap<uint32_t> update_irradiance(
     Vec3i pos,
     const tensors::Tensor<uint32_t>& sources_tensor) {
   CHECK_ARGUMENT(is_shard_aligned(pos));
+  ScopedTimer timer(irradiance_shard_ms);
   auto aabb = voxels::shift_box(voxels::cube_box(96), pos - vec3(32, 32, 32));
   auto irradiance = update_irradiance(
       sub_world_map(map.terrains, aabb).tensor,
@@ -962,60 +927,141 @@ WorldMap<uint32_t> update_irradiance(
   return WorldMap<uint32_t>{{pos, pos + to<int>(kShardShape)}, irradiance};
 }
 
-bool is_empty(const TerrainMapV2& map, Vec3i pos) {
-  return !tensors::any(map.terrains.chunk(pos)->array, [](TerrainId id) {
-    return is_occlusive(id);
-  });
+WorldMap<uint32_t> update_irradiance(
+    const TerrainRecordMap& map,
+    Vec3i pos,
+    const tensors::Tensor<uint32_t>& sources_tensor) {
+  CHECK_ARGUMENT(is_shard_aligned(pos));
+  ScopedTimer timer(irradiance_shard_ms);
+  auto aabb = voxels::shift_box(voxels::cube_box(96), pos - vec3(32, 32, 32));
+  auto [terrains, dyes, growths] = map.layers(
+      aabb,
+      &TerrainRecord::terrain,
+      &TerrainRecord::dye,
+      &TerrainRecord::growth);
+  auto irradiance = update_irradiance(
+      terrains.tensor, dyes.tensor, growths.tensor, sources_tensor);
+  CHECK_STATE(irradiance.shape == kShardShape);
+  return WorldMap<uint32_t>{{pos, pos + to<int>(kShardShape)}, irradiance};
 }
 
+int top_occlusive_layer(
+    const TerrainMapV2& map, Vec3i pos, SkyOcclusionCache* cache) {
+  const auto& chunk = map.terrains.chunk(pos);
+  if (cache) {
+    return cache->top_layer(pos, chunk);
+  }
+  return top_layer(chunk->array, is_occlusive);
+}
+
+// Returns the voxel columns of the given chunk column that have an occlusive
+// voxel at or above y.
+LayerMask occluders_above(
+    const TerrainMapV2& map, Vec2i column, int y, SkyOcclusionCache* cache) {
+  auto [v0, v1] = map.aabb();
+  auto step = static_cast<int>(tensors::kChunkDim);
+
+  LayerMask acc{};
+  ChunkMask mask;
+  for (auto sy = v1.y - step; sy >= v0.y && sy + step > y; sy -= step) {
+    auto pos = vec3(column.x, sy, column.y);
+    auto top = top_occlusive_layer(map, pos, cache);
+    if (top >= std::max(0, y - sy)) {
+      fill_mask(map.terrains.chunk(pos)->array, is_occlusive, mask);
+      accumulate(mask, std::max(0, y - sy), top, acc);
+      if (all_occluded(acc)) {
+        break;
+      }
+    }
+  }
+  return acc;
+}
+
+// Returns whether every voxel column of the box is occluded above the box.
+bool occluded_above(
+    const TerrainMapV2& map, const voxels::Box& box, SkyOcclusionCache* cache) {
+  static const auto k = static_cast<int>(tensors::kChunkDim);
+  auto from = k * floor_div(box.v0, k);
+  for (auto cz = from.z; cz < box.v1.z; cz += k) {
+    for (auto cx = from.x; cx < box.v1.x; cx += k) {
+      auto acc = occluders_above(map, {cx, cz}, box.v1.y, cache);
+      for (auto z = std::max(box.v0.z, cz); z < std::min(box.v1.z, cz + k);
+           z += 1) {
+        for (auto x = std::max(box.v0.x, cx); x < std::min(box.v1.x, cx + k);
+             x += 1) {
+          if (!((acc[z - cz] >> (x - cx)) & 1)) {
+            return false;
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// Computes the direct (unpropagated) sky occlusion of the shards of the column
+// within [y0, y1), taking the occluders above the range into account.
 void initialize_sky_occlusion_column(
-    const TerrainMapV2& map, WorldMap<uint8_t>& occlusions, Vec2i column) {
+    const TerrainMapV2& map,
+    WorldMap<uint8_t>& occlusions,
+    Vec2i column,
+    SkyOcclusionCache* cache,
+    int y0,
+    int y1) {
   auto [sx, sz] = column;
   auto [v0, v1] = occlusions.aabb;
 
   auto step = static_cast<int>(tensors::kChunkDim);
   auto sy = v1.y - step;
 
-  // Emit all of the empty non-occlusive shards.
-  for (; is_empty(map, {sx, sy, sz}); sy -= step) {
-    occlusions.chunk({sx, sy, sz}) = tensors::make_chunk_ptr<uint8_t>(0);
+  // Accumulate the occluders above the range.
+  LayerMask acc{};
+  ChunkMask mask;
+  for (; !all_occluded(acc) && sy >= y1; sy -= step) {
+    auto pos = vec3(sx, sy, sz);
+    auto top = top_occlusive_layer(map, pos, cache);
+    if (top >= 0) {
+      fill_mask(map.terrains.chunk(pos)->array, is_occlusive, mask);
+      accumulate(mask, 0, top, acc);
+    }
   }
-
-  static const auto layer_size = tensors::kChunkDim * tensors::kChunkDim;
-
-  // Emit shards until every voxel column is occluded.
-  std::bitset<layer_size> prev;
-  for (; !prev.all() && sy >= v0.y; sy -= step) {
-    auto src = reverse(map.terrains.chunk({sx, sy, sz})->array);
-    auto dst = tensors::map_dense(src, [&](auto pos, TerrainId id) {
-      auto i = pos % layer_size;
-      if (is_occlusive(id)) {
-        prev[i] = true;
-      }
-      return static_cast<uint8_t>(prev[i] ? kMaxOcclusion : 0);
-    });
-    occlusions.chunk({sx, sy, sz}) =
-        tensors::make_chunk_ptr(tensors::Chunk(reverse(dst)));
+  sy = std::min(sy, y1 - step);
+
+  // Emit shards until every voxel column is occluded. Shards that are empty
+  // and lie beneath an unoccluded layer are left entirely unoccluded.
+  for (; !all_occluded(acc) && sy >= y0; sy -= step) {
+    auto pos = vec3(sx, sy, sz);
+    auto top = top_occlusive_layer(map, pos, cache);
+    if (top < 0 && none_occluded(acc)) {
+      occlusions.chunk(pos) = tensors::make_chunk_ptr<uint8_t>(0);
+      continue;
+    }
+    if (top >= 0) {
+      fill_mask(map.terrains.chunk(pos)->array, is_occlusive, mask);
+    }
+    occlusions.chunk(pos) =
+        tensors::make_chunk_ptr(sweep_occlusion(mask, top, acc));
   }
 
   // Emit the final shards that are fully occluded.
-  for (; sy >= v0.y; sy -= step) {
+  for (; sy >= y0; sy -= step) {
     occlusions.chunk({sx, sy, sz}) =
         tensors::make_chunk_ptr<uint8_t>(kMaxOcclusion);
   }
 }
 
+// Finds the voxels of the column's shards within [y0, y1) from which light
+// needs to be propagated.
 Queue<Vec3i> schedule_sky_occlusion_column(
-    Vec2i column, const TerrainMapV2& map, WorldMap<uint8_t>& occlusion_map) {
+    Vec2i column,
+    const TerrainMapV2& map,
+    WorldMap<uint8_t>& occlusion_map,
+    int y0,
+    int y1) {
   auto [sx, sz] = column;
   auto [v0, v1] = map.aabb();
 
   auto step = static_cast<int>(tensors::kChunkDim);
-  auto sy = v1.y - step;
-
-  // Skip over all fully non-occlusive shards.
-  for (; is_empty(map, {sx, sy, sz}); sy -= step) {
-  }
 
   auto get_default = [&](Vec3i pos) {
     return occlusion_map.maybe_get(pos).value_or(
@@ -1024,7 +1070,7 @@ Queue<Vec3i> schedule_sky_occlusion_column(
 
   Queue<Vec3i> queue;
   // Identify all occlusive voxels with at least one non-occlusive neighbor.
-  for (; sy >= v0.y; sy -= step) {
+  for (auto sy = y1 - step; sy >= y0; sy -= step) {
     auto origin = vec3(sx, sy, sz);
     tensors::scan(occlusion_map.chunk(origin)->array, [&](auto run, auto so) {
       if (so != kMaxOcclusion) {
@@ -1053,6 +1099,26 @@ Queue<Vec3i> schedule_sky_occlusion_column(
     });
   }
 
+  // The layers just outside of a partial range keep their previous values,
+  // which may light the voxels on the boundary of the range.
+  auto schedule_boundary = [&](int y, int dy) {
+    for (auto z = sz; z < sz + step; z += 1) {
+      for (auto x = sx; x < sx + step; x += 1) {
+        auto pos = vec3(x, y, z);
+        auto outside = get_default(pos + vec3(0, dy, 0));
+        if (outside + kOcclusionStep < occlusion_map.get(pos)) {
+          queue.push(pos);
+        }
+      }
+    }
+  };
+  if (y1 < v1.y) {
+    schedule_boundary(y1 - 1, 1);
+  }
+  if (y0 > v0.y) {
+    schedule_boundary(y0, -1);
+  }
+
   return queue;
 }
 
@@ -1121,23 +1187,133 @@ voxels::Box expand_aabb(
       aabb.v1 + static_cast<int>(tensors::kChunkDim) * padding_pos};
 }
 
-WorldMap<uint8_t> update_occlusion(const TerrainMapV2& map, Vec2i column) {
+voxels::Box occlusion_region(const TerrainMapV2& map, Vec2i column) {
   voxels::Box column_aabb{
       {column.x, map.aabb().v0.y, column.y},
       {column.x + static_cast<int>(tensors::kChunkDim),
        map.aabb().v1.y,
        column.y + static_cast<int>(tensors::kChunkDim)},
   };
-
-  auto aabb = voxels::intersect_box(
+  return voxels::intersect_box(
       map.aabb(), expand_aabb(column_aabb, {1, 0, 1}, {1, 0, 1}));
+}
+
+WorldMap<uint8_t> update_occlusion_column(
+    const TerrainMapV2& map, Vec2i column, SkyOcclusionCache* cache) {
+  ScopedTimer timer(occlusion_update_ms);
+  auto [v0, v1] = map.aabb();
+  voxels::Box column_aabb{
+      {column.x, v0.y, column.y},
+      {column.x + static_cast<int>(tensors::kChunkDim),
+       v1.y,
+       column.y + static_cast<int>(tensors::kChunkDim)},
+  };
 
-  auto relevant_occlusions = sub_world_map(map.occlusions, aabb);
-  initialize_sky_occlusion_column(map, relevant_occlusions, column);
-  auto queue = schedule_sky_occlusion_column(column, map, relevant_occlusions);
+  auto relevant_occlusions =
+      sub_world_map(map.occlusions, occlusion_region(map, column));
+  initialize_sky_occlusion_column(
+      map, relevant_occlusions, column, cache, v0.y, v1.y);
+  auto queue = schedule_sky_occlusion_column(
+      column, map, relevant_occlusions, v0.y, v1.y);
   process_sky_occlusion_queue(map, relevant_occlusions, queue);
 
-  return sub_world_map(relevant_occlusions, column_aabb);
+  auto ret = sub_world_map(relevant_occlusions, column_aabb);
+  occlusion_chunks.Increment(static_cast<double>(ret.tensor.chunks.size()));
+  return ret;
+}
+
+std::vector<OcclusionShard> update_occlusion_span(
+    const TerrainMapV2& map,
+    Vec2i column,
+    const voxels::Box& change,
+    SkyOcclusionCache* cache) {
+  static const auto k = static_cast<int>(tensors::kChunkDim);
+  static const auto reach = vec3<int>(kMaxOcclusion, 0, kMaxOcclusion);
+  ScopedTimer timer(occlusion_update_ms);
+  auto [v0, v1] = map.aabb();
+
+  // Voxels further than the occlusion falloff from any change are unaffected.
+  auto span = voxels::intersect_box({
+      change,
+      map.aabb(),
+      {vec3(column.x, v0.y, column.y) - reach,
+       vec3(column.x + k, v1.y, column.y + k) + reach},
+  });
+  if (span.v1.x <= span.v0.x || span.v1.y <= span.v0.y ||
+      span.v1.z <= span.v0.z) {
+    return {};
+  }
+
+  // Besides the falloff around the change, direct sky exposure changes all
+  // the way down the column unless the change is already occluded from above.
+  auto lo = span.v0.y - kMaxOcclusion;
+  auto hi = span.v1.y + kMaxOcclusion;
+  if (!occluded_above(map, span, cache)) {
+    lo = v0.y;
+  }
+  auto y0 = v0.y + (std::max(lo, v0.y) - v0.y) / k * k;
+  auto y1 = v0.y + (std::min(hi, v1.y) - v0.y + k - 1) / k * k;
+
+  auto region = occlusion_region(map, column);
+  auto occlusions = sub_world_map(map.occlusions, region);
+  initialize_sky_occlusion_column(map, occlusions, column, cache, y0, y1);
+  auto queue = schedule_sky_occlusion_column(column, map, occlusions, y0, y1);
+  process_sky_occlusion_queue(map, occlusions, queue);
+
+  // Only return the shards whose contents actually changed.
+  std::vector<OcclusionShard> ret;
+  for (auto sy = y0; sy < y1; sy += k) {
+    auto pos = vec3(column.x, sy, column.y);
+    const auto& src = map.occlusions.chunk(pos);
+    const auto& dst = occlusions.chunk(pos);
+    auto same = tensors::all(
+        tensors::merge(
+            src->array,
+            dst->array,
+            [](uint8_t a, uint8_t b) {
+              return a == b;
+            }),
+        [](bool eq) {
+          return eq;
+        });
+    if (!same) {
+      ret.push_back(OcclusionShard{pos, dst});
+    }
+  }
+  occlusion_chunks.Increment(static_cast<double>(ret.size()));
+  return ret;
+}
+
+WorldMap<uint8_t> update_occlusion(const TerrainMapV2& map, Vec2i column) {
+  return update_occlusion_column(map, column, nullptr);
+}
+
+WorldMap<uint8_t> update_occlusion(
+    const TerrainMapV2& map, Vec2i column, SkyOcclusionCache& cache) {
+  return update_occlusion_column(map, column, &cache);
+}
+
+std::vector<OcclusionShard> update_occlusion(
+    const TerrainMapV2& map, Vec2i column, const voxels::Box& change) {
+  return update_occlusion_span(map, column, change, nullptr);
+}
+
+std::vector<OcclusionShard> update_occlusion(
+    const TerrainMapV2& map,
+    Vec2i column,
+    const voxels::Box& change,
+    SkyOcclusionCache& cache) {
+  return update_occlusion_span(map, column, change, &cache);
+}
+
+int SkyOcclusionCache::top_layer(
+    Vec3i pos, const tensors::ChunkPtr<TerrainId>& chunk) {
+  auto& entry = entries_[pos];
+  if (entry.chunk.lock() != chunk) {
+    entry.chunk = chunk;
+    entry.top = gaia::top_layer(chunk->array, is_occlusive);
+  }
+  return entry.top;
 }
 
 }  // namespace voxeloo::gaia
@@ -8,7 +8,9 @@
 #include "voxeloo/gaia/lazy.hpp"
 #include "voxeloo/gaia/logger.hpp"
 #include "voxeloo/gaia/maps.hpp"
+#include "voxeloo/gaia/records.hpp"
 #include "voxeloo/gaia/scanner.hpp"
+#include "voxeloo/gaia/scheduler.hpp"
 #include "voxeloo/gaia/stream.hpp"
 #include "voxeloo/gaia/terrain.hpp"
 #include "voxeloo/tensors/buffers.hpp"
@@ -92,7 +94,9 @@ class LightSimulation {
   Dep<SkyOcclusionWriter> sky_occlusion_writer_;
   Dep<Lazy<IrradianceMap>> irradiance_map_;
   Dep<IrradianceWriter> irradiance_writer_;
-  StreamReader<Vec3i> subscription_;
+  TerrainStream::Reader subscription_;
+  std::vector<TerrainChange> changes_;
+  UpdateScheduler<Vec2i, Vec2Hash> column_scheduler_;
   Lazy<Scanner2> column_scanner_;
 };
 
@@ -118,7 +122,51 @@ WorldMap<uint32_t> update_irradiance(
     const TerrainMapV2& map,
     Vec3i pos,
     const tensors::Tensor<uint32_t>& sources_tensor);
+
+// As above, but gathers the terrain, dye and growth of the neighbourhood from
+// a single lookup of each shard's record.
+WorldMap<uint32_t> update_irradiance(
+    const TerrainRecordMap& map,
+    Vec3i pos,
+    const tensors::Tensor<uint32_t>& sources_tensor);
+
+// Remembers the topmost occlusive layer of each terrain chunk, so that columns
+// whose chunks have not been replaced skip rescanning them for occluders.
+class SkyOcclusionCache {
+ public:
+  int top_layer(Vec3i pos, const tensors::ChunkPtr<TerrainId>& chunk);
+
+ private:
+  struct Entry {
+    std::weak_ptr<const tensors::Chunk<TerrainId>> chunk;
+    int top = -1;
+  };
+
+  Map3<Entry> entries_;
+};
+
 WorldMap<uint8_t> update_occlusion(const TerrainMapV2& map, Vec2i column);
+WorldMap<uint8_t> update_occlusion(
+    const TerrainMapV2& map, Vec2i column, SkyOcclusionCache& cache);
+
+// A sky-occlusion shard whose contents changed.
+struct OcclusionShard {
+  Vec3i pos;
+  tensors::ChunkPtr<uint8_t> chunk;
+};
+
+// Incrementally updates the sky occlusion of a column after the voxels within
+// the given (world-space) box changed. Only the range of shards that the change
+// can affect is recomputed: the occlusion falloff around the change and, if
+// the change is not occluded from above, everything below it. Returns the
+// shards of the column whose contents changed.
+std::vector<OcclusionShard> update_occlusion(
+    const TerrainMapV2& map, Vec2i column, const voxels::Box& change);
+std::vector<OcclusionShard> update_occlusion(
+    const TerrainMapV2& map,
+    Vec2i column,
+    const voxels::Box& change,
+    SkyOcclusionCache& cache);
 
 struct Colour {
   Vec3<float> rgb{};
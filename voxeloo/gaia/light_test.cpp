@@ -43,4 +43,148 @@ TEST_CASE("Test the irradiance map update logic", "[all]") {
     auto value = im.get({15, 32 - y, 15});
     REQUIRE(value == Vec4<uint8_t>{intensity, intensity, intensity, 0});
   }
-}
\ No newline at end of file
+}
+
+TEST_CASE("Test the sky occlusion column kernel", "[all]") {
+  // A single-chunk column with an overhang covering part of the layer at
+  // y = 20, over a floor at y = 2.
+  auto seed = [] {
+    tensors::SparseTensorBuilder<TerrainId> builder(tensors::kChunkShape);
+    for (auto z = 0u; z < 32u; z += 1) {
+      for (auto x = 0u; x < 32u; x += 1) {
+        builder.set({x, 2, z}, 1);
+      }
+    }
+    for (auto x = 5u; x < 17u; x += 1) {
+      builder.set({x, 20, 3}, 1);
+    }
+    return std::move(builder).build();
+  }();
+
+  TerrainMapBuilderV2 builder;
+  builder.assign_seed_block({0, 0, 0}, seed);
+  builder.assign_occlusion_block(
+      {0, 0, 0}, tensors::make_tensor<uint8_t>(tensors::kChunkShape, 15));
+  builder.assign_seed_block(
+      {0, 32, 0}, tensors::make_tensor<TerrainId>(tensors::kChunkShape, 0));
+  builder.assign_occlusion_block(
+      {0, 32, 0}, tensors::make_tensor<uint8_t>(tensors::kChunkShape, 15));
+  auto map = std::move(builder).build();
+
+  SkyOcclusionCache cache;
+  for (int pass = 0; pass < 2; pass += 1) {
+    auto occlusion = update_occlusion(map, {0, 0}, cache);
+    REQUIRE(occlusion.get({0, 40, 0}) == 0);
+    REQUIRE(occlusion.get({0, 19, 3}) == 0);
+    REQUIRE(occlusion.get({5, 19, 3}) > 0);
+    REQUIRE(occlusion.get({16, 10, 3}) > 0);
+    REQUIRE(occlusion.get({17, 10, 3}) == 0);
+    REQUIRE(occlusion.get({31, 1, 31}) == 15);
+
+    auto uncached = update_occlusion(map, {0, 0});
+    REQUIRE(tensors::hash(uncached.tensor) == tensors::hash(occlusion.tensor));
+  }
+
+  // Replacing a chunk invalidates its cached top layer.
+  map.update_diff(
+      {0, 32, 0},
+      tensors::make_tensor<std::optional<TerrainId>>(tensors::kChunkShape, 1));
+  auto occlusion = update_occlusion(map, {0, 0}, cache);
+  REQUIRE(occlusion.get({0, 19, 3}) == 15);
+  REQUIRE(occlusion.get({0, 40, 0}) == 15);
+}
+
+TEST_CASE("Test incremental sky occlusion updates", "[all]") {
+  // Rolling hills beneath an overhanging slab, 2x4x2 shards in size.
+  auto map = [] {
+    TerrainMapBuilderV2 builder;
+    for (int sz = 0; sz < 64; sz += 32) {
+      for (int sy = 0; sy < 128; sy += 32) {
+        for (int sx = 0; sx < 64; sx += 32) {
+          tensors::SparseTensorBuilder<TerrainId> seed(tensors::kChunkShape);
+          for (auto z = 0; z < 32; z += 1) {
+            for (auto x = 0; x < 32; x += 1) {
+              auto wx = sx + x;
+              auto wz = sz + z;
+              auto height = 30 + (wx * 7 + wz * 13) % 23;
+              auto slab = wx >= 10 && wx < 50 && wz >= 8 && wz < 40 &&
+                          (wx + wz) % 11 != 0;
+              for (auto y = 0; y < 32; y += 1) {
+                auto wy = sy + y;
+                if (wy < height || (slab && wy == 90)) {
+                  seed.set(to<unsigned int>(vec3(x, y, z)), 1);
+                }
+              }
+            }
+          }
+          builder.assign_seed_block({sx, sy, sz}, std::move(seed).build());
+        }
+      }
+    }
+    return std::move(builder).build();
+  }();
+
+  std::vector<Vec2i> columns = {{0, 0}, {32, 0}, {0, 32}, {32, 32}};
+
+  // Iterate full updates until the occlusion of every column is stable.
+  for (auto pass = 0; pass < 16; pass += 1) {
+    auto before = tensors::hash(map.occlusions.tensor);
+    for (auto column : columns) {
+      auto occlusion = update_occlusion(map, column);
+      for (int sy = 0; sy < 128; sy += 32) {
+        auto pos = vec3(column.x, sy, column.y);
+        map.occlusions.chunk(pos) = occlusion.chunk(pos);
+      }
+    }
+    if (tensors::hash(map.occlusions.tensor) == before) {
+      break;
+    }
+  }
+
+  auto check = [&](const std::vector<Vec3i>& edits, TerrainId value) {
+    auto edited = map;
+    auto shard = 32 * floor_div(edits[0], 32);
+    voxels::Box change = {edits[0], edits[0] + 1};
+    tensors::SparseTensorBuilder<std::optional<TerrainId>> diff(
+        tensors::kChunkShape);
+    for (auto pos : edits) {
+      diff.set(to<unsigned int>(pos - shard), value);
+      change = voxels::union_box(change, {pos, pos + 1});
+    }
+    edited.update_diff(shard, std::move(diff).build());
+
+    SkyOcclusionCache cache;
+    size_t changed = 0;
+    for (auto column : columns) {
+      auto expected = update_occlusion(edited, column);
+      auto shards = update_occlusion(edited, column, change, cache);
+      REQUIRE(shards.size() == update_occlusion(edited, column, change).size());
+      changed += shards.size();
+
+      auto actual = sub_world_map(edited.occlusions, expected.aabb);
+      for (const auto& shard : shards) {
+        actual.chunk(shard.pos) = shard.chunk;
+      }
+      voxels::box_scan(expected.aabb, [&](int x, int y, int z) {
+        REQUIRE(actual.get({x, y, z}) == expected.get({x, y, z}));
+      });
+    }
+    return changed;
+  };
+
+  // Digging beneath the slab only affects the surrounding shards.
+  REQUIRE(check({{20, 40, 20}, {20, 41, 20}, {21, 41, 20}}, 0) > 0);
+
+  // Placing a block in the shade of the slab only recomputes the shards
+  // around it.
+  check({{20, 70, 20}, {21, 70, 20}}, 1);
+
+  // Opening the slab lets light through all the way down.
+  REQUIRE(check({{30, 90, 20}, {31, 90, 20}, {30, 90, 21}}, 0) > 0);
+
+  // Capping a hill in the open casts a shadow beneath it.
+  REQUIRE(check({{60, 80, 60}}, 1) > 0);
+
+  // Edits within the fully occluded ground change nothing.
+  REQUIRE(check({{5, 2, 5}}, 0) == 0);
+}
@@ -1,9 +1,13 @@
 #pragma once
 
+#include <algorithm>
 #include <chrono>
+#include <utility>
+#include <vector>
 
 #include "voxeloo/common/hashing.hpp"
 #include "voxeloo/common/voxels.hpp"
+#include "voxeloo/gaia/parallel.hpp"
 #include "voxeloo/tensors/routines.hpp"
 #include "voxeloo/tensors/sparse.hpp"
 #include "voxeloo/tensors/tensors.hpp"
@@ -109,13 +113,16 @@ class SparseMapWriter {
       builder.set(tensors::chunk_mod(map_.world_to_tensor(pos)), val);
     }
 
-    // Update all affected world map chunks by merging in the new values.
+    // Update all affected world map chunks by merging in the new values. The
+    // merged chunk replaces the old one rather than modifying it, since chunks
+    // may be shared with other maps (e.g. snapshots or sub world maps).
     for (auto&& [i, builder] : std::move(builders)) {
       auto src = std::move(builder).build();
-      auto dst = map_.tensor.chunks[i];
-      dst->array = tensors::merge(dst->array, src.array, [](auto a, auto b) {
-        return b.value_or(a);
-      });
+      auto& dst = map_.tensor.chunks[i];
+      dst = tensors::make_chunk_ptr(tensors::Chunk<T>(
+          tensors::merge(dst->array, src.array, [](auto a, auto b) {
+            return b.value_or(a);
+          })));
     }
     buffer_.clear();
   }
@@ -214,11 +221,23 @@ class WorldMapBuilder {
   WorldMap<T> build(std::optional<voxels::Box> aabb_override) && {
     auto aabb = aabb_override.value_or(aabb_);
     auto shape = to<unsigned int>(voxels::box_size(aabb));
-    auto out = tensors::make_tensor<T>(shape);
+    tensors::Tensor<T> out(
+        shape,
+        tensors::Buffer<tensors::ChunkPtr<T>>(
+            tensors::shape_len(tensors::chunk_div(shape))));
+
+    // Assigned chunks are adopted as is (they may still be shared with the
+    // caller, so they must not be modified); holes get an empty chunk.
     for (auto& [pos, block] : map_) {
       auto ijk = to<uint32_t>(pos - aabb.v0);
-      out.chunk(ijk)->array = std::move(block.chunks[0]->array);
+      out.chunk(ijk) = std::move(block.chunks[0]);
+    }
+    for (auto& chunk : out.chunks) {
+      if (!chunk) {
+        chunk = tensors::make_chunk_ptr<T>();
+      }
     }
+    map_.clear();
 
     return WorldMap<T>{aabb, std::move(out)};
   }
@@ -256,4 +275,111 @@ inline WorldMap<T> sub_world_map(
       aabb, tensors::Tensor<T>{shape, std::move(builder).build()}};
 }
 
+namespace detail {
+
+// Invokes fn(origin, local) for every chunk of the map intersecting the box,
+// with the chunk's origin in world space and the intersection in its local
+// coordinates.
+template <typename T, typename Fn>
+inline void scan_box_chunks(
+    const WorldMap<T>& map, const voxels::Box& box, Fn&& fn) {
+  static const auto k = static_cast<int>(tensors::kChunkDim);
+
+  auto [v0, v1] = voxels::intersect_box(box, map.aabb);
+  if (v1.x <= v0.x || v1.y <= v0.y || v1.z <= v0.z) {
+    return;
+  }
+  auto c0 = map.aabb.v0 + k * floor_div(v0 - map.aabb.v0, k);
+  for (auto z = c0.z; z < v1.z; z += k) {
+    for (auto y = c0.y; y < v1.y; y += k) {
+      for (auto x = c0.x; x < v1.x; x += k) {
+        auto origin = vec3(x, y, z);
+        auto local = voxels::Box{
+            max(v0 - origin, vec3(0, 0, 0)),
+            min(v1 - origin, vec3(k, k, k)),
+        };
+        fn(origin, local);
+      }
+    }
+  }
+}
+
+// Invokes fn(pos, len, val) for the runs of the chunk clipped to the local
+// box, one row segment at a time. Rows and runs are both visited in array
+// order, so the cost is linear in their combined count.
+template <typename T, typename Fn>
+inline void scan_chunk_runs(
+    const tensors::Chunk<T>& chunk,
+    Vec3i origin,
+    const voxels::Box& local,
+    Fn&& fn) {
+  auto y = local.v0.y;
+  auto z = local.v0.z;
+  tensors::scan(chunk.array, [&](auto run, const auto& val) {
+    uint32_t end = run.pos + run.len;
+    while (y < local.v1.y) {
+      uint32_t base =
+          tensors::encode_tensor_pos(to<unsigned int>(vec3(0, y, z)));
+      auto lo = base + static_cast<uint32_t>(local.v0.x);
+      auto hi = base + static_cast<uint32_t>(local.v1.x);
+      if (lo >= end) {
+        return;
+      }
+      auto l = std::max<uint32_t>(lo, run.pos);
+      auto r = std::min(hi, end);
+      if (l < r) {
+        fn(origin + vec3(static_cast<int>(l - base), y, z), r - l, val);
+      }
+      if (hi > end) {
+        return;
+      }
+      z += 1;
+      if (z == local.v1.z) {
+        z = local.v0.z;
+        y += 1;
+      }
+    }
+  });
+}
+
+}  // namespace detail
+
+// Invokes fn(pos, len, val) for every run of equal values along the x-axis
+// within the box, where pos is the world position of its first voxel. Only the
+// chunks intersecting the box are visited and runs are clipped to the box, so
+// no shard alignment is required.
+template <typename T, typename Fn>
+inline void scan_box_runs(
+    const WorldMap<T>& map, const voxels::Box& box, Fn&& fn) {
+  detail::scan_box_chunks(map, box, [&](Vec3i origin, const auto& local) {
+    detail::scan_chunk_runs(*map.chunk(origin), origin, local, fn);
+  });
+}
+
+// Invokes fn(pos, val) for every voxel of the map within the box.
+template <typename T, typename Fn>
+inline void scan_box(const WorldMap<T>& map, const voxels::Box& box, Fn&& fn) {
+  scan_box_runs(map, box, [&](Vec3i pos, auto len, const T& val) {
+    for (auto i = 0; i < static_cast<int>(len); i += 1) {
+      fn(pos + vec3(i, 0, 0), val);
+    }
+  });
+}
+
+// Like scan_box_runs, but visits the chunks concurrently. Runs of a chunk are
+// visited in order on the same thread, while those of different chunks may be
+// visited at the same time, so fn must be safe to call concurrently.
+template <typename T, typename Fn>
+inline void parallel_scan_box_runs(
+    const WorldMap<T>& map, const voxels::Box& box, Fn&& fn) {
+  std::vector<std::pair<Vec3i, voxels::Box>> chunks;
+  detail::scan_box_chunks(map, box, [&](Vec3i origin, const auto& local) {
+    chunks.emplace_back(origin, local);
+  });
+  parallel_for_each(chunks.size(), [&](uint32_t i) {
+    const auto& [origin, local] = chunks[i];
+    detail::scan_chunk_runs(*map.chunk(origin), origin, local, fn);
+  });
+}
+
 }  // namespace voxeloo::gaia
\ No newline at end of file
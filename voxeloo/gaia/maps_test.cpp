@@ -1,6 +1,10 @@
 #include "voxeloo/gaia/maps.hpp"
 
+#include <algorithm>
 #include <catch2/catch.hpp>
+#include <mutex>
+#include <tuple>
+#include <vector>
 
 #include "voxeloo/common/geometry.hpp"
 
@@ -49,4 +53,56 @@ TEST_CASE("Test the sparse map writer", "[all]") {
   REQUIRE(map.get({5, 1, -2}) == 5);
   REQUIRE(map.get({-2, -2, -2}) == 7);
   REQUIRE(map.get({29, 29, 29}) == 8);
-}
\ No newline at end of file
+}
+
+TEST_CASE("Test scanning world map regions", "[all]") {
+  // Bands along x and y give chunks both long runs and runs that wrap rows.
+  auto tensor = tensors::make_tensor<int>({64, 64, 64}, 0);
+  for (auto& chunk : tensor.chunks) {
+    tensors::ArrayBuilder<int> builder;
+    for (auto i = 0u; i < tensors::kChunkSize; i += 40) {
+      builder.add(std::min(40u, tensors::kChunkSize - i), (i / 40) % 3);
+    }
+    chunk = tensors::make_chunk_ptr(
+        tensors::Chunk<int>(std::move(builder).build()));
+  }
+  gaia::WorldMap<int> map{{{-32, 0, 32}, {32, 64, 96}}, tensor};
+
+  for (auto box : {
+           voxels::Box{{-5, 3, 40}, {17, 40, 70}},
+           voxels::Box{{-40, -8, 20}, {40, 80, 100}},
+           voxels::Box{{0, 0, 32}, {1, 1, 33}},
+           voxels::Box{{31, 63, 95}, {40, 70, 99}},
+           voxels::Box{{100, 0, 0}, {120, 10, 10}},
+       }) {
+    std::vector<std::pair<Vec3i, int>> expected;
+    auto clipped = voxels::intersect_box(box, map.aabb);
+    voxels::box_scan(clipped, [&](auto x, auto y, auto z) {
+      expected.emplace_back(vec3(x, y, z), map.get({x, y, z}));
+    });
+
+    std::vector<std::pair<Vec3i, int>> visited;
+    gaia::scan_box(map, box, [&](Vec3i pos, int val) {
+      visited.emplace_back(pos, val);
+    });
+
+    std::mutex mutex;
+    std::vector<std::pair<Vec3i, int>> parallel;
+    gaia::parallel_scan_box_runs(map, box, [&](Vec3i pos, auto len, int val) {
+      std::lock_guard lock(mutex);
+      for (auto i = 0; i < static_cast<int>(len); i += 1) {
+        parallel.emplace_back(pos + vec3(i, 0, 0), val);
+      }
+    });
+
+    auto by_pos = [](const auto& a, const auto& b) {
+      return std::tie(a.first.x, a.first.y, a.first.z) <
+             std::tie(b.first.x, b.first.y, b.first.z);
+    };
+    std::sort(expected.begin(), expected.end(), by_pos);
+    std::sort(visited.begin(), visited.end(), by_pos);
+    std::sort(parallel.begin(), parallel.end(), by_pos);
+    REQUIRE(visited == expected);
+    REQUIRE(parallel == expected);
+  }
+}
@@ -1,6 +1,14 @@
 #include "voxeloo/gaia/muck.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <optional>
+
+#include "prometheus/counter.h"
+#include "prometheus/histogram.h"
 #include "voxeloo/common/geometry.hpp"
+#include "voxeloo/common/metrics.hpp"
+#include "voxeloo/gaia/timer.hpp"
 #include "voxeloo/tensors/routines.hpp"
 #include "voxeloo/tensors/tensors.hpp"
 
@@ -10,24 +18,102 @@ constexpr static auto kMuckMaximum = 15;
 constexpr static auto kMuckQuantum = 8;
 
 namespace {
+
+auto& muck_gradient_ms =
+    prometheus::BuildHistogram()
+        .Name("gaia_muck_cpp_gradient_ms")
+        .Help("Duration per muck gradient update.")
+        .Register(metrics::registry())
+        .Add({}, latency_buckets());
+
+auto& muck_apply_ms =
+    prometheus::BuildHistogram()
+        .Name("gaia_muck_cpp_apply_ms")
+        .Help("Duration per muck gradient application.")
+        .Register(metrics::registry())
+        .Add({}, latency_buckets());
+
+auto& muck_evaluated_chunks =
+    prometheus::BuildCounter()
+        .Name("gaia_muck_cpp_evaluated_chunks_total")
+        .Help("Number of chunks evaluated by muck gradient updates.")
+        .Register(metrics::registry())
+        .Add({});
+
+auto& muck_chunks =
+    prometheus::BuildCounter()
+        .Name("gaia_muck_cpp_chunks_total")
+        .Help("Number of muck chunks rewritten by gradient applications.")
+        .Register(metrics::registry())
+        .Add({});
+
 auto square(double x) {
   return x * x;
 }
 
-template <typename GradFn>
-tensors::Tensor<int> to_muck_gradient(
-    WorldMap<uint8_t>& muck, GradFn&& grad_fn) {
-  return tensors::map_dense(muck.tensor, [&](auto pos, auto val) {
-    auto grad = grad_fn(to<double>(muck.aabb.v0 + to<int>(pos)), val);
-    return static_cast<uint8_t>(std::clamp(val + grad, 0, kMuckMaximum));
-  });
+// Unmuck sources leave voxels further than this from their volume alone: their
+// gradient is then just a step towards the maximum, which is what the gradient
+// is initialized to before the muck is clamped.
+constexpr static auto kMuckReach = kMuckMaximum * kMuckQuantum + 1;
+
+// Returns the (world-space) box of the voxels within the given distance of a
+// box centred on the source.
+auto reach_box(Vec3d source, Vec3d half_size, double reach) {
+  auto v0 = source - half_size - vec3(reach, reach, reach);
+  auto v1 = source + half_size + vec3(reach, reach, reach);
+  return voxels::Box{
+      {ifloor(v0.x), ifloor(v0.y), ifloor(v0.z)},
+      {ifloor(v1.x) + 1, ifloor(v1.y) + 1, ifloor(v1.z) + 1},
+  };
 }
 
+// Lowers the gradient of the voxels within the region to fn(pos, val). Only
+// the chunks intersecting the region are evaluated; the others keep their
+// gradient (and their chunk).
 template <typename Fn>
-auto map_muck(const WorldMap<uint8_t>& muck, Fn&& fn) {
-  return tensors::map_dense(muck.tensor, [&](auto pos, auto val) {
-    return fn(to<double>(muck.aabb.v0 + to<int>(pos)), val);
-  });
+void update_muck_gradient(
+    tensors::Tensor<int>& grad,
+    const WorldMap<uint8_t>& muck,
+    const voxels::Box& region,
+    Fn&& fn) {
+  static const auto k = static_cast<int>(tensors::kChunkDim);
+  CHECK_ARGUMENT(grad.shape == muck.tensor.shape);
+  ScopedTimer timer(muck_gradient_ms);
+
+  auto box = voxels::intersect_box(region, muck.aabb);
+  if (box.v1.x <= box.v0.x || box.v1.y <= box.v0.y || box.v1.z <= box.v0.z) {
+    return;
+  }
+  auto v0 = k * floor_div(box.v0 - muck.aabb.v0, k);
+  auto v1 = box.v1 - muck.aabb.v0;
+  for (auto z = v0.z; z < v1.z; z += k) {
+    for (auto y = v0.y; y < v1.y; y += k) {
+      for (auto x = v0.x; x < v1.x; x += k) {
+        auto origin = vec3(x, y, z);
+        muck_evaluated_chunks.Increment();
+        const auto& src = muck.tensor.chunk(to<unsigned int>(origin));
+        auto update = tensors::map_dense(src->array, [&](auto i, auto val) {
+          auto pos = origin + to<int>(tensors::decode_tensor_pos(i));
+          return fn(to<double>(muck.aabb.v0 + pos), val);
+        });
+
+        auto& dst = grad.chunk(to<unsigned int>(origin));
+        dst = tensors::make_chunk_ptr(tensors::Chunk<int>(tensors::merge(
+            dst->array, update, [](auto l, auto r) {
+              return std::min(l, r);
+            })));
+      }
+    }
+  }
+}
+
+// Returns the value of the array if all of its values are the same.
+template <typename T>
+std::optional<T> uniform_value(const tensors::Array<T>& array) {
+  if (array.data.size() == 1) {
+    return array.data[0];
+  }
+  return std::nullopt;
 }
 
 template <typename Fn>
@@ -56,7 +142,9 @@ void update_muck_gradient_with_sphere(
     Vec3d unmuck_source,
     double unmuck_radius,
     uint32_t step_size) {
-  auto update = map_muck(muck, [&](auto pos, auto val) {
+  auto reach = std::abs(unmuck_radius) + kMuckReach;
+  auto region = reach_box(unmuck_source, vec3(0.0, 0.0, 0.0), reach);
+  update_muck_gradient(grad, muck, region, [&](auto pos, auto val) {
     auto mid = pos + vec3(0.5, 0.5, 0.5);
     auto tgt = square_norm(mid - unmuck_source);
     return solve(val, step_size, [&](auto src) {
@@ -69,9 +157,6 @@ void update_muck_gradient_with_sphere(
       }
     });
   });
-  grad = tensors::merge(grad, update, [](auto l, auto r) {
-    return std::min(l, r);
-  });
 }
 
 void update_muck_gradient_with_aabb(
@@ -80,7 +165,8 @@ void update_muck_gradient_with_aabb(
     Vec3d unmuck_source,
     Vec3d unmuck_size,
     uint32_t step_size) {
-  auto update = map_muck(muck, [&](auto pos, auto val) {
+  auto region = reach_box(unmuck_source, 0.5 * abs(unmuck_size), kMuckReach);
+  update_muck_gradient(grad, muck, region, [&](auto pos, auto val) {
     auto mid = pos + vec3(0.5, 0.5, 0.5);
     auto [dx, dy, dz] = abs(unmuck_source - mid) - 0.5 * unmuck_size;
     auto tgt = ifloor(std::max({dx, dy, dz}) / kMuckQuantum) + 1;
@@ -94,17 +180,31 @@ void update_muck_gradient_with_aabb(
       }
     });
   });
-  grad = tensors::merge(grad, update, [](auto l, auto r) {
-    return std::min(l, r);
-  });
 }
 
 void apply_muck_gradient(
     WorldMap<uint8_t>& muck, const tensors::Tensor<int>& grad) {
-  muck.tensor = tensors::merge(muck.tensor, grad, [](auto m, auto g) {
+  CHECK_ARGUMENT(grad.shape == muck.tensor.shape);
+  ScopedTimer timer(muck_apply_ms);
+
+  auto apply = [](auto m, auto g) {
     auto update = static_cast<int>(m) + g;
     return static_cast<uint8_t>(std::clamp(update, 0, kMuckMaximum));
-  });
+  };
+  for (size_t i = 0; i < muck.tensor.chunks.size(); i += 1) {
+    auto& dst = muck.tensor.chunks[i];
+    const auto& src = grad.chunks[i]->array;
+
+    // Chunks that the gradient leaves as they are keep their chunk.
+    auto m = uniform_value(dst->array);
+    auto g = uniform_value(src);
+    if (g == 0 || (m && g && apply(*m, *g) == *m)) {
+      continue;
+    }
+    dst = tensors::make_chunk_ptr(
+        tensors::Chunk<uint8_t>(tensors::merge(dst->array, src, apply)));
+    muck_chunks.Increment();
+  }
 }
 
 }  // namespace voxeloo::gaia
@@ -7,6 +7,10 @@
 
 namespace voxeloo::gaia {
 
+// Lowers the gradient towards the given unmuck source. The gradient is only
+// evaluated in the chunks within reach of the source (its volume grown by the
+// full muck falloff); elsewhere it is left as is, which is equivalent once the
+// muck is clamped as long as the gradient starts at most at step_size.
 void update_muck_gradient_with_sphere(
     tensors::Tensor<int>& grad,
     const WorldMap<uint8_t>& muck,
@@ -21,6 +25,8 @@ void update_muck_gradient_with_aabb(
     Vec3d unmuck_size,
     uint32_t step_size);
 
+// Applies the gradient to the muck. Chunks that the gradient leaves unchanged
+// keep their chunk.
 void apply_muck_gradient(
     WorldMap<uint8_t>& muck, const tensors::Tensor<int>& grad);
 
@@ -169,4 +169,35 @@ TEST_CASE("Test gradient computation for spheres", "[all]") {
       REQUIRE(val == -1);
     }
   });
-}
\ No newline at end of file
+}
+
+TEST_CASE("Test gradient updates only touch affected chunks", "[all]") {
+  auto muck = gaia::WorldMap<uint8_t>{
+      {{0, 0, 0}, {512, 64, 512}},
+      tensors::make_tensor<uint8_t>({512u, 64u, 512u}, 15),
+  };
+  auto before = muck.tensor.chunks.clone();
+
+  auto grad = tensors::make_tensor<int>({512u, 64u, 512u}, 1);
+  auto fill = grad.chunks.clone();
+  gaia::update_muck_gradient_with_sphere(
+      grad, muck, {16.0, 16.0, 16.0}, 4.0, 1);
+  gaia::update_muck_gradient_with_aabb(
+      grad, muck, {496.0, 16.0, 496.0}, {8.0, 8.0, 8.0}, 1);
+  gaia::apply_muck_gradient(muck, grad);
+
+  REQUIRE(muck.get({16, 16, 16}) == 14);
+  REQUIRE(muck.get({496, 16, 496}) == 14);
+  REQUIRE(muck.get({256, 16, 256}) == 15);
+
+  // Only the chunks within reach of either source are updated.
+  auto updated = 0;
+  for (size_t i = 0; i < grad.chunks.size(); i += 1) {
+    if (grad.chunks[i] != fill[i]) {
+      updated += 1;
+    } else {
+      REQUIRE(muck.tensor.chunks[i] == before[i]);
+    }
+  }
+  REQUIRE(updated == 2 * (5 * 2 * 5));
+}
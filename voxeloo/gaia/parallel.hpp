@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "voxeloo/common/threads.hpp"
+
+namespace voxeloo::gaia {
+
+// Invokes fn(i) for every i in [0, n), concurrently when threads are available.
+// The wasm build is single-threaded, so the calls are made inline there.
+template <typename Fn>
+inline void parallel_for_each(size_t n, Fn&& fn) {
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+  for (uint32_t i = 0; i < n; i += 1) {
+    fn(i);
+  }
+#else
+  auto batch = [&](uint32_t l, uint32_t r) {
+    for (auto i = l; i < r; i += 1) {
+      fn(i);
+    }
+  };
+  threads::parallel_for(static_cast<uint32_t>(n), batch);
+#endif
+}
+
+}  // namespace voxeloo::gaia
@@ -0,0 +1,151 @@
+#include "voxeloo/gaia/properties.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+#include "voxeloo/common/errors.hpp"
+
+namespace voxeloo::gaia {
+
+namespace {
+
+using galois::terrain::from_flora_id;
+using galois::terrain::kBlockHeader;
+using galois::terrain::kFloraHeader;
+using galois::terrain::kGlassHeader;
+
+static constexpr uint8_t kMaxIntensity = 15;
+
+static const TerrainEmission kNoEmission{};
+
+auto emission_key(TerrainId id) {
+  return static_cast<uint64_t>(id) << 16;
+}
+
+auto emission_key(TerrainId id, uint8_t dye) {
+  return emission_key(id) | (static_cast<uint64_t>(dye) + 1);
+}
+
+TerrainEmission light(Vec4<uint8_t> levels, Vec3<uint8_t> rgb) {
+  return TerrainEmission{levels, rgb, kMaxIntensity, false};
+}
+
+// Coloured light only, growing brighter with the flora's growth stage.
+TerrainEmission flora_light(Vec3<uint8_t> rgb) {
+  return TerrainEmission{{0, 0, 0, 0}, rgb, kMaxIntensity, true};
+}
+
+}  // namespace
+
+const TerrainProperties& TerrainProperties::get() {
+  static const TerrainProperties properties;
+  return properties;
+}
+
+TerrainProperties::TerrainProperties()
+    : header_flags_(kHeaders, FLOWABLE),
+      dense_(kDenseHeaders * kDenseIds) {
+  header_flags_[kBlockHeader] = OCCLUSIVE | COLLIDABLE;
+  header_flags_[kFloraHeader] = FLOWABLE;
+  header_flags_[kGlassHeader] = COLLIDABLE;
+  for (uint32_t header = 0; header < kDenseHeaders; header += 1) {
+    std::fill_n(
+        dense_.begin() + header * kDenseIds, kDenseIds, header_flags_[header]);
+  }
+
+  // Air is not a block.
+  dense_[0] = FLOWABLE;
+
+  // TODO(matthew): Make this use terrain quirks after they has been
+  // migrated to bikkie
+
+  // led, by dye: none, blue, red, green, orange, white, purple, pink, yellow,
+  // black, tan, brown, silver, cyan, magenta, brightgreen, brightred,
+  // brightpurple, brightpink, brightyellow, brightblue, brightorange and
+  // lightblue.
+  static const std::pair<Vec4<uint8_t>, Vec3<uint8_t>> kLed[] = {
+      {{15, 15, 15, 0}, {255, 255, 255}},
+      {{3, 3, 15, 0}, {44, 116, 255}},
+      {{15, 3, 3, 0}, {255, 80, 80}},
+      {{3, 15, 3, 0}, {80, 255, 80}},
+      {{15, 8, 2, 0}, {255, 128, 32}},
+      {{15, 15, 15, 0}, {255, 255, 255}},
+      {{9, 5, 15, 0}, {128, 80, 255}},
+      {{15, 6, 15, 0}, {255, 96, 207}},
+      {{15, 15, 0, 0}, {255, 232, 23}},
+      {{10, 1, 15, 0}, {160, 16, 255}},
+      {{15, 15, 15, 0}, {255, 209, 143}},
+      {{15, 15, 15, 0}, {121, 55, 14}},
+      {{15, 15, 15, 0}, {127, 136, 151}},
+      {{15, 15, 15, 0}, {21, 255, 245}},
+      {{15, 15, 15, 0}, {252, 15, 255}},
+      {{15, 15, 15, 0}, {189, 255, 177}},
+      {{15, 15, 15, 0}, {255, 157, 157}},
+      {{15, 15, 15, 0}, {223, 187, 255}},
+      {{15, 15, 15, 0}, {255, 220, 236}},
+      {{15, 15, 15, 0}, {255, 254, 217}},
+      {{15, 15, 15, 0}, {150, 183, 255}},
+      {{15, 15, 15, 0}, {255, 197, 142}},
+      {{15, 15, 15, 0}, {176, 228, 255}},
+  };
+  for (uint8_t dye = 0; dye < std::size(kLed); dye += 1) {
+    set_emission(64, dye, light(kLed[dye].first, kLed[dye].second));
+  }
+
+  // emberstone; also lights up leds of other dyes.
+  set_emission(64, light({15, 6, 5, 0}, {255, 96, 80}));
+  set_emission(65, light({15, 6, 5, 0}, {255, 96, 80}));
+
+  // sunstone
+  set_emission(66, light({15, 12, 3, 0}, {255, 192, 48}));
+
+  // moonstone
+  set_emission(67, light({14, 14, 15, 0}, {240, 240, 255}));
+
+  // flare
+  set_emission(from_flora_id(15), light({15, 15, 15, 0}, {255, 255, 255}));
+
+  // ultraviolet, fire flower, marigold, morning glory, peony and sun flower.
+  set_emission(from_flora_id(45), flora_light({153, 50, 204}));
+  set_emission(from_flora_id(47), flora_light({255, 0, 40}));
+  set_emission(from_flora_id(48), flora_light({255, 165, 0}));
+  set_emission(from_flora_id(49), flora_light({130, 200, 255}));
+  set_emission(from_flora_id(50), flora_light({255, 90, 170}));
+  set_emission(from_flora_id(51), flora_light({255, 255, 0}));
+}
+
+const TerrainEmission& TerrainProperties::emission(
+    TerrainId id, uint8_t dye) const {
+  if (!is(id, EMISSIVE)) {
+    return kNoEmission;
+  }
+  for (auto key : {emission_key(id, dye), emission_key(id)}) {
+    if (auto it = emissions_.find(key); it != emissions_.end()) {
+      return it->second;
+    }
+  }
+  return kNoEmission;
+}
+
+void TerrainProperties::set_emission(TerrainId id, TerrainEmission emission) {
+  set_flags(id, emission);
+  emissions_[emission_key(id)] = emission;
+}
+
+void TerrainProperties::set_emission(
+    TerrainId id, uint8_t dye, TerrainEmission emission) {
+  set_flags(id, emission);
+  emissions_[emission_key(id, dye)] = emission;
+}
+
+void TerrainProperties::set_flags(TerrainId id, TerrainEmission emission) {
+  CHECK_ARGUMENT((id >> 24) < kDenseHeaders && (id & 0xffffff) < kDenseIds);
+  auto& flags = dense_[(id >> 24) * kDenseIds + (id & 0xffffff)];
+  flags |= EMISSIVE;
+  if (emission.levels != Vec4<uint8_t>{0, 0, 0, 0}) {
+    flags |= RGB_EMISSIVE;
+  }
+}
+
+}  // namespace voxeloo::gaia
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "voxeloo/common/geometry.hpp"
+#include "voxeloo/galois/terrain.hpp"
+#include "voxeloo/tensors/arrays.hpp"
+#include "voxeloo/tensors/routines.hpp"
+
+namespace voxeloo::gaia {
+
+using galois::terrain::TerrainId;
+
+enum TerrainFlag : uint8_t {
+  // Blocks light (sky occlusion and irradiance).
+  OCCLUSIVE = 1 << 0,
+  // Blocks entities.
+  COLLIDABLE = 1 << 1,
+  // Lets water through.
+  FLOWABLE = 1 << 2,
+  // Emits light in the per-channel irradiance simulation.
+  RGB_EMISSIVE = 1 << 3,
+  // Emits coloured light in the shard irradiance kernel (maybe depending on
+  // its dye and growth).
+  EMISSIVE = 1 << 4,
+};
+
+// The light emitted by a terrain type.
+struct TerrainEmission {
+  // Per-channel levels for the per-channel irradiance simulation.
+  Vec4<uint8_t> levels = {0, 0, 0, 0};
+  Vec3<uint8_t> rgb = {255, 255, 255};
+  uint8_t intensity = 0;
+  // Whether the intensity grows with the growth stage (flora).
+  bool scales_with_growth = false;
+};
+
+// A data-driven table of terrain properties, built once and shared.
+//
+// The flags of the low ids of each id header are stored densely, so that
+// classifying a terrain id is a single array lookup; the flags of the ids
+// beyond are the same for all ids of a header. Emissions are only looked up
+// for emissive ids.
+class TerrainProperties {
+ public:
+  static const TerrainProperties& get();
+
+  uint8_t flags(TerrainId id) const {
+    auto header = id >> 24;
+    auto low = id & 0xffffff;
+    if (header < kDenseHeaders && low < kDenseIds) {
+      return dense_[header * kDenseIds + low];
+    }
+    return header_flags_[header];
+  }
+
+  bool is(TerrainId id, uint8_t flag) const {
+    return (flags(id) & flag) != 0;
+  }
+
+  // Returns the emission of the terrain with the given dye, or a null
+  // emission if it emits no light.
+  const TerrainEmission& emission(TerrainId id, uint8_t dye = 0) const;
+
+ private:
+  static constexpr uint32_t kHeaders = 256;
+  static constexpr uint32_t kDenseHeaders = 3;
+  static constexpr uint32_t kDenseIds = 4096;
+
+  TerrainProperties();
+
+  void set_emission(TerrainId id, TerrainEmission emission);
+  void set_emission(TerrainId id, uint8_t dye, TerrainEmission emission);
+  void set_flags(TerrainId id, TerrainEmission emission);
+
+  std::vector<uint8_t> header_flags_;
+  std::vector<uint8_t> dense_;
+  std::unordered_map<uint64_t, TerrainEmission> emissions_;
+};
+
+inline uint8_t terrain_flags(TerrainId id) {
+  return TerrainProperties::get().flags(id);
+}
+
+// Maps an array of terrain ids to their flags with one lookup per run.
+inline auto classify(const tensors::Array<TerrainId>& array) {
+  const auto& properties = TerrainProperties::get();
+  return tensors::map_values(array, [&](TerrainId id) {
+    return properties.flags(id);
+  });
+}
+
+// Maps an array of terrain ids to whether they have any of the given flags,
+// with one lookup per run.
+inline auto classify(const tensors::Array<TerrainId>& array, uint8_t flag) {
+  const auto& properties = TerrainProperties::get();
+  return tensors::map_values(array, [&](TerrainId id) {
+    return properties.is(id, flag);
+  });
+}
+
+}  // namespace voxeloo::gaia
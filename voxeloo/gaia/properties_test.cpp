@@ -0,0 +1,55 @@
+#include "voxeloo/gaia/properties.hpp"
+
+#include <catch2/catch.hpp>
+
+#include "voxeloo/common/geometry.hpp"
+
+using namespace voxeloo;  // NOLINT
+using galois::terrain::from_flora_id;
+using galois::terrain::from_glass_id;
+
+TEST_CASE("Test the terrain property table", "[all]") {
+  const auto& properties = gaia::TerrainProperties::get();
+
+  REQUIRE(gaia::terrain_flags(0) == gaia::FLOWABLE);
+  REQUIRE(gaia::terrain_flags(1) == (gaia::OCCLUSIVE | gaia::COLLIDABLE));
+  REQUIRE(gaia::terrain_flags(1 << 20) == gaia::terrain_flags(1));
+  REQUIRE(gaia::terrain_flags(from_flora_id(3)) == gaia::FLOWABLE);
+  REQUIRE(gaia::terrain_flags(from_glass_id(3)) == gaia::COLLIDABLE);
+  REQUIRE(gaia::terrain_flags(0x7f000001) == gaia::FLOWABLE);
+
+  // Emissive blocks (led, moonstone) and flora (marigold).
+  REQUIRE(properties.is(64, gaia::RGB_EMISSIVE | gaia::OCCLUSIVE));
+  REQUIRE(properties.emission(64, 2).levels == Vec4<uint8_t>{15, 3, 3, 0});
+  REQUIRE(properties.emission(64, 2).rgb == Vec3<uint8_t>{255, 80, 80});
+  REQUIRE(properties.emission(67).rgb == Vec3<uint8_t>{240, 240, 255});
+  REQUIRE(properties.is(from_flora_id(48), gaia::EMISSIVE));
+  REQUIRE(!properties.is(from_flora_id(48), gaia::RGB_EMISSIVE));
+  REQUIRE(properties.emission(from_flora_id(48)).scales_with_growth);
+  REQUIRE(properties.emission(1).intensity == 0);
+}
+
+TEST_CASE("Test terrain run classification", "[all]") {
+  tensors::ArrayBuilder<gaia::TerrainId> builder;
+  builder.add(100, 0);
+  builder.add(100, 1);
+  builder.add(100, 2);
+  builder.add(100, from_flora_id(3));
+  builder.add(tensors::kChunkSize - 400, 64);
+  auto array = std::move(builder).build();
+
+  // Adjacent runs of the same class are merged.
+  auto occlusive = gaia::classify(array, gaia::OCCLUSIVE);
+  REQUIRE(occlusive.data.size() == 4);
+  REQUIRE(!occlusive.get(99));
+  REQUIRE(occlusive.get(100));
+  REQUIRE(occlusive.get(299));
+  REQUIRE(!occlusive.get(300));
+  REQUIRE(occlusive.get(400));
+
+  auto flags = gaia::classify(array);
+  REQUIRE(flags.data.size() == 4);
+  REQUIRE(flags.get(150) == (gaia::OCCLUSIVE | gaia::COLLIDABLE));
+  REQUIRE(flags.get(350) == gaia::FLOWABLE);
+  REQUIRE((flags.get(500) & gaia::RGB_EMISSIVE) != 0);
+}
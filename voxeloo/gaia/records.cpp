@@ -0,0 +1,121 @@
+#include "voxeloo/gaia/records.hpp"
+
+#include <utility>
+
+#include "voxeloo/tensors/routines.hpp"
+
+namespace voxeloo::gaia {
+
+namespace {
+
+template <typename T>
+auto copy_chunk(const WorldMap<T>& map, Vec3i pos) {
+  return map.contains(pos) ? *map.chunk(pos) : tensors::Chunk<T>();
+}
+
+// Adopts the chunk of a single-shard tensor, copying it only if it is shared.
+template <typename T>
+void assign_chunk(tensors::Chunk<T>& dst, tensors::Tensor<T>& src) {
+  auto& chunk = src.chunks[0];
+  if (chunk.use_count() == 1) {
+    dst = std::move(*chunk);
+  } else {
+    dst = *chunk;
+  }
+}
+
+}  // namespace
+
+TerrainRecordMap::TerrainRecordMap(const TerrainMapV2& map)
+    : aabb_(map.aabb()),
+      shape_(tensors::chunk_div(to<unsigned int>(aabb_.v1 - aabb_.v0))) {
+  records_.resize(tensors::shape_len(shape_));
+  for (size_t i = 0; i < records_.size(); i += 1) {
+    auto pos = record_pos(i);
+    auto record = std::make_shared<TerrainRecord>();
+    record->seed = copy_chunk(map.seeds, pos);
+    record->diff = copy_chunk(map.diffs, pos);
+    record->terrain = copy_chunk(map.terrains, pos);
+    record->water = copy_chunk(map.waters, pos);
+    record->irradiance = copy_chunk(map.irradiances, pos);
+    record->dye = copy_chunk(map.dyes, pos);
+    record->growth = copy_chunk(map.growths, pos);
+    record->occlusion = copy_chunk(map.occlusions, pos);
+    records_[i] = std::move(record);
+  }
+}
+
+size_t TerrainRecordMap::storage_size() const {
+  auto ret = sizeof(*this);
+  for (const auto& record : records_) {
+    ret += record->storage_size();
+  }
+  return ret;
+}
+
+void TerrainRecordMap::update_diff(Vec3i pos, SparseChunk diff) {
+  auto& record = writable(pos, diff.shape);
+  assign_chunk(record.diff, diff);
+  record.terrain = tensors::Chunk<TerrainId>(tensors::merge(
+      record.seed.array, record.diff.array, [](auto seed, auto diff) {
+        return diff.value_or(seed);
+      }));
+  record.dirty |= DIFF_LAYER | TERRAIN_LAYER;
+}
+
+void TerrainRecordMap::update_water(Vec3i pos, WaterChunk water) {
+  auto& record = writable(pos, water.shape);
+  assign_chunk(record.water, water);
+  record.dirty |= WATER_LAYER;
+}
+
+void TerrainRecordMap::update_irradiance(
+    Vec3i pos, IrradianceChunk irradiance) {
+  auto& record = writable(pos, irradiance.shape);
+  assign_chunk(record.irradiance, irradiance);
+  record.dirty |= IRRADIANCE_LAYER;
+}
+
+void TerrainRecordMap::update_dye(Vec3i pos, DyeChunk dye) {
+  auto& record = writable(pos, dye.shape);
+  assign_chunk(record.dye, dye);
+  record.dirty |= DYE_LAYER;
+}
+
+void TerrainRecordMap::update_growth(Vec3i pos, GrowthChunk growth) {
+  auto& record = writable(pos, growth.shape);
+  assign_chunk(record.growth, growth);
+  record.dirty |= GROWTH_LAYER;
+}
+
+void TerrainRecordMap::update_occlusion(Vec3i pos, OcclusionChunk occlusion) {
+  auto& record = writable(pos, occlusion.shape);
+  assign_chunk(record.occlusion, occlusion);
+  record.dirty |= OCCLUSION_LAYER;
+}
+
+TerrainMapV2 TerrainRecordMap::view() const {
+  return TerrainMapV2{
+      layer(&TerrainRecord::seed),
+      layer(&TerrainRecord::diff),
+      layer(&TerrainRecord::terrain),
+      layer(&TerrainRecord::water),
+      layer(&TerrainRecord::irradiance),
+      layer(&TerrainRecord::dye),
+      layer(&TerrainRecord::growth),
+      layer(&TerrainRecord::occlusion),
+  };
+}
+
+TerrainRecord& TerrainRecordMap::writable(Vec3i pos, const Vec3u& shape) {
+  CHECK_ARGUMENT(shape == kShardShape);
+  CHECK_ARGUMENT(is_shard_aligned(pos) && contains(pos));
+
+  auto& record = records_[record_index(pos)];
+  if (record.use_count() > 1) {
+    record = std::make_shared<TerrainRecord>(*record);
+  }
+  return *record;
+}
+
+}  // namespace voxeloo::gaia
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <vector>
+
+#include "voxeloo/common/errors.hpp"
+#include "voxeloo/common/geometry.hpp"
+#include "voxeloo/common/voxels.hpp"
+#include "voxeloo/gaia/maps.hpp"
+#include "voxeloo/gaia/terrain.hpp"
+#include "voxeloo/tensors/tensors.hpp"
+
+namespace voxeloo::gaia {
+
+// The layers of a terrain record, as bits of its dirty mask.
+enum TerrainLayer : uint8_t {
+  SEED_LAYER = 1 << 0,
+  DIFF_LAYER = 1 << 1,
+  TERRAIN_LAYER = 1 << 2,
+  WATER_LAYER = 1 << 3,
+  IRRADIANCE_LAYER = 1 << 4,
+  DYE_LAYER = 1 << 5,
+  GROWTH_LAYER = 1 << 6,
+  OCCLUSION_LAYER = 1 << 7,
+};
+
+// Every layer of a single shard, allocated together. Each layer keeps its own
+// run-length encoding, so a uniform layer costs a single run regardless of how
+// busy the others are.
+struct TerrainRecord {
+  tensors::Chunk<TerrainId> seed;
+  tensors::Chunk<std::optional<TerrainId>> diff;
+  tensors::Chunk<TerrainId> terrain;
+  tensors::Chunk<uint8_t> water;
+  tensors::Chunk<uint32_t> irradiance;
+  tensors::Chunk<uint8_t> dye;
+  tensors::Chunk<uint8_t> growth;
+  tensors::Chunk<uint8_t> occlusion;
+
+  // The layers updated since the mask was last taken. Unlike the layers, the
+  // mask is cleared in place, as views never read it.
+  uint8_t dirty = 0;
+
+  auto storage_size() const {
+    return sizeof(*this) + tensors::storage_size(seed) +
+           tensors::storage_size(diff) + tensors::storage_size(terrain) +
+           tensors::storage_size(water) + tensors::storage_size(irradiance) +
+           tensors::storage_size(dye) + tensors::storage_size(growth) +
+           tensors::storage_size(occlusion);
+  }
+};
+
+template <typename T>
+using TerrainRecordLayer = tensors::Chunk<T> TerrainRecord::*;
+
+// A terrain map laid out as one record per shard rather than one WorldMap per
+// layer, so that jobs reading several layers of a shard touch a single
+// allocation.
+//
+// Layers are exposed as WorldMaps whose chunks alias the records, which keeps
+// the map usable wherever a TerrainMapV2 is expected (see view()). Records are
+// copied on write: updating a shard whose record is still referenced by such a
+// view first clones it, so views are never modified under their readers.
+class TerrainRecordMap {
+ public:
+  TerrainRecordMap() = default;
+  explicit TerrainRecordMap(const TerrainMapV2& map);
+
+  auto aabb() const {
+    return aabb_;
+  }
+
+  bool contains(Vec3i pos) const {
+    return voxels::box_contains(aabb_, pos);
+  }
+
+  size_t storage_size() const;
+
+  const TerrainRecord& record(Vec3i pos) const {
+    return *records_[record_index(pos)];
+  }
+
+  auto get_terrain(Vec3i pos) const {
+    return record(pos).terrain.get(
+        tensors::chunk_mod(to<unsigned int>(pos - aabb_.v0)));
+  }
+
+  void update_diff(Vec3i pos, SparseChunk diff);
+  void update_water(Vec3i pos, WaterChunk water);
+  void update_irradiance(Vec3i pos, IrradianceChunk irradiance);
+  void update_dye(Vec3i pos, DyeChunk dye);
+  void update_growth(Vec3i pos, GrowthChunk growth);
+  void update_occlusion(Vec3i pos, OcclusionChunk occlusion);
+
+  // Invokes fn(pos, mask) on every record with dirty layers, then clears them.
+  template <typename Fn>
+  void take_dirty(Fn&& fn) {
+    for (size_t i = 0; i < records_.size(); i += 1) {
+      if (auto mask = records_[i]->dirty) {
+        records_[i]->dirty = 0;
+        fn(record_pos(i), mask);
+      }
+    }
+  }
+
+  // Returns the given layer over the shard-aligned aabb as a WorldMap sharing
+  // the records' chunks, like sub_world_map() does for TerrainMapV2 layers.
+  template <typename T>
+  WorldMap<T> layer(
+      TerrainRecordLayer<T> member, const voxels::Box& aabb) const {
+    return to_layer(member, aabb, gather(aabb));
+  }
+
+  template <typename T>
+  WorldMap<T> layer(TerrainRecordLayer<T> member) const {
+    return layer(member, aabb_);
+  }
+
+  // Returns several layers over the same aabb, looking each record up once.
+  template <typename... T>
+  std::tuple<WorldMap<T>...> layers(
+      const voxels::Box& aabb, TerrainRecordLayer<T>... members) const {
+    auto records = gather(aabb);
+    return {to_layer(members, aabb, records)...};
+  }
+
+  // Returns a TerrainMapV2 whose layers alias the records.
+  TerrainMapV2 view() const;
+
+ private:
+  size_t record_index(Vec3i pos) const {
+    CHECK_ARGUMENT(contains(pos));
+    auto [x, y, z] = tensors::chunk_div(to<unsigned int>(pos - aabb_.v0));
+    return x + shape_.x * (y + shape_.y * z);
+  }
+
+  Vec3i record_pos(size_t i) const {
+    auto x = static_cast<unsigned int>(i % shape_.x);
+    auto y = static_cast<unsigned int>(i / shape_.x % shape_.y);
+    auto z = static_cast<unsigned int>(i / shape_.x / shape_.y);
+    return aabb_.v0 + to<int>(tensors::chunk_mul({x, y, z}));
+  }
+
+  // Returns the records of the shards of the shard-aligned aabb in tensor
+  // order, null outside of the map.
+  std::vector<std::shared_ptr<TerrainRecord>> gather(
+      const voxels::Box& aabb) const {
+    CHECK_ARGUMENT(is_shard_aligned(aabb.v0) && is_shard_aligned(aabb.v1));
+
+    auto [w, h, d] = tensors::chunk_div(to<uint32_t>(aabb.v1 - aabb.v0));
+    std::vector<std::shared_ptr<TerrainRecord>> ret;
+    ret.reserve(w * h * d);
+    for (auto z = 0u; z < d; z += 1) {
+      for (auto y = 0u; y < h; y += 1) {
+        for (auto x = 0u; x < w; x += 1) {
+          Vec3i pos = aabb.v0 + to<int>(tensors::chunk_mul({x, y, z}));
+          ret.push_back(contains(pos) ? records_[record_index(pos)] : nullptr);
+        }
+      }
+    }
+    return ret;
+  }
+
+  template <typename T>
+  static WorldMap<T> to_layer(
+      TerrainRecordLayer<T> member,
+      const voxels::Box& aabb,
+      const std::vector<std::shared_ptr<TerrainRecord>>& records) {
+    tensors::BufferBuilder<tensors::ChunkPtr<T>> builder(records.size());
+    for (const auto& record : records) {
+      if (record) {
+        builder.add(tensors::ChunkPtr<T>(record, &((*record).*member)));
+      } else {
+        builder.add(tensors::make_chunk_ptr<T>());
+      }
+    }
+    Vec3u shape = to<uint32_t>(aabb.v1 - aabb.v0);
+    return WorldMap<T>{
+        aabb, tensors::Tensor<T>{shape, std::move(builder).build()}};
+  }
+
+  // Returns the record of the shard at pos for modification, cloning it first
+  // if it is shared with a view.
+  TerrainRecord& writable(Vec3i pos, const Vec3u& shape);
+
+  voxels::Box aabb_ = voxels::cube_box(0);
+  Vec3u shape_ = {0, 0, 0};
+  std::vector<std::shared_ptr<TerrainRecord>> records_;
+};
+
+template <typename T>
+inline WorldMap<T> sub_world_map(
+    const TerrainRecordMap& map,
+    TerrainRecordLayer<T> member,
+    const voxels::Box& aabb) {
+  return map.layer(member, aabb);
+}
+
+}  // namespace voxeloo::gaia
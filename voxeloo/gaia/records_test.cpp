@@ -0,0 +1,118 @@
+#include "voxeloo/gaia/records.hpp"
+
+#include <catch2/catch.hpp>
+
+#include "voxeloo/common/geometry.hpp"
+#include "voxeloo/gaia/light.hpp"
+#include "voxeloo/gaia/water.hpp"
+
+using namespace voxeloo;  // NOLINT
+using galois::terrain::TerrainId;
+
+namespace {
+
+auto make_map() {
+  gaia::TerrainMapBuilderV2 builder;
+  for (int z = 0; z < 64; z += 32) {
+    for (int x = 0; x < 96; x += 32) {
+      builder.assign_seed_block(
+          {x, 0, z},
+          tensors::make_tensor<TerrainId>(tensors::kChunkShape, x + z));
+      builder.assign_water_block(
+          {x, 0, z},
+          tensors::make_tensor<uint8_t>(tensors::kChunkShape, x == 32 ? 9 : 0));
+    }
+  }
+  return std::move(builder).build();
+}
+
+template <typename T>
+auto same_layer(const gaia::WorldMap<T>& a, const gaia::WorldMap<T>& b) {
+  if (a.aabb != b.aabb) {
+    return false;
+  }
+  bool same = true;
+  voxels::box_scan(a.aabb, [&](int x, int y, int z) {
+    same = same && a.get({x, y, z}) == b.get({x, y, z});
+  });
+  return same;
+}
+
+}  // namespace
+
+TEST_CASE("Test the terrain record map", "[all]") {
+  auto map = make_map();
+  gaia::TerrainRecordMap records(map);
+  REQUIRE(records.aabb() == map.aabb());
+  REQUIRE(records.get_terrain({65, 2, 33}) == 96);
+
+  auto view = records.view();
+  REQUIRE(same_layer(view.seeds, map.seeds));
+  REQUIRE(same_layer(view.terrains, map.terrains));
+  REQUIRE(same_layer(view.waters, map.waters));
+
+  // Layers of a shard share a single record.
+  auto sub = gaia::sub_world_map(
+      records, &gaia::TerrainRecord::water, {{32, 0, 0}, {64, 32, 32}});
+  REQUIRE(sub.get({32, 0, 0}) == 9);
+  REQUIRE(
+      sub.tensor.chunks[0].get() == &records.record({32, 0, 0}).water);
+
+  // The map kernels run unchanged on views.
+  auto water = gaia::update_water(view, {32, 0, 0});
+  REQUIRE(same_layer(water, gaia::update_water(map, {32, 0, 0})));
+
+  // Updates leave earlier views untouched and flag the layers they change.
+  records.update_water({32, 0, 0}, water.tensor);
+  records.update_diff(
+      {64, 0, 32},
+      tensors::make_tensor<std::optional<TerrainId>>(tensors::kChunkShape, 7));
+  REQUIRE(view.waters.get({32, 0, 0}) == 9);
+  REQUIRE(view.get_terrain({65, 2, 33}) == 96);
+  REQUIRE(records.get_terrain({65, 2, 33}) == 7);
+  REQUIRE(same_layer(records.layer(&gaia::TerrainRecord::water), [&] {
+    auto ret = map;
+    ret.update_water({32, 0, 0}, water.tensor);
+    return ret.waters;
+  }()));
+
+  std::vector<std::pair<Vec3i, uint8_t>> dirty;
+  records.take_dirty([&](Vec3i pos, uint8_t mask) {
+    dirty.emplace_back(pos, mask);
+  });
+  REQUIRE(dirty.size() == 2);
+  REQUIRE(dirty[0].first == Vec3i{32, 0, 0});
+  REQUIRE(dirty[0].second == gaia::WATER_LAYER);
+  REQUIRE(dirty[1].first == Vec3i{64, 0, 32});
+  REQUIRE(dirty[1].second == (gaia::DIFF_LAYER | gaia::TERRAIN_LAYER));
+
+  dirty.clear();
+  records.take_dirty([&](Vec3i pos, uint8_t mask) {
+    dirty.emplace_back(pos, mask);
+  });
+  REQUIRE(dirty.empty());
+}
+
+TEST_CASE("Test irradiance on a terrain record map", "[all]") {
+  auto map = make_map();
+  map.update_dye(
+      {32, 0, 32}, tensors::make_tensor<uint8_t>(tensors::kChunkShape, 3));
+  gaia::TerrainRecordMap records(map);
+
+  tensors::SparseTensorBuilder<uint32_t> sources({64u, 64u, 64u});
+  sources.set({32u, 32u, 32u}, 0xffc0800f);
+  auto sources_tensor = std::move(sources).build();
+
+  auto [terrains, dyes] = records.layers(
+      {{0, 0, 0}, {64, 32, 64}},
+      &gaia::TerrainRecord::terrain,
+      &gaia::TerrainRecord::dye);
+  REQUIRE(terrains.get({33, 0, 33}) == 64);
+  REQUIRE(dyes.get({33, 0, 33}) == 3);
+
+  for (auto pos : {Vec3i{0, 0, 0}, Vec3i{32, 0, 32}}) {
+    auto expected = gaia::update_irradiance(map, pos, sources_tensor);
+    auto actual = gaia::update_irradiance(records, pos, sources_tensor);
+    REQUIRE(same_layer(actual, expected));
+  }
+}
@@ -0,0 +1,261 @@
+#include "voxeloo/gaia/replay.hpp"
+
+#include <filesystem>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "voxeloo/common/errors.hpp"
+#include "voxeloo/gaia/checkpoint.hpp"
+#include "voxeloo/tensors/succinct.hpp"
+#include "voxeloo/tensors/tensors.hpp"
+
+namespace voxeloo::gaia {
+
+namespace {
+
+namespace fs = std::filesystem;
+
+constexpr uint32_t kMagic = 0x4c505247;  // "GRPL"
+constexpr uint32_t kVersion = 1;
+
+struct LogHeader {
+  uint32_t magic;
+  uint32_t version;
+};
+
+struct FrameHeader {
+  uint32_t diff_count;
+  uint32_t dye_count;
+};
+
+struct ArrayHeader {
+  uint32_t max;
+  uint32_t level_count;
+  uint32_t value_count;
+};
+
+auto initial_path(const std::string& dir) {
+  return (fs::path(dir) / "initial.full").string();
+}
+
+auto log_path(const std::string& dir) {
+  return (fs::path(dir) / "frames.log").string();
+}
+
+template <typename T>
+void write_value(std::ostream& out, const T& val) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  out.write(reinterpret_cast<const char*>(&val), sizeof(T));
+}
+
+template <typename T>
+T read_value(std::istream& in) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  T ret;
+  in.read(reinterpret_cast<char*>(&ret), sizeof(T));
+  CHECK_STATE(in.good());
+  return ret;
+}
+
+template <typename T>
+void write_array(std::ostream& out, const tensors::Array<T>& array) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  const auto& levels = array.dict.levels();
+  write_value(
+      out,
+      ArrayHeader{
+          array.dict.max(),
+          static_cast<uint32_t>(levels.size()),
+          static_cast<uint32_t>(array.data.size()),
+      });
+  out.write(
+      reinterpret_cast<const char*>(levels.data()),
+      sizeof(uint32_t) * levels.size());
+  out.write(
+      reinterpret_cast<const char*>(array.data.data()),
+      sizeof(T) * array.data.size());
+}
+
+template <typename T>
+auto read_array(std::istream& in) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  auto header = read_value<ArrayHeader>(in);
+  tensors::Buffer<uint32_t> levels(header.level_count);
+  in.read(
+      reinterpret_cast<char*>(levels.data()),
+      sizeof(uint32_t) * levels.size());
+  tensors::Buffer<T> data(header.value_count);
+  in.read(reinterpret_cast<char*>(data.data()), sizeof(T) * data.size());
+  CHECK_STATE(in.good());
+
+  tensors::RankDict dict(
+      static_cast<tensors::DictKey>(header.max), std::move(levels));
+  return tensors::Array<T>{std::move(dict), std::move(data)};
+}
+
+template <typename T>
+void write_edits(std::ostream& out, const std::vector<TerrainEdit<T>>& edits) {
+  for (const auto& edit : edits) {
+    const auto& pos = edit.change.pos;
+    write_value(out, pos.x);
+    write_value(out, pos.y);
+    write_value(out, pos.z);
+    write_array(out, edit.change.mask);
+    write_array(out, edit.values);
+  }
+}
+
+template <typename T>
+auto read_edits(std::istream& in, uint32_t count) {
+  std::vector<TerrainEdit<T>> ret;
+  ret.reserve(count);
+  for (uint32_t i = 0; i < count; i += 1) {
+    auto x = read_value<int>(in);
+    auto y = read_value<int>(in);
+    auto z = read_value<int>(in);
+    auto mask = read_array<bool>(in);
+    auto values = read_array<T>(in);
+    ret.push_back({{{x, y, z}, std::move(mask)}, std::move(values)});
+  }
+  return ret;
+}
+
+// Computes the edit that takes the source chunk to the target one, in the same
+// way that the terrain writer computes the masks it publishes.
+template <typename T>
+auto diff_edit(
+    Vec3i pos, const tensors::Array<T>& src, const tensors::Array<T>& tgt) {
+  size_t changed = 0;
+  tensors::SparseArrayBuilder<bool> mask(tensors::kChunkSize);
+  tensors::diff(src, tgt, [&](auto run, auto v1, auto v2) {
+    changed += run.len;
+    mask.add(run, true);
+  });
+
+  std::optional<TerrainEdit<T>> ret;
+  if (changed) {
+    auto change = TerrainChange{pos, std::move(mask).build()};
+    auto values = tensors::merge(change.mask, tgt, [](bool masked, T val) {
+      return masked ? val : T();
+    });
+    ret = TerrainEdit<T>{std::move(change), std::move(values)};
+  }
+  return ret;
+}
+
+// Overwrites the values of the chunk under the mask of the edit.
+template <typename T>
+auto apply_edit(const tensors::Array<T>& src, const TerrainEdit<T>& edit) {
+  auto updates = tensors::merge(
+      edit.change.mask, edit.values, [](bool masked, T val) {
+        return masked ? std::optional<T>(val) : std::nullopt;
+      });
+  return tensors::merge(src, updates, [](T val, std::optional<T> update) {
+    return update.value_or(val);
+  });
+}
+
+}  // namespace
+
+TerrainRecorder::TerrainRecorder(
+    const std::string& dir, const TerrainMapV2& map) {
+  fs::create_directories(dir);
+  write_checkpoint(initial_path(dir), map);
+
+  log_.open(log_path(dir), std::ios::binary | std::ios::trunc);
+  CHECK_STATE(log_.is_open());
+  write_value(log_, LogHeader{kMagic, kVersion});
+  log_.flush();
+}
+
+bool TerrainRecorder::update_diff(
+    TerrainMapV2& map, Vec3i pos, SparseChunk diff) {
+  CHECK_ARGUMENT(diff.shape == kShardShape);
+  CHECK_ARGUMENT(is_shard_aligned(pos) && map.contains(pos));
+
+  auto edit =
+      diff_edit(pos, map.diffs.chunk(pos)->array, diff.chunks[0]->array);
+  map.update_diff(pos, std::move(diff));
+  if (edit) {
+    frame_.diffs.push_back(std::move(*edit));
+  }
+  return edit.has_value();
+}
+
+bool TerrainRecorder::update_dye(TerrainMapV2& map, Vec3i pos, DyeChunk dye) {
+  CHECK_ARGUMENT(dye.shape == kShardShape);
+  CHECK_ARGUMENT(is_shard_aligned(pos) && map.contains(pos));
+
+  auto edit = diff_edit(pos, map.dyes.chunk(pos)->array, dye.chunks[0]->array);
+  map.update_dye(pos, std::move(dye));
+  if (edit) {
+    frame_.dyes.push_back(std::move(*edit));
+  }
+  return edit.has_value();
+}
+
+size_t TerrainRecorder::tick() {
+  auto ret = frame_.diffs.size() + frame_.dyes.size();
+  write_value(
+      log_,
+      FrameHeader{
+          static_cast<uint32_t>(frame_.diffs.size()),
+          static_cast<uint32_t>(frame_.dyes.size()),
+      });
+  write_edits(log_, frame_.diffs);
+  write_edits(log_, frame_.dyes);
+  log_.flush();
+  CHECK_STATE(log_.good());
+
+  frame_ = TerrainFrame();
+  return ret;
+}
+
+TerrainReplay::TerrainReplay(const std::string& dir)
+    : initial_(read_checkpoint(initial_path(dir))) {
+  std::ifstream in(log_path(dir), std::ios::binary);
+  CHECK_STATE(in.is_open());
+  auto header = read_value<LogHeader>(in);
+  CHECK_STATE(header.magic == kMagic);
+  CHECK_STATE(header.version == kVersion);
+
+  // A frame cut short by a crash of the recorder is dropped.
+  while (in.peek() != std::ifstream::traits_type::eof()) {
+    try {
+      auto counts = read_value<FrameHeader>(in);
+      TerrainFrame frame;
+      frame.diffs = read_edits<std::optional<TerrainId>>(in, counts.diff_count);
+      frame.dyes = read_edits<uint8_t>(in, counts.dye_count);
+      frames_.push_back(std::move(frame));
+    } catch (const std::exception&) {
+      break;
+    }
+  }
+}
+
+std::vector<TerrainChange> TerrainReplay::apply(
+    size_t frame, TerrainMapV2& map) const {
+  CHECK_ARGUMENT(frame < frames_.size());
+
+  std::vector<TerrainChange> changes;
+  for (const auto& edit : frames_[frame].diffs) {
+    const auto& pos = edit.change.pos;
+    map.update_diff(
+        pos,
+        tensors::make_tensor(
+            tensors::Chunk(apply_edit(map.diffs.chunk(pos)->array, edit))));
+    changes.push_back(edit.change);
+  }
+  for (const auto& edit : frames_[frame].dyes) {
+    const auto& pos = edit.change.pos;
+    map.update_dye(
+        pos,
+        tensors::make_tensor(
+            tensors::Chunk(apply_edit(map.dyes.chunk(pos)->array, edit))));
+    changes.push_back(edit.change);
+  }
+  return coalesce_changes(changes);
+}
+
+}  // namespace voxeloo::gaia
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "voxeloo/common/geometry.hpp"
+#include "voxeloo/gaia/terrain.hpp"
+
+namespace voxeloo::gaia {
+
+// Recordings capture the terrain edits of a running system so that they can be
+// replayed against the simulations offline (see gaia_bench). A recording is a
+// directory holding a full checkpoint of the initial terrain map and a log of
+// frames. Each frame holds the updates applied to the map during one tick, as
+// the mask of the voxels they changed and the new values of those voxels.
+
+// An update of one layer of a shard. Values outside of the mask are zeroed.
+template <typename T>
+struct TerrainEdit {
+  TerrainChange change;
+  tensors::Array<T> values;
+};
+
+struct TerrainFrame {
+  std::vector<TerrainEdit<std::optional<TerrainId>>> diffs;
+  std::vector<TerrainEdit<uint8_t>> dyes;
+};
+
+// Records the updates applied to a TerrainMapV2 through it, one frame per tick.
+class TerrainRecorder {
+ public:
+  TerrainRecorder(const std::string& dir, const TerrainMapV2& map);
+
+  // Apply the update to the map, as TerrainMapV2::update_diff does, and record
+  // the voxels it changed. Return whether any voxel changed.
+  bool update_diff(TerrainMapV2& map, Vec3i pos, SparseChunk diff);
+  bool update_dye(TerrainMapV2& map, Vec3i pos, DyeChunk dye);
+
+  // Appends the updates recorded since the last tick to the log as a new
+  // frame. Returns the number of updates recorded.
+  size_t tick();
+
+ private:
+  std::ofstream log_;
+  TerrainFrame frame_;
+};
+
+// Reads a recording back frame by frame.
+class TerrainReplay {
+ public:
+  explicit TerrainReplay(const std::string& dir);
+
+  const auto& initial() const {
+    return initial_;
+  }
+
+  auto frame_count() const {
+    return frames_.size();
+  }
+
+  const auto& frame(size_t i) const {
+    return frames_.at(i);
+  }
+
+  // Applies the given frame to the map, which must be in the state left by the
+  // previous frame. Returns the changes of the frame, coalesced by shard.
+  std::vector<TerrainChange> apply(size_t frame, TerrainMapV2& map) const;
+
+ private:
+  TerrainMapV2 initial_;
+  std::vector<TerrainFrame> frames_;
+};
+
+}  // namespace voxeloo::gaia
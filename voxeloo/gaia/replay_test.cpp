@@ -0,0 +1,71 @@
+#include "voxeloo/gaia/replay.hpp"
+
+#include <catch2/catch.hpp>
+#include <filesystem>
+
+#include "voxeloo/common/geometry.hpp"
+
+using namespace voxeloo;  // NOLINT
+using galois::terrain::TerrainId;
+
+namespace {
+
+auto make_diff(Vec3u pos, TerrainId val) {
+  tensors::SparseTensorBuilder<std::optional<TerrainId>> builder(
+      tensors::kChunkShape);
+  builder.set(pos, val);
+  return std::move(builder).build();
+}
+
+}  // namespace
+
+TEST_CASE("Test recording and replaying terrain edits", "[all]") {
+  auto dir = std::filesystem::temp_directory_path() / "gaia_replay_test";
+  std::filesystem::remove_all(dir);
+
+  auto map = [] {
+    gaia::TerrainMapBuilderV2 builder;
+    for (int x = 0; x < 96; x += 32) {
+      builder.assign_seed_block(
+          {x, 0, 0}, tensors::make_tensor<TerrainId>(tensors::kChunkShape, 1));
+    }
+    return std::move(builder).build();
+  }();
+
+  {
+    gaia::TerrainRecorder recorder(dir.string(), map);
+
+    REQUIRE(recorder.update_diff(map, {32, 0, 0}, make_diff({1, 2, 3}, 5)));
+    REQUIRE(recorder.update_diff(map, {64, 0, 0}, make_diff({4, 5, 6}, 6)));
+    REQUIRE(recorder.tick() == 2);
+    REQUIRE(!recorder.update_diff(map, {64, 0, 0}, make_diff({4, 5, 6}, 6)));
+    REQUIRE(recorder.tick() == 0);
+    REQUIRE(recorder.update_diff(map, {32, 0, 0}, make_diff({7, 8, 9}, 7)));
+    REQUIRE(recorder.tick() == 1);
+  }
+  REQUIRE(map.get_terrain({39, 8, 9}) == 7);
+
+  gaia::TerrainReplay replay(dir.string());
+  REQUIRE(replay.frame_count() == 3);
+  REQUIRE(replay.initial().get_terrain({33, 2, 3}) == 1);
+
+  // Frames hold the masks of the changed voxels, not the whole shards.
+  const auto& edit = replay.frame(2).diffs.at(0);
+  REQUIRE(edit.change.pos == Vec3i{32, 0, 0});
+  REQUIRE(gaia::change_size(edit.change) == 2);
+
+  auto replayed = replay.initial();
+  auto changes = replay.apply(0, replayed);
+  REQUIRE(changes.size() == 2);
+  REQUIRE(changes[0].pos == Vec3i{32, 0, 0});
+  REQUIRE(changes[1].pos == Vec3i{64, 0, 0});
+  REQUIRE(gaia::change_size(changes[1]) == 1);
+  REQUIRE(replayed.get_terrain({33, 2, 3}) == 5);
+  REQUIRE(replayed.get_terrain({68, 5, 6}) == 6);
+  REQUIRE(replay.apply(1, replayed).empty());
+  REQUIRE(replay.apply(2, replayed).size() == 1);
+  REQUIRE(replayed.get_terrain({33, 2, 3}) == 1);
+  REQUIRE(replayed.get_terrain({39, 8, 9}) == 7);
+
+  std::filesystem::remove_all(dir);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "voxeloo/common/errors.hpp"
+
+namespace voxeloo::gaia {
+
+// A bounded lock-free ring buffer supporting many concurrent producers and a
+// single consumer. Each cell carries a sequence number that tells producers and
+// the consumer whether the cell is free or holds a published value, so neither
+// side ever blocks on the other. The capacity must be a power of two.
+template <typename T>
+class RingBuffer {
+  struct Cell {
+    std::atomic<size_t> seq;
+    T val;
+  };
+
+ public:
+  explicit RingBuffer(size_t capacity)
+      : mask_(capacity - 1),
+        cells_(new Cell[capacity]),
+        enter_(0),
+        leave_(0) {
+    CHECK_ARGUMENT(capacity > 0 && (capacity & mask_) == 0);
+    for (size_t i = 0; i < capacity; i += 1) {
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  RingBuffer(const RingBuffer&) = delete;
+  RingBuffer& operator=(const RingBuffer&) = delete;
+
+  auto capacity() const {
+    return mask_ + 1;
+  }
+
+  // Returns an estimate of the number of queued values. The value is exact
+  // when no producer is concurrently pushing.
+  auto size() const {
+    auto enter = enter_.load(std::memory_order_acquire);
+    auto leave = leave_.load(std::memory_order_acquire);
+    return enter - leave;
+  }
+
+  auto empty() const {
+    return size() == 0;
+  }
+
+  // Safe to call from any thread. Returns false if the buffer is full.
+  bool try_push(T val) {
+    auto pos = enter_.load(std::memory_order_relaxed);
+    for (;;) {
+      auto& cell = cells_[pos & mask_];
+      auto seq = cell.seq.load(std::memory_order_acquire);
+      auto dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (dif == 0) {
+        if (enter_.compare_exchange_weak(
+                pos, pos + 1, std::memory_order_relaxed)) {
+          cell.val = std::move(val);
+          cell.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = enter_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Must only be called from the single consumer thread. Returns false if no
+  // published value is available.
+  bool try_pop(T& out) {
+    auto pos = leave_.load(std::memory_order_relaxed);
+    auto& cell = cells_[pos & mask_];
+    auto seq = cell.seq.load(std::memory_order_acquire);
+    if (static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1) < 0) {
+      return false;
+    }
+    out = std::move(cell.val);
+    cell.val = T();
+    cell.seq.store(pos + mask_ + 1, std::memory_order_release);
+    leave_.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+ private:
+  const size_t mask_;
+  std::unique_ptr<Cell[]> cells_;
+  alignas(64) std::atomic<size_t> enter_;
+  alignas(64) std::atomic<size_t> leave_;
+};
+
+}  // namespace voxeloo::gaia
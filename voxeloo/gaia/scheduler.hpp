@@ -0,0 +1,141 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "voxeloo/common/errors.hpp"
+
+namespace voxeloo::gaia {
+
+// Hands out pending work items (e.g. dirty shards or columns) in priority
+// order under a per-tick time budget.
+//
+// Producers push items with a priority reflecting how much the update matters
+// (proximity to players, size of the edit, ...). Pushing an item that is
+// already pending only ever raises its priority. Waiting items gain `aging`
+// priority per tick, so low-priority work is delayed under load but never
+// starved. Items are identified by value, so at most one update per item is
+// ever pending.
+template <typename T, typename Hash = std::hash<T>>
+class UpdateScheduler {
+  using Clock = std::chrono::steady_clock;
+
+  struct Entry {
+    double key;
+    uint64_t seq;
+    T item;
+
+    bool operator<(const Entry& other) const {
+      if (key != other.key) {
+        return key < other.key;
+      }
+      return seq > other.seq;
+    }
+  };
+
+ public:
+  using Duration = std::chrono::duration<double, std::milli>;
+
+  explicit UpdateScheduler(double aging = 1.0)
+      : aging_(aging), tick_(0), seq_(0) {
+    CHECK_ARGUMENT(aging >= 0.0);
+  }
+
+  auto size() const {
+    return pending_.size();
+  }
+
+  auto empty() const {
+    return pending_.empty();
+  }
+
+  auto tick() const {
+    return tick_;
+  }
+
+  bool contains(const T& item) const {
+    return pending_.count(item) > 0;
+  }
+
+  void push(T item, double priority) {
+    // Aging is applied by discounting later arrivals rather than by updating
+    // the waiting entries, which keeps the ordering static.
+    auto key = priority - aging_ * static_cast<double>(tick_);
+    auto [it, inserted] = pending_.try_emplace(item, key);
+    if (!inserted) {
+      if (key <= it->second) {
+        return;
+      }
+      it->second = key;
+    }
+    heap_.push(Entry{key, seq_++, std::move(item)});
+  }
+
+  // Removes and returns the highest-priority pending item. Ties are broken in
+  // first-in, first-out order.
+  T pop() {
+    CHECK_ARGUMENT(!empty());
+    for (;;) {
+      auto entry = heap_.top();
+      heap_.pop();
+
+      // Skip entries superseded by a later priority increase.
+      auto it = pending_.find(entry.item);
+      if (it != pending_.end() && it->second == entry.key) {
+        pending_.erase(it);
+        return std::move(entry.item);
+      }
+    }
+  }
+
+  // Invokes fn(item) on pending items in priority order until none are left or
+  // the budget is spent, then advances the tick. At least one item is processed
+  // per call so that progress is made even when a single item exceeds the
+  // budget. Items pushed by fn may be handed out within the same call. Returns
+  // the number of items processed.
+  template <typename Fn>
+  size_t run(Duration budget, Fn&& fn) {
+    auto deadline =
+        Clock::now() + std::chrono::duration_cast<Clock::duration>(budget);
+    size_t ret = 0;
+    while (!empty() && (ret == 0 || Clock::now() < deadline)) {
+      fn(pop());
+      ret += 1;
+    }
+    tick_ += 1;
+    compact();
+    return ret;
+  }
+
+ private:
+  // Drops stale entries once they dominate the heap.
+  void compact() {
+    if (heap_.size() <= 2 * pending_.size() + 64) {
+      return;
+    }
+    std::vector<Entry> entries;
+    entries.reserve(pending_.size());
+    while (!heap_.empty()) {
+      auto entry = heap_.top();
+      heap_.pop();
+      auto it = pending_.find(entry.item);
+      if (it != pending_.end() && it->second == entry.key) {
+        entries.push_back(std::move(entry));
+      }
+    }
+    heap_ = std::priority_queue<Entry>(std::less<Entry>(), std::move(entries));
+  }
+
+  double aging_;
+  uint64_t tick_;
+  uint64_t seq_;
+  std::priority_queue<Entry> heap_;
+  std::unordered_map<T, double, Hash> pending_;
+};
+
+}  // namespace voxeloo::gaia
@@ -0,0 +1,63 @@
+#include "voxeloo/gaia/scheduler.hpp"
+
+#include <catch2/catch.hpp>
+#include <vector>
+
+using namespace voxeloo;  // NOLINT
+
+TEST_CASE("Test scheduler priorities", "[all]") {
+  gaia::UpdateScheduler<int> scheduler(0.0);
+  scheduler.push(1, 1.0);
+  scheduler.push(2, 5.0);
+  scheduler.push(3, 1.0);
+  scheduler.push(4, 3.0);
+  REQUIRE(scheduler.size() == 4);
+
+  // Re-pushing only ever raises the priority.
+  scheduler.push(2, 0.0);
+  scheduler.push(3, 4.0);
+  REQUIRE(scheduler.size() == 4);
+
+  std::vector<int> order;
+  while (!scheduler.empty()) {
+    order.push_back(scheduler.pop());
+  }
+  REQUIRE(order == std::vector<int>{2, 3, 4, 1});
+}
+
+TEST_CASE("Test scheduler aging", "[all]") {
+  gaia::UpdateScheduler<int> scheduler(1.0);
+  scheduler.push(1, 0.0);
+
+  // Each tick hands out one item and queues a more important one.
+  std::vector<int> order;
+  for (int i = 2; i <= 5; i += 1) {
+    scheduler.push(i, 2.5);
+    scheduler.run(std::chrono::milliseconds(0), [&](int item) {
+      order.push_back(item);
+    });
+  }
+
+  // The old, low-priority item overtakes new arrivals after a few ticks.
+  REQUIRE(order == std::vector<int>{2, 3, 4, 1});
+  REQUIRE(scheduler.pop() == 5);
+}
+
+TEST_CASE("Test scheduler budget", "[all]") {
+  gaia::UpdateScheduler<int> scheduler;
+  for (int i = 0; i < 1000; i += 1) {
+    scheduler.push(i, static_cast<double>(i));
+  }
+
+  // At least one item is processed, even with no budget at all.
+  std::vector<int> order;
+  auto fn = [&](int item) {
+    order.push_back(item);
+  };
+  REQUIRE(scheduler.run(std::chrono::milliseconds(0), fn) == 1);
+  REQUIRE(order == std::vector<int>{999});
+
+  REQUIRE(scheduler.run(std::chrono::hours(1), fn) == 999);
+  REQUIRE(scheduler.empty());
+  REQUIRE(scheduler.tick() == 2);
+}
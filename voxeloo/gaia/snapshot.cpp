@@ -0,0 +1,34 @@
+#include "voxeloo/gaia/snapshot.hpp"
+
+namespace voxeloo::gaia {
+
+VersionedTerrainMap::VersionedTerrainMap(TerrainMapV2 map)
+    : epoch_(0), current_(std::make_shared<TerrainMapV2>(std::move(map))) {}
+
+uint64_t VersionedTerrainMap::epoch() const {
+  std::lock_guard lock(publish_mutex_);
+  return epoch_;
+}
+
+TerrainSnapshot VersionedTerrainMap::snapshot() const {
+  std::lock_guard lock(publish_mutex_);
+  return TerrainSnapshot(epoch_, current_);
+}
+
+std::shared_ptr<const TerrainMapV2> VersionedTerrainMap::load() const {
+  std::lock_guard lock(publish_mutex_);
+  return current_;
+}
+
+void VersionedTerrainMap::publish(std::shared_ptr<const TerrainMapV2> map) {
+  std::shared_ptr<const TerrainMapV2> prev;
+  {
+    std::lock_guard lock(publish_mutex_);
+    prev.swap(current_);
+    current_ = std::move(map);
+    epoch_ += 1;
+  }
+  // The previous version (if unpinned) is released outside of the lock.
+}
+
+}  // namespace voxeloo::gaia
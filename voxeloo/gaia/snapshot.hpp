@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+#include "voxeloo/common/errors.hpp"
+#include "voxeloo/gaia/terrain.hpp"
+
+namespace voxeloo::gaia {
+
+// An immutable, consistent view of a TerrainMapV2 at some epoch. Holding the
+// snapshot pins the version: its chunks are never modified in place, so jobs
+// may read it from any thread while newer versions are being committed.
+class TerrainSnapshot {
+ public:
+  TerrainSnapshot(uint64_t epoch, std::shared_ptr<const TerrainMapV2> map)
+      : epoch_(epoch), map_(std::move(map)) {}
+
+  auto epoch() const {
+    return epoch_;
+  }
+
+  const TerrainMapV2& get() const {
+    return *map_;
+  }
+
+  const TerrainMapV2& operator*() const {
+    return *map_;
+  }
+
+  const TerrainMapV2* operator->() const {
+    return map_.get();
+  }
+
+ private:
+  uint64_t epoch_;
+  std::shared_ptr<const TerrainMapV2> map_;
+};
+
+// Multi-version wrapper around a TerrainMapV2.
+//
+// Readers take O(1) snapshots of the latest committed version. Writers stage
+// updates against a private copy of the latest version and publish it on
+// commit. The copy is shallow: chunks are shared between versions and every
+// TerrainMapV2::update_* call swaps in a new chunk pointer rather than
+// modifying a chunk, so unchanged chunks are never duplicated. Commits are
+// serialized with respect to each other; readers only ever wait on the swap of
+// the published version pointer.
+class VersionedTerrainMap {
+ public:
+  explicit VersionedTerrainMap(TerrainMapV2 map);
+
+  uint64_t epoch() const;
+  TerrainSnapshot snapshot() const;
+
+  // Applies fn(TerrainMapV2&) to a copy-on-write version of the latest map and
+  // publishes the result. Returns the epoch of the committed version. Batching
+  // many updates into one commit amortizes the cost of the shallow copy.
+  template <typename Fn>
+  uint64_t commit(Fn&& fn) {
+    std::lock_guard lock(commit_mutex_);
+    auto next = std::make_shared<TerrainMapV2>(*load());
+    fn(*next);
+    publish(std::move(next));
+    return epoch();
+  }
+
+ private:
+  std::shared_ptr<const TerrainMapV2> load() const;
+  void publish(std::shared_ptr<const TerrainMapV2> map);
+
+  std::mutex commit_mutex_;
+  mutable std::mutex publish_mutex_;
+  uint64_t epoch_;
+  std::shared_ptr<const TerrainMapV2> current_;
+};
+
+}  // namespace voxeloo::gaia
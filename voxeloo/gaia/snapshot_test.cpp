@@ -0,0 +1,97 @@
+#include "voxeloo/gaia/snapshot.hpp"
+
+#include <catch2/catch.hpp>
+
+#include "voxeloo/common/geometry.hpp"
+#include "voxeloo/gaia/light.hpp"
+
+using namespace voxeloo;  // NOLINT
+using galois::terrain::TerrainId;
+
+namespace {
+
+auto make_map() {
+  gaia::TerrainMapBuilderV2 builder;
+  for (int x = 0; x < 96; x += 32) {
+    builder.assign_seed_block(
+        {x, 0, 0}, tensors::make_tensor<TerrainId>(tensors::kChunkShape, 1));
+    builder.assign_occlusion_block(
+        {x, 0, 0}, tensors::make_tensor<uint8_t>(tensors::kChunkShape, 0));
+  }
+  return std::move(builder).build();
+}
+
+}  // namespace
+
+TEST_CASE("Test that snapshots are isolated from commits", "[all]") {
+  gaia::VersionedTerrainMap map(make_map());
+
+  auto before = map.snapshot();
+  REQUIRE(before.epoch() == 0);
+  REQUIRE(before->get_terrain({40, 0, 0}) == 1);
+
+  auto epoch = map.commit([](gaia::TerrainMapV2& map) {
+    map.update_diff(
+        {32, 0, 0},
+        tensors::make_tensor<std::optional<TerrainId>>(
+            tensors::kChunkShape, 7));
+  });
+  REQUIRE(epoch == 1);
+
+  auto after = map.snapshot();
+  REQUIRE(after.epoch() == 1);
+  REQUIRE(after->get_terrain({40, 0, 0}) == 7);
+
+  // The pinned snapshot still observes the old version.
+  REQUIRE(before->get_terrain({40, 0, 0}) == 1);
+  REQUIRE(!before->diffs.get({40, 0, 0}));
+
+  // Unchanged chunks are shared between the versions.
+  const auto& t0 = before->terrains;
+  const auto& t1 = after->terrains;
+  REQUIRE(t0.chunk({0, 0, 0}) == t1.chunk({0, 0, 0}));
+  REQUIRE(t0.chunk({32, 0, 0}) != t1.chunk({32, 0, 0}));
+}
+
+TEST_CASE("Test that simulations do not modify snapshot chunks", "[all]") {
+  // A narrow roof over the middle column casts a shadow that the occlusion
+  // falloff spreads into the (stale, fully occluded) neighboring column.
+  auto roof = [] {
+    tensors::SparseTensorBuilder<TerrainId> builder(tensors::kChunkShape);
+    for (auto z = 0u; z < tensors::kChunkDim; z += 1) {
+      for (auto x = 0u; x < 8u; x += 1) {
+        builder.set({x, 31, z}, 1);
+      }
+    }
+    return std::move(builder).build();
+  }();
+
+  gaia::TerrainMapBuilderV2 builder;
+  for (int x = 0; x < 96; x += 32) {
+    for (int y = 0; y < 64; y += 32) {
+      auto pos = vec3(x, y, 0);
+      if (pos == vec3(32, 32, 0)) {
+        builder.assign_seed_block(pos, roof);
+      } else {
+        builder.assign_seed_block(
+            pos, tensors::make_tensor<TerrainId>(tensors::kChunkShape, 0));
+      }
+      builder.assign_occlusion_block(
+          pos, tensors::make_tensor<uint8_t>(tensors::kChunkShape, 15));
+    }
+  }
+
+  gaia::VersionedTerrainMap map(std::move(builder).build());
+  auto snapshot = map.snapshot();
+
+  auto occlusion = gaia::update_occlusion(snapshot.get(), {32, 0});
+  REQUIRE(occlusion.aabb == voxels::Box{{32, 0, 0}, {64, 64, 32}});
+  REQUIRE(occlusion.get({32, 0, 0}) == 8);
+
+  tensors::scan_chunks(
+      snapshot->occlusions.tensor, [&](auto i, auto pos, const auto& chunk) {
+        REQUIRE(tensors::all(chunk.array, [](auto val) {
+          return val == 15;
+        }));
+      });
+}
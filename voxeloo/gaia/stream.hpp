@@ -1,7 +1,14 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
 #include "voxeloo/common/errors.hpp"
 #include "voxeloo/gaia/queue.hpp"
+#include "voxeloo/gaia/ring.hpp"
 #include "voxeloo/tensors/buffers.hpp"
 
 namespace voxeloo::gaia {
@@ -72,4 +79,194 @@ class StreamReader {
   std::shared_ptr<ClosableQueue<T>> queue_;
 };
 
+// Thread-safe streams.
+//
+// A SyncStream may be written from any number of threads while each reader is
+// drained from its own thread. Every subscriber owns a bounded lock-free ring
+// buffer. When a ring is full, the Overflow policy of the stream decides what
+// happens to the event:
+//
+//  * DropOverflow discards the event and flags the reader, which must then
+//    resynchronize its state from the source of truth (see needs_resync).
+//  * A coalescing policy spills the event into a keyed side table where it is
+//    merged with any pending event for the same key. Merging must be
+//    commutative since spilled events may be drained after newer ring events.
+
+template <typename T>
+struct DropOverflow {
+  static constexpr bool kCoalesce = false;
+};
+
+template <typename T, typename Policy>
+class SyncStreamReader;
+
+template <typename T, typename Policy>
+class SyncQueue {
+ public:
+  explicit SyncQueue(size_t capacity) : ring_(capacity) {}
+
+  bool open() const {
+    return open_.load(std::memory_order_acquire);
+  }
+
+  void close() {
+    open_.store(false, std::memory_order_release);
+  }
+
+  bool empty() const {
+    if (!ring_.empty()) {
+      return false;
+    }
+    if constexpr (Policy::kCoalesce) {
+      std::lock_guard lock(spill_mutex_);
+      return spill_.empty();
+    }
+    return true;
+  }
+
+  void push(const T& data) {
+    if (ring_.try_push(data)) {
+      return;
+    }
+    if constexpr (Policy::kCoalesce) {
+      std::lock_guard lock(spill_mutex_);
+      auto key = Policy::key(data);
+      if (auto it = spill_.find(key); it != spill_.end()) {
+        Policy::merge(it->second, data);
+      } else {
+        spill_.emplace(key, data);
+      }
+    } else {
+      resync_.store(true, std::memory_order_release);
+    }
+  }
+
+  void drain(std::vector<T>& out) {
+    for (T val; ring_.try_pop(val);) {
+      out.push_back(std::move(val));
+    }
+    if constexpr (Policy::kCoalesce) {
+      std::lock_guard lock(spill_mutex_);
+      for (auto&& [key, val] : spill_) {
+        out.push_back(std::move(val));
+      }
+      spill_.clear();
+    }
+  }
+
+  bool take_resync() {
+    return resync_.exchange(false, std::memory_order_acq_rel);
+  }
+
+ private:
+  template <typename P, typename = void>
+  struct Spill {
+    using type = std::unordered_map<int, T>;
+  };
+  template <typename P>
+  struct Spill<P, std::enable_if_t<P::kCoalesce>> {
+    using type = std::unordered_map<typename P::Key, T, typename P::Hash>;
+  };
+
+  std::atomic<bool> open_ = true;
+  std::atomic<bool> resync_ = false;
+  RingBuffer<T> ring_;
+  mutable std::mutex spill_mutex_;
+  typename Spill<Policy>::type spill_;
+};
+
+template <typename T, typename Policy = DropOverflow<T>>
+class SyncStream {
+  using QueuePtr = std::shared_ptr<SyncQueue<T, Policy>>;
+  using QueueList = std::vector<QueuePtr>;
+
+ public:
+  using Reader = SyncStreamReader<T, Policy>;
+
+  static constexpr size_t kDefaultCapacity = 1024;
+
+  explicit SyncStream(size_t capacity = kDefaultCapacity)
+      : capacity_(capacity), queues_(std::make_shared<const QueueList>()) {}
+
+  // Lock-free with respect to other writers and to readers.
+  void write(const T& data) {
+    auto queues =
+        std::atomic_load_explicit(&queues_, std::memory_order_acquire);
+    for (const auto& queue : *queues) {
+      if (queue->open()) {
+        queue->push(data);
+      }
+    }
+  }
+
+  auto subscribe() const {
+    auto queue = std::make_shared<SyncQueue<T, Policy>>(capacity_);
+
+    // Publish a new copy of the subscriber list, pruning closed queues.
+    std::lock_guard lock(mutex_);
+    QueueList queues;
+    for (const auto& other : *queues_) {
+      if (other->open() && other.use_count() > 1) {
+        queues.push_back(other);
+      }
+    }
+    queues.push_back(queue);
+    std::atomic_store_explicit(
+        &queues_,
+        std::make_shared<const QueueList>(std::move(queues)),
+        std::memory_order_release);
+
+    return Reader(std::move(queue));
+  }
+
+ private:
+  size_t capacity_;
+  mutable std::mutex mutex_;
+  mutable std::shared_ptr<const QueueList> queues_;
+};
+
+template <typename T, typename Policy>
+class SyncStreamReader {
+ public:
+  explicit SyncStreamReader(std::shared_ptr<SyncQueue<T, Policy>> queue)
+      : queue_(std::move(queue)) {}
+
+  bool open() const {
+    return queue_->open();
+  }
+
+  bool empty() const {
+    return queue_->empty();
+  }
+
+  // Returns true (once) if events were dropped since the last call, in which
+  // case the reader should rebuild its state rather than trust the stream.
+  bool needs_resync() {
+    return queue_->take_resync();
+  }
+
+  // Drains all pending events into the given buffer, reusing its storage.
+  void read(std::vector<T>& out) {
+    out.clear();
+    queue_->drain(out);
+  }
+
+  auto read() {
+    std::vector<T> batch;
+    read(batch);
+    tensors::BufferBuilder<T> builder(batch.size());
+    for (auto& val : batch) {
+      builder.add(std::move(val));
+    }
+    return std::move(builder).build();
+  }
+
+  void close() {
+    queue_->close();
+  }
+
+ private:
+  std::shared_ptr<SyncQueue<T, Policy>> queue_;
+};
+
 }  // namespace voxeloo::gaia
\ No newline at end of file
@@ -1,6 +1,8 @@
 #include "voxeloo/gaia/stream.hpp"
 
+#include <algorithm>
 #include <catch2/catch.hpp>
+#include <thread>
 
 #include "voxeloo/common/geometry.hpp"
 
@@ -57,4 +59,117 @@ TEST_CASE("Test the stream data structure", "[all]") {
   REQUIRE(sub2.read().empty());
   REQUIRE(sub3.read().empty());
   REQUIRE(sub4.read().empty());
-}
\ No newline at end of file
+}
+
+TEST_CASE("Test the ring buffer", "[all]") {
+  gaia::RingBuffer<int> ring(4);
+
+  REQUIRE(ring.empty());
+  REQUIRE(ring.try_push(1));
+  REQUIRE(ring.try_push(2));
+  REQUIRE(ring.try_push(3));
+  REQUIRE(ring.try_push(4));
+  REQUIRE(!ring.try_push(5));
+  REQUIRE(ring.size() == 4);
+
+  int val = 0;
+  REQUIRE(ring.try_pop(val));
+  REQUIRE(val == 1);
+  REQUIRE(ring.try_push(6));
+  for (auto expected : {2, 3, 4, 6}) {
+    REQUIRE(ring.try_pop(val));
+    REQUIRE(val == expected);
+  }
+  REQUIRE(!ring.try_pop(val));
+  REQUIRE(ring.empty());
+}
+
+TEST_CASE("Test the synchronized stream with many writers", "[all]") {
+  static constexpr int kWriters = 4;
+  static constexpr int kWrites = 10000;
+
+  gaia::SyncStream<int> stream(1 << 16);
+  auto sub = stream.subscribe();
+
+  std::vector<std::thread> writers;
+  for (int i = 0; i < kWriters; i += 1) {
+    writers.emplace_back([&, i] {
+      for (int j = 0; j < kWrites; j += 1) {
+        stream.write(i * kWrites + j);
+      }
+    });
+  }
+
+  // Drain concurrently with the writers into a reused buffer.
+  std::vector<int> seen;
+  std::vector<int> batch;
+  while (seen.size() < kWriters * kWrites) {
+    sub.read(batch);
+    seen.insert(seen.end(), batch.begin(), batch.end());
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+
+  REQUIRE(!sub.needs_resync());
+  std::sort(seen.begin(), seen.end());
+  for (int i = 0; i < kWriters * kWrites; i += 1) {
+    REQUIRE(seen[i] == i);
+  }
+}
+
+struct SumByParity {
+  static constexpr bool kCoalesce = true;
+  using Key = int;
+  using Hash = std::hash<int>;
+
+  static auto key(int val) {
+    return val % 2;
+  }
+
+  static void merge(int& into, int from) {
+    into += from;
+  }
+};
+
+TEST_CASE("Test the synchronized stream overflow policies", "[all]") {
+  SECTION("Dropping overflow requests a resync") {
+    gaia::SyncStream<int> stream(2);
+    auto sub = stream.subscribe();
+    stream.write(1);
+    stream.write(2);
+    stream.write(3);
+
+    REQUIRE(to_vector<int>(sub.read()) == std::vector<int>({1, 2}));
+    REQUIRE(sub.needs_resync());
+    REQUIRE(!sub.needs_resync());
+  }
+
+  SECTION("Coalescing overflow merges by key") {
+    gaia::SyncStream<int, SumByParity> stream(2);
+    auto sub = stream.subscribe();
+    for (int i = 1; i <= 6; i += 1) {
+      stream.write(i);
+    }
+
+    auto out = to_vector<int>(sub.read());
+    std::sort(out.begin(), out.end());
+    REQUIRE(out == std::vector<int>({1, 2, 3 + 5, 4 + 6}));
+    REQUIRE(!sub.needs_resync());
+    REQUIRE(sub.empty());
+  }
+
+  SECTION("Closed readers stop receiving events") {
+    gaia::SyncStream<int> stream;
+    auto sub1 = stream.subscribe();
+    stream.write(1);
+    sub1.close();
+    stream.write(2);
+    auto sub2 = stream.subscribe();
+    stream.write(3);
+
+    REQUIRE(!sub1.open());
+    REQUIRE(to_vector<int>(sub1.read()) == std::vector<int>({1}));
+    REQUIRE(to_vector<int>(sub2.read()) == std::vector<int>({3}));
+  }
+}
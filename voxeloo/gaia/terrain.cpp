@@ -1,10 +1,84 @@
 #include "voxeloo/gaia/terrain.hpp"
 
+#include <functional>
+#include <iterator>
+
+#include "prometheus/counter.h"
+#include "voxeloo/common/metrics.hpp"
 #include "voxeloo/common/voxels.hpp"
+#include "voxeloo/gaia/parallel.hpp"
 #include "voxeloo/tensors/tensors.hpp"
 
 namespace voxeloo::gaia {
 
+namespace {
+
+auto& terrain_changes =
+    prometheus::BuildCounter()
+        .Name("gaia_terrain_cpp_changes_total")
+        .Help("Number of chunk change events published by terrain writers.")
+        .Register(metrics::registry())
+        .Add({});
+
+auto& terrain_changed_voxels =
+    prometheus::BuildCounter()
+        .Name("gaia_terrain_cpp_changed_voxels_total")
+        .Help("Number of changed voxels published by terrain writers.")
+        .Register(metrics::registry())
+        .Add({});
+
+}  // namespace
+
+voxels::Box change_box(const TerrainChange& change) {
+  static const auto k = static_cast<int>(tensors::kChunkDim);
+
+  auto ret = voxels::empty_box();
+  tensors::scan(change.mask, [&](auto run, auto changed) {
+    if (!changed) {
+      return;
+    }
+    auto p0 = to<int>(tensors::decode_tensor_pos(run.pos));
+    auto p1 = to<int>(tensors::decode_tensor_pos(run.pos + run.len - 1));
+
+    // Runs that wrap around a row (or a layer) cover its entire extent.
+    voxels::Box box{p0, p1 + 1};
+    if (p0.y != p1.y) {
+      box.v0.x = box.v0.z = 0;
+      box.v1.x = box.v1.z = k;
+    } else if (p0.z != p1.z) {
+      box.v0.x = 0;
+      box.v1.x = k;
+    }
+    ret = voxels::union_box(ret, box);
+  });
+  if (ret == voxels::empty_box()) {
+    return ret;
+  }
+  return voxels::shift_box(ret, change.pos);
+}
+
+size_t change_size(const TerrainChange& change) {
+  size_t ret = 0;
+  tensors::scan(change.mask, [&](auto run, auto changed) {
+    if (changed) {
+      ret += run.len;
+    }
+  });
+  return ret;
+}
+
+void record_terrain_change(size_t voxels) {
+  terrain_changes.Increment();
+  terrain_changed_voxels.Increment(static_cast<double>(voxels));
+}
+
+void merge_change(TerrainChange& into, const TerrainChange& from) {
+  CHECK_ARGUMENT(into.pos == from.pos);
+  into.mask = tensors::merge(into.mask, from.mask, [](bool a, bool b) {
+    return a || b;
+  });
+}
+
 size_t TerrainMapBuilder::storage_size() const {
   auto ret = sizeof(aabb_);
   ret += spatial::storage_size<VolumeChunk>(seeds_);
@@ -80,35 +154,66 @@ void TerrainMapBuilderV2::assign_seed_block(
   seeded_.insert(pos);
 }
 
+void TerrainMapBuilderV2::assign_seed_block(Vec3i pos, VolumeChunk&& seed) {
+  seeds_.assign_block(pos, std::move(seed));
+  seeded_.insert(pos);
+}
+
 void TerrainMapBuilderV2::assign_diff_block(
     Vec3i pos, const SparseChunk& diff) {
   diffs_.assign_block(pos, diff);
 }
 
+void TerrainMapBuilderV2::assign_diff_block(Vec3i pos, SparseChunk&& diff) {
+  diffs_.assign_block(pos, std::move(diff));
+}
+
 void TerrainMapBuilderV2::assign_water_block(
     Vec3i pos, const WaterChunk& water) {
   waters_.assign_block(pos, water);
 }
 
+void TerrainMapBuilderV2::assign_water_block(Vec3i pos, WaterChunk&& water) {
+  waters_.assign_block(pos, std::move(water));
+}
+
 void TerrainMapBuilderV2::assign_irradiance_block(
     Vec3i pos, const IrradianceChunk& irradiance) {
   irradiances_.assign_block(pos, irradiance);
 }
 
+void TerrainMapBuilderV2::assign_irradiance_block(
+    Vec3i pos, IrradianceChunk&& irradiance) {
+  irradiances_.assign_block(pos, std::move(irradiance));
+}
+
 void TerrainMapBuilderV2::assign_dye_block(Vec3i pos, const DyeChunk& dye) {
   dyes_.assign_block(pos, dye);
 }
 
+void TerrainMapBuilderV2::assign_dye_block(Vec3i pos, DyeChunk&& dye) {
+  dyes_.assign_block(pos, std::move(dye));
+}
+
 void TerrainMapBuilderV2::assign_growth_block(
     Vec3i pos, const GrowthChunk& growth) {
   growths_.assign_block(pos, growth);
 }
 
+void TerrainMapBuilderV2::assign_growth_block(Vec3i pos, GrowthChunk&& growth) {
+  growths_.assign_block(pos, std::move(growth));
+}
+
 void TerrainMapBuilderV2::assign_occlusion_block(
     Vec3i pos, const OcclusionChunk& occlusion) {
   occlusions_.assign_block(pos, occlusion);
 }
 
+void TerrainMapBuilderV2::assign_occlusion_block(
+    Vec3i pos, OcclusionChunk&& occlusion) {
+  occlusions_.assign_block(pos, std::move(occlusion));
+}
+
 Vec3i TerrainMapBuilderV2::aabb() {
   return voxels::box_size(seeds_.aabb());
 }
@@ -138,23 +243,51 @@ TerrainMapV2 TerrainMapBuilderV2::build() && {
       occlusions_.aabb(),
   });
 
-  auto seeds = std::move(seeds_).build(aabb);
-  auto diffs = std::move(diffs_).build(aabb);
-  auto terrains = WorldMap<TerrainId>{
-      seeds.aabb,
-      tensors::merge(seeds.tensor, diffs.tensor, [](auto seed, auto diff) {
-        return diff.value_or(seed);
-      })};
-  return TerrainMapV2{
-      std::move(seeds),
-      std::move(diffs),
-      std::move(terrains),
-      std::move(waters_).build(aabb),
-      std::move(irradiances_).build(aabb),
-      std::move(dyes_).build(aabb),
-      std::move(growths_).build(aabb),
-      std::move(occlusions_).build(aabb),
+  TerrainMapV2 ret;
+  std::function<void()> tasks[] = {
+      [&] {
+        ret.seeds = std::move(seeds_).build(aabb);
+      },
+      [&] {
+        ret.diffs = std::move(diffs_).build(aabb);
+      },
+      [&] {
+        ret.waters = std::move(waters_).build(aabb);
+      },
+      [&] {
+        ret.irradiances = std::move(irradiances_).build(aabb);
+      },
+      [&] {
+        ret.dyes = std::move(dyes_).build(aabb);
+      },
+      [&] {
+        ret.growths = std::move(growths_).build(aabb);
+      },
+      [&] {
+        ret.occlusions = std::move(occlusions_).build(aabb);
+      },
   };
+  parallel_for_each(std::size(tasks), [&](uint32_t i) {
+    tasks[i]();
+  });
+
+  const auto& seeds = ret.seeds.tensor;
+  const auto& diffs = ret.diffs.tensor;
+  tensors::Buffer<tensors::ChunkPtr<TerrainId>> terrains(seeds.chunks.size());
+  parallel_for_each(terrains.size(), [&](uint32_t i) {
+    terrains[i] = tensors::make_chunk_ptr(tensors::Chunk<TerrainId>(
+        tensors::merge(
+            seeds.chunks[i]->array,
+            diffs.chunks[i]->array,
+            [](auto seed, auto diff) {
+              return diff.value_or(seed);
+            })));
+  });
+  ret.terrains = WorldMap<TerrainId>{
+      ret.seeds.aabb,
+      tensors::Tensor<TerrainId>(seeds.shape, std::move(terrains)),
+  };
+  return ret;
 }
 
 }  // namespace voxeloo::gaia
@@ -16,6 +16,7 @@
 #include "voxeloo/galois/terrain.hpp"
 #include "voxeloo/tensors/buffers.hpp"
 #include "voxeloo/tensors/routines.hpp"
+#include "voxeloo/tensors/sparse.hpp"
 #include "voxeloo/tensors/tensors.hpp"
 
 namespace voxeloo::gaia {
@@ -165,7 +166,71 @@ class TerrainMapBuilder {
   spatial::Map<DyeChunk> dyes_;
 };
 
-using TerrainStream = Stream<Vec3i>;
+// A chunk-granular terrain change event. Rather than publishing every changed
+// voxel on its own, writers publish the chunk origin together with a run-length
+// encoded mask of the voxels that changed within the chunk.
+struct TerrainChange {
+  Vec3i pos;
+  tensors::Array<bool> mask;
+};
+
+template <typename Fn>
+inline void scan_changes(const TerrainChange& change, Fn&& fn) {
+  tensors::scan(change.mask, [&](auto run, auto changed) {
+    if (changed) {
+      for (auto i = run.pos; i < run.pos + run.len; i += 1) {
+        fn(change.pos + to<int>(tensors::decode_tensor_pos(i)));
+      }
+    }
+  });
+}
+
+// Returns the world-space bounding box of the voxels flagged in the change.
+voxels::Box change_box(const TerrainChange& change);
+
+// Returns the number of voxels modified by the change.
+size_t change_size(const TerrainChange& change);
+
+// Merges the mask of the second event into the first (for the same chunk).
+void merge_change(TerrainChange& into, const TerrainChange& from);
+
+// Merges all events targeting the same chunk into a single event, preserving
+// the order in which each chunk first appears.
+template <typename Range>
+inline auto coalesce_changes(const Range& changes) {
+  std::vector<TerrainChange> ret;
+  Map3<size_t> index;
+  for (const auto& change : changes) {
+    if (auto it = index.find(change.pos); it != index.end()) {
+      merge_change(ret[it->second], change);
+    } else {
+      index.emplace(change.pos, ret.size());
+      ret.push_back(change);
+    }
+  }
+  return ret;
+}
+
+// Overflow policy for terrain streams: events that do not fit in a reader's
+// ring buffer are coalesced by chunk until the reader drains them.
+struct CoalesceChanges {
+  static constexpr bool kCoalesce = true;
+  using Key = Vec3i;
+  using Hash = Vec3Hash;
+
+  static auto key(const TerrainChange& change) {
+    return change.pos;
+  }
+
+  static void merge(TerrainChange& into, const TerrainChange& from) {
+    merge_change(into, from);
+  }
+};
+
+using TerrainStream = SyncStream<TerrainChange, CoalesceChanges>;
+
+// Accounts for a change published by a terrain writer in the gaia metrics.
+void record_terrain_change(size_t voxels);
 
 class TerrainWriter {
  public:
@@ -192,19 +257,22 @@ class TerrainWriter {
  private:
   bool apply_changes(
       Vec3i pos, const auto& src_tensor, const auto& tgt_tensor) {
-    // Publish the positions at which terrain changes.
-    bool changed = false;
+    // Publish a single event with the mask of voxels at which terrain changes.
+    size_t changed = 0;
+    tensors::SparseArrayBuilder<bool> mask(tensors::kChunkSize);
     tensors::diff(
         src_tensor->array, tgt_tensor->array, [&](auto run, auto v1, auto v2) {
-          changed = true;
-          for (auto i = run.pos; i < run.pos + run.len; i += 1) {
-            stream_->write(pos + to<int>(tensors::decode_tensor_pos(i)));
-          }
+          changed += run.len;
+          mask.add(run, true);
         });
+    if (changed) {
+      stream_->write(TerrainChange{pos, std::move(mask).build()});
+      record_terrain_change(changed);
+    }
 
     // Update the map chunk.
     src_tensor->array = std::move(tgt_tensor->array);
-    return changed;
+    return changed > 0;
   }
 
   Dep<Logger> logger_;
@@ -299,18 +367,31 @@ struct TerrainMapV2 {
   }
 };
 
+// Collects the shards of every layer and assembles them into a TerrainMapV2.
+// Blocks passed by rvalue are adopted without copying; either way, their chunks
+// end up shared with the built map and must not be modified afterwards.
 class TerrainMapBuilderV2 {
  public:
   void assign_seed_block(Vec3i pos, const VolumeChunk& seed);
+  void assign_seed_block(Vec3i pos, VolumeChunk&& seed);
   void assign_diff_block(Vec3i pos, const SparseChunk& diff);
-  void assign_water_block(Vec3i pos, const WaterChunk& dye);
+  void assign_diff_block(Vec3i pos, SparseChunk&& diff);
+  void assign_water_block(Vec3i pos, const WaterChunk& water);
+  void assign_water_block(Vec3i pos, WaterChunk&& water);
   void assign_irradiance_block(Vec3i pos, const IrradianceChunk& irradiance);
+  void assign_irradiance_block(Vec3i pos, IrradianceChunk&& irradiance);
   void assign_dye_block(Vec3i pos, const DyeChunk& dye);
-  void assign_growth_block(Vec3i pos, const GrowthChunk& dye);
+  void assign_dye_block(Vec3i pos, DyeChunk&& dye);
+  void assign_growth_block(Vec3i pos, const GrowthChunk& growth);
+  void assign_growth_block(Vec3i pos, GrowthChunk&& growth);
   void assign_occlusion_block(Vec3i pos, const OcclusionChunk& occlusion);
+  void assign_occlusion_block(Vec3i pos, OcclusionChunk&& occlusion);
   Vec3i aabb();
   uint32_t shard_count();
   uint32_t hole_count();
+
+  // Builds the layers concurrently, then merges seeds and diffs into terrains
+  // chunk by chunk, also concurrently. Runs serially in single-threaded builds.
   TerrainMapV2 build() &&;
 
  private:
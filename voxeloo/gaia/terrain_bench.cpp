@@ -0,0 +1,164 @@
+#include <catch2/catch.hpp>
+#include <string>
+#include <vector>
+
+#include "voxeloo/common/geometry.hpp"
+#include "voxeloo/common/threads.hpp"
+#include "voxeloo/gaia/maps.hpp"
+#include "voxeloo/gaia/terrain.hpp"
+
+namespace voxeloo::gaia {
+
+namespace {
+
+using galois::terrain::TerrainId;
+
+// Roughly the extent of a production world, in shards.
+const auto kWorldShards = Vec3i{64, 8, 64};
+
+auto make_seed(int y) {
+  tensors::SparseTensorBuilder<TerrainId> builder(tensors::kChunkShape);
+  if (y == 0) {
+    for (auto z = 0u; z < tensors::kChunkDim; z += 1) {
+      for (auto x = 0u; x < tensors::kChunkDim; x += 1) {
+        builder.set({x, (x * 7 + z * 13) % tensors::kChunkDim, z}, 1);
+      }
+    }
+  }
+  return std::move(builder).build();
+}
+
+// Builds the same map as TerrainMapBuilderV2, one layer and one chunk after
+// another, as the serial reference for its parallel build.
+class SerialTerrainMapBuilder {
+ public:
+  void assign_seed_block(Vec3i pos, VolumeChunk&& seed) {
+    seeds_.assign_block(pos, std::move(seed));
+  }
+
+  void assign_diff_block(Vec3i pos, SparseChunk&& diff) {
+    diffs_.assign_block(pos, std::move(diff));
+  }
+
+  void assign_water_block(Vec3i pos, WaterChunk&& water) {
+    waters_.assign_block(pos, std::move(water));
+  }
+
+  void assign_irradiance_block(Vec3i pos, IrradianceChunk&& irradiance) {
+    irradiances_.assign_block(pos, std::move(irradiance));
+  }
+
+  void assign_dye_block(Vec3i pos, DyeChunk&& dye) {
+    dyes_.assign_block(pos, std::move(dye));
+  }
+
+  void assign_growth_block(Vec3i pos, GrowthChunk&& growth) {
+    growths_.assign_block(pos, std::move(growth));
+  }
+
+  void assign_occlusion_block(Vec3i pos, OcclusionChunk&& occlusion) {
+    occlusions_.assign_block(pos, std::move(occlusion));
+  }
+
+  TerrainMapV2 build() && {
+    auto aabb = voxels::union_box({
+        seeds_.aabb(),
+        diffs_.aabb(),
+        waters_.aabb(),
+        irradiances_.aabb(),
+        dyes_.aabb(),
+        growths_.aabb(),
+        occlusions_.aabb(),
+    });
+
+    TerrainMapV2 ret;
+    ret.seeds = std::move(seeds_).build(aabb);
+    ret.diffs = std::move(diffs_).build(aabb);
+    ret.waters = std::move(waters_).build(aabb);
+    ret.irradiances = std::move(irradiances_).build(aabb);
+    ret.dyes = std::move(dyes_).build(aabb);
+    ret.growths = std::move(growths_).build(aabb);
+    ret.occlusions = std::move(occlusions_).build(aabb);
+
+    const auto& seeds = ret.seeds.tensor;
+    const auto& diffs = ret.diffs.tensor;
+    tensors::Buffer<tensors::ChunkPtr<TerrainId>> terrains(
+        seeds.chunks.size());
+    for (size_t i = 0; i < terrains.size(); i += 1) {
+      terrains[i] = tensors::make_chunk_ptr(tensors::Chunk<TerrainId>(
+          tensors::merge(
+              seeds.chunks[i]->array,
+              diffs.chunks[i]->array,
+              [](auto seed, auto diff) {
+                return diff.value_or(seed);
+              })));
+    }
+    ret.terrains = WorldMap<TerrainId>{
+        ret.seeds.aabb,
+        tensors::Tensor<TerrainId>(seeds.shape, std::move(terrains)),
+    };
+    return ret;
+  }
+
+ private:
+  WorldMapBuilder<TerrainId> seeds_;
+  WorldMapBuilder<std::optional<TerrainId>> diffs_;
+  WorldMapBuilder<uint8_t> waters_;
+  WorldMapBuilder<uint32_t> irradiances_;
+  WorldMapBuilder<uint8_t> dyes_;
+  WorldMapBuilder<uint8_t> growths_;
+  WorldMapBuilder<uint8_t> occlusions_;
+};
+
+template <typename Builder>
+void populate(Builder& builder) {
+  static const auto k = static_cast<int>(tensors::kChunkDim);
+  for (int z = 0; z < kWorldShards.z; z += 1) {
+    for (int y = 0; y < kWorldShards.y; y += 1) {
+      for (int x = 0; x < kWorldShards.x; x += 1) {
+        auto pos = k * vec3(x, y, z);
+        builder.assign_seed_block(pos, make_seed(y));
+        builder.assign_diff_block(
+            pos,
+            tensors::make_tensor<std::optional<TerrainId>>(
+                tensors::kChunkShape));
+        builder.assign_water_block(
+            pos, tensors::make_tensor<uint8_t>(tensors::kChunkShape));
+        builder.assign_irradiance_block(
+            pos, tensors::make_tensor<uint32_t>(tensors::kChunkShape));
+        builder.assign_dye_block(
+            pos, tensors::make_tensor<uint8_t>(tensors::kChunkShape));
+        builder.assign_growth_block(
+            pos, tensors::make_tensor<uint8_t>(tensors::kChunkShape));
+        builder.assign_occlusion_block(
+            pos, tensors::make_tensor<uint8_t>(tensors::kChunkShape, 15));
+      }
+    }
+  }
+}
+
+template <typename Builder>
+void benchmark_build(const std::string& name) {
+  BENCHMARK_ADVANCED(std::string(name))(Catch::Benchmark::Chronometer meter) {
+    std::vector<Builder> builders(meter.runs());
+    for (auto& builder : builders) {
+      populate(builder);
+    }
+    meter.measure([&](int i) {
+      return std::move(builders[i]).build().storage_size();
+    });
+  };
+}
+
+}  // namespace
+
+// The speedup of the parallel build is the ratio of the two, which is only
+// meaningful on machines with several cores.
+TEST_CASE("Benchmark terrain map building", "[all]") {
+  auto cores = threads::cores();
+  benchmark_build<SerialTerrainMapBuilder>("serial build");
+  benchmark_build<TerrainMapBuilderV2>(
+      "build on " + std::to_string(cores) + " cores");
+}
+
+}  // namespace voxeloo::gaia
@@ -36,6 +36,38 @@ TEST_CASE("Test the terrain map", "[all]") {
   REQUIRE(map.get_diff({33, 10, 9}) == 4);
 }
 
+TEST_CASE("Test the terrain map v2 builder", "[all]") {
+  auto water = tensors::make_tensor<uint8_t>(tensors::kChunkShape, 5);
+
+  gaia::TerrainMapBuilderV2 builder;
+  for (int z = 0; z < 64; z += 32) {
+    for (int x = 0; x < 96; x += 32) {
+      builder.assign_seed_block(
+          {x, 0, z},
+          tensors::make_tensor<TerrainId>(tensors::kChunkShape, x + z));
+    }
+  }
+  builder.assign_diff_block(
+      {32, 0, 32},
+      tensors::make_tensor<std::optional<TerrainId>>(tensors::kChunkShape, 7));
+  builder.assign_water_block({64, 0, 0}, water);
+  REQUIRE(builder.hole_count() == 0);
+
+  auto map = std::move(builder).build();
+  REQUIRE(map.aabb() == voxels::Box{{0, 0, 0}, {96, 32, 64}});
+  REQUIRE(map.get_terrain({1, 2, 3}) == 0);
+  REQUIRE(map.get_terrain({65, 2, 3}) == 64);
+  REQUIRE(map.get_terrain({65, 2, 33}) == 96);
+  REQUIRE(map.get_terrain({33, 2, 33}) == 7);
+  REQUIRE(map.waters.get({64, 0, 0}) == 5);
+  REQUIRE(map.waters.get({0, 0, 0}) == 0);
+  REQUIRE(map.occlusions.get({0, 0, 0}) == 0);
+
+  // Copied blocks share their chunks with the map but are left intact.
+  REQUIRE(water.get({0, 0, 0}) == 5);
+  REQUIRE(water.chunks[0] == map.waters.chunk({64, 0, 0}));
+}
+
 TEST_CASE("Test sub world map extraction", "[all]") {
   auto tensor = map_chunks(
       tensors::make_tensor({96, 96, 96}, 0), [&](int i, Vec3u pos, auto _) {
@@ -78,4 +110,55 @@ TEST_CASE("Test sub world map extraction", "[all]") {
     REQUIRE(sub.get({0, 32, 32}) == 12);
     REQUIRE(sub.get({32, 32, 32}) == 13);
   }
-}
\ No newline at end of file
+}
+
+TEST_CASE("Test chunk-granular terrain change events", "[all]") {
+  auto map = gaia::make_dep<gaia::Lazy<gaia::TerrainMap>>();
+  map->set([] {
+    gaia::TerrainMapBuilder builder;
+    builder.assign_seed_block(
+        {0, 0, 0}, tensors::make_tensor<TerrainId>(tensors::kChunkShape, 1));
+    builder.assign_seed_block(
+        {32, 0, 0}, tensors::make_tensor<TerrainId>(tensors::kChunkShape, 2));
+    return std::move(builder).build();
+  }());
+
+  auto stream = gaia::make_dep<gaia::TerrainStream>();
+  auto reader = stream->subscribe();
+  gaia::TerrainWriter writer(gaia::make_dep<gaia::Logger>(), map, stream);
+
+  auto make_diff = [](std::vector<Vec3u> positions) {
+    tensors::SparseTensorBuilder<std::optional<TerrainId>> builder(
+        tensors::kChunkShape);
+    for (auto pos : positions) {
+      builder.set(pos, 5);
+    }
+    return std::move(builder).build();
+  };
+
+  REQUIRE(writer.update_diff({32, 0, 0}, make_diff({{1, 2, 3}, {4, 5, 6}})));
+  REQUIRE(writer.update_diff({0, 0, 0}, make_diff({{0, 31, 0}})));
+  REQUIRE(writer.update_diff(
+      {32, 0, 0}, make_diff({{1, 2, 3}, {4, 5, 6}, {7, 8, 9}})));
+  REQUIRE(!writer.update_diff(
+      {32, 0, 0}, make_diff({{1, 2, 3}, {4, 5, 6}, {7, 8, 9}})));
+
+  auto events = reader.read();
+  REQUIRE(events.size() == 3);
+
+  auto changes = gaia::coalesce_changes(events);
+  REQUIRE(changes.size() == 2);
+  REQUIRE(changes[0].pos == Vec3i{32, 0, 0});
+  REQUIRE(changes[1].pos == Vec3i{0, 0, 0});
+
+  std::vector<Vec3i> positions;
+  gaia::scan_changes(changes[0], [&](auto pos) {
+    positions.push_back(pos);
+  });
+  REQUIRE(positions == std::vector<Vec3i>{{33, 2, 3}, {36, 5, 6}, {39, 8, 9}});
+
+  auto box0 = voxels::Box{{33, 2, 3}, {40, 9, 10}};
+  auto box1 = voxels::Box{{0, 31, 0}, {1, 32, 1}};
+  REQUIRE(gaia::change_box(changes[0]) == box0);
+  REQUIRE(gaia::change_box(changes[1]) == box1);
+}
@@ -2,30 +2,51 @@
 
 #include <chrono>
 
-#include "voxeloo/common/voxels.hpp"
-#include "voxeloo/tensors/routines.hpp"
-#include "voxeloo/tensors/sparse.hpp"
-#include "voxeloo/tensors/tensors.hpp"
+#include "prometheus/gauge.h"
+#include "prometheus/histogram.h"
 
 namespace voxeloo::gaia {
 
-using Clock = std::chrono::high_resolution_clock;
+// Bucket boundaries (in milliseconds) shared by the gaia latency histograms.
+// They span sub-millisecond shard updates up to multi-second initializations.
+inline prometheus::Histogram::BucketBoundaries latency_buckets() {
+  return {0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 25, 50, 100, 250, 1000, 5000};
+}
+
+// Bucket boundaries for per-tick counts (queue sizes, chunks emitted, ...).
+inline prometheus::Histogram::BucketBoundaries count_buckets() {
+  return {0, 1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 4096, 16384};
+}
+
+// Observes the lifetime of the enclosing scope, in milliseconds, on the given
+// histogram. The only work done is a clock read on either end.
+class ScopedTimer {
+  using Clock = std::chrono::steady_clock;
 
-template <typename Fn>
-class Timer {
  public:
-  explicit Timer(Fn&& fn) : fn_(fn) {
-    start_ = Clock::now();
-  }
+  explicit ScopedTimer(prometheus::Histogram& histogram)
+      : histogram_(histogram), gauge_(nullptr), start_(Clock::now()) {}
+
+  // Also sets the gauge to the duration, for a deprecated gauge that the
+  // histogram replaces.
+  ScopedTimer(prometheus::Histogram& histogram, prometheus::Gauge& gauge)
+      : histogram_(histogram), gauge_(&gauge), start_(Clock::now()) {}
+
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
 
-  ~Timer() {
+  ~ScopedTimer() {
     std::chrono::duration<double, std::milli> duration = Clock::now() - start_;
-    fn_(duration.count());
+    histogram_.Observe(duration.count());
+    if (gauge_ != nullptr) {
+      gauge_->Set(duration.count());
+    }
   }
 
  private:
-  std::chrono::time_point<Clock> start_;
-  Fn fn_;
+  prometheus::Histogram& histogram_;
+  prometheus::Gauge* gauge_;
+  Clock::time_point start_;
 };
 
-}  // namespace voxeloo::gaia
\ No newline at end of file
+}  // namespace voxeloo::gaia
@@ -1,63 +1,99 @@
 #include "voxeloo/gaia/water.hpp"
 
+#include <algorithm>
+#include <array>
+#include <memory>
+
+#include "prometheus/counter.h"
+#include "prometheus/histogram.h"
 #include "voxeloo/common/geometry.hpp"
+#include "voxeloo/common/metrics.hpp"
+#include "voxeloo/gaia/parallel.hpp"
+#include "voxeloo/gaia/properties.hpp"
 #include "voxeloo/gaia/terrain.hpp"
+#include "voxeloo/gaia/timer.hpp"
 #include "voxeloo/galois/conv.hpp"
-#include "voxeloo/galois/terrain.hpp"
 #include "voxeloo/tensors/buffers.hpp"
 
 namespace voxeloo::gaia {
 
 namespace {
 
+auto& water_update_ms =
+    prometheus::BuildHistogram()
+        .Name("gaia_water_cpp_update_ms")
+        .Help("Duration per water update.")
+        .Register(metrics::registry())
+        .Add({}, latency_buckets());
+
+auto& water_active_shards =
+    prometheus::BuildHistogram()
+        .Name("gaia_water_cpp_active_shards")
+        .Help("Number of active water shards per step.")
+        .Register(metrics::registry())
+        .Add({}, count_buckets());
+
+auto& water_stepped_voxels =
+    prometheus::BuildCounter()
+        .Name("gaia_water_cpp_stepped_voxels_total")
+        .Help("Number of water voxels stepped.")
+        .Register(metrics::registry())
+        .Add({});
+
+auto& water_chunks =
+    prometheus::BuildCounter()
+        .Name("gaia_water_cpp_chunks_total")
+        .Help("Number of changed water chunks emitted by water updates.")
+        .Register(metrics::registry())
+        .Add({});
+
 static constexpr uint8_t kMaxWater = 15;
 
+using galois::conv::Block;
+
 auto is_flowable(TerrainId id) {
-  return id == 0 || !galois::terrain::is_collidable(id);
+  return (terrain_flags(id) & FLOWABLE) != 0;
 }
 
-auto build_water_mask(const WorldMap<uint8_t>& water, Vec3i chunk_pos) {
-  return galois::conv::to_block(*water.chunk(chunk_pos), [&](Vec3i offset) {
-    auto pos = chunk_pos + offset;
-    return water.contains(pos) ? water.get(pos) : static_cast<uint8_t>(0);
-  });
+// Assembles the padded block around the shard at pos out of the chunks of its
+// 26 neighbours. The chunk function returns nullptr for shards outside of the
+// map, whose voxels are given the fill value.
+template <typename T, typename ChunkFn>
+auto to_padded_block(Vec3i pos, T fill, ChunkFn&& chunk_fn) {
+  static const auto k = static_cast<int>(tensors::kChunkDim);
+
+  galois::conv::Neighbours<T> neighbours;
+  for (auto z = -1; z <= 1; z += 1) {
+    for (auto y = -1; y <= 1; y += 1) {
+      for (auto x = -1; x <= 1; x += 1) {
+        neighbours[galois::conv::neighbour_index({x, y, z})] =
+            chunk_fn(pos + k * vec3(x, y, z));
+      }
+    }
+  }
+
+  return galois::conv::to_block(neighbours, fill);
 }
 
 auto to_flowable_terrain(const TerrainMapV2& map, Vec3i pos) {
-  return tensors::merge(
+  return tensors::Chunk<bool>(tensors::merge(
       map.seeds.chunk(pos)->array,
       map.diffs.chunk(pos)->array,
       [](auto t1, auto t2) {
         return is_flowable(t2.value_or(t1));
-      });
+      }));
 }
 
-}  // namespace
-
-WorldMap<uint8_t> update_water(const TerrainMapV2& map, Vec3i chunk_pos) {
-  // Load a 3D array with all shard positions and their neighbors.
-  auto water_mask = build_water_mask(map.waters, chunk_pos);
-
-  // Map the terrain to a bit-mask of
-  auto flow_shard = to_flowable_terrain(map, chunk_pos);
-
+// Advances the water of a shard by one step, given the padded blocks of the
+// water levels and the flowable voxels around it.
+auto step_water(const Block<uint8_t>& water_mask, const Block<bool>& flow) {
   // Helper routine to check if a given water voxel is "falling" down.
   auto is_falling = [&](Vec3i pos) {
     auto below_pos = pos - vec3(0, 1, 0);
-    auto world_pos = chunk_pos + below_pos;
-    if (map.contains(world_pos)) {
-      if (is_flowable(map.get_terrain(world_pos))) {
-        if (water_mask.get(below_pos) != kMaxWater) {
-          return true;
-        }
-      }
-    }
-    return false;
+    return flow.get(below_pos) && water_mask.get(below_pos) != kMaxWater;
   };
 
-  // Map positions that permit water to pass through them..
-  auto out = tensors::map_sparse(flow_shard, [&](auto i, auto _) {
-    auto pos = to<int>(tensors::decode_tensor_pos(i));
+  auto update = [&](Vec3i pos) {
     auto val = water_mask.get(pos);
     if (val >= kMaxWater) {
       return kMaxWater;
@@ -95,12 +131,147 @@ WorldMap<uint8_t> update_water(const TerrainMapV2& map, Vec3i chunk_pos) {
     } else {
       return static_cast<uint8_t>(d_max - 1);
     }
+  };
+
+  // Only positions that permit water to pass through them hold any.
+  tensors::ArrayBuilder<uint8_t> builder;
+  for (tensors::ArrayPos i = 0; i < tensors::kChunkSize; i += 1) {
+    auto pos = to<int>(tensors::decode_tensor_pos(i));
+    builder.add(1, flow.get(pos) ? update(pos) : static_cast<uint8_t>(0));
+  }
+  return tensors::Chunk<uint8_t>(std::move(builder).build());
+}
+
+bool same_water(
+    const tensors::Chunk<uint8_t>& a, const tensors::Chunk<uint8_t>& b) {
+  return tensors::all(
+      tensors::merge(
+          a.array,
+          b.array,
+          [](uint8_t x, uint8_t y) {
+            return x == y;
+          }),
+      [](bool eq) {
+        return eq;
+      });
+}
+
+}  // namespace
+
+WorldMap<uint8_t> update_water(const TerrainMapV2& map, Vec3i chunk_pos) {
+  ScopedTimer timer(water_update_ms);
+  water_active_shards.Observe(1);
+  water_stepped_voxels.Increment(tensors::kChunkSize);
+  water_chunks.Increment();
+
+  // Load 3D arrays with the shard and its neighbors.
+  auto water_mask = to_padded_block<uint8_t>(chunk_pos, 0, [&](Vec3i pos) {
+    return map.contains(pos) ? map.waters.chunk(pos).get() : nullptr;
   });
+  auto flow = galois::conv::to_block(
+      to_flowable_terrain(map, chunk_pos), [&](Vec3i offset) {
+        auto pos = chunk_pos + offset;
+        return map.contains(pos) && is_flowable(map.get_terrain(pos));
+      });
 
   // Write out the updated chunk
   return WorldMap<uint8_t>{
       voxels::shift_box(kShardBox, chunk_pos),
-      make_tensor(tensors::Chunk(out))};
+      make_tensor(step_water(water_mask, flow))};
+}
+
+WaterUpdate update_water(
+    const TerrainMapV2& map, const std::vector<Vec3i>& shards, int steps) {
+  static const auto k = static_cast<int>(tensors::kChunkDim);
+  CHECK_ARGUMENT(steps >= 0);
+  ScopedTimer timer(water_update_ms);
+
+  Set3 active;
+  for (auto pos : shards) {
+    CHECK_ARGUMENT(is_shard_aligned(pos) && map.contains(pos));
+    active.insert(pos);
+  }
+
+  // The water levels as of the latest step, overlaid on the map.
+  Map3<tensors::ChunkPtr<uint8_t>> waters;
+  auto water_chunk = [&](Vec3i pos) -> const tensors::Chunk<uint8_t>* {
+    if (!map.contains(pos)) {
+      return nullptr;
+    }
+    auto it = waters.find(pos);
+    return it != waters.end() ? it->second.get() : map.waters.chunk(pos).get();
+  };
+
+  // The terrain doesn't change while stepping, so its flowable blocks are
+  // assembled once per shard.
+  Map3<tensors::Chunk<bool>> flow_chunks;
+  Map3<std::unique_ptr<Block<bool>>> flow_blocks;
+  auto flow_chunk = [&](Vec3i pos) -> const tensors::Chunk<bool>* {
+    if (!map.contains(pos)) {
+      return nullptr;
+    }
+    auto it = flow_chunks.find(pos);
+    if (it == flow_chunks.end()) {
+      it = flow_chunks.emplace(pos, to_flowable_terrain(map, pos)).first;
+    }
+    return &it->second;
+  };
+
+  std::vector<Vec3i> positions;
+  std::vector<tensors::ChunkPtr<uint8_t>> updates;
+  for (auto step = 0; step < steps && !active.empty(); step += 1) {
+    positions.assign(active.begin(), active.end());
+    water_active_shards.Observe(static_cast<double>(positions.size()));
+    water_stepped_voxels.Increment(
+        static_cast<double>(positions.size() * tensors::kChunkSize));
+    for (auto pos : positions) {
+      if (!flow_blocks.count(pos)) {
+        flow_blocks.emplace(
+            pos,
+            std::make_unique<Block<bool>>(
+                to_padded_block<bool>(pos, false, flow_chunk)));
+      }
+    }
+
+    // Every shard is advanced from the same state before any is written back.
+    updates.assign(positions.size(), nullptr);
+    parallel_for_each(positions.size(), [&](uint32_t i) {
+      auto pos = positions[i];
+      auto water_mask = to_padded_block<uint8_t>(pos, 0, water_chunk);
+      auto next = step_water(water_mask, *flow_blocks.at(pos));
+      if (!same_water(next, *water_chunk(pos))) {
+        updates[i] = tensors::make_chunk_ptr(std::move(next));
+      }
+    });
+
+    active.clear();
+    for (size_t i = 0; i < positions.size(); i += 1) {
+      if (!updates[i]) {
+        continue;
+      }
+      waters[positions[i]] = std::move(updates[i]);
+      for (auto z = -k; z <= k; z += k) {
+        for (auto y = -k; y <= k; y += k) {
+          for (auto x = -k; x <= k; x += k) {
+            auto neighbour = positions[i] + vec3(x, y, z);
+            if (map.contains(neighbour)) {
+              active.insert(neighbour);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  WaterUpdate ret;
+  for (auto& [pos, chunk] : waters) {
+    if (!same_water(*chunk, *map.waters.chunk(pos))) {
+      ret.shards.push_back(WaterShard{pos, std::move(chunk)});
+    }
+  }
+  ret.active.assign(active.begin(), active.end());
+  water_chunks.Increment(static_cast<double>(ret.shards.size()));
+  return ret;
 }
 
-}  // namespace voxeloo::gaia
\ No newline at end of file
+}  // namespace voxeloo::gaia
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <vector>
+
 #include "voxeloo/common/geometry.hpp"
 #include "voxeloo/gaia/terrain.hpp"
 
@@ -7,4 +9,25 @@ namespace voxeloo::gaia {
 
 WorldMap<uint8_t> update_water(const TerrainMapV2& map, Vec3i chunk_pos);
 
-}  // namespace voxeloo::gaia
\ No newline at end of file
+// A water shard whose contents changed.
+struct WaterShard {
+  Vec3i pos;
+  tensors::ChunkPtr<uint8_t> chunk;
+};
+
+struct WaterUpdate {
+  // The shards whose water changed, with their final contents.
+  std::vector<WaterShard> shards;
+  // The shards that may still change on the next step.
+  std::vector<Vec3i> active;
+};
+
+// Advances the water of the given shards by up to the given number of steps.
+// Each step updates every active shard from the state left by the previous
+// step, exactly as update_water would; shards that change activate their
+// neighbours for the next step, while the others are dropped. Stops early once
+// no shard is active.
+WaterUpdate update_water(
+    const TerrainMapV2& map, const std::vector<Vec3i>& shards, int steps);
+
+}  // namespace voxeloo::gaia
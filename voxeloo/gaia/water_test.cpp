@@ -0,0 +1,105 @@
+#include "voxeloo/gaia/water.hpp"
+
+#include <catch2/catch.hpp>
+
+#include "voxeloo/common/geometry.hpp"
+
+using namespace voxeloo;  // NOLINT
+using galois::terrain::TerrainId;
+
+namespace {
+
+// A reservoir of source water on a flat floor, walled in except for a breach
+// in its eastern wall.
+auto make_map() {
+  gaia::TerrainMapBuilderV2 builder;
+  for (int sz = 0; sz < 96; sz += 32) {
+    for (int sy = 0; sy < 64; sy += 32) {
+      for (int sx = 0; sx < 96; sx += 32) {
+        tensors::SparseTensorBuilder<TerrainId> seed(tensors::kChunkShape);
+        tensors::SparseTensorBuilder<uint8_t> water(tensors::kChunkShape);
+        for (auto z = 0; z < 32; z += 1) {
+          for (auto y = 0; y < 32; y += 1) {
+            for (auto x = 0; x < 32; x += 1) {
+              auto pos = vec3(sx + x, sy + y, sz + z);
+              auto inside = pos.x > 40 && pos.x < 55 && pos.z > 40 &&
+                            pos.z < 55 && pos.y >= 20 && pos.y < 30;
+              auto wall = pos.x >= 40 && pos.x <= 55 && pos.z >= 40 &&
+                          pos.z <= 55 && pos.y >= 20 && pos.y < 30 &&
+                          !inside && !(pos.x == 55 && pos.z == 47);
+              auto local = to<unsigned int>(vec3(x, y, z));
+              if (pos.y < 20 || wall) {
+                seed.set(local, 1);
+              } else if (inside) {
+                water.set(local, 15);
+              }
+            }
+          }
+        }
+        builder.assign_seed_block({sx, sy, sz}, std::move(seed).build());
+        builder.assign_water_block({sx, sy, sz}, std::move(water).build());
+      }
+    }
+  }
+  return std::move(builder).build();
+}
+
+// Steps every shard of the map with the single-shard kernel.
+void step_all(gaia::TerrainMapV2& map) {
+  std::vector<std::pair<Vec3i, gaia::WorldMap<uint8_t>>> updates;
+  for (int sz = 0; sz < 96; sz += 32) {
+    for (int sy = 0; sy < 64; sy += 32) {
+      for (int sx = 0; sx < 96; sx += 32) {
+        updates.emplace_back(
+            vec3(sx, sy, sz), gaia::update_water(map, {sx, sy, sz}));
+      }
+    }
+  }
+  for (auto& [pos, water] : updates) {
+    map.update_water(pos, water.tensor);
+  }
+}
+
+void apply(gaia::TerrainMapV2& map, const gaia::WaterUpdate& update) {
+  for (const auto& shard : update.shards) {
+    map.waters.chunk(shard.pos) = shard.chunk;
+  }
+}
+
+}  // namespace
+
+TEST_CASE("Test multi-step water updates", "[all]") {
+  auto expected = make_map();
+  auto actual = expected;
+
+  auto update = gaia::update_water(actual, {{32, 0, 32}}, 10);
+  apply(actual, update);
+  for (auto step = 0; step < 10; step += 1) {
+    step_all(expected);
+  }
+  REQUIRE(!update.shards.empty());
+  REQUIRE(!update.active.empty());
+  REQUIRE(
+      tensors::hash(actual.waters.tensor) ==
+      tensors::hash(expected.waters.tensor));
+  REQUIRE(actual.waters.get({57, 20, 47}) > 0);
+
+  // Resuming from the active shards is the same as stepping them all at once.
+  update = gaia::update_water(actual, update.active, 10);
+  apply(actual, update);
+  for (auto step = 0; step < 10; step += 1) {
+    step_all(expected);
+  }
+  REQUIRE(
+      tensors::hash(actual.waters.tensor) ==
+      tensors::hash(expected.waters.tensor));
+
+  // The flow eventually settles.
+  update = gaia::update_water(actual, update.active, 1000);
+  REQUIRE(update.active.empty());
+
+  // Shards without any water nearby never change.
+  update = gaia::update_water(make_map(), {{0, 32, 0}}, 10);
+  REQUIRE(update.shards.empty());
+  REQUIRE(update.active.empty());
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <optional>
+#include <type_traits>
+#include <vector>
+
+#include "voxeloo/common/errors.hpp"
+#include "voxeloo/common/geometry.hpp"
+#include "voxeloo/common/threads.hpp"
+#include "voxeloo/common/utils.hpp"
+#include "voxeloo/galois/conv.hpp"
+#include "voxeloo/galois/florae.hpp"
+#include "voxeloo/galois/groups.hpp"
+#include "voxeloo/galois/muck.hpp"
+#include "voxeloo/galois/shapes.hpp"
+#include "voxeloo/galois/water.hpp"
+#include "voxeloo/tensors/tensors.hpp"
+
+namespace voxeloo::galois::batch {
+
+// Returns fn(input) for each of the inputs, computed in parallel on the
+// threads executor, in input order.
+template <typename Input, typename Fn>
+inline auto map(const std::vector<Input>& inputs, Fn&& fn) {
+  using Output = std::decay_t<decltype(fn(inputs[0]))>;
+  std::vector<Output> ret(inputs.size());
+  if (!inputs.empty()) {
+    auto n = static_cast<uint32_t>(inputs.size());
+    threads::parallel_for(n, [&](uint32_t i0, uint32_t i1) {
+      for (auto i = i0; i < i1; i += 1) {
+        ret[i] = fn(inputs[i]);
+      }
+    });
+  }
+  return ret;
+}
+
+// Returns the tensor of the shard at the given shard position, or null if
+// there is none. Lookups are made concurrently, so they must not mutate.
+template <typename T>
+using ShardLookup = std::function<const tensors::Tensor<T>*(Vec3i)>;
+
+// The tensors of a shard and of its 26 neighbours, looked up once.
+template <typename T>
+class Neighbourhood {
+ public:
+  Neighbourhood(const ShardLookup<T>& lookup, Vec3i shard) {
+    auto i = 0;
+    for (auto z = -1; z <= 1; z += 1) {
+      for (auto y = -1; y <= 1; y += 1) {
+        for (auto x = -1; x <= 1; x += 1) {
+          tensors_[i++] = lookup(shard + vec3(x, y, z));
+        }
+      }
+    }
+  }
+
+  const tensors::Tensor<T>* center() const {
+    return tensors_[13];
+  }
+
+  // The chunks of the shards, for assembling padded blocks.
+  conv::Neighbours<T> chunks() const {
+    conv::Neighbours<T> ret;
+    for (size_t i = 0; i < tensors_.size(); i += 1) {
+      ret[i] = tensors_[i] ? tensors_[i]->chunks[0].get() : nullptr;
+    }
+    return ret;
+  }
+
+  // Returns the value at the position relative to the shard origin, which
+  // must be within a voxel of the shard, or nothing if its shard is missing.
+  std::optional<T> get(Vec3i pos) const {
+    static constexpr int k = static_cast<int>(tensors::kChunkDim);
+    auto offset = floor_div(pos, k);
+    CHECK_ARGUMENT(
+        offset.x >= -1 && offset.x <= 1 && offset.y >= -1 && offset.y <= 1 &&
+        offset.z >= -1 && offset.z <= 1);
+    auto i = (offset.x + 1) + 3 * (offset.y + 1) + 9 * (offset.z + 1);
+    if (const auto* tensor = tensors_[i]) {
+      return tensor->get(to<unsigned int>(pos - k * offset));
+    }
+    return std::nullopt;
+  }
+
+ private:
+  std::array<const tensors::Tensor<T>*, 27> tensors_;
+};
+
+inline auto shard_origin(Vec3i shard) {
+  return static_cast<int>(tensors::kChunkDim) * shard;
+}
+
+// Meshes the blocks of each of the given shards, culling faces against the
+// neighbouring shards.
+inline auto to_block_geometry(
+    const std::vector<Vec3i>& shards,
+    const shapes::Index& index,
+    const ShardLookup<shapes::IsomorphismId>& isomorphisms) {
+  return map(shards, [&](Vec3i shard) {
+    Neighbourhood<shapes::IsomorphismId> neighbourhood(isomorphisms, shard);
+    const auto* tensor = neighbourhood.center();
+    CHECK_ARGUMENT(tensor != nullptr);
+
+    // Extract the self-occlusion values of the tensor and its neighbours.
+    auto mask_fn = [&](auto id) {
+      return index.occlusion_masks.at(index.offsets.at(id));
+    };
+    auto masks = tensors::map_values(*tensor, mask_fn);
+    auto block = conv::to_block(
+        neighbourhood.chunks(), static_cast<uint8_t>(0), mask_fn);
+    auto occlusion = shapes::to_occlusion_tensor(masks, block);
+
+    return shapes::to_geometry_buffer(*tensor, occlusion, index);
+  });
+}
+
+struct FloraShard {
+  florae::Tensor tensor;
+  florae::GrowthTensor growths;
+  muck::Tensor mucks;
+  Vec3i origin;
+};
+
+inline auto to_flora_geometry(
+    const std::vector<FloraShard>& shards, const florae::Index& index) {
+  return map(shards, [&](const FloraShard& shard) {
+    return florae::to_geometry(
+        shard.tensor, shard.growths, shard.mucks, index, shard.origin);
+  });
+}
+
+// Meshes the water surfaces of each of the given shards, with heights and
+// culling that account for the water and terrain of neighbouring shards.
+inline auto to_water_geometry(
+    const std::vector<Vec3i>& shards,
+    const ShardLookup<shapes::IsomorphismId>& isomorphisms,
+    const ShardLookup<uint8_t>& waters) {
+  return map(shards, [&](Vec3i shard) {
+    Neighbourhood<shapes::IsomorphismId> terrain(isomorphisms, shard);
+    Neighbourhood<uint8_t> water(waters, shard);
+    const auto* tensor = water.center();
+    CHECK_ARGUMENT(tensor != nullptr);
+    auto origin = shard_origin(shard);
+
+    auto surface = water::to_surface(
+        *tensor,
+        conv::to_block(water.chunks(), false, [](auto val) {
+          return val != 0;
+        }));
+
+    // Water heights are averaged around the vertices of the voxels, from the
+    // neighbouring water and air (i.e. empty) voxels.
+    auto air_fn = [&](Vec3i pos) {
+      return terrain.get(pos - origin).value_or(0) == 0;
+    };
+    auto water_fn = [&](Vec3i pos) {
+      return water.get(pos - origin).value_or(0);
+    };
+    conv::BlockCache cached_edge_fn(
+        [origin, kernel = water::make_kernel_fn(air_fn, water_fn)](Vec3i pos) {
+          return kernel(origin + pos);
+        });
+
+    auto height_fn = [&](Vec3u pos) {
+      water::HeightMask mask{0};
+      mask.set({0u, 0u}, cached_edge_fn(to<int>(pos) + vec3(0, 0, 0)));
+      mask.set({1u, 0u}, cached_edge_fn(to<int>(pos) + vec3(1, 0, 0)));
+      mask.set({0u, 1u}, cached_edge_fn(to<int>(pos) + vec3(0, 0, 1)));
+      mask.set({1u, 1u}, cached_edge_fn(to<int>(pos) + vec3(1, 0, 1)));
+      return mask;
+    };
+
+    return water::to_geometry(surface, origin, height_fn);
+  });
+}
+
+inline auto to_group_mesh(
+    const std::vector<groups::Tensor>& tensors, const groups::Index& index) {
+  return map(tensors, [&](const groups::Tensor& tensor) {
+    return groups::to_mesh(tensor, index);
+  });
+}
+
+}  // namespace voxeloo::galois::batch
@@ -0,0 +1,111 @@
+#include "voxeloo/galois/batch.hpp"
+
+#include <catch2/catch.hpp>
+#include <map>
+#include <tuple>
+
+#include "voxeloo/common/geometry.hpp"
+#include "voxeloo/galois/water.hpp"
+#include "voxeloo/tensors/tensors.hpp"
+
+using namespace voxeloo;          // NOLINT
+using namespace voxeloo::galois;  // NOLINT
+
+namespace {
+
+template <typename T>
+struct Shards {
+  std::map<std::tuple<int, int, int>, tensors::Tensor<T>> tensors;
+
+  void set(Vec3i shard, tensors::Tensor<T> tensor) {
+    tensors[{shard.x, shard.y, shard.z}] = std::move(tensor);
+  }
+
+  batch::ShardLookup<T> lookup() const {
+    return [this](Vec3i shard) -> const tensors::Tensor<T>* {
+      auto it = tensors.find({shard.x, shard.y, shard.z});
+      return it != tensors.end() ? &it->second : nullptr;
+    };
+  }
+};
+
+}  // namespace
+
+TEST_CASE("Test batch map keeps the input order", "[all]") {
+  std::vector<int> inputs(10'000);
+  for (size_t i = 0; i < inputs.size(); i += 1) {
+    inputs[i] = static_cast<int>(i);
+  }
+  auto outputs = batch::map(inputs, [](int i) {
+    return std::vector<int>(i % 7, i);
+  });
+  REQUIRE(outputs.size() == inputs.size());
+  for (size_t i = 0; i < inputs.size(); i += 1) {
+    REQUIRE(outputs[i] == std::vector<int>(i % 7, static_cast<int>(i)));
+  }
+
+  auto empty = batch::map(std::vector<int>{}, [](int i) {
+    return i;
+  });
+  REQUIRE(empty.empty());
+  REQUIRE_THROWS(batch::map(inputs, [](int i) {
+    CHECK_ARGUMENT(i != 5000);
+    return i;
+  }));
+}
+
+TEST_CASE("Test shard neighbourhoods", "[all]") {
+  Shards<uint8_t> shards;
+  auto make_shard = [](uint8_t val) {
+    return tensors::make_tensor<uint8_t>(tensors::kChunkShape, val);
+  };
+  shards.set({0, 0, 0}, make_shard(1));
+  shards.set({1, 0, 0}, make_shard(2));
+  shards.set({0, 0, -1}, make_shard(3));
+
+  batch::Neighbourhood<uint8_t> neighbourhood(shards.lookup(), {0, 0, 0});
+  REQUIRE(neighbourhood.center() != nullptr);
+  REQUIRE(neighbourhood.get({0, 0, 0}) == 1);
+  REQUIRE(neighbourhood.get({31, 5, 31}) == 1);
+  REQUIRE(neighbourhood.get({32, 5, 0}) == 2);
+  REQUIRE(neighbourhood.get({0, 5, -1}) == 3);
+  REQUIRE(neighbourhood.get({-1, 5, 0}) == std::nullopt);
+  REQUIRE_THROWS(neighbourhood.get({64, 0, 0}));
+}
+
+TEST_CASE("Test batch water meshing", "[all]") {
+  auto full = tensors::make_tensor<uint8_t>(tensors::kChunkShape, 15);
+  Shards<uint8_t> waters;
+  waters.set({0, 0, 0}, full);
+  waters.set({1, 0, 0}, full);
+  waters.set({5, 0, 0}, full);
+  Shards<shapes::IsomorphismId> isomorphisms;
+
+  auto geometry = batch::to_water_geometry(
+      {{5, 0, 0}, {0, 0, 0}, {1, 0, 0}},
+      isomorphisms.lookup(),
+      waters.lookup());
+  REQUIRE(geometry.size() == 3);
+  REQUIRE(geometry[0].origin == vec3(160, 0, 0));
+  REQUIRE(geometry[1].origin == vec3(0, 0, 0));
+  REQUIRE(geometry[2].origin == vec3(32, 0, 0));
+
+  // Faces between neighbouring shards are culled.
+  auto count_faces = [](const water::GeometryBuffer& buffer, voxels::Dir dir) {
+    auto ret = 0;
+    for (const auto& vertex : buffer.vertices) {
+      ret += static_cast<voxels::Dir>(vertex.dir) == dir;
+    }
+    return ret;
+  };
+  REQUIRE(count_faces(geometry[0], voxels::X_NEG) > 0);
+  REQUIRE(count_faces(geometry[0], voxels::X_POS) > 0);
+  REQUIRE(count_faces(geometry[1], voxels::X_NEG) > 0);
+  REQUIRE(count_faces(geometry[1], voxels::X_POS) == 0);
+  REQUIRE(count_faces(geometry[2], voxels::X_NEG) == 0);
+  REQUIRE(count_faces(geometry[2], voxels::X_POS) > 0);
+
+  // Shards must have a tensor to be meshed.
+  REQUIRE_THROWS(batch::to_water_geometry(
+      {{2, 0, 0}}, isomorphisms.lookup(), waters.lookup()));
+}
@@ -1,6 +1,11 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <limits>
+#include <optional>
+#include <tuple>
+#include <type_traits>
 #include <vector>
 
 #include "voxeloo/common/bits.hpp"
@@ -61,10 +66,35 @@ inline auto to_box_list(const tensors::Tensor<T>& tensor, Vec3d origin) {
   return out;
 }
 
-// TODO(taylor): Add a level of indirection to handle large numbers of boxes.
+inline auto overlaps(const AABB& a, const AABB& b) {
+  auto v0 = max(a.v0, b.v0);
+  auto v1 = min(a.v1, b.v1);
+  return v0.x < v1.x && v0.y < v1.y && v0.z < v1.z;
+}
+
+// A set of boxes indexed by a bounding volume hierarchy, so that queries only
+// visit the boxes near them. The hierarchy is built once by splitting the
+// boxes at their median along the longest axis of their bounds.
 class BoxDict {
+  // The boxes per leaf, below which scanning beats descending further.
+  static constexpr uint32_t kLeafSize = 4;
+
+  // Inner nodes are followed by their left child and point to their right
+  // one, while leaves (with no right child) hold the boxes [begin, end).
+  struct Node {
+    AABB bounds;
+    uint32_t right;
+    uint32_t begin;
+    uint32_t end;
+  };
+
  public:
-  explicit BoxDict(BoxList boxes) : boxes_(std::move(boxes)) {}
+  explicit BoxDict(BoxList boxes) : boxes_(std::move(boxes)) {
+    CHECK_ARGUMENT(boxes_.size() < std::numeric_limits<uint32_t>::max());
+    if (!boxes_.empty()) {
+      build(0, static_cast<uint32_t>(boxes_.size()));
+    }
+  }
 
   auto size() const {
     return boxes_.size();
@@ -77,22 +107,43 @@ class BoxDict {
     }
   }
 
+  // Calls fn on each box intersecting the given one, in no particular order.
+  // If fn returns a bool, then returning true stops the query.
   template <typename Fn>
   void intersect(const AABB& aabb, Fn&& fn) const {
-    for (const auto& b : boxes_) {
-      auto v0 = max(b.v0, aabb.v0);
-      auto v1 = min(b.v1, aabb.v1);
-      if (v0.x < v1.x && v0.y < v1.y && v0.z < v1.z) {
-        if constexpr (std::is_same_v<decltype(fn(b)), bool>) {
-          if (fn(b)) {
-            return;
+    if (nodes_.empty()) {
+      return;
+    }
+
+    // The tree is balanced, so its depth is below 32.
+    std::array<uint32_t, 64> stack;
+    size_t top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+      auto i = stack[--top];
+      const auto& node = nodes_[i];
+      if (!overlaps(node.bounds, aabb)) {
+        continue;
+      }
+      if (node.right != 0) {
+        stack[top++] = node.right;
+        stack[top++] = i + 1;
+        continue;
+      }
+      for (auto j = node.begin; j < node.end; j += 1) {
+        const auto& b = boxes_[j];
+        if (overlaps(b, aabb)) {
+          if constexpr (std::is_same_v<decltype(fn(b)), bool>) {
+            if (fn(b)) {
+              return;
+            }
+          } else {
+            fn(b);
           }
-        } else {
-          fn(b);
         }
       }
     }
-  };
+  }
 
   bool intersects(const AABB& aabb) const {
     bool ret = false;
@@ -103,8 +154,57 @@ class BoxDict {
     return ret;
   }
 
+  // Batch variant of intersect(), calling fn with the index of each query
+  // along with each box intersecting it. Returning true from fn stops only
+  // the current query.
+  template <typename Fn>
+  void intersect(const std::vector<AABB>& aabbs, Fn&& fn) const {
+    for (size_t i = 0; i < aabbs.size(); i += 1) {
+      intersect(aabbs[i], [&](const AABB& b) {
+        return fn(i, b);
+      });
+    }
+  }
+
+  // Returns whether each of the given boxes intersects any box.
+  auto intersects(const std::vector<AABB>& aabbs) const {
+    std::vector<bool> ret(aabbs.size());
+    for (size_t i = 0; i < aabbs.size(); i += 1) {
+      ret[i] = intersects(aabbs[i]);
+    }
+    return ret;
+  }
+
  private:
+  uint32_t build(uint32_t begin, uint32_t end) {
+    AABB bounds = boxes_[begin];
+    for (auto i = begin + 1; i < end; i += 1) {
+      bounds.v0 = min(bounds.v0, boxes_[i].v0);
+      bounds.v1 = max(bounds.v1, boxes_[i].v1);
+    }
+
+    auto index = static_cast<uint32_t>(nodes_.size());
+    nodes_.push_back({bounds, 0, begin, end});
+    if (end - begin > kLeafSize) {
+      auto size = bounds.v1 - bounds.v0;
+      auto axis = size.x > size.y ? (size.x > size.z ? 0 : 2)
+                                  : (size.y > size.z ? 1 : 2);
+      auto mid = begin + (end - begin) / 2;
+      std::nth_element(
+          boxes_.begin() + begin,
+          boxes_.begin() + mid,
+          boxes_.begin() + end,
+          [axis](const AABB& l, const AABB& r) {
+            return l.v0[axis] + l.v1[axis] < r.v0[axis] + r.v1[axis];
+          });
+      build(begin, mid);
+      nodes_[index].right = build(mid, end);
+    }
+    return index;
+  }
+
   BoxList boxes_;
+  std::vector<Node> nodes_;
 };
 
 inline auto to_box_dict(const BoxList& boxes) {
@@ -116,4 +216,91 @@ inline auto to_box_dict(const tensors::Tensor<T>& tensor, Vec3d origin) {
   return to_box_dict(to_box_list(tensor, origin));
 }
 
+// The first contact of a box moving through a set of boxes.
+struct Contact {
+  // The time of impact, or the whole duration of the motion if nothing is hit.
+  double time;
+  // The normal of the face that is hit, or zero if nothing is hit.
+  Vec3d normal;
+};
+
+// Returns the fraction of the displacement after which the moving box first
+// touches the other one, along with the axis of the faces in contact. Boxes
+// that overlap to begin with are never hit, so that stuck boxes can get out.
+inline std::optional<std::tuple<double, int>> sweep(
+    const AABB& aabb, const Vec3d& delta, const AABB& other) {
+  static constexpr auto inf = std::numeric_limits<double>::infinity();
+  auto entry = -inf;
+  auto exit = inf;
+  auto axis = 0;
+  for (auto i = 0; i < 3; i += 1) {
+    auto t0 = -inf;
+    auto t1 = inf;
+    if (delta[i] > 0.0) {
+      t0 = (other.v0[i] - aabb.v1[i]) / delta[i];
+      t1 = (other.v1[i] - aabb.v0[i]) / delta[i];
+    } else if (delta[i] < 0.0) {
+      t0 = (other.v1[i] - aabb.v0[i]) / delta[i];
+      t1 = (other.v0[i] - aabb.v1[i]) / delta[i];
+    } else if (other.v1[i] <= aabb.v0[i] || aabb.v1[i] <= other.v0[i]) {
+      return std::nullopt;
+    }
+    if (t0 > entry) {
+      entry = t0;
+      axis = i;
+    }
+    exit = std::min(exit, t1);
+  }
+  if (entry < 0.0 || entry > 1.0 || entry >= exit) {
+    return std::nullopt;
+  }
+  return std::tuple(entry, axis);
+}
+
+// Returns the first contact of the box moving at the given velocity for the
+// given duration through the boxes of the dicts, e.g. of a shard and of its
+// neighbours.
+inline auto sweep(
+    const std::vector<const BoxDict*>& dicts,
+    const AABB& aabb,
+    const Vec3d& velocity,
+    double dt) {
+  auto delta = dt * velocity;
+  AABB bounds = {
+      min(aabb.v0, aabb.v0 + delta),
+      max(aabb.v1, aabb.v1 + delta),
+  };
+
+  auto time = 1.0;
+  Vec3d normal = {0.0, 0.0, 0.0};
+  for (const auto* dict : dicts) {
+    dict->intersect(bounds, [&](const AABB& box) {
+      if (auto hit = sweep(aabb, delta, box)) {
+        auto [t, axis] = *hit;
+        if (t < time) {
+          time = t;
+          normal = {0.0, 0.0, 0.0};
+          normal[axis] = delta[axis] > 0.0 ? -1.0 : 1.0;
+        }
+      }
+    });
+  }
+  return Contact{time * dt, normal};
+}
+
+// Batch variant of sweep(), for many boxes moving for the same duration.
+inline auto sweep(
+    const std::vector<const BoxDict*>& dicts,
+    const std::vector<AABB>& aabbs,
+    const std::vector<Vec3d>& velocities,
+    double dt) {
+  CHECK_ARGUMENT(aabbs.size() == velocities.size());
+  std::vector<Contact> ret;
+  ret.reserve(aabbs.size());
+  for (size_t i = 0; i < aabbs.size(); i += 1) {
+    ret.push_back(sweep(dicts, aabbs[i], velocities[i], dt));
+  }
+  return ret;
+}
+
 }  // namespace voxeloo::galois::collision
@@ -0,0 +1,139 @@
+#include "voxeloo/galois/collision.hpp"
+
+#include <algorithm>
+#include <catch2/catch.hpp>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include "voxeloo/common/geometry.hpp"
+#include "voxeloo/tensors/sparse.hpp"
+#include "voxeloo/tensors/tensors.hpp"
+
+using namespace voxeloo;                     // NOLINT
+using namespace voxeloo::galois::collision;  // NOLINT
+
+namespace {
+
+auto random_boxes(std::mt19937& rng, size_t count, double max_size) {
+  std::uniform_real_distribution<double> pos(-40.0, 40.0);
+  std::uniform_real_distribution<double> size(0.0, max_size);
+  BoxList ret;
+  for (size_t i = 0; i < count; i += 1) {
+    auto v0 = vec3(pos(rng), pos(rng), pos(rng));
+    ret.push_back({v0, v0 + vec3(size(rng), size(rng), size(rng))});
+  }
+  return ret;
+}
+
+auto sorted(std::vector<Vec3d> corners) {
+  std::sort(corners.begin(), corners.end(), [](const auto& l, const auto& r) {
+    return std::tie(l.x, l.y, l.z) < std::tie(r.x, r.y, r.z);
+  });
+  return corners;
+}
+
+}  // namespace
+
+TEST_CASE("Test box dicts match brute force intersection", "[all]") {
+  std::mt19937 rng(11);
+  auto boxes = random_boxes(rng, 2000, 4.0);
+  auto queries = random_boxes(rng, 500, 8.0);
+  BoxDict dict(boxes);
+  REQUIRE(dict.size() == boxes.size());
+
+  for (const auto& query : queries) {
+    std::vector<Vec3d> expected;
+    for (const auto& box : boxes) {
+      if (overlaps(box, query)) {
+        expected.push_back(box.v0);
+      }
+    }
+    std::vector<Vec3d> found;
+    dict.intersect(query, [&](const AABB& box) {
+      found.push_back(box.v0);
+    });
+    REQUIRE(sorted(found) == sorted(expected));
+    REQUIRE(dict.intersects(query) == !expected.empty());
+  }
+
+  // Batch queries give the same results, and stop early per query.
+  auto hits = dict.intersects(queries);
+  std::vector<int> counts(queries.size());
+  dict.intersect(queries, [&](size_t i, ATTR_UNUSED const AABB& box) {
+    counts[i] += 1;
+    return true;
+  });
+  for (size_t i = 0; i < queries.size(); i += 1) {
+    REQUIRE(hits[i] == dict.intersects(queries[i]));
+    REQUIRE(counts[i] == (hits[i] ? 1 : 0));
+  }
+}
+
+TEST_CASE("Test box dicts with touching and empty boxes", "[all]") {
+  BoxDict empty({});
+  REQUIRE(!empty.intersects(AABB{{0, 0, 0}, {1, 1, 1}}));
+
+  // Boxes that only share a face do not intersect.
+  BoxList boxes;
+  for (auto x = 0; x < 32; x += 1) {
+    auto v0 = vec3(x, 0, 0).to<double>();
+    boxes.push_back({v0, v0 + vec3(1.0, 1.0, 1.0)});
+  }
+  BoxDict dict(boxes);
+  REQUIRE(!dict.intersects(AABB{{0, 1, 0}, {32, 2, 1}}));
+  REQUIRE(!dict.intersects(AABB{{32, 0, 0}, {33, 1, 1}}));
+  auto count = 0;
+  dict.intersect(AABB{{3.5, 0.5, 0.5}, {6.0, 2.0, 2.0}}, [&](const AABB& box) {
+    REQUIRE(box.v0.x >= 3.0);
+    REQUIRE(box.v1.x <= 6.0);
+    count += 1;
+  });
+  REQUIRE(count == 3);
+}
+
+TEST_CASE("Test sweeping boxes through box dicts", "[all]") {
+  // A floor from a terrain tensor, and a wall in a neighbouring shard.
+  tensors::SparseTensorBuilder<bool> builder(tensors::kChunkShape);
+  for (uint32_t x = 0; x < tensors::kChunkDim; x += 1) {
+    for (uint32_t z = 0; z < tensors::kChunkDim; z += 1) {
+      builder.set({x, 0, z}, true);
+    }
+  }
+  auto floor = to_box_dict(std::move(builder).build(), {0.0, 0.0, 0.0});
+  BoxDict wall({{{32.0, 0.0, 0.0}, {33.0, 32.0, 32.0}}});
+  std::vector<const BoxDict*> dicts = {&floor, &wall};
+
+  // Falling onto the floor.
+  AABB player = {{1.0, 2.0, 1.0}, {1.6, 3.8, 1.6}};
+  auto contact = sweep(dicts, player, {0.0, -10.0, 0.0}, 0.5);
+  REQUIRE(contact.time == Approx(0.1));
+  REQUIRE(contact.normal == vec3(0.0, 1.0, 0.0));
+
+  // Walking on the floor, then into the wall.
+  AABB standing = {{30.0, 1.0, 1.0}, {30.6, 2.8, 1.6}};
+  contact = sweep(dicts, standing, {1.0, 0.0, 0.0}, 1.0);
+  REQUIRE(contact.time == 1.0);
+  REQUIRE(contact.normal == vec3(0.0, 0.0, 0.0));
+  contact = sweep(dicts, standing, {4.0, 0.0, 4.0}, 1.0);
+  REQUIRE(contact.time == Approx(0.35));
+  REQUIRE(contact.normal == vec3(-1.0, 0.0, 0.0));
+
+  // Boxes overlapping to begin with can move out of them.
+  AABB stuck = {{31.5, 0.5, 1.0}, {32.5, 2.0, 2.0}};
+  contact = sweep(dicts, stuck, {-1.0, 1.0, 0.0}, 1.0);
+  REQUIRE(contact.time == 1.0);
+
+  // Batches give the same contacts.
+  auto contacts = sweep(
+      dicts,
+      {player, standing, stuck},
+      {{0.0, -10.0, 0.0}, {4.0, 0.0, 4.0}, {-1.0, 1.0, 0.0}},
+      0.5);
+  REQUIRE(contacts.size() == 3);
+  REQUIRE(contacts[0].time == Approx(0.1));
+  REQUIRE(contacts[1].time == Approx(0.35));
+  REQUIRE(contacts[2].time == 0.5);
+  std::vector<AABB> unmatched = {player};
+  REQUIRE_THROWS(sweep(dicts, unmatched, std::vector<Vec3d>{}, 0.5));
+}
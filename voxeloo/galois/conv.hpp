@@ -1,6 +1,7 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
 #include <vector>
 
 #include "voxeloo/common/errors.hpp"
@@ -102,6 +103,108 @@ inline auto to_block(const tensors::Tensor<T>& tensor, BoundaryFn&& fn) {
   return to_block(*tensor.chunks[0], std::forward<BoundaryFn>(fn));
 }
 
+// The chunks around a chunk, indexed by neighbour_index() of their offset, so
+// that the chunk itself is at 13. Missing neighbours are null.
+template <typename T>
+using Neighbours = std::array<const tensors::Chunk<T>*, 27>;
+
+inline auto neighbour_index(Vec3i offset) {
+  return offset.x + 1 + 3 * (offset.y + 1 + 3 * (offset.z + 1));
+}
+
+namespace detail {
+
+// Copies the box [lo, hi] of the chunk into the block, shifted by the given
+// offset. The rows of the box are contiguous along x in the chunk array, so
+// rows within a single run are filled without decoding each of their voxels.
+template <typename T, typename U, typename Fn>
+inline void copy_box(
+    const tensors::Chunk<T>& chunk,
+    Vec3i lo,
+    Vec3i hi,
+    Vec3i shift,
+    Block<U>& block,
+    Fn&& fn) {
+  const auto& [dict, data] = chunk.array;
+  auto len = hi.x - lo.x + 1;
+  for (auto y = lo.y; y <= hi.y; y += 1) {
+    for (auto z = lo.z; z <= hi.z; z += 1) {
+      auto pos = tensors::encode_tensor_pos(to<unsigned int>(vec3(lo.x, y, z)));
+      auto i = block.index(shift + vec3(lo.x, y, z));
+      auto rank = dict.rank(pos);
+      if (rank == dict.rank(pos + len - 1)) {
+        std::fill_n(&block.data[i], len, fn(data[rank]));
+        continue;
+      }
+      for (auto j = 0; j < len; j += 1) {
+        block.data[i + j] = fn(data[dict.rank(pos + j)]);
+      }
+    }
+  }
+}
+
+}  // namespace detail
+
+// Assembles the padded block around the center of the neighbours, decoding
+// only the faces, edges and corners of the other chunks that border it. The
+// values are mapped through fn, and voxels of missing neighbours are given the
+// fill value.
+template <typename T, typename U, typename Fn>
+inline auto to_block(const Neighbours<T>& chunks, U fill, Fn&& fn) {
+  static constexpr int dim = static_cast<int>(tensors::kChunkDim);
+  CHECK_ARGUMENT(chunks[13] != nullptr);
+
+  // The range of chunk coordinates bordering the center along an axis.
+  auto lo_fn = [](int offset) {
+    return offset < 0 ? dim - 1 : 0;
+  };
+  auto hi_fn = [](int offset) {
+    return offset > 0 ? 0 : dim - 1;
+  };
+
+  // Decode the center chunk as a whole.
+  Block<U> block;
+  tensors::scan(chunks[13]->array, [&](auto run, const T& val) {
+    auto mapped = fn(val);
+    for (auto pos = run.pos; pos < run.pos + run.len; pos += 1) {
+      block.set(to<int>(tensors::decode_tensor_pos(pos)), mapped);
+    }
+  });
+
+  for (auto z = -1; z <= 1; z += 1) {
+    for (auto y = -1; y <= 1; y += 1) {
+      for (auto x = -1; x <= 1; x += 1) {
+        if (x == 0 && y == 0 && z == 0) {
+          continue;
+        }
+        auto lo = vec3(lo_fn(x), lo_fn(y), lo_fn(z));
+        auto hi = vec3(hi_fn(x), hi_fn(y), hi_fn(z));
+        auto shift = dim * vec3(x, y, z);
+        if (const auto* chunk = chunks[neighbour_index({x, y, z})]) {
+          detail::copy_box(*chunk, lo, hi, shift, block, fn);
+          continue;
+        }
+        for (auto k = lo.z; k <= hi.z; k += 1) {
+          for (auto j = lo.y; j <= hi.y; j += 1) {
+            for (auto i = lo.x; i <= hi.x; i += 1) {
+              block.set(shift + vec3(i, j, k), fill);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  return block;
+}
+
+template <typename T>
+inline auto to_block(const Neighbours<T>& chunks, T fill) {
+  return to_block(chunks, fill, [](T val) {
+    return val;
+  });
+}
+
 // Provides lazy conv-block memoization, which is helpful when the points of
 // evaluation determined on the fly (e.g. convolving around a surface tensor).
 template <typename Fn>
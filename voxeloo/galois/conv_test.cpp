@@ -0,0 +1,64 @@
+#include "voxeloo/galois/conv.hpp"
+
+#include <catch2/catch.hpp>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "voxeloo/common/geometry.hpp"
+#include "voxeloo/common/utils.hpp"
+#include "voxeloo/tensors/sparse.hpp"
+#include "voxeloo/tensors/tensors.hpp"
+
+using namespace voxeloo;          // NOLINT
+using namespace voxeloo::galois;  // NOLINT
+
+TEST_CASE("Test padded blocks from neighbouring chunks", "[all]") {
+  static constexpr int k = static_cast<int>(tensors::kChunkDim);
+  std::mt19937 rng(3);
+
+  // Chunks of random runs, with some of the neighbours missing.
+  std::vector<tensors::Chunk<int>> chunks;
+  for (auto i = 0; i < 27; i += 1) {
+    tensors::SparseChunkBuilder<int> builder;
+    for (auto j = 0; j < 50; j += 1) {
+      auto x = static_cast<uint32_t>(rng() % tensors::kChunkDim);
+      auto y = static_cast<uint32_t>(rng() % tensors::kChunkDim);
+      auto z = static_cast<uint32_t>(rng() % tensors::kChunkDim);
+      auto val = static_cast<int>(rng() % 4);
+      for (auto n = rng() % 40; n > 0 && x < tensors::kChunkDim; n -= 1) {
+        builder.set({x++, y, z}, val);
+      }
+    }
+    chunks.push_back(std::move(builder).build());
+  }
+  chunks[0] = tensors::make_chunk(2);
+  conv::Neighbours<int> neighbours;
+  for (auto i = 0; i < 27; i += 1) {
+    neighbours[i] = i % 5 == 1 ? nullptr : &chunks[i];
+  }
+
+  auto expected = std::make_unique<conv::Block<int>>();
+  *expected = conv::to_block(chunks[13], [&](Vec3i pos) {
+    auto d = floor_div(pos, k);
+    const auto* chunk = neighbours[conv::neighbour_index(d)];
+    return chunk ? chunk->get(to<unsigned int>(pos - k * d)) : -1;
+  });
+
+  auto block = std::make_unique<conv::Block<int>>();
+  *block = conv::to_block(neighbours, -1);
+  REQUIRE(block->data == expected->data);
+
+  // Values are mapped, but not the fill value.
+  auto mapped = std::make_unique<conv::Block<bool>>();
+  *mapped = conv::to_block(neighbours, true, [](int val) {
+    return val == 2;
+  });
+  for (size_t i = 0; i < mapped->data.size(); i += 1) {
+    auto val = expected->data[i];
+    REQUIRE(mapped->data[i] == (val == -1 || val == 2));
+  }
+
+  neighbours[13] = nullptr;
+  REQUIRE_THROWS(conv::to_block(neighbours, -1));
+}
@@ -300,4 +300,169 @@ TEST_CASE("Test large group tensor building and serde", "[all]") {
     REQUIRE(get_id(pos) == entry.block.block_id);
   });
   REQUIRE(count == dim * dim * dim);
-}
\ No newline at end of file
+}
+
+TEST_CASE("Test merging group block faces", "[all]") {
+  using namespace groups;  // NOLINT
+
+  // A 4x3 wall facing +x, with one face sampling another tile.
+  std::vector<BlockQuad> quads;
+  for (int z = 0; z < 4; z += 1) {
+    for (int y = 0; y < 3; y += 1) {
+      auto uv = z == 3 && y == 2 ? vec2(16.0f, 0.0f) : vec2(0.0f, 0.0f);
+      auto pos = vec3(5, y, z).to<float>();
+      quads.push_back({pos, voxels::X_POS, uv, shapes::Level::MACRO});
+    }
+  }
+  // A micro face on the same plane.
+  quads.push_back(
+      {vec3(40, 8, 8).to<float>(), voxels::X_POS, {}, shapes::Level::MICRO});
+
+  auto merged = merge_block_quads(quads);
+  REQUIRE(merged.size() == 4);
+  auto area = 0.0f;
+  for (const auto& quad : merged) {
+    area += quad.size.x * quad.size.y;
+  }
+  REQUIRE(area == quads.size());
+
+  // The merged quads cover the same faces, with the tile repeating across.
+  TextureAtlaser atlaser({16, 16});
+  atlaser.add(0);
+  atlaser.add(1);
+  std::vector<Texture> textures(2, Texture{{16, 16}, {}});
+  textures[0].data.resize(256);
+  textures[1].data.resize(256);
+  auto mesh = make_tiled_blocklike_mesh(atlaser, textures, merged);
+  REQUIRE(mesh.vertices.size() == 4 * merged.size());
+  REQUIRE(mesh.indices.size() == 6 * merged.size());
+  for (size_t i = 0; i < merged.size(); i += 1) {
+    if (merged[i].size == vec2(4.0f, 2.0f)) {
+      Vec2f uv_max = {0, 0};
+      for (size_t j = 4 * i; j < 4 * i + 4; j += 1) {
+        const auto& vertex = mesh.vertices[j];
+        REQUIRE(vertex.pos.x == 6.0f);
+        REQUIRE(vertex.tile.xy() == vec2(0.0f, 0.0f));
+        REQUIRE(vertex.tile.zw() == atlaser.normalize({16, 16}));
+        uv_max = {
+            std::max(uv_max.x, vertex.uv.x), std::max(uv_max.y, vertex.uv.y)};
+      }
+      REQUIRE(uv_max == vec2(4.0f, 2.0f));
+    }
+  }
+
+  // Unit quads come out of both mesh builders the same.
+  auto unit = make_blocklike_mesh(atlaser, textures, quads);
+  auto tiled = make_tiled_blocklike_mesh(atlaser, textures, quads);
+  for (size_t i = 0; i < unit.vertices.size(); i += 1) {
+    const auto& a = unit.vertices[i];
+    const auto& b = tiled.vertices[i];
+    REQUIRE(a.pos == b.pos);
+    auto uv = b.tile.xy() + b.uv * b.tile.zw();
+    REQUIRE(a.uv.x == Approx(uv.x));
+    REQUIRE(a.uv.y == Approx(uv.y));
+  }
+}
+
+TEST_CASE("Test texture atlas caches", "[all]") {
+  using namespace groups;  // NOLINT
+
+  // Textures of 4x2 pixels, each filled with its own offset.
+  std::vector<Texture> textures;
+  for (uint8_t i = 0; i < 8; i += 1) {
+    textures.push_back({{2, 4}, std::vector<RGBA>(8, {i, 0, 0, 255})});
+  }
+  auto pixel = [](const Texture& texture, Vec2u pos) {
+    return texture.data.at(pos.x + pos.y * texture.shape.y)[0];
+  };
+
+  // Cached tiles are placed as by the atlaser, and blitted only once.
+  AtlasCache cache(textures, {4, 2}, 8);
+  TextureAtlaser atlaser({4, 2});
+  for (auto offset : {3u, 5u, 3u, 0u}) {
+    REQUIRE(cache.add(offset) == atlaser.add(offset));
+  }
+  REQUIRE(cache.atlas().shape == vec2(8u, kMaxAtlasDim));
+  REQUIRE(
+      cache.normalize({4.0f, 2.0f}) ==
+      vec2(4.0f / kMaxAtlasDim, 2.0f / kMaxAtlasDim));
+  auto atlas = atlaser.make_atlas(textures);
+  for (auto offset : {3u, 5u, 0u}) {
+    auto pos = cache.add(offset);
+    for (auto y = 0u; y < 2; y += 1) {
+      for (auto x = 0u; x < 4; x += 1) {
+        REQUIRE(pixel(cache.atlas(), pos + vec2(x, y)) == offset);
+        REQUIRE(pixel(atlas, pos + vec2(x, y)) == offset);
+      }
+    }
+  }
+
+  // Deltas hold the rows blitted since the last one.
+  auto delta = cache.take_delta();
+  REQUIRE(delta.row == 0);
+  REQUIRE(delta.texture.shape == vec2(2u, kMaxAtlasDim));
+  REQUIRE(delta.shape == vec2(8u, kMaxAtlasDim));
+  REQUIRE(!delta.resized);
+  REQUIRE(pixel(delta.texture, {4, 1}) == 5);
+  REQUIRE(cache.take_delta().texture.data.empty());
+  cache.add(5);
+  REQUIRE(cache.take_delta().texture.data.empty());
+
+  // Filling a row of tiles moves on to the next, growing the atlas when full.
+  std::vector<Texture> many(kMaxAtlasDim, textures[7]);
+  AtlasCache full(many, {4, 2}, 4);
+  for (uint32_t i = 0; i < kMaxAtlasDim / 4; i += 1) {
+    full.add(i);
+  }
+  REQUIRE(full.add(kMaxAtlasDim / 4) == vec2(0u, 2u));
+  delta = full.take_delta();
+  REQUIRE(delta.row == 0);
+  REQUIRE(delta.texture.shape.x == 4);
+  REQUIRE(pixel(delta.texture, {0, 3}) == 7);
+  REQUIRE(!delta.resized);
+  for (uint32_t i = kMaxAtlasDim / 4 + 1; i < kMaxAtlasDim / 2; i += 1) {
+    full.add(i);
+  }
+  REQUIRE(full.add(kMaxAtlasDim / 2) == vec2(0u, 4u));
+  REQUIRE(full.atlas().shape == vec2(8u, kMaxAtlasDim));
+  REQUIRE(pixel(full.atlas(), {0, 1}) == 7);
+  REQUIRE(pixel(full.atlas(), {0, 5}) == 7);
+
+  // The delta of a grown atlas holds all of its rows in use.
+  delta = full.take_delta();
+  REQUIRE(delta.resized);
+  REQUIRE(delta.row == 0);
+  REQUIRE(delta.shape == vec2(8u, kMaxAtlasDim));
+  REQUIRE(delta.texture.shape.x == 6);
+  REQUIRE(!full.take_delta().resized);
+
+  // Atlases grow up to kMaxAtlasDim rows.
+  std::vector<Texture> tall(2, {{kMaxAtlasDim, 4}, {}});
+  tall[0].data.resize(4 * kMaxAtlasDim);
+  tall[1].data.resize(4 * kMaxAtlasDim);
+  AtlasCache tallest(tall, {4, kMaxAtlasDim}, 0);
+  REQUIRE(tallest.add(0) == vec2(0u, 0u));
+  REQUIRE(tallest.atlas().shape == vec2(kMaxAtlasDim, kMaxAtlasDim));
+  REQUIRE(tallest.add(1) == vec2(4u, 0u));
+  std::vector<Texture> wide(kMaxAtlasDim / 4 + 1, tall[0]);
+  AtlasCache overflow(wide, {4, kMaxAtlasDim}, 0);
+  for (uint32_t i = 0; i < kMaxAtlasDim / 4; i += 1) {
+    overflow.add(i);
+  }
+  REQUIRE_THROWS(overflow.add(kMaxAtlasDim / 4));
+}
+
+TEST_CASE("Test texture atlas cache tile shapes", "[all]") {
+  using namespace groups;  // NOLINT
+
+  Index index;
+  REQUIRE(atlas_dim(index) == vec2(0u, 0u));
+  index.textures.push_back({{2, 2}, std::vector<RGBA>(4)});
+  index.textures.push_back({{4, 4}, std::vector<RGBA>(16)});
+  index.flora_offsets = {0};
+  REQUIRE(atlas_dim(index) == vec2(2u, 2u));
+  index.glass_offsets = {0, 0};
+  REQUIRE(atlas_dim(index) == vec2(2u, 2u));
+  index.block_offsets = {1};
+  REQUIRE_THROWS(atlas_dim(index));
+}
@@ -2,9 +2,12 @@
 
 #include <cereal/types/tuple.hpp>
 #include <cereal/types/unordered_map.hpp>
+#include <algorithm>
+#include <limits>
 #include <vector>
 
 #include "voxeloo/common/geometry.hpp"
+#include "voxeloo/common/quadifier.hpp"
 #include "voxeloo/common/voxels.hpp"
 #include "voxeloo/galois/blocks.hpp"
 #include "voxeloo/galois/csg.hpp"
@@ -32,7 +35,7 @@ struct Texture {
   std::vector<RGBA> data;
 
   auto ptr() const {
-    return reinterpret_cast<const uint8_t*>(&data[0]);
+    return reinterpret_cast<const uint8_t*>(data.data());
   }
 
   auto bytes() const {
@@ -40,8 +43,18 @@ struct Texture {
   }
 };
 
-struct Mesh {
-  std::vector<Vertex> vertices;
+// A vertex of a face-merged block mesh. Its uv is in tile units and repeats
+// across the quad; the atlas coordinates are tile.xy + fract(uv) * tile.zw.
+struct TiledVertex {
+  Vec3f pos;
+  Vec3f normal;
+  Vec2f uv;
+  Vec4f tile;
+};
+
+template <typename V>
+struct BasicMesh {
+  std::vector<V> vertices;
   std::vector<uint32_t> indices;
   Texture texture;
 
@@ -54,7 +67,7 @@ struct Mesh {
   }
 
   auto vertices_bytes() const {
-    return sizeof(Vertex) * vertices.size();
+    return sizeof(V) * vertices.size();
   }
 
   auto indices_bytes() const {
@@ -62,10 +75,13 @@ struct Mesh {
   }
 
   auto stride() const {
-    return sizeof(Vertex) / sizeof(float);
+    return sizeof(V) / sizeof(float);
   }
 };
 
+using Mesh = BasicMesh<Vertex>;
+using TiledMesh = BasicMesh<TiledVertex>;
+
 struct CombinedMesh {
   Mesh blocks;
   Mesh florae;
@@ -428,6 +444,23 @@ inline auto load(Archive& ar, Tensor& tensor) {
 
 static constexpr auto kMaxAtlasDim = 2048u;
 
+namespace detail {
+
+// Copies the texture of the given tile shape into the atlas at the position,
+// a row at a time.
+inline void blit(
+    const Texture& texture, Vec2u dim, Texture& atlas, Vec2u pos) {
+  auto w = atlas.shape.y;
+  for (auto y = 0u; y < dim.y; y += 1) {
+    std::copy_n(
+        texture.data.begin() + y * dim.x,
+        dim.x,
+        atlas.data.begin() + pos.x + (pos.y + y) * w);
+  }
+}
+
+}  // namespace detail
+
 class TextureAtlaser {
  public:
   explicit TextureAtlaser(Vec2u dim) : dim_(dim), cursor_{0, 0} {}
@@ -465,23 +498,123 @@ class TextureAtlaser {
     ret.shape = vec2(h, w);
     ret.data.resize(w * h);
     for (const auto& [offset, pos] : index_) {
-      auto texture = textures.at(offset);
-      for (auto y = 0u; y < dim_.y; y += 1) {
-        for (auto x = 0u; x < dim_.x; x += 1) {
-          auto i = x + y * dim_.x;
-          auto j = pos.x + x + (pos.y + y) * w;
-          ret.data[j] = texture.data[i];
-        }
+      detail::blit(textures.at(offset), dim_, ret, pos);
+    }
+
+    return ret;
+  }
+
+ private:
+  Vec2u dim_;
+  Vec2u cursor_;
+  std::unordered_map<uint32_t, Vec2u> index_;
+};
+
+// The rows of an atlas cache that changed since the last upload.
+struct AtlasDelta {
+  uint32_t row;
+  Texture texture;
+  // The shape of the whole atlas, which changes when it grows. The rows of a
+  // grown atlas are all held by the delta, so that it can be reallocated.
+  Vec2u shape;
+  bool resized;
+};
+
+// A texture atlas that outlives the meshes built against it, so that textures
+// shared between meshes are blitted and uploaded once. Tiles are never moved,
+// and the atlas grows rows as it fills up. Uvs are normalized against the
+// largest atlas, of kMaxAtlasDim rows, so that the uvs of earlier meshes stay
+// valid as it grows; they must be scaled by kMaxAtlasDim / rows to sample the
+// atlas itself. Caches are not thread-safe.
+class AtlasCache {
+ public:
+  AtlasCache(std::vector<Texture> textures, Vec2u dim, uint32_t height)
+      : textures_(std::move(textures)), dim_(dim), cursor_{0, 0} {
+    CHECK_ARGUMENT(dim.x <= kMaxAtlasDim && dim.y <= kMaxAtlasDim);
+    CHECK_ARGUMENT(height <= kMaxAtlasDim);
+    atlas_.shape = vec2(height, kMaxAtlasDim);
+    atlas_.data.resize(height * kMaxAtlasDim);
+  }
+
+  auto add(uint32_t offset) {
+    auto it = index_.find(offset);
+    if (it == index_.end()) {
+      CHECK_STATE(dim_.x > 0 && dim_.y > 0);
+      if (cursor_.x + dim_.x > kMaxAtlasDim) {
+        cursor_.x = 0;
+        cursor_.y += dim_.y;
+      }
+      if (cursor_.y + dim_.y > atlas_.shape.x) {
+        grow(cursor_.y + dim_.y);
       }
+      const auto& texture = textures_.at(offset);
+      CHECK_ARGUMENT(texture.data.size() == dim_.x * dim_.y);
+      detail::blit(texture, dim_, atlas_, cursor_);
+      dirty_lo_ = std::min(dirty_lo_, cursor_.y);
+      dirty_hi_ = std::max(dirty_hi_, cursor_.y + dim_.y);
+      it = index_.emplace(offset, cursor_).first;
+      cursor_.x += dim_.x;
     }
+    return it->second;
+  }
+
+  auto uv_scale() const {
+    return dim_.template to<float>();
+  }
+
+  auto size() const {
+    return vec2(kMaxAtlasDim, kMaxAtlasDim);
+  }
+
+  auto normalize(Vec2f coord) const {
+    return coord / size().template to<float>();
+  }
 
+  const auto& atlas() const {
+    return atlas_;
+  }
+
+  // Returns the rows blitted to since the last call, and marks them uploaded.
+  auto take_delta() {
+    auto w = atlas_.shape.y;
+    AtlasDelta ret{0, {vec2(0u, w), {}}, atlas_.shape, resized_};
+    if (dirty_lo_ < dirty_hi_) {
+      ret.row = dirty_lo_;
+      ret.texture.shape.x = dirty_hi_ - dirty_lo_;
+      ret.texture.data.assign(
+          atlas_.data.begin() + dirty_lo_ * w,
+          atlas_.data.begin() + dirty_hi_ * w);
+    }
+    dirty_lo_ = std::numeric_limits<uint32_t>::max();
+    dirty_hi_ = 0;
+    resized_ = false;
     return ret;
   }
 
  private:
+  // Doubles the rows of the atlas until it holds the given number of them.
+  void grow(uint32_t rows) {
+    CHECK_STATE(rows <= kMaxAtlasDim);
+    auto height = std::max(atlas_.shape.x, 1u);
+    while (height < rows) {
+      height *= 2;
+    }
+    height = std::min(height, kMaxAtlasDim);
+    atlas_.shape.x = height;
+    atlas_.data.resize(height * kMaxAtlasDim);
+    dirty_lo_ = 0;
+    dirty_hi_ = std::max(dirty_hi_, cursor_.y);
+    resized_ = true;
+  }
+
+  std::vector<Texture> textures_;
   Vec2u dim_;
   Vec2u cursor_;
   std::unordered_map<uint32_t, Vec2u> index_;
+  Texture atlas_;
+  uint32_t dirty_lo_ = std::numeric_limits<uint32_t>::max();
+  uint32_t dirty_hi_ = 0;
+  bool resized_ = false;
 };
 
 inline auto texture_dim(
@@ -494,50 +627,177 @@ inline auto texture_dim(
   }
 }
 
+// Returns the tile shape of the cached atlas of the meshes of the index, which
+// all of its block, flora and glass textures must share.
+inline auto atlas_dim(const Index& index) {
+  auto ret = vec2(0u, 0u);
+  for (const auto* offsets :
+       {&index.block_offsets, &index.flora_offsets, &index.glass_offsets}) {
+    auto dim = texture_dim(*offsets, index.textures);
+    if (dim.x > 0 && dim.y > 0) {
+      CHECK_ARGUMENT(ret == vec2(0u, 0u) || ret == dim);
+      ret = dim;
+    }
+  }
+  return ret;
+}
+
 struct BlockQuad {
   Vec3f pos;
   voxels::Dir dir;
   Vec2f uv;
   shapes::Level lvl;
+  // The extent of the quad along the face uv axes, in units of its level.
+  Vec2f size = {1, 1};
 };
 
+namespace detail {
+
+inline auto to_voxel_space(Vec3f pos, shapes::Level lvl) {
+  if (lvl == shapes::Level::MICRO) {
+    return pos * shapes::kInvMicroScale;
+  } else {
+    return pos;
+  }
+}
+
+// Returns the scale taking the unit face in the given direction to the size.
+inline auto face_extent(Vec2f size, voxels::Dir dir) {
+  switch (dir) {
+    case voxels::X_NEG:
+    case voxels::X_POS:
+      return vec3(1.0f, size.y, size.x);
+    case voxels::Y_NEG:
+    case voxels::Y_POS:
+      return vec3(size.x, 1.0f, size.y);
+    default:
+      return vec3(size.x, size.y, 1.0f);
+  }
+}
+
+// The inverse of voxels::face_uv_coords() on the given plane.
+inline auto face_pos(Vec2i uv, int plane, voxels::Dir dir) {
+  switch (dir) {
+    case voxels::X_NEG:
+    case voxels::X_POS:
+      return vec3(plane, uv.y, uv.x);
+    case voxels::Y_NEG:
+    case voxels::Y_POS:
+      return vec3(uv.x, plane, uv.y);
+    default:
+      return vec3(uv.x, uv.y, plane);
+  }
+}
+
+// Invokes fn(pos, normal, uv) on the vertices of the quad, where the uv is in
+// tile units and runs from the corner of the tile the quad starts on.
+template <typename Fn>
+inline void scan_quad_vertices(const BlockQuad& quad, Fn&& fn) {
+  auto origin = to_voxel_space(quad.pos, quad.lvl);
+  auto normal = voxels::face_normal(quad.dir);
+  auto extent = face_extent(quad.size, quad.dir);
+  for (auto vertex : voxels::face_vertices(quad.dir)) {
+    auto offset = to_voxel_space(vertex * extent, quad.lvl);
+    auto uv = voxels::face_modular_uv_coords(origin, quad.dir);
+    uv += voxels::face_uv_coords(offset, quad.dir);
+    fn(origin + offset, normal, uv);
+  }
+}
+
+}  // namespace detail
+
+// Returns the mesh of the quads, with uvs into the atlas of the atlaser but
+// without the atlas itself.
+template <typename Atlaser>
+inline auto to_blocklike_mesh(
+    const Atlaser& atlaser, const std::vector<BlockQuad>& quads) {
+  Mesh mesh;
+
+  // Populate the mesh with all faces.
+  uint32_t index_offset = 0;
+  for (const auto& quad : quads) {
+    // Push back the quad vertices.
+    detail::scan_quad_vertices(quad, [&](Vec3f pos, Vec3f normal, Vec2f uv) {
+      uv = atlaser.normalize(atlaser.uv_scale() * uv + quad.uv);
+      mesh.vertices.push_back({pos, normal, uv});
+    });
+
+    // Push back the quad indices.
+    for (auto i : voxels::face_indices()) {
+      mesh.indices.push_back(index_offset + i);
+    }
+    index_offset += 4;
+  }
+
+  return mesh;
+}
+
 inline auto make_blocklike_mesh(
     const TextureAtlaser& atlaser,
     const std::vector<Texture>& textures,
     const std::vector<BlockQuad>& quads) {
-  Mesh mesh;
+  auto mesh = to_blocklike_mesh(atlaser, quads);
   mesh.texture = atlaser.make_atlas(textures);
+  return mesh;
+}
 
-  auto to_voxel_space = [](Vec3f pos, shapes::Level lvl) {
-    if (lvl == shapes::Level::MICRO) {
-      return pos * shapes::kInvMicroScale;
-    } else {
-      return pos;
+// Greedily merges adjacent coplanar unit quads of the same level that sample
+// the same atlas tile, so that e.g. a wall of planks becomes a single quad.
+inline auto merge_block_quads(const std::vector<BlockQuad>& quads) {
+  struct Key {
+    shapes::Level lvl;
+    voxels::Dir dir;
+    int plane;
+    Vec2f uv;
+  };
+
+  // Quads are sliced by level, direction and plane, so that only the tile
+  // needs comparing within a slice.
+  struct KeyEqual {
+    bool operator()(const Key& a, const Key& b) const {
+      return a.uv == b.uv;
     }
   };
 
-  // Populate the mesh with all faces.
-  uint32_t index_offset = 0;
+  int planes = 1;
   for (const auto& quad : quads) {
-    // Push back the quad vertices.
-    for (auto vertex : voxels::face_vertices(quad.dir)) {
-      auto lvl = quad.lvl;
-      auto origin = to_voxel_space(quad.pos, lvl);
-      auto offset = to_voxel_space(vertex, lvl);
-
-      // Work out the vertex position and normal.
-      auto pos = origin + offset;
-      auto normal = voxels::face_normal(quad.dir);
-
-      // Work out the uv coordinates in voxel space.
-      auto uv = voxels::face_modular_uv_coords(origin, quad.dir);
-      uv += voxels::face_uv_coords(offset, quad.dir);
-      uv = atlaser.normalize(atlaser.uv_scale() * uv + quad.uv);
+    auto plane = static_cast<int>(quad.pos[quad.dir / 2]);
+    planes = std::max(planes, plane + 1);
+  }
 
-      mesh.vertices.push_back({pos, normal, uv});
-    }
+  quadifier::MaskQuadifier<Key, KeyEqual> quadifier(
+      2 * voxels::kDirCount * planes);
+  for (const auto& quad : quads) {
+    auto plane = static_cast<int>(quad.pos[quad.dir / 2]);
+    auto slice = (quad.lvl * voxels::kDirCount + quad.dir) * planes + plane;
+    auto pos = voxels::face_uv_coords(quad.pos, quad.dir).template to<int>();
+    quadifier.add(slice, {quad.lvl, quad.dir, plane, quad.uv}, pos);
+  }
+
+  std::vector<BlockQuad> ret;
+  for (const auto& [key, quad] : quadifier.build()) {
+    auto pos = detail::face_pos(quad.v0, key.plane, key.dir);
+    auto size = (quad.v1 - quad.v0).template to<float>();
+    ret.push_back({pos.template to<float>(), key.dir, key.uv, key.lvl, size});
+  }
+  return ret;
+}
+
+// Like to_blocklike_mesh(), but for quads spanning several tiles: the
+// texture is repeated over each quad by the shader (see TiledVertex).
+template <typename Atlaser>
+inline auto to_tiled_blocklike_mesh(
+    const Atlaser& atlaser, const std::vector<BlockQuad>& quads) {
+  TiledMesh mesh;
+  auto extent = atlaser.normalize(atlaser.uv_scale());
+  uint32_t index_offset = 0;
+  for (const auto& quad : quads) {
+    auto origin = atlaser.normalize(quad.uv);
+    auto tile = vec4(origin.x, origin.y, extent.x, extent.y);
+    detail::scan_quad_vertices(quad, [&](Vec3f pos, Vec3f normal, Vec2f uv) {
+      mesh.vertices.push_back({pos, normal, uv, tile});
+    });
 
-    // Push back the quad indices.
     for (auto i : voxels::face_indices()) {
       mesh.indices.push_back(index_offset + i);
     }
@@ -547,7 +807,18 @@ inline auto make_blocklike_mesh(
   return mesh;
 }
 
-inline auto populate_block_mesh(const Tensor& tensor, const Index& index) {
+inline auto make_tiled_blocklike_mesh(
+    const TextureAtlaser& atlaser,
+    const std::vector<Texture>& textures,
+    const std::vector<BlockQuad>& quads) {
+  auto mesh = to_tiled_blocklike_mesh(atlaser, quads);
+  mesh.texture = atlaser.make_atlas(textures);
+  return mesh;
+}
+
+template <typename Atlaser>
+inline auto to_block_quads(
+    const Tensor& tensor, const Index& index, Atlaser& atlaser) {
   // Generate the tensor of the blocks shape isomorphisms.
   // NOTE: We mask out shape overrides for voxels with an empty block.
   auto block_mask = tensors::map_values(tensor.blocks, [](auto val) {
@@ -568,9 +839,6 @@ inline auto populate_block_mesh(const Tensor& tensor, const Index& index) {
       tensor.moistures,
       index.blocks);
 
-  // Initialize the texture atlaser.
-  TextureAtlaser atlaser(texture_dim(index.block_offsets, index.textures));
-
   // Collect all of the quads in the output.
   std::vector<BlockQuad> quads;
   shapes::emit_quads(
@@ -592,10 +860,41 @@ inline auto populate_block_mesh(const Tensor& tensor, const Index& index) {
         quads.push_back({scaled_pos.template to<float>(), dir, uv, quad.lvl});
       });
 
+  return quads;
+}
+
+inline auto populate_block_mesh(const Tensor& tensor, const Index& index) {
+  TextureAtlaser atlaser(texture_dim(index.block_offsets, index.textures));
+  auto quads = to_block_quads(tensor, index, atlaser);
   return make_blocklike_mesh(atlaser, index.textures, quads);
 }
 
-inline auto populate_glass_mesh(const Tensor& tensor, const Index& index) {
+// Like populate_block_mesh(), but with coplanar faces of the same texture
+// merged, which cuts the vertex count of typical builds several times over.
+inline auto populate_tiled_block_mesh(
+    const Tensor& tensor, const Index& index) {
+  TextureAtlaser atlaser(texture_dim(index.block_offsets, index.textures));
+  auto quads = merge_block_quads(to_block_quads(tensor, index, atlaser));
+  return make_tiled_blocklike_mesh(atlaser, index.textures, quads);
+}
+
+// Like populate_block_mesh(), but with uvs into the cached atlas, so that the
+// mesh carries no texture of its own.
+inline auto populate_block_mesh(
+    const Tensor& tensor, const Index& index, AtlasCache& cache) {
+  return to_blocklike_mesh(cache, to_block_quads(tensor, index, cache));
+}
+
+// Like populate_tiled_block_mesh(), but with uvs into the cached atlas.
+inline auto populate_tiled_block_mesh(
+    const Tensor& tensor, const Index& index, AtlasCache& cache) {
+  auto quads = merge_block_quads(to_block_quads(tensor, index, cache));
+  return to_tiled_blocklike_mesh(cache, quads);
+}
+
+template <typename Atlaser>
+inline auto to_glass_quads(
+    const Tensor& tensor, const Index& index, Atlaser& atlaser) {
   // Generate the tensor of the shape isomorphisms.
   // NOTE: We mask out shape overrides for voxels without glass blocks.
   auto glass_mask = tensors::map_values(tensor.glasses, [](auto val) {
@@ -617,9 +916,6 @@ inline auto populate_glass_mesh(const Tensor& tensor, const Index& index) {
       tensor.moistures,
       index.glass);
 
-  // Initialize the texture atlaser.
-  TextureAtlaser atlaser(texture_dim(index.glass_offsets, index.textures));
-
   // Collect all of the quads in the output.
   std::vector<BlockQuad> quads;
   shapes::emit_quads(
@@ -641,12 +937,26 @@ inline auto populate_glass_mesh(const Tensor& tensor, const Index& index) {
         quads.push_back({scaled_pos.template to<float>(), dir, uv, quad.lvl});
       });
 
+  return quads;
+}
+
+inline auto populate_glass_mesh(const Tensor& tensor, const Index& index) {
+  TextureAtlaser atlaser(texture_dim(index.glass_offsets, index.textures));
+  auto quads = to_glass_quads(tensor, index, atlaser);
   return make_blocklike_mesh(atlaser, index.textures, quads);
 }
 
-inline auto populate_flora_mesh(const Tensor& tensor, const Index& index) {
-  TextureAtlaser atlaser(texture_dim(index.flora_offsets, index.textures));
+// Like populate_glass_mesh(), but with uvs into the cached atlas.
+inline auto populate_glass_mesh(
+    const Tensor& tensor, const Index& index, AtlasCache& cache) {
+  return to_blocklike_mesh(cache, to_glass_quads(tensor, index, cache));
+}
 
+// Returns the flora mesh, with uvs into the atlas of the atlaser but without
+// the atlas itself.
+template <typename Atlaser>
+inline auto to_flora_mesh(
+    const Tensor& tensor, const Index& index, Atlaser& atlaser) {
   // Build the flora mesh.
   auto geometry = florae::to_geometry(
       tensor.florae,
@@ -670,11 +980,22 @@ inline auto populate_flora_mesh(const Tensor& tensor, const Index& index) {
     vertex.uv = atlaser.normalize(vertex.uv);
   }
 
-  mesh.texture = atlaser.make_atlas(index.textures);
+  return mesh;
+}
 
+inline auto populate_flora_mesh(const Tensor& tensor, const Index& index) {
+  TextureAtlaser atlaser(texture_dim(index.flora_offsets, index.textures));
+  auto mesh = to_flora_mesh(tensor, index, atlaser);
+  mesh.texture = atlaser.make_atlas(index.textures);
   return mesh;
 }
 
+// Like populate_flora_mesh(), but with uvs into the cached atlas.
+inline auto populate_flora_mesh(
+    const Tensor& tensor, const Index& index, AtlasCache& cache) {
+  return to_flora_mesh(tensor, index, cache);
+}
+
 inline auto to_mesh(const Tensor& tensor, const Index& index) {
   CHECK_ARGUMENT(tensor.blocks.shape == tensors::kChunkShape);
   CHECK_ARGUMENT(tensor.florae.shape == tensors::kChunkShape);
@@ -686,6 +1007,20 @@ inline auto to_mesh(const Tensor& tensor, const Index& index) {
   return ret;
 }
 
+// Like to_mesh(), but with the textures of all of the meshes in the cached
+// atlas, whose tiles must then all be of the same shape.
+inline auto to_mesh(
+    const Tensor& tensor, const Index& index, AtlasCache& cache) {
+  CHECK_ARGUMENT(tensor.blocks.shape == tensors::kChunkShape);
+  CHECK_ARGUMENT(tensor.florae.shape == tensors::kChunkShape);
+  CHECK_ARGUMENT(tensor.glasses.shape == tensors::kChunkShape);
+  CombinedMesh ret;
+  ret.blocks = populate_block_mesh(tensor, index, cache);
+  ret.florae = populate_flora_mesh(tensor, index, cache);
+  ret.glass = populate_glass_mesh(tensor, index, cache);
+  return ret;
+}
+
 inline auto to_wireframe_mesh(
     const Tensor& tensor, const shapes::Index& index) {
   shapes::WireframeMeshBuilder builder;
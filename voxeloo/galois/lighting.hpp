@@ -1,12 +1,14 @@
 #pragma once
 
 #include <array>
+#include <memory>
 #include <optional>
 #include <span>
 #include <vector>
 
 #include "voxeloo/common/bits.hpp"
 #include "voxeloo/common/errors.hpp"
+#include "voxeloo/galois/conv.hpp"
 #include "voxeloo/galois/gen/light_kernel.hpp"
 #include "voxeloo/galois/sbo.hpp"
 #include "voxeloo/galois/shapes.hpp"
@@ -141,6 +143,130 @@ inline auto to_light_tensor(
   });
 }
 
+// Computes the same light samples as to_light_tensor() with vertex functions
+// from make_vertex_fn(), given the per-voxel occlusion and light functions,
+// but for a whole chunk at once. The voxels around the surface are sampled
+// once into padded blocks, then the kernels are run once per vertex, rather
+// than for each of the 8 voxels around each of the 8 vertices of each surface
+// voxel.
+template <
+    typename T,
+    typename OcclusionFn,
+    typename IrradianceFn,
+    typename SkyVisibilityFn>
+inline auto to_chunk_light_tensor(
+    const tensors::Tensor<T>& surface,
+    OcclusionFn&& occlusion_fn,
+    IrradianceFn&& irradiance_fn,
+    SkyVisibilityFn&& sky_visibility_fn) {
+  CHECK_ARGUMENT(surface.shape == tensors::kChunkShape);
+  static constexpr int dim = static_cast<int>(tensors::kChunkDim) + 1;
+  auto vertex_index = [](Vec3i pos) {
+    return pos.x + dim * (pos.y + dim * pos.z);
+  };
+
+  // Flag the voxels and vertices around the surface, numbering the vertices.
+  // The blocks are too large for the stack.
+  auto occlusion = std::make_unique<conv::Block<bool>>();
+  std::vector<bool> sampled(occlusion->data.size());
+  std::vector<uint32_t> slots(dim * dim * dim);
+  uint32_t slot_count = 0;
+  tensors::scan_sparse(surface, [&](auto pos, ATTR_UNUSED auto val) {
+    auto p = to<int>(pos);
+    for (auto dz : {-1, 0, 1}) {
+      for (auto dy : {-1, 0, 1}) {
+        for (auto dx : {-1, 0, 1}) {
+          sampled[occlusion->index(p + vec3(dx, dy, dz))] = true;
+        }
+      }
+    }
+    for (auto dz : {0, 1}) {
+      for (auto dy : {0, 1}) {
+        for (auto dx : {0, 1}) {
+          auto& slot = slots[vertex_index(p + vec3(dx, dy, dz))];
+          if (!slot) {
+            slot = ++slot_count;
+          }
+        }
+      }
+    }
+  });
+
+  // Sample each flagged voxel once.
+  auto irradiance = std::make_unique<conv::Block<Vec3f>>();
+  auto sky = std::make_unique<conv::Block<Vec3f>>();
+  for (auto z = -1; z < dim; z += 1) {
+    for (auto y = -1; y < dim; y += 1) {
+      for (auto x = -1; x < dim; x += 1) {
+        auto i = occlusion->index({x, y, z});
+        if (sampled[i]) {
+          occlusion->data[i] = occlusion_fn(vec3(x, y, z));
+          irradiance->data[i] = irradiance_fn(vec3(x, y, z));
+          sky->data[i] = sky_visibility_fn(vec3(x, y, z));
+        }
+      }
+    }
+  }
+
+  // Run the kernels at each flagged vertex, in memory order.
+  std::vector<Vec3u> irr_masks(slot_count);
+  std::vector<uint32_t> sky_masks(slot_count);
+  for (auto z = 0; z < dim; z += 1) {
+    for (auto y = 0; y < dim; y += 1) {
+      for (auto x = 0; x < dim; x += 1) {
+        auto slot = slots[vertex_index({x, y, z})];
+        if (!slot) {
+          continue;
+        }
+
+        // The incident voxels, ordered as in make_vertex_fn().
+        auto mask = static_cast<uint8_t>(0);
+        std::array<Vec3f, 8> irr_samples;
+        std::array<Vec3f, 8> sky_samples;
+        auto k = 0;
+        for (auto dz : {1, 0}) {
+          for (auto dy : {1, 0}) {
+            for (auto dx : {1, 0}) {
+              auto i = occlusion->index({x - dx, y - dy, z - dz});
+              auto open = !occlusion->data[i];
+              mask |= static_cast<uint8_t>(open << (7 - k));
+              irr_samples[k] = irradiance->data[i];
+              sky_samples[k] = sky->data[i];
+              k += 1;
+            }
+          }
+        }
+        irr_masks[slot - 1] =
+            apply_light_kernel_with_occlusion<LightMask>(mask, irr_samples)
+                .value;
+        sky_masks[slot - 1] =
+            apply_light_kernel_with_occlusion<LightMask>(mask, sky_samples)
+                .value.x;
+      }
+    }
+  }
+
+  // Gather the corners of each surface voxel from its vertices.
+  return tensors::map_sparse(surface, [&](auto pos, ATTR_UNUSED auto val) {
+    LightMask irr;
+    LightMask sky;
+    for (auto dz : {0u, 1u}) {
+      for (auto dy : {0u, 1u}) {
+        for (auto dx : {0u, 1u}) {
+          auto slot = slots[vertex_index(to<int>(pos + vec3(dx, dy, dz)))] - 1;
+          Vec3u corner = {1 - dx, 1 - dy, 1 - dz};
+          LightMask sky_mask{{sky_masks[slot], 0, 0}};
+          irr.set({dx, dy, dz}, LightMask{irr_masks[slot]}.get(corner));
+          sky.set({dx, dy, dz}, sky_mask.get(corner));
+        }
+      }
+    }
+    // We just take one component of the sky occlusion color value since it is
+    // grayscale.
+    return std::optional<LightSample>{{irr.value, sky.value.x}};
+  });
+}
+
 template <typename T>
 inline auto to_light_tensor(
     const tensors::Tensor<T>& surface, const shapes::Tensor& isomorphisms) {
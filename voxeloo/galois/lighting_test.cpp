@@ -1,7 +1,10 @@
 #include "voxeloo/galois/lighting.hpp"
 
 #include <catch2/catch.hpp>
+#include <memory>
+#include <random>
 
+#include "voxeloo/galois/conv.hpp"
 #include "voxeloo/galois/gen/light_kernel.hpp"
 #include "voxeloo/tensors/sparse.hpp"
 #include "voxeloo/tensors/tensors.hpp"
@@ -136,4 +139,57 @@ TEST_CASE("Test to light tensor", "[all]") {
     mask.set({1, 1, 1}, v(8u));
     REQUIRE(std::get<1>(light.get({0, 0, 0}).value()) == mask.value.x);
   }
-}
\ No newline at end of file
+}
+
+TEST_CASE("Test chunk light tensors match per-vertex ones", "[all]") {
+  std::mt19937 rng(7);
+  std::uniform_int_distribution<int> coin(0, 3);
+  std::uniform_real_distribution<float> level(0.0f, 1.0f);
+
+  // Random occluders and light values around the chunk, with a random surface
+  // within it.
+  auto occluders = std::make_unique<conv::Block<bool>>();
+  auto lights = std::make_unique<conv::Block<Vec3f>>();
+  for (auto& val : occluders->data) {
+    val = coin(rng) == 0;
+  }
+  for (auto& val : lights->data) {
+    val = {level(rng), level(rng), level(rng)};
+  }
+  tensors::SparseTensorBuilder<bool> builder(tensors::kChunkShape);
+  for (auto i = 0; i < 4000; i += 1) {
+    auto x = static_cast<uint32_t>(rng() % tensors::kChunkDim);
+    auto y = static_cast<uint32_t>(rng() % tensors::kChunkDim);
+    auto z = static_cast<uint32_t>(rng() % tensors::kChunkDim);
+    builder.set({x, y, z}, true);
+  }
+  auto surface = std::move(builder).build();
+
+  auto occ_fn = [&](Vec3i pos) {
+    return occluders->get(pos);
+  };
+  auto irr_fn = [&](Vec3i pos) {
+    return lights->get(pos);
+  };
+  auto sky_fn = [&](Vec3i pos) {
+    return occluders->get(pos) ? Vec3f{} : Vec3f{1.0f, 1.0f, 1.0f};
+  };
+
+  auto expected = lighting::to_light_tensor(
+      surface,
+      lighting::make_vertex_fn(occ_fn, irr_fn),
+      lighting::make_vertex_fn(occ_fn, sky_fn));
+  auto light =
+      lighting::to_chunk_light_tensor(surface, occ_fn, irr_fn, sky_fn);
+
+  auto count = 0;
+  tensors::scan_sparse(expected, [&](auto pos, auto sample) {
+    REQUIRE(light.get(pos) == sample);
+    count += 1;
+  });
+  REQUIRE(count > 3000);
+  tensors::scan_sparse(light, [&](ATTR_UNUSED auto pos, ATTR_UNUSED auto val) {
+    count -= 1;
+  });
+  REQUIRE(count == 0);
+}
@@ -0,0 +1,206 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <tuple>
+#include <vector>
+
+#include "voxeloo/common/errors.hpp"
+#include "voxeloo/common/geometry.hpp"
+#include "voxeloo/common/voxels.hpp"
+#include "voxeloo/galois/groups.hpp"
+#include "voxeloo/galois/shapes.hpp"
+#include "voxeloo/galois/water.hpp"
+
+namespace voxeloo::galois::packing {
+
+// Positions are stored in 1/1024 voxel fixed point, offset so that anything
+// within 16 voxels of a chunk fits in 16 bits.
+static constexpr float kPositionScale = 1024.0f;
+static constexpr float kPositionBias = 16.0f;
+
+// The largest number of vertices addressable by 16-bit indices.
+static constexpr size_t kMaxShortIndexedVertices = 1 << 16;
+
+// A 12 byte vertex for meshes made of axis-aligned faces, whose normal is
+// implied by the face direction.
+struct PackedVertex {
+  std::array<uint16_t, 3> pos;
+  // The voxels::Dir of the face, in the low 3 bits.
+  uint16_t dir;
+  // The uv in 1/PackedMesh::uv_scale units.
+  std::array<uint16_t, 2> uv;
+};
+
+static_assert(sizeof(PackedVertex) == 12);
+
+struct PackedMesh {
+  std::vector<PackedVertex> vertices;
+  // Only one of the index buffers is populated: the 16-bit one when there are
+  // few enough vertices for it, else the 32-bit one.
+  std::vector<uint16_t> short_indices;
+  std::vector<uint32_t> long_indices;
+  float uv_scale = 1.0f;
+
+  auto short_indexed() const {
+    return vertices.size() <= kMaxShortIndexedVertices;
+  }
+
+  auto vertices_view() const {
+    return reinterpret_cast<const uint8_t*>(&vertices[0]);
+  }
+
+  auto indices_view() const {
+    return short_indexed()
+               ? reinterpret_cast<const uint8_t*>(&short_indices[0])
+               : reinterpret_cast<const uint8_t*>(&long_indices[0]);
+  }
+
+  auto vertices_bytes() const {
+    return sizeof(PackedVertex) * vertices.size();
+  }
+
+  auto indices_bytes() const {
+    return short_indexed() ? sizeof(uint16_t) * short_indices.size()
+                           : sizeof(uint32_t) * long_indices.size();
+  }
+
+  auto stride() const {
+    return sizeof(PackedVertex) / sizeof(uint16_t);
+  }
+};
+
+inline uint16_t pack_position(float x) {
+  auto val = std::round((x + kPositionBias) * kPositionScale);
+  CHECK_ARGUMENT(val >= 0.0f && val <= 65535.0f);
+  return static_cast<uint16_t>(val);
+}
+
+inline float unpack_position(uint16_t x) {
+  return static_cast<float>(x) / kPositionScale - kPositionBias;
+}
+
+// Returns the largest power of two by which uvs up to the given value can be
+// scaled and still fit in 16 bits, so that integral uvs are kept exact.
+inline float fit_uv_scale(float max_uv) {
+  return std::exp2(std::floor(std::log2(65535.0f / std::max(max_uv, 1.0f))));
+}
+
+// Returns the position, direction and uv of a packed vertex.
+inline auto unpack(const PackedVertex& vertex, float uv_scale) {
+  auto pos = vec3(
+      unpack_position(vertex.pos[0]),
+      unpack_position(vertex.pos[1]),
+      unpack_position(vertex.pos[2]));
+  auto dir = static_cast<voxels::Dir>(vertex.dir & 0x7);
+  auto uv = vec2(vertex.uv[0], vertex.uv[1]).template to<float>() / uv_scale;
+  return std::tuple(pos, dir, uv);
+}
+
+inline auto pack_vertex(Vec3f pos, int dir, Vec2f uv, float uv_scale) {
+  return PackedVertex{
+      {pack_position(pos.x), pack_position(pos.y), pack_position(pos.z)},
+      static_cast<uint16_t>(dir),
+      {
+          static_cast<uint16_t>(std::round(uv_scale * uv.x)),
+          static_cast<uint16_t>(std::round(uv_scale * uv.y)),
+      },
+  };
+}
+
+// Moves the indices into the index buffer that fits the vertex count.
+inline void set_indices(PackedMesh& mesh, std::vector<uint32_t> indices) {
+  if (mesh.short_indexed()) {
+    mesh.short_indices.assign(indices.begin(), indices.end());
+  } else {
+    mesh.long_indices = std::move(indices);
+  }
+}
+
+// Packs a mesh given fn(vertex) returning the position, direction and uv of
+// each of its vertices.
+template <typename Vertex, typename Fn>
+inline auto pack_mesh(
+    const std::vector<Vertex>& vertices,
+    const std::vector<uint32_t>& indices,
+    Fn&& fn) {
+  PackedMesh ret;
+
+  float max_uv = 0.0f;
+  for (const auto& vertex : vertices) {
+    auto [pos, dir, uv] = fn(vertex);
+    CHECK_ARGUMENT(uv.x >= 0.0f && uv.y >= 0.0f);
+    max_uv = std::max({max_uv, uv.x, uv.y});
+  }
+  ret.uv_scale = fit_uv_scale(max_uv);
+
+  ret.vertices.reserve(vertices.size());
+  for (const auto& vertex : vertices) {
+    auto [pos, dir, uv] = fn(vertex);
+    ret.vertices.push_back(pack_vertex(pos, dir, uv, ret.uv_scale));
+  }
+  set_indices(ret, indices);
+
+  return ret;
+}
+
+inline auto pack(const shapes::GeometryBuffer& buffer) {
+  return pack_mesh(buffer.vertices, buffer.indices, [](const auto& vertex) {
+    return std::tuple(vertex.pos, static_cast<int>(vertex.dir), vertex.uv);
+  });
+}
+
+inline auto pack(const water::GeometryBuffer& buffer) {
+  return pack_mesh(buffer.vertices, buffer.indices, [](const auto& vertex) {
+    return std::tuple(vertex.pos, static_cast<int>(vertex.dir), vertex.uv);
+  });
+}
+
+// Builds the packed geometry of the shapes straight from their quads, without
+// the intermediate float buffer of shapes::to_geometry_buffer(). The quads
+// span their faces with uvs of 0 or 1, so the uv scale is known upfront.
+inline auto to_packed_geometry_buffer(
+    const shapes::Tensor& tensor,
+    const shapes::OcclusionTensor& occlusion,
+    const shapes::Index& index) {
+  PackedMesh ret;
+  ret.uv_scale = fit_uv_scale(1.0f);
+
+  std::vector<uint32_t> indices;
+  shapes::scan_geometry_quads(
+      tensor, occlusion, index, [&](const auto& vertices) {
+        auto offset = static_cast<uint32_t>(ret.vertices.size());
+        for (const auto& vertex : vertices) {
+          auto dir = static_cast<int>(vertex.dir);
+          ret.vertices.push_back(
+              pack_vertex(vertex.pos, dir, vertex.uv, ret.uv_scale));
+        }
+        for (auto i : voxels::face_indices()) {
+          indices.push_back(offset + i);
+        }
+      });
+  set_indices(ret, std::move(indices));
+
+  return ret;
+}
+
+// Returns the direction of the face with the given normal.
+inline int face_dir(const Vec3f& normal) {
+  for (auto dir = 0; dir < voxels::kDirCount; dir += 1) {
+    if (voxels::face_normal(static_cast<voxels::Dir>(dir)) == normal) {
+      return dir;
+    }
+  }
+  CHECK_UNREACHABLE("Normal is not axis-aligned.");
+}
+
+// Packs a group block or glass mesh, whose normals are those of its faces.
+// The atlas texture is left with the mesh.
+inline auto pack(const groups::Mesh& mesh) {
+  return pack_mesh(mesh.vertices, mesh.indices, [](const auto& vertex) {
+    return std::tuple(vertex.pos, face_dir(vertex.normal), vertex.uv);
+  });
+}
+
+}  // namespace voxeloo::galois::packing
@@ -0,0 +1,159 @@
+#include "voxeloo/galois/packing.hpp"
+
+#include <algorithm>
+#include <catch2/catch.hpp>
+
+#include "voxeloo/common/geometry.hpp"
+#include "voxeloo/galois/groups.hpp"
+#include "voxeloo/galois/shapes.hpp"
+#include "voxeloo/galois/water.hpp"
+#include "voxeloo/tensors/sparse.hpp"
+#include "voxeloo/tensors/tensors.hpp"
+
+using namespace voxeloo;          // NOLINT
+using namespace voxeloo::galois;  // NOLINT
+
+namespace {
+
+template <typename Vertex>
+void require_packed(
+    const std::vector<Vertex>& vertices,
+    const packing::PackedMesh& packed,
+    float uv_epsilon) {
+  REQUIRE(packed.vertices.size() == vertices.size());
+  for (size_t i = 0; i < vertices.size(); i += 1) {
+    auto [pos, dir, uv] = packing::unpack(packed.vertices[i], packed.uv_scale);
+    for (auto j = 0; j < 3; j += 1) {
+      REQUIRE(pos[j] == Approx(vertices[i].pos[j]).margin(1.0f / 2048.0f));
+    }
+    REQUIRE(uv.x == Approx(vertices[i].uv.x).margin(uv_epsilon));
+    REQUIRE(uv.y == Approx(vertices[i].uv.y).margin(uv_epsilon));
+  }
+}
+
+}  // namespace
+
+TEST_CASE("Test packing water geometry", "[all]") {
+  tensors::SparseChunkBuilder<uint8_t> builder;
+  for (uint32_t x = 3; x < 9; x += 1) {
+    builder.set({x, 0, 4}, 15);
+    builder.set({x, 1, 4}, 7);
+  }
+  auto tensor = tensors::make_tensor(std::move(builder).build());
+  auto geometry = water::to_geometry(water::to_surface(tensor));
+  REQUIRE(!geometry.vertices.empty());
+
+  auto packed = packing::pack(geometry);
+  require_packed(geometry.vertices, packed, 0.0f);
+  for (size_t i = 0; i < geometry.vertices.size(); i += 1) {
+    auto dir = std::get<1>(packing::unpack(packed.vertices[i], 1.0f));
+    REQUIRE(dir == static_cast<voxels::Dir>(geometry.vertices[i].dir));
+  }
+
+  // Vertices are halved, and indices too as there are few of them.
+  REQUIRE(2 * packed.vertices_bytes() == geometry.vertices_bytes());
+  REQUIRE(packed.short_indexed());
+  REQUIRE(packed.long_indices.empty());
+  REQUIRE(2 * packed.indices_bytes() == geometry.indices_bytes());
+  REQUIRE(
+      std::equal(
+          geometry.indices.begin(),
+          geometry.indices.end(),
+          packed.short_indices.begin(),
+          packed.short_indices.end()));
+}
+
+TEST_CASE("Test packing group meshes", "[all]") {
+  using namespace groups;  // NOLINT
+
+  TextureAtlaser atlaser({16, 16});
+  std::vector<Texture> textures(3, Texture{{16, 16}, {}});
+  std::vector<BlockQuad> quads;
+  for (auto dir = 0; dir < voxels::kDirCount; dir += 1) {
+    auto uv = atlaser.add(dir % 3).template to<float>();
+    quads.push_back(
+        {{2, 3, 4}, static_cast<voxels::Dir>(dir), uv, shapes::Level::MACRO});
+    quads.push_back(
+        {{8, 0, 31}, static_cast<voxels::Dir>(dir), uv, shapes::Level::MICRO});
+  }
+  for (auto& texture : textures) {
+    texture.data.resize(256);
+  }
+  auto mesh = make_blocklike_mesh(atlaser, textures, quads);
+
+  auto packed = packing::pack(mesh);
+  require_packed(mesh.vertices, packed, 1.0f / 32768.0f);
+  for (size_t i = 0; i < mesh.vertices.size(); i += 1) {
+    auto dir = std::get<1>(packing::unpack(packed.vertices[i], 1.0f));
+    REQUIRE(voxels::face_normal(dir) == mesh.vertices[i].normal);
+  }
+  REQUIRE(8 * packed.vertices_bytes() == 3 * mesh.vertices_bytes());
+}
+
+TEST_CASE("Test packing large meshes", "[all]") {
+  shapes::GeometryBuffer geometry;
+  for (auto i = 0; i < 20000; i += 1) {
+    auto x = static_cast<float>(i % 32);
+    auto y = static_cast<float>(i / 32 % 32);
+    for (auto [u, v] : {vec2(0, 0), vec2(1, 0), vec2(1, 1), vec2(0, 1)}) {
+      auto uv = vec2(u, v).to<float>();
+      geometry.vertices.push_back({vec3(x + uv.x, y + uv.y, 0.0f), uv, 4.0f});
+    }
+    for (auto j : voxels::face_indices()) {
+      geometry.indices.push_back(4 * i + j);
+    }
+  }
+
+  auto packed = packing::pack(geometry);
+  require_packed(geometry.vertices, packed, 0.0f);
+  REQUIRE(!packed.short_indexed());
+  REQUIRE(packed.short_indices.empty());
+  REQUIRE(packed.long_indices == geometry.indices);
+  REQUIRE(packed.indices_bytes() == geometry.indices_bytes());
+
+  // Positions too far out of the chunk are rejected.
+  geometry.vertices[0].pos.x = -20.0f;
+  REQUIRE_THROWS(packing::pack(geometry));
+}
+
+TEST_CASE("Test building packed block geometry", "[all]") {
+  // Air, and a full block occluding all of its faces.
+  shapes::IndexBuilder index_builder(1);
+  shapes::Quads quads;
+  for (auto& dir_quads : quads.dir) {
+    dir_quads.push_back({{0, 0, 0}, shapes::Level::MACRO});
+  }
+  index_builder.set_offset(0, 0);
+  index_builder.set_offset(shapes::to_isomorphism_id(1, 0), 1);
+  index_builder.add_isomorphism({}, {}, {}, 0, {});
+  index_builder.add_isomorphism(quads, {}, {}, 0x3f, {});
+  auto index = index_builder.build();
+
+  // A staircase, so that the merged quads come in several sizes.
+  tensors::SparseTensorBuilder<shapes::IsomorphismId> builder(
+      tensors::kChunkShape);
+  for (uint32_t x = 0; x < 8; x += 1) {
+    for (uint32_t y = 0; y <= x; y += 1) {
+      builder.set({x, y, 3}, shapes::to_isomorphism_id(1, 0));
+    }
+  }
+  auto tensor = std::move(builder).build();
+  auto occlusion = shapes::to_occlusion_tensor(tensor, index);
+
+  auto geometry = shapes::to_geometry_buffer(tensor, occlusion, index);
+  auto packed = packing::to_packed_geometry_buffer(tensor, occlusion, index);
+  REQUIRE(!geometry.vertices.empty());
+  REQUIRE(packed.uv_scale == packing::pack(geometry).uv_scale);
+  require_packed(geometry.vertices, packed, 0.0f);
+  for (size_t i = 0; i < geometry.vertices.size(); i += 1) {
+    auto dir = std::get<1>(packing::unpack(packed.vertices[i], 1.0f));
+    REQUIRE(dir == static_cast<voxels::Dir>(geometry.vertices[i].dir));
+  }
+  REQUIRE(packed.short_indexed());
+  REQUIRE(
+      std::equal(
+          geometry.indices.begin(),
+          geometry.indices.end(),
+          packed.short_indices.begin(),
+          packed.short_indices.end()));
+}
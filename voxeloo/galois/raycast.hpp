@@ -0,0 +1,287 @@
+#pragma once
+
+#include <algorithm>
+#include <bitset>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <optional>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "voxeloo/common/errors.hpp"
+#include "voxeloo/common/geometry.hpp"
+#include "voxeloo/common/utils.hpp"
+#include "voxeloo/common/voxels.hpp"
+#include "voxeloo/galois/florae.hpp"
+#include "voxeloo/galois/glass.hpp"
+#include "voxeloo/galois/groups.hpp"
+#include "voxeloo/galois/shapes.hpp"
+#include "voxeloo/tensors/arrays.hpp"
+#include "voxeloo/tensors/tensors.hpp"
+#include "voxeloo/tensors/utils.hpp"
+
+namespace voxeloo::galois::raycast {
+
+// The tensors of a shard that rays can hit, any of which may be null. Voxels
+// of glass are hit through their isomorphisms, like blocks.
+struct Shard {
+  const shapes::Tensor* isomorphisms = nullptr;
+  const florae::Tensor* florae = nullptr;
+  const glass::Tensor* glass = nullptr;
+};
+
+// Returns the shard at the given shard position, or null if there is none.
+using ShardLookup = std::function<const Shard*(Vec3i)>;
+
+struct Ray {
+  Vec3f origin;
+  Vec3f dir;
+  float max_distance;
+};
+
+struct Hit {
+  // The kind of entry that was hit, or EMPTY if the ray hit nothing.
+  groups::EntryKind kind;
+  Vec3i voxel;
+  Vec3f pos;
+  Vec3f normal;
+  float distance;
+};
+
+// Shards are split into cells of this size to skip over empty space.
+static constexpr int kCellDim = 4;
+static constexpr int kShardDim = static_cast<int>(tensors::kChunkDim);
+static constexpr int kShardCells = kShardDim / kCellDim;
+
+// The cells of a shard that hold anything rays can hit.
+class Occupancy {
+ public:
+  explicit Occupancy(const Shard& shard) {
+    if (shard.isomorphisms) {
+      add(*shard.isomorphisms);
+    }
+    if (shard.florae) {
+      add(*shard.florae);
+    }
+  }
+
+  bool empty() const {
+    return cells_.none();
+  }
+
+  bool test(Vec3i pos) const {
+    return cells_.test(index(pos / kCellDim));
+  }
+
+ private:
+  static int index(Vec3i cell) {
+    return cell.x + kShardCells * (cell.y + kShardCells * cell.z);
+  }
+
+  template <typename T>
+  void add(const tensors::Tensor<T>& tensor) {
+    CHECK_ARGUMENT(tensor.shape == tensors::kChunkShape);
+    tensors::scan(tensor.chunks[0]->array, [&](auto run, const T& val) {
+      if (val) {
+        tensors::partition_run(run, [&](auto pos, auto len) {
+          auto lo = to<int>(pos);
+          auto hi = lo.x + static_cast<int>(len) - 1;
+          for (auto x = lo.x / kCellDim; x <= hi / kCellDim; x += 1) {
+            cells_.set(index({x, lo.y / kCellDim, lo.z / kCellDim}));
+          }
+        });
+      }
+    });
+  }
+
+  std::bitset<kShardCells * kShardCells * kShardCells> cells_;
+};
+
+// Casts rays through the voxels of shards, skipping over missing shards and
+// empty cells, and testing the subvoxel geometry of the blocks along the way.
+// The occupancy of each shard is computed once, when a ray first reaches it.
+class Caster {
+ public:
+  Caster(const shapes::Index& index, ShardLookup lookup)
+      : index_(index), lookup_(std::move(lookup)) {}
+
+  Hit cast(const Ray& ray) {
+    auto len = norm(ray.dir);
+    CHECK_ARGUMENT(len > 0.0f);
+    auto dir = (1.0f / len) * ray.dir;
+
+    // March from the origin until reaching empty space to skip, then from the
+    // far side of it, and so on.
+    std::optional<Hit> hit;
+    auto face = initial_face(dir);
+    for (auto t = 0.0f; !hit && t <= ray.max_distance;) {
+      auto start = ray.origin + t * dir;
+      auto next = std::numeric_limits<float>::infinity();
+      auto visit = [&](Vec3i voxel, float d, voxels::Dir entry) {
+        if (t + d > ray.max_distance) {
+          return false;
+        }
+
+        auto shard_pos = floor_div(voxel, kShardDim);
+        auto origin = kShardDim * shard_pos;
+        auto [shard, occupancy] = find(shard_pos);
+        if (shard == nullptr) {
+          std::tie(next, face) = exit(start, dir, origin, kShardDim);
+          next += t;
+          return false;
+        }
+
+        auto local = voxel - origin;
+        if (!occupancy->test(local)) {
+          auto cell = origin + kCellDim * (local / kCellDim);
+          std::tie(next, face) = exit(start, dir, cell, kCellDim);
+          next += t;
+          return false;
+        }
+
+        hit = test(*shard, voxel, local, ray.origin, dir, t + d, entry);
+        if (hit && hit->distance > ray.max_distance) {
+          hit.reset();
+          return false;
+        }
+        return !hit;
+      };
+
+      auto first = vec3(ifloor(start.x), ifloor(start.y), ifloor(start.z));
+      if (visit(first, 0.0f, face)) {
+        voxels::march_faces(
+            start, dir, [&](int x, int y, int z, float d, voxels::Dir entry) {
+              return visit({x, y, z}, d, entry);
+            });
+      }
+      t = next;
+    }
+
+    if (hit) {
+      return *hit;
+    }
+    return Hit{groups::EntryKind::EMPTY, {}, {}, {}, ray.max_distance};
+  }
+
+  std::vector<Hit> cast(const std::vector<Ray>& rays) {
+    std::vector<Hit> ret;
+    ret.reserve(rays.size());
+    for (const auto& ray : rays) {
+      ret.push_back(cast(ray));
+    }
+    return ret;
+  }
+
+ private:
+  // Resumes just past the far side of skipped cells, so that rounding does not
+  // leave the ray inside of them.
+  static constexpr float kSkipEpsilon = 1e-3f;
+
+  // The face through which a ray in the given direction enters voxels, as
+  // marched along its main axis.
+  static voxels::Dir initial_face(const Vec3f& dir) {
+    auto a = abs(dir);
+    if (a.x >= a.y && a.x >= a.z) {
+      return dir.x < 0.0f ? voxels::X_POS : voxels::X_NEG;
+    } else if (a.y >= a.z) {
+      return dir.y < 0.0f ? voxels::Y_POS : voxels::Y_NEG;
+    }
+    return dir.z < 0.0f ? voxels::Z_POS : voxels::Z_NEG;
+  }
+
+  // Returns the distance from the point to the far side of the cube, and the
+  // face through which the ray enters the voxel beyond.
+  static std::tuple<float, voxels::Dir> exit(
+      const Vec3f& pos, const Vec3f& dir, Vec3i origin, int size) {
+    static constexpr std::array<voxels::Dir, 3> neg_faces = {
+        voxels::X_NEG, voxels::Y_NEG, voxels::Z_NEG};
+    static constexpr std::array<voxels::Dir, 3> pos_faces = {
+        voxels::X_POS, voxels::Y_POS, voxels::Z_POS};
+    auto ret = std::numeric_limits<float>::infinity();
+    auto face = voxels::X_NEG;
+    for (auto i = 0; i < 3; i += 1) {
+      auto lo = static_cast<float>(origin[i]);
+      auto hi = static_cast<float>(origin[i] + size);
+      auto d = std::numeric_limits<float>::infinity();
+      if (dir[i] > 0.0f) {
+        d = (hi - pos[i]) / dir[i];
+      } else if (dir[i] < 0.0f) {
+        d = (lo - pos[i]) / dir[i];
+      }
+      if (d < ret) {
+        ret = d;
+        face = dir[i] > 0.0f ? neg_faces[i] : pos_faces[i];
+      }
+    }
+    return {std::max(ret, 0.0f) + kSkipEpsilon, face};
+  }
+
+  // Returns the shard and its occupancy, or nulls for missing and empty ones.
+  std::tuple<const Shard*, const Occupancy*> find(Vec3i pos) {
+    if (last_ && pos == last_pos_) {
+      return *last_;
+    }
+    std::tuple<const Shard*, const Occupancy*> ret = {nullptr, nullptr};
+    if (const auto* shard = lookup_(pos)) {
+      auto it = occupancies_.find(shard);
+      if (it == occupancies_.end()) {
+        it = occupancies_.emplace(shard, Occupancy(*shard)).first;
+      }
+      if (!it->second.empty()) {
+        ret = {shard, &it->second};
+      }
+    }
+    last_pos_ = pos;
+    last_ = ret;
+    return ret;
+  }
+
+  std::optional<Hit> test(
+      const Shard& shard,
+      Vec3i voxel,
+      Vec3i local,
+      const Vec3f& origin,
+      const Vec3f& dir,
+      float distance,
+      voxels::Dir entry) const {
+    auto pos = to<unsigned int>(local);
+    if (shard.isomorphisms) {
+      if (auto id = shard.isomorphisms->get(pos); id != 0) {
+        auto entry_pos = origin + distance * dir - to<float>(voxel);
+        if (auto hit = shapes::subvoxel_ray_hit(index_, id, entry_pos, dir)) {
+          auto [face, d] = *hit;
+          auto kind = shard.glass && shard.glass->get(pos) != 0
+                          ? groups::EntryKind::GLASS
+                          : groups::EntryKind::BLOCK;
+          return Hit{
+              kind,
+              voxel,
+              origin + (distance + d) * dir,
+              voxels::face_normal(face),
+              distance + d,
+          };
+        }
+      }
+    }
+    if (shard.florae && shard.florae->get(pos) != 0) {
+      return Hit{
+          groups::EntryKind::FLORA,
+          voxel,
+          origin + distance * dir,
+          voxels::face_normal(entry),
+          distance,
+      };
+    }
+    return std::nullopt;
+  }
+
+  const shapes::Index& index_;
+  ShardLookup lookup_;
+  std::unordered_map<const Shard*, Occupancy> occupancies_;
+  Vec3i last_pos_;
+  std::optional<std::tuple<const Shard*, const Occupancy*>> last_;
+};
+
+}  // namespace voxeloo::galois::raycast
@@ -0,0 +1,190 @@
+#include "voxeloo/galois/raycast.hpp"
+
+#include <catch2/catch.hpp>
+#include <map>
+#include <random>
+#include <tuple>
+#include <vector>
+
+#include "voxeloo/common/geometry.hpp"
+#include "voxeloo/common/utils.hpp"
+#include "voxeloo/common/voxels.hpp"
+#include "voxeloo/galois/shapes.hpp"
+#include "voxeloo/tensors/sparse.hpp"
+#include "voxeloo/tensors/tensors.hpp"
+
+using namespace voxeloo;          // NOLINT
+using namespace voxeloo::galois;  // NOLINT
+
+namespace {
+
+// A full block and a bottom slab.
+auto make_shape_index() {
+  shapes::IndexBuilder builder(2);
+  shapes::IsomorphismMask full;
+  shapes::IsomorphismMask slab;
+  for (auto z = 0; z < 8; z += 1) {
+    for (auto y = 0; y < 8; y += 1) {
+      for (auto x = 0; x < 8; x += 1) {
+        full[z * 64 + y * 8 + x] = true;
+        slab[z * 64 + y * 8 + x] = y < 4;
+      }
+    }
+  }
+  builder.set_offset(shapes::to_isomorphism_id(1, 0), 0);
+  builder.set_offset(shapes::to_isomorphism_id(2, 0), 1);
+  builder.add_isomorphism({}, {}, {}, 0, full);
+  builder.add_isomorphism({}, {}, {}, 0, slab);
+  return builder.build();
+}
+
+}  // namespace
+
+TEST_CASE("Test casting rays through shards", "[all]") {
+  using groups::EntryKind;
+  auto index = make_shape_index();
+  auto full = shapes::to_isomorphism_id(1, 0);
+  auto slab = shapes::to_isomorphism_id(2, 0);
+
+  // Blocks in the shard at the origin, and glass and florae in the one above
+  // its neighbour along x. The shards in between are missing.
+  tensors::SparseTensorBuilder<shapes::IsomorphismId> isomorphisms(
+      tensors::kChunkShape);
+  isomorphisms.set({10, 5, 3}, full);
+  isomorphisms.set({20, 5, 3}, slab);
+  tensors::SparseTensorBuilder<shapes::IsomorphismId> glass_isomorphisms(
+      tensors::kChunkShape);
+  glass_isomorphisms.set({4, 4, 4}, full);
+  tensors::SparseTensorBuilder<glass::GlassId> glass(tensors::kChunkShape);
+  glass.set({4, 4, 4}, 7);
+  tensors::SparseTensorBuilder<florae::FloraId> florae(tensors::kChunkShape);
+  florae.set({4, 10, 4}, 3);
+
+  auto blocks_tensor = std::move(isomorphisms).build();
+  auto glass_isomorphisms_tensor = std::move(glass_isomorphisms).build();
+  auto glass_tensor = std::move(glass).build();
+  auto florae_tensor = std::move(florae).build();
+  std::map<std::tuple<int, int, int>, raycast::Shard> shards;
+  shards[{0, 0, 0}] = {&blocks_tensor, nullptr, nullptr};
+  shards[{1, 1, 0}] = {
+      &glass_isomorphisms_tensor, &florae_tensor, &glass_tensor};
+
+  auto lookups = 0;
+  raycast::Caster caster(index, [&](Vec3i pos) -> const raycast::Shard* {
+    lookups += 1;
+    auto it = shards.find({pos.x, pos.y, pos.z});
+    return it != shards.end() ? &it->second : nullptr;
+  });
+
+  // Along x, into the full block.
+  auto hit = caster.cast({{0.5f, 5.5f, 3.5f}, {1.0f, 0.0f, 0.0f}, 100.0f});
+  REQUIRE(hit.kind == EntryKind::BLOCK);
+  REQUIRE(hit.voxel == vec3(10, 5, 3));
+  REQUIRE(hit.normal == vec3(-1.0f, 0.0f, 0.0f));
+  REQUIRE(hit.distance == Approx(9.5f).margin(1e-3f));
+  REQUIRE(hit.pos.x == Approx(10.0f).margin(1e-3f));
+
+  // Down onto the top of the slab, passing the full block on the way.
+  hit = caster.cast({{20.5f, 9.0f, 3.5f}, {0.0f, -2.0f, 0.0f}, 100.0f});
+  REQUIRE(hit.kind == EntryKind::BLOCK);
+  REQUIRE(hit.voxel == vec3(20, 5, 3));
+  REQUIRE(hit.normal == vec3(0.0f, 1.0f, 0.0f));
+  REQUIRE(hit.pos.y == Approx(5.5f).margin(1e-3f));
+
+  // Over the top of the slab, and too short to reach anything.
+  hit = caster.cast({{19.5f, 5.75f, 3.5f}, {1.0f, 0.0f, 0.0f}, 100.0f});
+  REQUIRE(hit.kind == EntryKind::EMPTY);
+  hit = caster.cast({{0.5f, 5.5f, 3.5f}, {1.0f, 0.0f, 0.0f}, 9.0f});
+  REQUIRE(hit.kind == EntryKind::EMPTY);
+  REQUIRE(hit.distance == 9.0f);
+
+  // Diagonally across missing shards into the glass, and up into the florae.
+  auto target = vec3(36.5f, 36.5f, 4.5f);
+  auto origin = vec3(-20.5f, -30.5f, 4.5f);
+  hit = caster.cast({origin, target - origin, 200.0f});
+  REQUIRE(hit.kind == EntryKind::GLASS);
+  REQUIRE(hit.voxel == vec3(36, 36, 4));
+  hit = caster.cast({{36.5f, 39.5f, 4.5f}, {0.0f, 1.0f, 0.0f}, 200.0f});
+  REQUIRE(hit.kind == EntryKind::FLORA);
+  REQUIRE(hit.voxel == vec3(36, 42, 4));
+  REQUIRE(hit.normal == vec3(0.0f, -1.0f, 0.0f));
+  REQUIRE(hit.distance == Approx(2.5f).margin(1e-3f));
+
+  // Batches give the same hits, and long rays skip over whole shards.
+  lookups = 0;
+  auto hits = caster.cast(
+      {{{0.5f, 5.5f, 3.5f}, {1.0f, 0.0f, 0.0f}, 100.0f},
+       {{0.5f, 20.5f, 0.5f}, {0.0f, 0.0f, 1.0f}, 3200.0f}});
+  REQUIRE(hits.size() == 2);
+  REQUIRE(hits[0].voxel == vec3(10, 5, 3));
+  REQUIRE(hits[1].kind == EntryKind::EMPTY);
+  REQUIRE(lookups < 200);
+}
+
+TEST_CASE("Test casting rays matches marching every voxel", "[all]") {
+  auto index = make_shape_index();
+  std::mt19937 rng(5);
+  std::uniform_real_distribution<float> coord(-8.0f, 72.0f);
+
+  // Sparse blocks over a 2x2x2 set of shards, one of which is missing.
+  std::vector<shapes::Tensor> tensors;
+  for (auto i = 0; i < 8; i += 1) {
+    tensors::SparseTensorBuilder<shapes::IsomorphismId> builder(
+        tensors::kChunkShape);
+    for (auto j = 0; j < 60; j += 1) {
+      auto id = shapes::to_isomorphism_id(1 + rng() % 2, 0);
+      auto x = static_cast<uint32_t>(rng() % tensors::kChunkDim);
+      auto y = static_cast<uint32_t>(rng() % tensors::kChunkDim);
+      auto z = static_cast<uint32_t>(rng() % tensors::kChunkDim);
+      builder.set({x, y, z}, id);
+    }
+    tensors.push_back(std::move(builder).build());
+  }
+  std::vector<raycast::Shard> shards;
+  for (auto& tensor : tensors) {
+    shards.push_back({&tensor, nullptr, nullptr});
+  }
+  auto lookup = [&](Vec3i pos) -> const raycast::Shard* {
+    if (pos.x < 0 || pos.y < 0 || pos.z < 0 || pos.x > 1 || pos.y > 1 ||
+        pos.z > 1 || pos == vec3(1, 0, 1)) {
+      return nullptr;
+    }
+    return &shards[pos.x + 2 * (pos.y + 2 * pos.z)];
+  };
+  raycast::Caster caster(index, lookup);
+
+  auto hits = 0;
+  for (auto i = 0; i < 500; i += 1) {
+    auto origin = vec3(coord(rng), coord(rng), coord(rng));
+    auto target = vec3(coord(rng), coord(rng), coord(rng));
+    raycast::Ray ray = {origin, target - origin, 150.0f};
+    auto hit = caster.cast(ray);
+
+    // March every voxel along the ray instead.
+    auto dir = (1.0f / norm(ray.dir)) * ray.dir;
+    std::optional<Vec3i> expected;
+    voxels::march(origin, dir, [&](int x, int y, int z, float d) {
+      if (d > ray.max_distance) {
+        return false;
+      }
+      auto shard_pos = floor_div(vec3(x, y, z), raycast::kShardDim);
+      if (const auto* shard = lookup(shard_pos)) {
+        auto local = vec3(x, y, z) - raycast::kShardDim * shard_pos;
+        auto id = shard->isomorphisms->get(to<unsigned int>(local));
+        auto entry = origin + d * dir - vec3(x, y, z).to<float>();
+        if (id != 0 && shapes::subvoxel_ray_hit(index, id, entry, dir)) {
+          expected = vec3(x, y, z);
+          return false;
+        }
+      }
+      return true;
+    });
+
+    REQUIRE(expected.has_value() == (hit.kind == groups::EntryKind::BLOCK));
+    if (expected) {
+      REQUIRE(hit.voxel == *expected);
+      hits += 1;
+    }
+  }
+  REQUIRE(hits > 50);
+}
@@ -2,7 +2,12 @@
 
 #include <cereal/types/array.hpp>
 #include <cereal/types/vector.hpp>
+#include <algorithm>
+#include <array>
 #include <cmath>
+#include <optional>
+#include <tuple>
+#include <type_traits>
 #include <vector>
 
 #include "voxeloo/biomes/culling.hpp"
@@ -72,7 +77,8 @@ struct Edge {
 using Boxes = std::vector<Box>;
 using IsomorphismMask = std::array<bool, 8 * 8 * 8>;
 
-inline bool subvoxel_exists(IsomorphismMask mask, int x, int y, int z) {
+inline bool subvoxel_exists(
+    const IsomorphismMask& mask, int x, int y, int z) {
   return mask[z * 64 + y * 8 + x];
 }
 
@@ -316,9 +322,9 @@ inline auto to_tensor(const blocks::Tensor& tensor, IsomorphismId isomorphism) {
   });
 }
 
-template <typename SampleFn>
-inline auto to_occlusion_tensor(const OcclusionTensor& tensor, SampleFn&& fn) {
-  auto block = conv::to_block(tensor, std::forward<SampleFn>(fn));
+// Given the padded block of occlusion masks around the tensor.
+inline auto to_occlusion_tensor(
+    const OcclusionTensor& tensor, const conv::Block<uint8_t>& block) {
   return tensors::map_dense(tensor, [&](auto pos, ATTR_UNUSED auto val) {
     auto i_pos = to<int>(pos);
     auto x_neg = (block.get(i_pos - vec3(1, 0, 0)) & 0b10) >> 1;
@@ -331,6 +337,14 @@ inline auto to_occlusion_tensor(const OcclusionTensor& tensor, SampleFn&& fn) {
   });
 }
 
+template <
+    typename SampleFn,
+    typename = std::enable_if_t<std::is_invocable_v<SampleFn, Vec3i>>>
+inline auto to_occlusion_tensor(const OcclusionTensor& tensor, SampleFn&& fn) {
+  return to_occlusion_tensor(
+      tensor, conv::to_block(tensor, std::forward<SampleFn>(fn)));
+}
+
 inline auto to_occlusion_tensor(const Tensor& tensor, const Index& index) {
   // Extract the tensors self-occlusion values.
   auto masks = tensors::map_values(tensor, [&](auto id) {
@@ -432,15 +446,6 @@ inline bool operator==(const Cell& a, const Cell& b) {
   return a.key == b.key && a.dir == b.dir && a.lvl == b.lvl;
 }
 
-struct CellHash {
-  size_t operator()(const Cell& cell) const {
-    auto x = static_cast<uint32_t>(cell.key);
-    auto y = static_cast<uint32_t>(cell.dir);
-    auto z = static_cast<uint32_t>(cell.lvl);
-    return spatial::combine(x, y, z);
-  }
-};
-
 template <typename EmitFn>
 inline auto emit_quads(
     const Tensor& tensor,
@@ -465,46 +470,56 @@ inline auto emit_quads(
   });
 }
 
-inline auto to_geometry_buffer(
+// Invokes fn(vertices) with the four vertices of each merged quad of the
+// geometry, in the order expected by voxels::face_indices().
+template <typename Fn>
+inline void scan_geometry_quads(
     const Tensor& tensor,
     const OcclusionTensor& occlusion,
-    const Index& index) {
-  // TODO(taylor): Use more efficient quadifier to skip the hashing / sorting.
-  quadifier::Quadifier<Cell, CellHash> quadifier;
+    const Index& index,
+    Fn&& fn) {
+  // Faces are sliced by direction and plane, in micro-voxel units at most.
+  const auto& shape = tensor.shape;
+  auto size = static_cast<int>(std::max({shape.x, shape.y, shape.z}));
+  auto planes = kMicroScale * size + 1;
+  quadifier::MaskQuadifier<Cell> quadifier(voxels::kDirCount * planes);
+  auto add = [&](const Cell& cell, Vec2i pos) {
+    quadifier.add(cell.dir * planes + cell.lvl, cell, pos);
+  };
   emit_quads(tensor, occlusion, index, [&](auto pos, auto dir, auto quad) {
     auto scale = quad.lvl == Level::MICRO ? kMicroScale : 1;
     const auto& [x, y, z] = scale * to<int>(pos) + quad.pos;
     switch (dir) {
       case voxels::X_NEG:
-        quadifier.add({quad.lvl, voxels::X_NEG, x}, {z, y});
+        add({quad.lvl, voxels::X_NEG, x}, {z, y});
         break;
       case voxels::X_POS:
-        quadifier.add({quad.lvl, voxels::X_POS, x + 1}, {z, y});
+        add({quad.lvl, voxels::X_POS, x + 1}, {z, y});
         break;
       case voxels::Y_NEG:
-        quadifier.add({quad.lvl, voxels::Y_NEG, y}, {x, z});
+        add({quad.lvl, voxels::Y_NEG, y}, {x, z});
         break;
       case voxels::Y_POS:
-        quadifier.add({quad.lvl, voxels::Y_POS, y + 1}, {x, z});
+        add({quad.lvl, voxels::Y_POS, y + 1}, {x, z});
         break;
       case voxels::Z_NEG:
-        quadifier.add({quad.lvl, voxels::Z_NEG, z}, {x, y});
+        add({quad.lvl, voxels::Z_NEG, z}, {x, y});
         break;
       case voxels::Z_POS:
-        quadifier.add({quad.lvl, voxels::Z_POS, z + 1}, {x, y});
+        add({quad.lvl, voxels::Z_POS, z + 1}, {x, y});
         break;
     }
   });
 
-  GeometryBuffer ret;
-  uint32_t index_offset = 0;
   for (const auto& [cell, quad] : quadifier.build()) {
     auto dir = static_cast<float>(cell.dir);
     auto scale = 1.0f / static_cast<float>(cell.key == MICRO ? kMicroScale : 1);
+    std::array<QuadVertex, 4> vertices;
+    size_t count = 0;
     auto emit_vertex = [&](int x, int y, int z, int u, int v) {
       auto pos = scale * vec3(x, y, z).to<float>();
       auto uv = vec2(u, v).to<float>();
-      ret.vertices.push_back({pos, uv, dir});
+      vertices[count++] = {pos, uv, dir};
     };
 
     switch (cell.dir) {
@@ -546,12 +561,23 @@ inline auto to_geometry_buffer(
         break;
     }
 
+    fn(vertices);
+  }
+}
+
+inline auto to_geometry_buffer(
+    const Tensor& tensor,
+    const OcclusionTensor& occlusion,
+    const Index& index) {
+  GeometryBuffer ret;
+  uint32_t index_offset = 0;
+  scan_geometry_quads(tensor, occlusion, index, [&](const auto& vertices) {
+    ret.vertices.insert(ret.vertices.end(), vertices.begin(), vertices.end());
     for (const auto i : voxels::face_indices()) {
       ret.indices.emplace_back(index_offset + i);
     }
-
     index_offset += 4;
-  }
+  });
 
   return ret;
 }
@@ -619,19 +645,21 @@ inline auto to_occluder(
 
 static constexpr int kMaxSubvoxelMarchLength = 4 * 8;
 
-// Computes the face of a ray intersection, for subvoxel geometry.
-inline auto subvoxel_ray_intersection(
+// Computes the face of a ray intersection with subvoxel geometry, along with
+// its distance in voxels from the ray origin.
+inline auto subvoxel_ray_hit(
     const shapes::Index& shape_index,
     const uint32_t isomorphism_id,
     const Vec3f& ray_origin,
     const Vec3f& ray_direction) {
   uint32_t offset = shape_index.offsets.at(isomorphism_id);
-  auto isomorphism_mask = shape_index.isomorphism_masks[offset];
+  const auto& isomorphism_mask = shape_index.isomorphism_masks.at(offset);
 
-  std::optional<voxels::Dir> hit;
+  std::optional<std::tuple<voxels::Dir, float>> hit;
   auto scale = static_cast<float>(kMicroScale);
   // Shift back slightly so hits on the outer-most subvoxels are detected.
-  auto ray_origin_subvoxel_coords = scale * ray_origin - 0.1f * ray_direction;
+  auto shift = 0.1f * ray_direction;
+  auto ray_origin_subvoxel_coords = scale * ray_origin - shift;
   // Check if the ray has entered a voxel. Only stop marching when
   // there is a hit, or the ray has past through a voxel.
   auto before = true;
@@ -642,7 +670,8 @@ inline auto subvoxel_ray_intersection(
         if (voxels::box_contains(voxels::cube_box(8), {x, y, z})) {
           before = false;
           if (subvoxel_exists(isomorphism_mask, x, y, z)) {
-            hit = face;
+            auto d = std::max(distance - norm(shift), 0.0f) / scale;
+            hit = std::tuple(face, d);
           }
           // Stop marching if there is a hit.
           return !hit;
@@ -656,4 +685,18 @@ inline auto subvoxel_ray_intersection(
   return hit;
 }
 
+// Computes the face of a ray intersection, for subvoxel geometry.
+inline auto subvoxel_ray_intersection(
+    const shapes::Index& shape_index,
+    const uint32_t isomorphism_id,
+    const Vec3f& ray_origin,
+    const Vec3f& ray_direction) {
+  std::optional<voxels::Dir> ret;
+  if (auto hit = subvoxel_ray_hit(
+          shape_index, isomorphism_id, ray_origin, ray_direction)) {
+    ret = std::get<0>(*hit);
+  }
+  return ret;
+}
+
 }  // namespace voxeloo::galois::shapes
@@ -2,6 +2,7 @@
 
 #include <array>
 #include <bitset>
+#include <type_traits>
 #include <vector>
 
 #include "voxeloo/common/bits.hpp"
@@ -71,12 +72,6 @@ inline bool operator==(const Cell& a, const Cell& b) {
   }
 }
 
-struct CellHash {
-  size_t operator()(const Cell& cell) const {
-    return cell.dir | (cell.plane << 3) | (cell.heights << 9);
-  }
-};
-
 struct QuadVertex {
   Vec3f pos;
   Vec2f uv;
@@ -109,16 +104,10 @@ struct GeometryBuffer {
   }
 };
 
-template <typename IsWaterFn>
-inline auto to_surface(const Tensor& tensor, IsWaterFn&& water_fn) {
-  // Convert the water tensor into a boolean mask of voxels containing water.
-  auto mask = tensors::map_values(tensor, [&](auto val) {
-    return val != 0;
-  });
-
+// Given the padded block of voxels containing water around the tensor.
+inline auto to_surface(const Tensor& tensor, const conv::Block<bool>& block) {
   // Convolve the water mask to find faces with a surface for each water voxel.
-  auto block = conv::to_block(mask, water_fn);
-  return tensors::map_sparse(mask, [&](auto pos, auto val) {
+  return tensors::map_sparse(tensor, [&](auto pos, auto val) {
     FaceMask mask{0};
     auto i_pos = to<int>(pos);
     mask.set(voxels::X_NEG, !block.get(i_pos - vec3(1, 0, 0)));
@@ -131,6 +120,17 @@ inline auto to_surface(const Tensor& tensor, IsWaterFn&& water_fn) {
   });
 }
 
+template <
+    typename IsWaterFn,
+    typename = std::enable_if_t<std::is_invocable_v<IsWaterFn, Vec3i>>>
+inline auto to_surface(const Tensor& tensor, IsWaterFn&& water_fn) {
+  // Convert the water tensor into a boolean mask of voxels containing water.
+  auto mask = tensors::map_values(tensor, [&](auto val) {
+    return val != 0;
+  });
+  return to_surface(tensor, conv::to_block(mask, water_fn));
+}
+
 inline auto to_surface(const Tensor& tensor) {
   return to_surface(tensor, [&](Vec3i pos) {
     if (voxels::box_contains(voxels::cube_box(tensors::kChunkDim), pos)) {
@@ -143,30 +143,36 @@ inline auto to_surface(const Tensor& tensor) {
 template <typename HeightFn>
 inline auto to_geometry(
     const SurfaceTensor& tensor, const Vec3i& origin, HeightFn&& height_fn) {
-  // Turn the masks into a mesh.
-  quadifier::Quadifier<Cell, CellHash> quadifier;
+  // Turn the masks into a mesh, slicing faces by direction and plane.
+  const auto& shape = tensor.shape;
+  auto planes =
+      static_cast<int>(std::max({shape.x, shape.y, shape.z})) + 1;
+  quadifier::MaskQuadifier<Cell> quadifier(voxels::kDirCount * planes);
+  auto add = [&](const Cell& cell, Vec2i pos) {
+    quadifier.add(cell.dir * planes + cell.plane, cell, pos);
+  };
   tensors::scan_sparse(tensor, [&](auto pos, auto val) {
     FaceMask mask{val};
     auto h = height_fn(pos).value;
     auto [x, y, z] = to<int>(pos);
     if (h) {
       if (mask.has(voxels::X_NEG)) {
-        quadifier.add({voxels::X_NEG, x, h}, {z, y});
+        add({voxels::X_NEG, x, h}, {z, y});
       }
       if (mask.has(voxels::X_POS)) {
-        quadifier.add({voxels::X_POS, x + 1, h}, {z, y});
+        add({voxels::X_POS, x + 1, h}, {z, y});
       }
       if (mask.has(voxels::Y_NEG)) {
-        quadifier.add({voxels::Y_NEG, y, 0}, {x, z});
+        add({voxels::Y_NEG, y, 0}, {x, z});
       }
       if (mask.has(voxels::Y_POS)) {
-        quadifier.add({voxels::Y_POS, y + 1, h}, {x, z});
+        add({voxels::Y_POS, y + 1, h}, {x, z});
       }
       if (mask.has(voxels::Z_NEG)) {
-        quadifier.add({voxels::Z_NEG, z, h}, {x, y});
+        add({voxels::Z_NEG, z, h}, {x, y});
       }
       if (mask.has(voxels::Z_POS)) {
-        quadifier.add({voxels::Z_POS, z + 1, h}, {x, y});
+        add({voxels::Z_POS, z + 1, h}, {x, y});
       }
     }
   });
@@ -1,18 +1,22 @@
 #pragma once
 
 #include <emscripten/bind.h>
+#include <emscripten/emscripten.h>
 #include <emscripten/val.h>
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "voxeloo/biomes/migration.hpp"
 #include "voxeloo/common/hashing.hpp"
+#include "voxeloo/gaia/checkpoint.hpp"
 #include "voxeloo/gaia/deps.hpp"
 #include "voxeloo/gaia/lazy.hpp"
 #include "voxeloo/gaia/light.hpp"
 #include "voxeloo/gaia/logger.hpp"
 #include "voxeloo/gaia/muck.hpp"
+#include "voxeloo/gaia/replay.hpp"
 #include "voxeloo/gaia/terrain.hpp"
 #include "voxeloo/gaia/water.hpp"
 #include "voxeloo/js_ext/biomes.hpp"
@@ -172,12 +176,45 @@ class TerrainMapBuilderJs {
   TerrainMapBuilder impl_;
 };
 
+class TerrainStreamReaderJs {
+ public:
+  explicit TerrainStreamReaderJs(const TerrainStream& stream)
+      : impl_(stream.subscribe()) {}
+
+  auto open() const {
+    return impl_.open();
+  }
+
+  auto empty() const {
+    return impl_.empty();
+  }
+
+  auto close() {
+    return impl_.close();
+  }
+
+  void read(BufferJs<Vec3i>& out) {
+    tensors::BufferBuilder<Vec3i> builder;
+    impl_.read(changes_);
+    for (const auto& change : coalesce_changes(changes_)) {
+      scan_changes(change, [&](auto pos) {
+        builder.add(pos);
+      });
+    }
+    out.impl = std::move(builder).build();
+  }
+
+ private:
+  TerrainStream::Reader impl_;
+  std::vector<TerrainChange> changes_;
+};
+
 class TerrainStreamJs {
  public:
   TerrainStreamJs() : impl_(make_dep<TerrainStream>()) {}
 
   auto subscribe() const {
-    return StreamReaderJs<Vec3i>(*impl_);
+    return TerrainStreamReaderJs(*impl_);
   }
 
   const auto& impl() const {
@@ -404,6 +441,27 @@ inline void bind_world_map(const char* name) {
           }));
 }
 
+// Under node, mounts the host directory over the same path of the in-memory
+// filesystem, so that checkpoints outlive the process. Does nothing elsewhere.
+// Returns the directory.
+inline std::string mount_host_dir(std::string dir) {
+  EM_ASM(
+      {
+        if (!ENVIRONMENT_IS_NODE) {
+          return;
+        }
+        const dir = UTF8ToString($0);
+        require("fs").mkdirSync(dir, {recursive : true});
+        FS.mkdirTree(dir);
+        const node = FS.lookupPath(dir, {follow_mount : false}).node;
+        if (!FS.isMountpoint(node)) {
+          FS.mount(NODEFS, {root : dir}, dir);
+        }
+      },
+      dir.c_str());
+  return dir;
+}
+
 class TerrainMapV2Js {
  public:
   TerrainMapV2Js(){};
@@ -423,20 +481,34 @@ class TerrainMapV2Js {
 
   void update_diff(
       Vec3i pos, const biomes::js::SparseBlockJs<TerrainId>& block) {
-    impl_.update_diff(
-        pos, biomes::migration::tensor_from_sparse_block(block.impl()));
+    auto diff = biomes::migration::tensor_from_sparse_block(block.impl());
+    if (recorder_) {
+      recorder_->update_diff(impl_, pos, std::move(diff));
+    } else {
+      impl_.update_diff(pos, std::move(diff));
+    }
   };
 
   void update_water(Vec3i pos, const WaterChunk& water) {
     impl_.update_water(pos, water);
   }
 
+  // Stores a shard returned by the water kernel, sharing its chunk.
+  void apply_water(const WaterShard& shard) {
+    CHECK_ARGUMENT(is_shard_aligned(shard.pos) && impl_.contains(shard.pos));
+    impl_.waters.chunk(shard.pos) = shard.chunk;
+  }
+
   void update_irradiance(Vec3i pos, const IrradianceChunk& irradiance) {
     impl_.update_irradiance(pos, irradiance);
   }
 
   void update_dye(Vec3i pos, const DyeChunk& dye) {
-    impl_.update_dye(pos, dye);
+    if (recorder_) {
+      recorder_->update_dye(impl_, pos, dye);
+    } else {
+      impl_.update_dye(pos, dye);
+    }
   }
 
   void update_growth(Vec3i pos, const GrowthChunk& growth) {
@@ -451,8 +523,24 @@ class TerrainMapV2Js {
     return impl_;
   }
 
+  SkyOcclusionCache& occlusion_cache() const {
+    return occlusion_cache_;
+  }
+
+  // Records the diff and dye updates applied from now on to the given host
+  // directory, one frame per call to tick_recording (see replay.hpp).
+  void start_recording(const std::string& dir) {
+    recorder_ = std::make_unique<TerrainRecorder>(mount_host_dir(dir), impl_);
+  }
+
+  size_t tick_recording() {
+    return recorder_ ? recorder_->tick() : 0;
+  }
+
  private:
   TerrainMapV2 impl_;
+  mutable SkyOcclusionCache occlusion_cache_;
+  std::unique_ptr<TerrainRecorder> recorder_;
 };
 
 class TerrainMapBuilderV2Js {
@@ -502,6 +590,68 @@ class TerrainMapBuilderV2Js {
   TerrainMapBuilderV2 impl_;
 };
 
+// Writes checkpoints to the given host directory when running under node.
+class TerrainCheckpointerJs {
+ public:
+  TerrainCheckpointerJs(std::string dir, uint32_t full_interval)
+      : impl_(mount_host_dir(std::move(dir)), full_interval) {}
+
+  void checkpoint(const TerrainMapV2Js& map) {
+    impl_.checkpoint(map.impl());
+  }
+
+  static bool restore(const std::string& dir, TerrainMapV2Js& map) {
+    mount_host_dir(dir);
+    TerrainMapV2 restored;
+    if (!TerrainCheckpointer::restore(dir, restored)) {
+      return false;
+    }
+    map = std::move(restored);
+    return true;
+  }
+
+ private:
+  TerrainCheckpointer impl_;
+};
+
+// Tracks the shards whose water is still flowing across calls, so that water
+// events can be stepped many times per call.
+class WaterSimulationJs {
+ public:
+  void activate(Vec3i pos) {
+    active_.push_back(pos);
+  }
+
+  auto active_count() const {
+    return active_.size();
+  }
+
+  // Advances the active shards, stores the changed shards in the map so that
+  // the next step continues from them, and returns the number of changed
+  // shards.
+  auto step(TerrainMapV2Js& map, int steps) {
+    auto update = gaia::update_water(map.impl(), active_, steps);
+    for (const auto& shard : update.shards) {
+      map.apply_water(shard);
+    }
+    active_ = std::move(update.active);
+    changed_ = std::move(update.shards);
+    return changed_.size();
+  }
+
+  auto changed(size_t i) const {
+    CHECK_ARGUMENT(i < changed_.size());
+    const auto& shard = changed_[i];
+    return WorldMap<uint8_t>{
+        voxels::shift_box(kShardBox, shard.pos),
+        tensors::make_tensor(*shard.chunk)};
+  }
+
+ private:
+  std::vector<Vec3i> active_;
+  std::vector<WaterShard> changed_;
+};
+
 WorldMap<uint8_t> update_water(const TerrainMapV2Js& terrain, Vec3i chunk_pos) {
   return gaia::update_water(terrain.impl(), chunk_pos);
 }
@@ -516,7 +666,25 @@ WorldMap<uint32_t> update_irradiance(
 
 WorldMap<uint8_t> update_occlusion(
     const TerrainMapV2Js& terrain, Vec2i column) {
-  return gaia::update_occlusion(terrain.impl(), column);
+  return gaia::update_occlusion(
+      terrain.impl(), column, terrain.occlusion_cache());
+}
+
+// Recomputes only the part of the column that a change to the voxels within
+// the box can reach, returning the shards whose occlusion changed.
+std::vector<WorldMap<uint8_t>> update_occlusion_span(
+    const TerrainMapV2Js& terrain, Vec2i column, const voxels::Box& change) {
+  auto shards = gaia::update_occlusion(
+      terrain.impl(), column, change, terrain.occlusion_cache());
+
+  std::vector<WorldMap<uint8_t>> ret;
+  ret.reserve(shards.size());
+  for (const auto& shard : shards) {
+    ret.push_back(WorldMap<uint8_t>{
+        voxels::shift_box(kShardBox, shard.pos),
+        tensors::make_tensor(*shard.chunk)});
+  }
+  return ret;
 }
 
 inline void bind() {
@@ -525,6 +693,7 @@ inline void bind() {
   bind_stream_reader<Vec3i>("StreamReader_Vec3i");
   bind_world_map<uint8_t>("WorldMap_U8");
   bind_world_map<uint32_t>("WorldMap_U32");
+  em::register_vector<WorldMap<uint8_t>>("Vector_WorldMap_U8");
 
   em::class_<LoggerJs>("GaiaLogger")
       .constructor<emscripten::val>()
@@ -549,6 +718,12 @@ inline void bind() {
       .function("assignDye", &TerrainMapBuilderJs::assign_dye)
       .function("build", &TerrainMapBuilderJs::build);
 
+  em::class_<TerrainStreamReaderJs>("GaiaTerrainStreamReader")
+      .function("isOpen", &TerrainStreamReaderJs::open)
+      .function("isEmpty", &TerrainStreamReaderJs::empty)
+      .function("read", &TerrainStreamReaderJs::read)
+      .function("close", &TerrainStreamReaderJs::close);
+
   em::class_<TerrainStreamJs>("GaiaTerrainStream")
       .constructor<>()
       .function("subscribe", &TerrainStreamJs::subscribe);
@@ -613,6 +788,7 @@ inline void bind() {
   em::function("updateWater", update_water);
   em::function("updateIrradiance", update_irradiance);
   em::function("updateOcclusion", update_occlusion);
+  em::function("updateOcclusionSpan", update_occlusion_span);
 
   em::class_<TerrainMapV2Js>("GaiaTerrainMapV2")
       .constructor()
@@ -624,7 +800,9 @@ inline void bind() {
       .function("updateIrradiance", &TerrainMapV2Js::update_irradiance)
       .function("updateDye", &TerrainMapV2Js::update_dye)
       .function("updateGrowth", &TerrainMapV2Js::update_growth)
-      .function("updateOcclusion", &TerrainMapV2Js::update_occlusion);
+      .function("updateOcclusion", &TerrainMapV2Js::update_occlusion)
+      .function("startRecording", &TerrainMapV2Js::start_recording)
+      .function("tickRecording", &TerrainMapV2Js::tick_recording);
 
   em::class_<TerrainMapBuilderV2Js>("GaiaTerrainMapBuilderV2")
       .constructor()
@@ -642,6 +820,18 @@ inline void bind() {
       .function("shardCount", &TerrainMapBuilderV2Js::shard_count)
       .function("holeCount", &TerrainMapBuilderV2Js::hole_count)
       .function("build", &TerrainMapBuilderV2Js::build);
+
+  em::class_<TerrainCheckpointerJs>("GaiaTerrainCheckpointer")
+      .constructor<std::string, uint32_t>()
+      .function("checkpoint", &TerrainCheckpointerJs::checkpoint)
+      .class_function("restore", &TerrainCheckpointerJs::restore);
+
+  em::class_<WaterSimulationJs>("GaiaWaterSimulation")
+      .constructor()
+      .function("activate", &WaterSimulationJs::activate)
+      .function("activeCount", &WaterSimulationJs::active_count)
+      .function("step", &WaterSimulationJs::step)
+      .function("changed", &WaterSimulationJs::changed);
 }
 
 }  // namespace voxeloo::gaia::js
@@ -3,6 +3,9 @@
 #include <emscripten/bind.h>
 #include <emscripten/val.h>
 
+#include <memory>
+#include <vector>
+
 #include "voxeloo/biomes/memoize.hpp"
 #include "voxeloo/biomes/migration.hpp"
 #include "voxeloo/biomes/shards.hpp"
@@ -15,6 +18,8 @@
 #include "voxeloo/galois/groups.hpp"
 #include "voxeloo/galois/lighting.hpp"
 #include "voxeloo/galois/material_properties.hpp"
+#include "voxeloo/galois/packing.hpp"
+#include "voxeloo/galois/raycast.hpp"
 #include "voxeloo/galois/shapes.hpp"
 #include "voxeloo/galois/terrain.hpp"
 #include "voxeloo/galois/water.hpp"
@@ -57,26 +62,51 @@ inline auto make_shard_cache(emscripten::val loader) {
   });
 }
 
+// Returns the chunks of the given shard tensor and of the loaded neighbours of
+// its shard, for assembling padded blocks.
+template <typename T>
+inline auto load_neighbours(
+    const Tensor<T>& tensor, Vec3i origin, emscripten::val loader) {
+  constexpr static auto k = static_cast<int>(tensors::kChunkDim);
+  auto shard = floor_div(origin, k);
+
+  conv::Neighbours<T> ret;
+  for (auto z = -1; z <= 1; z += 1) {
+    for (auto y = -1; y <= 1; y += 1) {
+      for (auto x = -1; x <= 1; x += 1) {
+        auto i = conv::neighbour_index({x, y, z});
+        if (i == 13) {
+          ret[i] = tensor.chunks[0].get();
+          continue;
+        }
+        auto val = loader(shards::js::shard_encode_js(shard + vec3(x, y, z)));
+        if (!val.isNull() && !val.isUndefined()) {
+          ret[i] = js::as_ptr<Tensor<T>>(val)->chunks[0].get();
+        } else {
+          ret[i] = nullptr;
+        }
+      }
+    }
+  }
+  return ret;
+}
+
 inline auto to_occlusion_tensor(
     const shapes::Tensor& tensor,
     const shapes::Index& index,
     Vec3i origin,
     emscripten::val loader) {
-  auto cache = make_shard_cache<shapes::Tensor>(loader);
-
-  // Extract the tensors self-occlusion values.
-  auto masks = tensors::map_values(tensor, [&](auto id) {
+  // Extract the self-occlusion values of the tensor and its neighbours.
+  auto mask_fn = [&](auto id) {
     return index.occlusion_masks.at(index.offsets.at(id));
-  });
+  };
+  auto masks = tensors::map_values(tensor, mask_fn);
+  auto block = conv::to_block(
+      load_neighbours(tensor, origin, loader),
+      static_cast<uint8_t>(0),
+      mask_fn);
 
-  return shapes::to_occlusion_tensor(masks, [&](Vec3i pos) {
-    auto [shard, local] = shards::block_partition(origin + pos);
-    if (auto isomorphisms = cache(shard.x, shard.y, shard.z); isomorphisms) {
-      auto isomorphism_id = isomorphisms->get(local);
-      return index.occlusion_masks.at(index.offsets.at(isomorphism_id));
-    }
-    return static_cast<uint8_t>(0);
-  });
+  return shapes::to_occlusion_tensor(masks, block);
 }
 
 inline auto to_glass_occlusion_tensor(
@@ -147,6 +177,35 @@ inline auto geometry_buffer_to_value_object(
   return ret;
 }
 
+inline auto packed_mesh_to_value_object(
+    const Vec3i& origin, const packing::PackedMesh& mesh) -> emscripten::val {
+  auto ret = emscripten::val::object();
+  ret.set("origin", emscripten::val(origin));
+  ret.set("stride", emscripten::val(mesh.stride()));
+  ret.set("uvScale", emscripten::val(mesh.uv_scale));
+  if (mesh.short_indexed()) {
+    ret.set(
+        "indices",
+        emscripten::val::global("Uint16Array")
+            .new_(to_buffer<uint16_t>(
+                mesh.indices_view(), mesh.indices_bytes())));
+  } else {
+    ret.set(
+        "indices",
+        emscripten::val::global("Uint32Array")
+            .new_(to_buffer<uint32_t>(
+                mesh.indices_view(), mesh.indices_bytes())));
+  }
+  ret.set(
+      "vertices",
+      emscripten::val::global("Uint16Array")
+          .new_(to_buffer<uint16_t>(
+              mesh.vertices_view(), mesh.vertices_bytes())));
+  ret.set("empty", emscripten::val(mesh.vertices.empty()));
+
+  return ret;
+}
+
 inline auto to_block_geometry(
     const shapes::Tensor& tensor,
     const shapes::OcclusionTensor& occlusion,
@@ -156,6 +215,15 @@ inline auto to_block_geometry(
       origin, shapes::to_geometry_buffer(tensor, occlusion, index));
 }
 
+inline auto to_packed_block_geometry(
+    const shapes::Tensor& tensor,
+    const shapes::OcclusionTensor& occlusion,
+    const shapes::Index& index,
+    Vec3i origin) {
+  return packed_mesh_to_value_object(
+      origin, packing::to_packed_geometry_buffer(tensor, occlusion, index));
+}
+
 class BlockMaterialBuffer {
  public:
   explicit BlockMaterialBuffer(material_properties::Buffer impl)
@@ -259,23 +327,16 @@ inline auto to_lighting_buffer(
     return Vec3f{1.0, 1.0, 1.0};
   };
 
-  // Cached routine producing irradiance lighting at a given voxel vertex.
-  auto irr_fn = conv::BlockCache(lighting::make_vertex_fn(
-      [&](Vec3i pos) {
-        return false;
-        // return iso_fn(pos) == 1u;  // full
-      },
-      irr_light_fn));
-
-  // Cached routine producing sky-occlusion lighting at a given voxel vertex.
-  auto sky_fn = conv::BlockCache(lighting::make_vertex_fn(
+  // Lights the whole chunk at once, sampling each voxel around its surface
+  // once rather than for each vertex it touches.
+  return LightingBuffer(lighting::to_buffer(lighting::to_chunk_light_tensor(
+      tensor,
       [&](Vec3i pos) {
         return false;
         // return iso_fn(pos) == 1u;  // full
       },
-      sky_light_fn));
-
-  return LightingBuffer(lighting::to_buffer(tensor, irr_fn, sky_fn));
+      irr_light_fn,
+      sky_light_fn)));
 }
 
 inline auto to_block_lighting_buffer(
@@ -499,10 +560,11 @@ class GroupTensorBuilder {
   groups::TensorBuilder impl_;
 };
 
-class GroupSubMesh {
+template <typename M>
+class BasicGroupSubMesh {
  public:
-  GroupSubMesh() = default;
-  explicit GroupSubMesh(groups::Mesh impl) : impl_(std::move(impl)) {}
+  BasicGroupSubMesh() = default;
+  explicit BasicGroupSubMesh(M impl) : impl_(std::move(impl)) {}
 
   auto empty() const {
     return impl_.indices.empty();
@@ -529,15 +591,27 @@ class GroupSubMesh {
   }
 
  private:
-  groups::Mesh impl_;
+  M impl_;
 };
 
+using GroupSubMesh = BasicGroupSubMesh<groups::Mesh>;
+
+// A block mesh with its coplanar faces of the same texture merged, whose
+// vertices carry the atlas tile to repeat (see groups::TiledVertex).
+using GroupTiledSubMesh = BasicGroupSubMesh<groups::TiledMesh>;
+
 struct GroupMesh {
   GroupSubMesh blocks;
   GroupSubMesh florae;
   GroupSubMesh glass;
 };
 
+struct TiledGroupMesh {
+  GroupTiledSubMesh blocks;
+  GroupSubMesh florae;
+  GroupSubMesh glass;
+};
+
 class WireframeMeshJs {
  public:
   WireframeMeshJs() = default;
@@ -574,6 +648,87 @@ inline auto to_group_mesh(
   };
 }
 
+// Like to_group_mesh(), but with the blocks as a tiled mesh. It renders with
+// fewer vertices but needs a material that repeats the atlas tiles, so it
+// cannot be exported to GLTF as is.
+inline auto to_tiled_group_mesh(
+    const GroupTensor& tensor, const groups::Index& index) {
+  return TiledGroupMesh{
+      GroupTiledSubMesh(
+          groups::populate_tiled_block_mesh(tensor.impl(), index)),
+      GroupSubMesh(groups::populate_flora_mesh(tensor.impl(), index)),
+      GroupSubMesh(groups::populate_glass_mesh(tensor.impl(), index)),
+  };
+}
+
+class GroupAtlasDelta {
+ public:
+  explicit GroupAtlasDelta(groups::AtlasDelta impl) : impl_(std::move(impl)) {}
+
+  auto row() const {
+    return impl_.row;
+  }
+
+  auto texture_shape() const {
+    return impl_.texture.shape;
+  }
+
+  auto texture_data() const {
+    return to_buffer<uint8_t>(impl_.texture.ptr(), impl_.texture.bytes());
+  }
+
+  auto shape() const {
+    return impl_.shape;
+  }
+
+  auto resized() const {
+    return impl_.resized;
+  }
+
+ private:
+  groups::AtlasDelta impl_;
+};
+
+// A texture atlas shared by the group meshes built against it, whose meshes
+// carry no textures of their own. The cache holds its own copy of the textures
+// of the index.
+class GroupAtlasCache {
+ public:
+  GroupAtlasCache(const groups::Index& index, uint32_t height)
+      : impl_(index.textures, groups::atlas_dim(index), height) {}
+
+  auto texture_shape() const {
+    return impl_.atlas().shape;
+  }
+
+  auto texture_data() const {
+    return to_buffer<uint8_t>(impl_.atlas().ptr(), impl_.atlas().bytes());
+  }
+
+  auto take_delta() {
+    return GroupAtlasDelta(impl_.take_delta());
+  }
+
+  auto& impl() {
+    return impl_;
+  }
+
+ private:
+  groups::AtlasCache impl_;
+};
+
+inline auto to_cached_group_mesh(
+    const GroupTensor& tensor,
+    const groups::Index& index,
+    GroupAtlasCache& cache) {
+  auto mesh = groups::to_mesh(tensor.impl(), index, cache.impl());
+  return GroupMesh{
+      GroupSubMesh(std::move(mesh.blocks)),
+      GroupSubMesh(std::move(mesh.florae)),
+      GroupSubMesh(std::move(mesh.glass)),
+  };
+}
+
 inline auto to_block_samples(
     blocks::Index& index,
     uint8_t dye,
@@ -650,18 +805,11 @@ inline auto to_water_geometry(
 
 inline auto to_water_surface(
     const water::Tensor& tensor, Vec3i origin, emscripten::val water_loader) {
-  auto cache = make_shard_cache<water::Tensor>(water_loader);
-  auto is_water_fn = [&](Vec3i pos) {
-    constexpr static auto k = static_cast<int>(tensors::kChunkDim);
-    auto shift = pos + origin;
-    auto shard = floor_div(shift, k);
-    auto local = to<unsigned int>(shift - k * shard);
-    if (auto water_tensor = cache(shard.x, shard.y, shard.z); water_tensor) {
-      return water_tensor->get(local) != 0;
-    }
-    return false;
-  };
-  return water::to_surface(tensor, is_water_fn);
+  auto block = conv::to_block(
+      load_neighbours(tensor, origin, water_loader), false, [](auto val) {
+        return val != 0;
+      });
+  return water::to_surface(tensor, block);
 }
 
 class WaterMaterialBuffer {
@@ -696,30 +844,67 @@ inline auto to_water_material_buffer(
 
 class BoxDictJs {
  public:
-  explicit BoxDictJs(collision::BoxDict impl) : impl_(std::move(impl)) {}
+  explicit BoxDictJs(collision::BoxDict impl)
+      : impl_(std::make_shared<const collision::BoxDict>(std::move(impl))) {}
 
   auto size() const {
-    return impl_.size();
+    return impl_->size();
   }
 
   void scan(emscripten::val callback) {
-    impl_.scan([&](const collision::AABB& box) {
+    impl_->scan([&](const collision::AABB& box) {
       callback(box);
     });
   }
 
   void intersect(const collision::AABB& aabb, emscripten::val callback) {
-    impl_.intersect(aabb, [&](const collision::AABB& box) {
+    impl_->intersect(aabb, [&](const collision::AABB& box) {
       return callback(box).as<bool>();
     });
   }
 
   bool intersects(const collision::AABB& aabb) {
-    return impl_.intersects(aabb);
+    return impl_->intersects(aabb);
+  }
+
+  // Returns 1 for each of the given boxes that intersects the dict, else 0.
+  auto intersects_all(const std::vector<collision::AABB>& aabbs) {
+    auto hits = impl_->intersects(aabbs);
+    return std::vector<uint8_t>(hits.begin(), hits.end());
+  }
+
+  const auto& impl() const {
+    return impl_;
+  }
+
+ private:
+  std::shared_ptr<const collision::BoxDict> impl_;
+};
+
+// A set of box dicts to sweep boxes through, e.g. those of a shard and of its
+// neighbours. The set shares ownership of the dicts, so they may be deleted
+// from JS while still in it.
+class BoxDictSetJs {
+ public:
+  void add(const BoxDictJs& dict) {
+    owned_.push_back(dict.impl());
+    dicts_.push_back(owned_.back().get());
+  }
+
+  auto sweep(const collision::AABB& aabb, const Vec3d& velocity, double dt) {
+    return collision::sweep(dicts_, aabb, velocity, dt);
+  }
+
+  auto sweep_all(
+      const std::vector<collision::AABB>& aabbs,
+      const std::vector<Vec3d>& velocities,
+      double dt) {
+    return collision::sweep(dicts_, aabbs, velocities, dt);
   }
 
  private:
-  const collision::BoxDict impl_;
+  std::vector<std::shared_ptr<const collision::BoxDict>> owned_;
+  std::vector<const collision::BoxDict*> dicts_;
 };
 
 class BoxListJs {
@@ -795,6 +980,7 @@ inline void bind_blocks() {
   em::function("toBlockSampleTensor", blocks::to_block_sample_tensor);
   em::function("toBlockMaterialBuffer", to_block_material_buffer);
   em::function("toBlockGeometry", to_block_geometry);
+  em::function("toPackedBlockGeometry", to_packed_block_geometry);
   em::function("toBlockSamples", to_block_samples);
 }
 
@@ -802,6 +988,7 @@ inline void bind_collision() {
   em::value_array<collision::AABB>("AABB")
       .element(&collision::AABB::v0)
       .element(&collision::AABB::v1);
+  em::register_vector<collision::AABB>("Vector_AABB");
 
   em::class_<BoxListJs>("BoxList")
       .constructor()
@@ -814,7 +1001,20 @@ inline void bind_collision() {
       .function("size", &BoxDictJs::size)
       .function("scan", &BoxDictJs::scan)
       .function("intersect", &BoxDictJs::intersect)
-      .function("intersects", &BoxDictJs::intersects);
+      .function("intersects", &BoxDictJs::intersects)
+      .function("intersectsAll", &BoxDictJs::intersects_all);
+
+  em::value_object<collision::Contact>("Contact")
+      .field("time", &collision::Contact::time)
+      .field("normal", &collision::Contact::normal);
+  em::register_vector<Vec3d>("Vector_Vec3d");
+  em::register_vector<collision::Contact>("Vector_Contact");
+
+  em::class_<BoxDictSetJs>("BoxDictSet")
+      .constructor()
+      .function("add", &BoxDictSetJs::add)
+      .function("sweep", &BoxDictSetJs::sweep)
+      .function("sweepAll", &BoxDictSetJs::sweep_all);
 }
 
 inline auto subvoxel_ray_intersection(
@@ -832,6 +1032,42 @@ inline auto subvoxel_ray_intersection(
   }
 }
 
+// Returns the loaded tensor of the shard, or null if there is none.
+template <typename T>
+inline const T* load_shard(emscripten::val& loader, Vec3i shard) {
+  auto val = loader(shards::js::shard_encode_js(shard));
+  if (!val.isNull() && !val.isUndefined()) {
+    return js::as_ptr<T>(val);
+  }
+  return nullptr;
+}
+
+// Casts the rays through the loaded shards, returning the first block, glass
+// or flora voxel that each ray hits. Each shard is loaded at most once.
+inline auto cast_rays(
+    const shapes::Index& index,
+    const std::vector<raycast::Ray>& rays,
+    emscripten::val isomorphism_loader,
+    emscripten::val flora_loader,
+    emscripten::val glass_loader) {
+  std::map<std::tuple<int, int, int>, std::optional<raycast::Shard>> loaded;
+  raycast::Caster caster(index, [&](Vec3i pos) -> const raycast::Shard* {
+    auto [it, inserted] = loaded.try_emplace({pos.x, pos.y, pos.z});
+    if (inserted) {
+      raycast::Shard shard = {
+          load_shard<shapes::Tensor>(isomorphism_loader, pos),
+          load_shard<florae::Tensor>(flora_loader, pos),
+          load_shard<glass::Tensor>(glass_loader, pos),
+      };
+      if (shard.isomorphisms || shard.florae) {
+        it->second = shard;
+      }
+    }
+    return it->second ? &*it->second : nullptr;
+  });
+  return caster.cast(rays);
+}
+
 inline void bind_shapes() {
   em::value_array<shapes::Edge>("Edge")
       .element(&shapes::Edge::v0)
@@ -856,6 +1092,20 @@ inline void bind_shapes() {
   em::function("toIsomorphismOccluder", to_isomorphism_occluder);
   em::function("toWireframeMesh", to_wireframe_mesh);
   em::function("subvoxelRayIntersection", subvoxel_ray_intersection);
+
+  em::value_object<raycast::Ray>("Ray")
+      .field("origin", &raycast::Ray::origin)
+      .field("dir", &raycast::Ray::dir)
+      .field("max_distance", &raycast::Ray::max_distance);
+  em::value_object<raycast::Hit>("RayHit")
+      .field("kind", &raycast::Hit::kind)
+      .field("voxel", &raycast::Hit::voxel)
+      .field("pos", &raycast::Hit::pos)
+      .field("normal", &raycast::Hit::normal)
+      .field("distance", &raycast::Hit::distance);
+  em::register_vector<raycast::Ray>("Vector_Ray");
+  em::register_vector<raycast::Hit>("Vector_RayHit");
+  em::function("castRays", cast_rays);
 }
 
 inline void bind_florae() {
@@ -874,6 +1124,17 @@ inline void bind_florae() {
   em::function("toFloraBoxList", to_flora_box_list);
 }
 
+template <typename SubMesh>
+inline void bind_group_sub_mesh(const char* name) {
+  em::class_<SubMesh>(name)
+      .function("empty", &SubMesh::empty)
+      .function("stride", &SubMesh::stride)
+      .function("indices", &SubMesh::indices)
+      .function("vertices", &SubMesh::vertices)
+      .function("textureShape", &SubMesh::texture_shape)
+      .function("textureData", &SubMesh::texture_data);
+}
+
 inline void bind_groups() {
   using groups::BlockEntry;
   using groups::Entry;
@@ -929,20 +1190,35 @@ inline void bind_groups() {
       .function("get", &GroupTensorBuilder::get)
       .function("build", &GroupTensorBuilder::build);
 
-  em::class_<GroupSubMesh>("GroupSubMesh")
-      .function("empty", &GroupSubMesh::empty)
-      .function("stride", &GroupSubMesh::stride)
-      .function("indices", &GroupSubMesh::indices)
-      .function("vertices", &GroupSubMesh::vertices)
-      .function("textureShape", &GroupSubMesh::texture_shape)
-      .function("textureData", &GroupSubMesh::texture_data);
+  bind_group_sub_mesh<GroupSubMesh>("GroupSubMesh");
+  bind_group_sub_mesh<GroupTiledSubMesh>("GroupTiledSubMesh");
 
   em::value_object<GroupMesh>("GroupMesh")
       .field("blocks", &GroupMesh::blocks)
       .field("florae", &GroupMesh::florae)
       .field("glass", &GroupMesh::glass);
 
+  em::value_object<TiledGroupMesh>("TiledGroupMesh")
+      .field("blocks", &TiledGroupMesh::blocks)
+      .field("florae", &TiledGroupMesh::florae)
+      .field("glass", &TiledGroupMesh::glass);
+
+  em::class_<GroupAtlasDelta>("GroupAtlasDelta")
+      .function("row", &GroupAtlasDelta::row)
+      .function("textureShape", &GroupAtlasDelta::texture_shape)
+      .function("textureData", &GroupAtlasDelta::texture_data)
+      .function("shape", &GroupAtlasDelta::shape)
+      .function("resized", &GroupAtlasDelta::resized);
+
+  em::class_<GroupAtlasCache>("GroupAtlasCache")
+      .constructor<const Index&, uint32_t>()
+      .function("textureShape", &GroupAtlasCache::texture_shape)
+      .function("textureData", &GroupAtlasCache::texture_data)
+      .function("takeDelta", &GroupAtlasCache::take_delta);
+
   em::function("toGroupMesh", to_group_mesh);
+  em::function("toTiledGroupMesh", to_tiled_group_mesh);
+  em::function("toCachedGroupMesh", to_cached_group_mesh);
   em::function("toGroupBoxList", to_group_box_list);
 }
 
@@ -5,6 +5,7 @@
 #include <pybind11/stl.h>
 
 #include "voxeloo/common/geometry.hpp"
+#include "voxeloo/galois/batch.hpp"
 #include "voxeloo/galois/csg.hpp"
 #include "voxeloo/galois/florae.hpp"
 #include "voxeloo/galois/groups.hpp"
@@ -229,6 +230,11 @@ void bind_florae(py::module m) {
           const GrowthTensor&,
           const muck::Tensor&,
           const Index&>(florae::to_geometry));
+
+  py::class_<batch::FloraShard>(m, "Shard")
+      .def(py::init<Tensor, GrowthTensor, muck::Tensor, Vec3i>());
+
+  m.def("to_geometry_batch", &batch::to_flora_geometry);
 }
 
 inline auto texture_from_numpy(const py::array_t<uint8_t>& array) {
@@ -312,6 +318,7 @@ void bind_groups(py::module m) {
   m.def("to_index", &groups::to_index);
   m.def("to_tensor", &groups::to_tensor);
   m.def("to_mesh", &groups::to_mesh);
+  m.def("to_mesh_batch", &batch::to_group_mesh);
   m.def("to_wireframe_mesh", &groups::to_wireframe_mesh);
 }
 
@@ -311,7 +311,7 @@ template <typename T, typename Hash = std::hash<T>>
 inline auto hash(const Tensor<T>& tensor) {
   auto hashed = 0u;
   for (const auto& chunk : tensor.chunks) {
-    hashed = random_hash(hash + hash<T, Hash>(chunk->array));
+    hashed = random_hash(hashed + hash<T, Hash>(chunk->array));
   }
   return hashed;
 }
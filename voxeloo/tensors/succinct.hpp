@@ -100,6 +100,11 @@ class RankDict {
     });
   }
 
+  // The raw bitmap levels, as accepted by the constructor.
+  const auto& levels() const {
+    return levels_;
+  }
+
   auto to_buffer() const& {
     return levels_;
   }